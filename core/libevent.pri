@@ -0,0 +1,15 @@
+# Where to find libevent, shared by the core library and everything linking it
+
+unix: LIBS += -levent -levent_pthreads
+
+win32 { LIBS += -L$$PWD/../../libevent/build/lib -levent -levent_core
+
+INCLUDEPATH += $$PWD/../../libevent/include \
+               $$PWD/../../libevent/build/include
+
+DEPENDPATH += $$PWD/../../libevent/include
+}
+
+win32 {
+LIBS += -lws2_32
+}
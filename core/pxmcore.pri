@@ -0,0 +1,11 @@
+# Include from a project to link against pxmcore
+
+INCLUDEPATH += $$PWD/../include
+DEPENDPATH += $$PWD/../include
+
+LIBS += -L$$PWD/../lib -lpxmcore
+win32: PRE_TARGETDEPS += $$PWD/../lib/pxmcore.lib
+else: PRE_TARGETDEPS += $$PWD/../lib/libpxmcore.a
+
+include($$PWD/libevent.pri)
+include($$PWD/uring.pri)
@@ -0,0 +1,74 @@
+# Network core: discovery, connections, sync, history and diagnostics.
+# Only depends on QtCore and libevent so it can run without a display.
+TEMPLATE = lib
+TARGET = pxmcore
+CONFIG += staticlib \
+          RELEASE \
+          DEBUG
+
+QT = core
+
+include($$PWD/libevent.pri)
+include($$PWD/uring.pri)
+
+INCLUDEPATH += $$PWD/../include
+
+QMAKE_CXXFLAGS += -Wall \
+                -std=c++14
+
+SOURCES += \
+    $$PWD/../src/pxmclient.cpp \
+    $$PWD/../src/pxmpeerworker.cpp \
+    $$PWD/../src/pxminireader.cpp \
+    $$PWD/../src/pxmserver.cpp \
+    $$PWD/../src/netcompression.cpp \
+    $$PWD/../src/pxmpeers.cpp \
+    $$PWD/../src/pxmformatter.cpp \
+    $$PWD/../src/pxmhistory.cpp \
+    $$PWD/../src/pxmsearch.cpp \
+    $$PWD/../src/pxmlogbackend.cpp \
+    $$PWD/../src/pxmtrace.cpp \
+    $$PWD/../src/pxmlatency.cpp \
+    $$PWD/../src/pxmmetrics.cpp \
+    $$PWD/../src/pxmutf8.cpp \
+    $$PWD/../src/pxmtransfer.cpp \
+    $$PWD/../src/pxmblobcache.cpp
+
+HEADERS += \
+    $$PWD/../include/pxmpeerworker.h \
+    $$PWD/../include/pxminireader.h \
+    $$PWD/../include/pxmserver.h \
+    $$PWD/../include/pxmclient.h \
+    $$PWD/../include/netcompression.h \
+    $$PWD/../include/timedvector.h \
+    $$PWD/../include/pxmclock.h \
+    $$PWD/../include/pxmcache.h \
+    $$PWD/../include/pxmmembership.h \
+    $$PWD/../include/pxmutf8.h \
+    $$PWD/../include/pxmconsts.h \
+    $$PWD/../include/pxmpeers.h \
+    $$PWD/../include/pxmformatter.h \
+    $$PWD/../include/pxmhistory.h \
+    $$PWD/../include/pxmsearch.h \
+    $$PWD/../include/pxmlogbackend.h \
+    $$PWD/../include/pxmlog.h \
+    $$PWD/../include/pxmtrace.h \
+    $$PWD/../include/pxmlatency.h \
+    $$PWD/../include/pxmmetrics.h \
+    $$PWD/../include/pxmtransfer.h \
+    $$PWD/../include/pxmblobcache.h
+
+pxm_uring:unix {
+SOURCES += $$PWD/../src/pxmuring.cpp
+HEADERS += $$PWD/../include/pxmuring.h
+}
+
+DESTDIR = $$PWD/../lib
+win32 {
+OBJECTS_DIR = $$PWD/../build-win32/core/obj
+MOC_DIR = $$PWD/../build-win32/core/moc
+}
+unix {
+OBJECTS_DIR = $$PWD/../build-unix/core/obj
+MOC_DIR = $$PWD/../build-unix/core/moc
+}
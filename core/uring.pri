@@ -0,0 +1,9 @@
+# io_uring transport for TCP, off unless qmake is run with CONFIG+=pxm_uring.
+# Needs liburing 2.2 or newer, the server falls back to libevent at runtime
+# where the kernel lacks what it uses
+
+pxm_uring:unix {
+CONFIG += link_pkgconfig
+PKGCONFIG += liburing
+DEFINES += PXM_URING
+}
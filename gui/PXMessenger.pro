@@ -0,0 +1,71 @@
+TEMPLATE = app
+TARGET = PXMessenger
+VERSION = 1.4.0
+QMAKE_TARGET_COMPANY = Bolar Code Solutions
+QMAKE_TARGET_PRODUCT = PXMessenger
+QMAKE_TARGET_DESCRIPTION = Instant Messenger
+
+target.path 	= /usr/local/bin
+desktop.path 	= /usr/share/applications
+desktop.files 	+= $$PWD/../resources/pxmessenger.desktop
+icon.path 	= /usr/share/pixmaps
+icon.files 	+= $$PWD/../resources/PXMessenger.png
+INSTALLS += target desktop icon
+
+QT = core gui widgets multimedia
+CONFIG += RELEASE\
+          DEBUG
+
+include($$PWD/../core/pxmcore.pri)
+
+#win32 {
+#RC_ICONS = $$PWD/../resources/PXM_Icon.ico
+#}
+
+QMAKE_CXXFLAGS += -Wall \
+                -std=c++14
+
+SOURCES += \
+    $$PWD/../src/pxmmainwindow.cpp \
+    $$PWD/../src/pxmessenger.cpp \
+    $$PWD/../src/pxmstackwidget.cpp \
+    $$PWD/../src/pxmconsole.cpp \
+    $$PWD/../src/pxmagent.cpp \
+    $$PWD/../src/pxmpeerlist.cpp
+
+HEADERS += \
+    $$PWD/../include/pxmmainwindow.h \
+    $$PWD/../include/pxmstackwidget.h \
+    $$PWD/../include/pxmconsole.h \
+    $$PWD/../include/pxmagent.h \
+    $$PWD/../include/pxmpeerlist.h \
+    $$PWD/../include/pxmsettingsdialog.h
+
+RESOURCES += 	$$PWD/../resources/resources.qrc
+
+RC_FILE = 	$$PWD/../resources/PXMessenger_resource.rc
+
+win32 {
+Release:DESTDIR = $$PWD/..
+Debug:DESTDIR = $$PWD/..
+OBJECTS_DIR = $$PWD/../build-win32/gui/obj
+MOC_DIR = $$PWD/../build-win32/gui/moc
+RCC_DIR = $$PWD/../build-win32/gui/rcc
+UI_DIR = $$PWD/../build-win32/gui/ui
+}
+unix {
+release:DESTDIR = $$PWD/..
+debug:DESTDIR = $$PWD/..
+OBJECTS_DIR = $$PWD/../build-unix/gui/obj
+MOC_DIR = $$PWD/../build-unix/gui/moc
+RCC_DIR = $$PWD/../build-unix/gui/rcc
+UI_DIR = $$PWD/../build-unix/gui/ui
+}
+
+FORMS += \
+    $$PWD/../ui/pxmmainwindow.ui \
+    $$PWD/../ui/pxmaboutdialog.ui \
+    $$PWD/../ui/pxmsettingsdialog.ui
+
+DISTFILES += \
+    ../resources/PXMessenger_resource.rc
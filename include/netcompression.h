@@ -2,6 +2,10 @@
 #define NETCOMPRESSION_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <QUuid>
 
 #ifdef __WIN32
 #include <winsock2.h>
@@ -11,16 +15,118 @@
 #error "include header for sockaddr_in"
 #endif
 
-class QUuid;
+/*!
+ * Wire codecs for the fixed size fields of the protocol.
+ *
+ * Everything writes into and reads from caller buffers, nothing allocates.
+ * Integers are big endian and assembled byte by byte, so the same code is
+ * right on any host and can run at compile time.  A uuid is the RFC 4122
+ * layout, what QUuid::toRfc4122 produces.  A sockaddr_in keeps its address
+ * and port in the network order they are already stored in.
+ */
 namespace NetCompression
 {
-const size_t PACKED_UUID_LENGTH = 16;
-size_t packUUID(unsigned char* buf, const QUuid& uuid);
-size_t unpackUUID(const unsigned char* src, QUuid &uuid);
+constexpr size_t PACKED_UUID_LENGTH        = 16;
+constexpr size_t PACKED_SOCKADDR_IN_LENGTH = 6;
+// One peer in a MSG_SYNC packet
+constexpr size_t PACKED_PEER_RECORD_LENGTH = PACKED_SOCKADDR_IN_LENGTH + PACKED_UUID_LENGTH;
+
+constexpr size_t writeUint16(unsigned char* buf, uint16_t value)
+{
+    buf[0] = static_cast<unsigned char>(value >> 8);
+    buf[1] = static_cast<unsigned char>(value);
+    return sizeof(uint16_t);
+}
+constexpr size_t writeUint32(unsigned char* buf, uint32_t value)
+{
+    buf[0] = static_cast<unsigned char>(value >> 24);
+    buf[1] = static_cast<unsigned char>(value >> 16);
+    buf[2] = static_cast<unsigned char>(value >> 8);
+    buf[3] = static_cast<unsigned char>(value);
+    return sizeof(uint32_t);
+}
+constexpr size_t writeUint64(unsigned char* buf, uint64_t value)
+{
+    writeUint32(&buf[0], static_cast<uint32_t>(value >> 32));
+    writeUint32(&buf[4], static_cast<uint32_t>(value));
+    return sizeof(uint64_t);
+}
+constexpr uint16_t readUint16(const unsigned char* buf)
+{
+    return static_cast<uint16_t>(buf[0] << 8 | buf[1]);
+}
+constexpr uint32_t readUint32(const unsigned char* buf)
+{
+    return static_cast<uint32_t>(buf[0]) << 24 | static_cast<uint32_t>(buf[1]) << 16 |
+           static_cast<uint32_t>(buf[2]) << 8 | static_cast<uint32_t>(buf[3]);
+}
+constexpr uint64_t readUint64(const unsigned char* buf)
+{
+    return static_cast<uint64_t>(readUint32(&buf[0])) << 32 | readUint32(&buf[4]);
+}
+
+constexpr QUuid readUUID(const unsigned char* src)
+{
+    return QUuid(readUint32(&src[0]), readUint16(&src[4]), readUint16(&src[6]), src[8], src[9], src[10], src[11],
+                 src[12], src[13], src[14], src[15]);
+}
+inline size_t unpackUUID(const unsigned char* src, QUuid& uuid)
+{
+    uuid = readUUID(src);
+    return PACKED_UUID_LENGTH;
+}
+inline size_t packUUID(unsigned char* buf, const QUuid& uuid)
+{
+    writeUint32(&buf[0], uuid.data1);
+    writeUint16(&buf[4], uuid.data2);
+    writeUint16(&buf[6], uuid.data3);
+    memcpy(&buf[8], uuid.data4, sizeof(uuid.data4));
+    return PACKED_UUID_LENGTH;
+}
+
+inline size_t packSockaddr_in(unsigned char* buf, const sockaddr_in& addr)
+{
+    memcpy(&buf[0], &addr.sin_addr.s_addr, sizeof(uint32_t));
+    memcpy(&buf[4], &addr.sin_port, sizeof(uint16_t));
+    return PACKED_SOCKADDR_IN_LENGTH;
+}
+inline size_t unpackSockaddr_in(const unsigned char* buf, sockaddr_in& addr)
+{
+    memcpy(&addr.sin_addr.s_addr, &buf[0], sizeof(uint32_t));
+    memcpy(&addr.sin_port, &buf[4], sizeof(uint16_t));
+    return PACKED_SOCKADDR_IN_LENGTH;
+}
+
+struct PeerRecord {
+    sockaddr_in addr;
+    QUuid uuid;
+};
+
+inline size_t packPeerRecord(unsigned char* buf, const sockaddr_in& addr, const QUuid& uuid)
+{
+    packSockaddr_in(&buf[0], addr);
+    packUUID(&buf[PACKED_SOCKADDR_IN_LENGTH], uuid);
+    return PACKED_PEER_RECORD_LENGTH;
+}
+
+/*!
+ * \brief packPeerRecords writes count records back to back
+ * \param buf room for count * PACKED_PEER_RECORD_LENGTH bytes
+ * \return bytes written
+ */
+size_t packPeerRecords(unsigned char* buf, const PeerRecord* records, size_t count);
 
-const size_t PACKED_SOCKADDR_IN_LENGTH = 6;
-size_t packSockaddr_in(unsigned char* buf, const sockaddr_in &addr);
-size_t unpackSockaddr_in(const unsigned char* buf, sockaddr_in &addr);
+/*!
+ * \brief unpackPeerRecords reads the whole records in buf, a trailing
+ * partial record is ignored
+ *
+ * Records with a null uuid, address or port are dropped and the rest are
+ * packed to the front of records.  The uuids are decoded with SSE2 or
+ * SSSE3 when the build targets them.
+ * \param records room for maxCount records, sin_family is set to AF_INET
+ * \return valid records read
+ */
+size_t unpackPeerRecords(const unsigned char* buf, size_t len, PeerRecord* records, size_t maxCount);
 }
 
 #endif  // NETCOMPRESSION_H
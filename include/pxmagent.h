@@ -28,7 +28,18 @@ class PXMAgent : public QObject
     // Destructor
     ~PXMAgent();
 
-    int init();
+    /*!
+     * \brief init
+     *
+     * Reads the ini and starts the worker and network threads.  A headless
+     * agent has no window, splash screen or tray and only needs a
+     * QCoreApplication.  With simulatePeers set the window is filled with
+     * that many made up peers and messages for them once it is up and the
+     * time and memory it took are logged, a debug aid for the cost of large
+     * networks in the gui.
+     * \return 0 on success
+     */
+    int init(bool headless = false, int simulatePeers = 0);
 };
 
 #endif  // PXMAGENT_H
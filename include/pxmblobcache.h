@@ -0,0 +1,100 @@
+#ifndef PXMBLOBCACHE_H
+#define PXMBLOBCACHE_H
+
+#include <QByteArray>
+#include <QObject>
+#include <QScopedPointer>
+#include <QString>
+#include <QUuid>
+
+/*!
+ * Content addressed cache of received files.
+ *
+ * Every file that arrives whole and matches the hash in its offer is copied
+ * into the cache directory, named by the hex SHA-256 of its content.  An
+ * offer for content already in the cache is answered from it without a
+ * transfer, and a peer holding it can stream it to others in place of the
+ * original sender, see pxmtransfer.h.
+ *
+ * The cache is capped in bytes and evicts the least recently used blob
+ * first.  Use is recorded in the file's modification time so the order
+ * survives a restart.
+ *
+ * Hashing and copying files runs on a Hasher in its own thread, the Store
+ * itself is only touched by the worker thread.
+ */
+namespace PXMBlobCache
+{
+// SHA-256
+const int HASH_BYTES        = 32;
+const int DEFAULT_MEGABYTES = 1024;
+// Read size while hashing and copying
+const qint64 IO_BLOCK_BYTES = 256 * 1024;
+
+/*!
+ * \brief hashFile SHA-256 of the file at path
+ * \return The raw hash, empty if the file could not be read or the calling
+ * thread was asked to stop
+ */
+QByteArray hashFile(const QString& path);
+
+struct StorePrivate;
+class Store
+{
+    QScopedPointer<StorePrivate> d_ptr;
+
+   public:
+    // Reads what is already in directory and evicts down to capBytes
+    Store(QString directory, qint64 capBytes);
+    ~Store();
+    Store(Store const&) = delete;
+    Store& operator=(Store const&) = delete;
+
+    QString directory() const;
+    qint64 bytes() const;
+    int count() const;
+    /*!
+     * \brief find
+     *
+     * Path of the blob for hash, if it is cached and size bytes long.  Marks
+     * it as used.
+     * \return The path, or a null QString
+     */
+    QString find(const QByteArray& hash, qint64 size);
+    /*!
+     * \brief adopt
+     *
+     * Takes in a blob that copyIn() placed in the directory, evicting others
+     * as needed to stay under the cap.  A blob larger than the whole cap is
+     * removed again.
+     */
+    bool adopt(const QByteArray& hash);
+    /*!
+     * \brief copyIn
+     *
+     * Copies path into directory as the blob for hash, through a temporary
+     * file so a blob is never seen half written.  Does not touch any Store
+     * state so it can run on another thread.
+     */
+    static bool copyIn(const QString& directory, const QByteArray& hash, const QString& path);
+};
+
+/*!
+ * Runs the file work for transfers off the worker thread, a large file
+ * would otherwise hold up chat for as long as it takes to read.  Stops
+ * early once its thread is asked to.
+ */
+class Hasher : public QObject
+{
+    Q_OBJECT
+   public slots:
+    // Hashes path, and if the hash is expected copies it into directory
+    void hash(QUuid id, QString path, QByteArray expected, QString directory);
+    void copy(QUuid id, QString from, QString to);
+   signals:
+    void hashed(QUuid id, QByteArray hash);
+    void copied(QUuid id, bool ok);
+};
+}
+
+#endif  // PXMBLOBCACHE_H
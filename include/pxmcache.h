@@ -0,0 +1,306 @@
+#ifndef PXMCACHE_H
+#define PXMCACHE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QVector>
+
+#include "pxmclock.h"
+
+/*!
+ * Bounded cache with expiry, for peer and protocol state that should be
+ * forgotten after a while: negative caching of failed connects, reply
+ * suppression, dedupe.
+ *
+ * Entries live ttl milliseconds from their last insert (0 for forever).
+ * When the cache is full an insert evicts either the least recently used
+ * entry or the oldest inserted one.  Storage is allocated once for the
+ * capacity: the entries sit in one QVector, linked into a recency list and
+ * an expiry list by index, and found through an open addressing table of
+ * indices.  Every operation is O(1), expiry is amortized over them.
+ *
+ * The clock is a template parameter with a static now() in milliseconds,
+ * ManualClock lets simulations and benchmarks drive time themselves.
+ */
+namespace PXMCache
+{
+struct MonotonicClock {
+    static qint64 now() { return PXMClock::monotonicMsecs(); }
+};
+
+struct WallClock {
+    static qint64 now() { return QDateTime::currentMSecsSinceEpoch(); }
+};
+
+struct ManualClock {
+    static qint64& time()
+    {
+        static qint64 current = 0;
+        return current;
+    }
+    static qint64 now() { return time(); }
+    static void set(qint64 msecs) { time() = msecs; }
+    static void advance(qint64 msecs) { time() += msecs; }
+};
+
+enum Eviction { LEAST_RECENTLY_USED, OLDEST_INSERTED };
+
+template <class Key, class Value, class Clock = MonotonicClock>
+class Cache
+{
+    struct Node {
+        Key key;
+        Value value;
+        qint64 expiry;
+        // Recency list, newest first
+        int newer;
+        int older;
+        // Expiry list, soonest first
+        int earlier;
+        int later;
+        Node() : key(), value(), expiry(0), newer(-1), older(-1), earlier(-1), later(-1) {}
+    };
+
+    QVector<Node> nodes;
+    QVector<int> slots;
+    int freeList;
+    int count;
+    int newest;
+    int oldest;
+    int firstExpiry;
+    int lastExpiry;
+    const qint64 ttl;
+    const Eviction eviction;
+
+    int home(const Key& key) const { return static_cast<int>(qHash(key) & static_cast<uint>(slots.size() - 1)); }
+
+    // Slot holding key, or -1
+    int findSlot(const Key& key) const
+    {
+        int mask = slots.size() - 1;
+        for (int i = home(key);; i = (i + 1) & mask) {
+            int node = slots.at(i);
+            if (node < 0) {
+                return -1;
+            }
+            if (nodes.at(node).key == key) {
+                return i;
+            }
+        }
+    }
+
+    void eraseSlot(int i)
+    {
+        int mask = slots.size() - 1;
+        int j    = i;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (slots.at(j) < 0) {
+                break;
+            }
+            int k      = home(nodes.at(slots.at(j)).key);
+            bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stays) {
+                slots[i] = slots.at(j);
+                i        = j;
+            }
+        }
+        slots[i] = -1;
+    }
+
+    void unlinkRecency(int n)
+    {
+        Node& node = nodes[n];
+        if (node.newer >= 0) {
+            nodes[node.newer].older = node.older;
+        } else {
+            newest = node.older;
+        }
+        if (node.older >= 0) {
+            nodes[node.older].newer = node.newer;
+        } else {
+            oldest = node.newer;
+        }
+        node.newer = node.older = -1;
+    }
+
+    void pushNewest(int n)
+    {
+        Node& node = nodes[n];
+        node.newer = -1;
+        node.older = newest;
+        if (newest >= 0) {
+            nodes[newest].newer = n;
+        } else {
+            oldest = n;
+        }
+        newest = n;
+    }
+
+    void unlinkExpiry(int n)
+    {
+        Node& node = nodes[n];
+        if (node.earlier >= 0) {
+            nodes[node.earlier].later = node.later;
+        } else {
+            firstExpiry = node.later;
+        }
+        if (node.later >= 0) {
+            nodes[node.later].earlier = node.earlier;
+        } else {
+            lastExpiry = node.earlier;
+        }
+        node.earlier = node.later = -1;
+    }
+
+    // Every entry gets the same ttl, so the latest insert always expires last
+    void pushLatest(int n)
+    {
+        Node& node   = nodes[n];
+        node.later   = -1;
+        node.earlier = lastExpiry;
+        if (lastExpiry >= 0) {
+            nodes[lastExpiry].later = n;
+        } else {
+            firstExpiry = n;
+        }
+        lastExpiry = n;
+    }
+
+    void eraseNode(int slot)
+    {
+        int n = slots.at(slot);
+        eraseSlot(slot);
+        unlinkRecency(n);
+        unlinkExpiry(n);
+        // Let go of whatever the key and value hold
+        nodes[n]       = Node();
+        nodes[n].older = freeList;
+        freeList       = n;
+        count--;
+    }
+
+    void expire(qint64 now)
+    {
+        while (ttl > 0 && firstExpiry >= 0 && nodes.at(firstExpiry).expiry <= now) {
+            eraseNode(findSlot(nodes.at(firstExpiry).key));
+        }
+    }
+
+   public:
+    /*!
+     * \brief Cache
+     * \param capacity most entries held at once
+     * \param ttlMsecs lifetime of an entry from its last insert, 0 for no expiry
+     * \param eviction which entry makes room when the cache is full
+     */
+    Cache(int capacity, qint64 ttlMsecs, Eviction eviction = LEAST_RECENTLY_USED)
+        : freeList(-1),
+          count(0),
+          newest(-1),
+          oldest(-1),
+          firstExpiry(-1),
+          lastExpiry(-1),
+          ttl(ttlMsecs),
+          eviction(eviction)
+    {
+        capacity = qMax(1, capacity);
+        nodes.resize(capacity);
+        for (int i = capacity - 1; i >= 0; i--) {
+            nodes[i].older = freeList;
+            freeList       = i;
+        }
+        int slotCount = 2;
+        while (slotCount < capacity * 2) {
+            slotCount *= 2;
+        }
+        slots.fill(-1, slotCount);
+    }
+
+    // Adds or replaces key, either way its lifetime starts over
+    void insert(const Key& key, const Value& value)
+    {
+        qint64 now = Clock::now();
+        expire(now);
+        int slot = findSlot(key);
+        int n;
+        if (slot >= 0) {
+            n = slots.at(slot);
+            unlinkRecency(n);
+            unlinkExpiry(n);
+        } else {
+            if (freeList < 0) {
+                int victim = eviction == LEAST_RECENTLY_USED ? oldest : firstExpiry;
+                eraseNode(findSlot(nodes.at(victim).key));
+            }
+            n        = freeList;
+            freeList = nodes.at(n).older;
+            int mask = slots.size() - 1;
+            int i    = home(key);
+            while (slots.at(i) >= 0) {
+                i = (i + 1) & mask;
+            }
+            slots[i]     = n;
+            nodes[n].key = key;
+            count++;
+        }
+        Node& node  = nodes[n];
+        node.value  = value;
+        node.expiry = now + ttl;
+        pushNewest(n);
+        pushLatest(n);
+    }
+
+    // The cached value or null, a hit counts as a use for eviction
+    Value* find(const Key& key)
+    {
+        expire(Clock::now());
+        int slot = findSlot(key);
+        if (slot < 0) {
+            return nullptr;
+        }
+        int n = slots.at(slot);
+        if (n != newest) {
+            unlinkRecency(n);
+            pushNewest(n);
+        }
+        return &nodes[n].value;
+    }
+
+    bool contains(const Key& key) { return find(key) != nullptr; }
+
+    Value value(const Key& key, const Value& defaultValue = Value())
+    {
+        Value* found = find(key);
+        return found ? *found : defaultValue;
+    }
+
+    bool remove(const Key& key)
+    {
+        expire(Clock::now());
+        int slot = findSlot(key);
+        if (slot < 0) {
+            return false;
+        }
+        eraseNode(slot);
+        return true;
+    }
+
+    int size()
+    {
+        expire(Clock::now());
+        return count;
+    }
+
+    int capacity() const { return nodes.size(); }
+
+    void clear()
+    {
+        while (newest >= 0) {
+            eraseNode(findSlot(nodes.at(newest).key));
+        }
+    }
+};
+}
+
+#endif  // PXMCACHE_H
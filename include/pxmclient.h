@@ -20,6 +20,8 @@ class PXMClient : public QObject
     QScopedPointer<PXMClientPrivate> d_ptr;
 
    public:
+    // Longest payload sendMsg will frame
+    static const size_t MAX_MESSAGE_LENGTH = 65400;
     PXMClient(QObject* parent, in_addr multicast, QUuid localUUID);
     ~PXMClient();
     /** Sets the uuid for this program for use in comms
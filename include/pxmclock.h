@@ -0,0 +1,27 @@
+#ifndef PXMCLOCK_H
+#define PXMCLOCK_H
+
+#include <QElapsedTimer>
+
+/*!
+ * Monotonic time in milliseconds for timers and expiry.
+ *
+ * Counts from the first call in the process, so values are only
+ * comparable with each other and never go backwards when the wall clock
+ * is changed.
+ */
+namespace PXMClock
+{
+inline qint64 monotonicMsecs()
+{
+    // Started once on first use, initialization is thread safe
+    static const QElapsedTimer timer = [] {
+        QElapsedTimer started;
+        started.start();
+        return started;
+    }();
+    return timer.elapsed();
+}
+}
+
+#endif  // PXMCLOCK_H
@@ -8,6 +8,8 @@
 #include <QFile>
 #include <QDir>
 
+#include "pxmlogbackend.h"
+
 class QPushButton;
 namespace PXMConsole
 {
@@ -23,26 +25,16 @@ class Window : public QMainWindow
     explicit Window(QWidget* parent = 0);
     ~Window();
     QPushButton* pushButton;
+    QPushButton* traceButton;
     static QTextEdit* textEdit;
    public slots:
     void verbosityChanged();
    private slots:
+    void dumpTrace();
     void adjustScrollBar(int i);
     void rangeChanged(int, int i2);
 };
 
-class AppendTextEvent : public QEvent
-{
-   public:
-    AppendTextEvent(QString text, QColor color) : QEvent(static_cast<Type>(type)), text(text), textColor(color) {}
-    QString getText() { return text; }
-    QColor getColor() { return textColor; }
-   private:
-    static int type;
-    QString text;
-    QColor textColor;
-};
-
 class Logger : public QObject
 {
    public:
@@ -50,28 +42,27 @@ class Logger : public QObject
     {
         if (!loggerInstance) {
             loggerInstance = new Logger;
-#ifdef __WIN32
-            loggerInstance->logFile.reset(new QFile(QDir::currentPath() + "/log.txt", loggerInstance));
-#else
-            loggerInstance->logFile.reset(new QFile(QDir::homePath() + "/.pxmessenger-log", loggerInstance));
-#endif
         }
 
         return loggerInstance;
     }
-    void setTextEdit(QTextEdit* textEdit) { logTextEdit = textEdit; }
-    int getVerbosityLevel() { return verbosityLevel; }
-    void setVerbosityLevel(int value) { verbosityLevel = value; }
-    bool getLogStatus() { return logActive; }
-    void setLogStatus(bool stat);
-    QScopedPointer<QFile> logFile;
+    void setTextEdit(QTextEdit* textEdit)
+    {
+        logTextEdit = textEdit;
+        PXMLog::Backend::instance()->setConsoleSink(textEdit ? this : nullptr);
+    }
+    // Both are kept by the log backend so its writer thread can see them
+    int getVerbosityLevel() { return PXMLog::Backend::instance()->verbosityLevel(); }
+    void setVerbosityLevel(int value) { PXMLog::Backend::instance()->setVerbosityLevel(value); }
+    bool getLogStatus() { return PXMLog::Backend::instance()->fileLoggingEnabled(); }
+    void setLogStatus(bool stat) { PXMLog::Backend::instance()->setFileLogging(stat); }
 
    private:
     Logger() : QObject() {}
     static Logger* loggerInstance;
     QTextEdit* logTextEdit = 0;
-    int verbosityLevel     = 0;
-    bool logActive         = 0;
+
+    static QColor colorFor(QtMsgType type);
 
    protected:
     virtual void customEvent(QEvent* event);
@@ -12,6 +12,7 @@ namespace PXMConsts
 {
 const char DEFAULT_MULTICAST_ADDRESS[]       = "239.192.13.13";
 const int MESSAGE_HISTORY_LENGTH             = 500;
+const int HISTORY_PAGE_SIZE                  = 100;
 const size_t MIDNIGHT_TIMER_INTERVAL_MINUTES = 1;
 #ifdef QT_DEBUG
 const size_t DEBUG_PADDING = 23;
@@ -31,8 +32,24 @@ enum MESSAGE_TYPE : const uint32_t {
     MSG_AUTH         = 0x55555555,
     MSG_NAME         = 0x66666666,
     MSG_DISOVER      = 0x77777777,
-    MSG_ID           = 0x88888888
+    MSG_ID           = 0x88888888,
+    // MSG_TEXT and MSG_GLOBAL with a send time prefix, see pxmlatency.h
+    MSG_TEXT_STAMPED   = 0x99999999,
+    MSG_GLOBAL_STAMPED = 0xAAAAAAAA,
+    // File transfers, see pxmtransfer.h
+    MSG_FILE_OFFER    = 0xBBBBBBBB,
+    MSG_FILE_ACCEPT   = 0xCCCCCCCC,
+    MSG_FILE_CANCEL   = 0xDDDDDDDD,
+    MSG_FILE_STREAM   = 0xEEEEEEEE,
+    MSG_FILE_HAVE     = 0x1A1A1A1A,
+    MSG_FILE_REDIRECT = 0x1B1B1B1B,
+    MSG_FILE_PULL     = 0x1C1C1C1C,
+    // [4B big endian mask of CAPABILITY_ flags], sent right after MSG_AUTH.
+    // Older clients drop frame types they do not know
+    MSG_CAPABILITIES = 0x1D1D1D1D
 };
+// Peer takes MSG_TEXT_STAMPED and MSG_GLOBAL_STAMPED, see pxmlatency.h
+const uint32_t CAPABILITY_STAMPS = 0x1;
 constexpr size_t ct_strlen(const char* s) noexcept
 {
     return *s ? 1 + ct_strlen(s + 1) : 0;
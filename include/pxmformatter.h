@@ -0,0 +1,75 @@
+#ifndef PXMFORMATTER_H
+#define PXMFORMATTER_H
+
+#include <QHash>
+#include <QString>
+#include <QUuid>
+
+/*!
+ * \brief The PXMFormatter class
+ *
+ * Turns message html into the fragment that is handed to the text browsers.
+ * Lives on the worker thread, the UI only appends what comes out of here.
+ *
+ * The "(hh:mm:ss) " timestamp is rebuilt at most once per second and the
+ * coloured header span for each peer is built once and reused until that
+ * peers hostname or colour changes, or it disconnects.
+ */
+class PXMFormatter
+{
+    struct Header {
+        QString color;
+        QString hostname;
+        QString open;
+        QString close;
+    };
+    QHash<QUuid, Header> headers;
+    qint64 cachedSecond;
+    QString cachedTimestamp;
+
+    const QString& timestamp();
+
+   public:
+    PXMFormatter() : cachedSecond(-1) {}
+    /*!
+     * \brief formatMessage
+     *
+     * Inserts the timestamp and hostname header after the first <p> tag.
+     * \return 0 on success, -1 if no paragraph tag was found and str was
+     * left untouched
+     */
+    int formatMessage(QString& str, const QUuid& uuid, const QString& hostname, const QString& color);
+    /*!
+     * \brief formatUncached
+     *
+     * Same header as formatMessage() for a sender that is not a peer,
+     * nothing is kept for it.
+     */
+    int formatUncached(QString& str, const QString& hostname, const QString& color);
+    // Drops the cached header of a peer that went away
+    void forget(const QUuid& uuid) { headers.remove(uuid); }
+    /*!
+     * \brief paragraphEnd
+     *
+     * Hand written replacement for matching "(<p.*?>)".
+     * \return offset just past the first "<p...>" tag, -1 if there is none
+     */
+    static int paragraphEnd(const QString& str);
+    /*!
+     * \brief stripHeader
+     *
+     * Undoes formatMessage(), for text that should not carry the sender and
+     * time of day such as the search index.
+     * \return str without the header, str itself if it has none
+     */
+    static QString stripHeader(const QString& str);
+    /*!
+     * \brief removeBodyFormatting
+     *
+     * Strips the style attribute QTextEdit::toHtml() puts on the body tag.
+     * \return 0 on success, -1 if the body tag has no style attribute
+     */
+    static int removeBodyFormatting(QByteArray& str);
+};
+
+#endif  // PXMFORMATTER_H
@@ -0,0 +1,125 @@
+#ifndef PXMHISTORY_H
+#define PXMHISTORY_H
+
+#include <QMetaType>
+#include <QObject>
+#include <QScopedPointer>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+/*!
+ * On disk message history.
+ *
+ * Every conversation gets its own directory of append-only segment files
+ * (00000000.seg, 00000001.seg, ...).  A segment starts with SEGMENT_MAGIC and
+ * then holds records of the form
+ *
+ *   uint32 length | int64 msecs since epoch | length bytes of utf8 | uint32 length
+ *
+ * all little endian.  The trailing length lets a reader walk backwards from
+ * any record boundary, which is how the view pages towards older messages.
+ *
+ * Appends are buffered and handed to a writer thread together every
+ * FLUSH_INTERVAL_MSECS or once FLUSH_THRESHOLD_BYTES are waiting.  For each
+ * touched conversation the writer appends the records with one write and
+ * fsync.  A conversation has at most one batch with the writer, records that
+ * fail to be written stay queued for the next flush and the store only
+ * counts what was synced.  Reads never wait for the writer: what is on disk
+ * is read through QFile::map, with at most MAX_MAPPED_SEGMENTS segments
+ * mapped at once, and the rest from the batch with the writer and the
+ * records still queued.
+ */
+namespace PXMHistory
+{
+const char SEGMENT_MAGIC[]             = "PXMHIST1";
+const quint32 SEGMENT_HEADER_LEN       = 8;
+const quint32 RECORD_OVERHEAD          = 16;
+const quint32 SEGMENT_MAX_BYTES        = 4 * 1024 * 1024;
+const int FLUSH_INTERVAL_MSECS         = 250;
+const int FLUSH_THRESHOLD_BYTES        = 64 * 1024;
+const int MAX_MAPPED_SEGMENTS          = 8;
+const char GLOBAL_CONVERSATION[]       = "global";
+
+// Position of the start of a record.  A null cursor means "after the newest
+// record".
+struct Cursor {
+    quint32 segment;
+    quint32 offset;
+    Cursor() : segment(0), offset(0) {}
+    Cursor(quint32 seg, quint32 off) : segment(seg), offset(off) {}
+    bool isNull() const { return offset == 0; }
+    bool operator<(const Cursor& c) const
+    {
+        return segment < c.segment || (segment == c.segment && offset < c.offset);
+    }
+};
+
+struct Record {
+    qint64 msecs;
+    QString text;
+    Cursor position;
+};
+
+struct StorePrivate;
+class Store : public QObject
+{
+    Q_OBJECT
+    QScopedPointer<StorePrivate> d_ptr;
+
+   public:
+    Store(QString directory, QObject* parent = nullptr);
+    ~Store();
+    Store(Store const&) = delete;
+    Store& operator=(Store const&) = delete;
+
+    QString directory() const;
+    /*!
+     * \brief append
+     *
+     * Queues a message for the conversation.  It is on disk once the
+     * writer is done with the next flush.
+     * \return Where the record will be once it is written
+     */
+    Cursor append(const QString& conversation, const QString& text, qint64 msecs);
+    /*!
+     * \brief readAt
+     *
+     * Reads the record that starts at cursor.  The returned record has a null
+     * position if there is no such record.
+     */
+    Record readAt(const QString& conversation, Cursor cursor);
+    /*!
+     * \brief readBefore
+     *
+     * Reads up to count records that come before cursor, oldest first.  Pass
+     * a null cursor to start from the newest record.  The position of the
+     * first returned record is the cursor for the next, older, page.
+     */
+    QVector<Record> readBefore(const QString& conversation, Cursor cursor, int count);
+    /*!
+     * \brief scan
+     *
+     * Read only walk over a conversation, oldest first, starting at from (a
+     * null cursor starts at the beginning).  Does not touch any Store state
+     * so it can be used from another thread while a Store is appending to
+     * the same directory.  Stops at the first incomplete record or when
+     * visitor returns false.
+     * \return Cursor just past the last record visited
+     */
+    static Cursor scan(const QString& directory,
+                       const QString& conversation,
+                       Cursor from,
+                       const std::function<bool(const Record&)>& visitor);
+   public slots:
+    void flush();
+   private slots:
+    // From the writer thread when a batch is done
+    void written();
+};
+}
+
+Q_DECLARE_METATYPE(PXMHistory::Cursor)
+
+#endif  // PXMHISTORY_H
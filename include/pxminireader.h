@@ -38,6 +38,14 @@ class PXMIniReader {
   void setVerbosity(int level) const;
   bool getLogActive() const;
   void setLogActive(bool status) const;
+  bool getHistoryEnabled();
+  bool getLatencyStamps();
+  QString getMetricsSocket();
+  bool getLocalTransport();
+  // Only matters in builds with CONFIG+=pxm_uring
+  bool getIoUring();
+  // Cap on the received file cache, 0 turns it off
+  int getBlobCacheMegabytes();
 };
 
 #endif  // MESSINIREADER_H
@@ -0,0 +1,105 @@
+#ifndef PXMLATENCY_H
+#define PXMLATENCY_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QString>
+#include <QUuid>
+
+#include <atomic>
+
+/*!
+ * Message latency histograms.
+ *
+ * A received message is timed through the stages below, each kept overall
+ * and per peer:
+ *
+ *   SEND_TO_WIRE        sender: send requested -> handed to the socket
+ *   REMOTE_TO_PARSE     sender's send stamp -> parsed here, includes any
+ *                       clock difference between the two hosts
+ *   WIRE_TO_PARSE       full frame read -> parsed
+ *   PARSE_TO_WORKER     parsed -> picked up by the worker thread
+ *   WORKER_TO_RENDERED  picked up by the worker -> appended to the view
+ *
+ * The first two need stamped frames: MSG_TEXT_STAMPED and
+ * MSG_GLOBAL_STAMPED carry the sender's wall clock time in microseconds as
+ * an 8 byte big endian prefix.  They are only sent when LatencyStamps is
+ * enabled in the ini and the peer set CAPABILITY_STAMPS in the
+ * MSG_CAPABILITIES frame that follows its auth packet.
+ *
+ * Histograms are HDR style: values below 64us get a bucket each, above
+ * that every power of two is split into 32 buckets, so any value is
+ * reported within about 3%.  Recording is a few relaxed atomic adds.
+ */
+namespace PXMLatency
+{
+enum Stage { SEND_TO_WIRE, REMOTE_TO_PARSE, WIRE_TO_PARSE, PARSE_TO_WORKER, WORKER_TO_RENDERED, STAGE_COUNT };
+const int STAMP_LENGTH = 8;
+
+const char* stageName(Stage stage);
+qint64 monotonicMicros();
+qint64 wallMicros();
+// msg with the current wall clock time prefixed
+QByteArray stamp(const QByteArray& msg);
+qint64 readStamp(const unsigned char* buf);
+
+class Histogram
+{
+   public:
+    static const int SUB_BITS   = 5;
+    static const int LINEAR_MAX = 2 << SUB_BITS;
+    // Values from 2^MAX_BIT microseconds (about 12 days) up share the last bucket
+    static const int MAX_BIT    = 40;
+    static const int BUCKETS    = LINEAR_MAX + (MAX_BIT - SUB_BITS - 1) * (1 << SUB_BITS);
+
+    Histogram();
+    void record(qint64 micros);
+    quint64 count() const { return total.load(std::memory_order_relaxed); }
+    qint64 maxValue() const { return static_cast<qint64>(max.load(std::memory_order_relaxed)); }
+    // Upper bound of the bucket holding the given fraction of values
+    qint64 percentile(double fraction) const;
+
+    static int bucketFor(quint64 value);
+    static quint64 bucketLowerBound(int bucket);
+    static quint64 bucketUpperBound(int bucket);
+
+   private:
+    std::atomic<quint64> counts[BUCKETS];
+    std::atomic<quint64> total;
+    std::atomic<quint64> max;
+};
+
+class Recorder
+{
+    struct PeerHistograms {
+        Histogram stages[STAGE_COUNT];
+    };
+    Histogram overall[STAGE_COUNT];
+    QHash<QUuid, QSharedPointer<PeerHistograms>> peers;
+    mutable QReadWriteLock peersLock;
+
+    Recorder() {}
+    PeerHistograms* peer(const QUuid& uuid);
+
+   public:
+    static Recorder* instance();
+    Recorder(Recorder const&) = delete;
+    Recorder& operator=(Recorder const&) = delete;
+
+    // Safe from any thread, a null uuid only records the overall histogram
+    void record(Stage stage, const QUuid& uuid, qint64 micros);
+    const Histogram& overallHistogram(Stage stage) const { return overall[stage]; }
+    /*!
+     * \brief summary
+     *
+     * p50/p99/p999 for every stage that has samples, overall and per peer.
+     * names maps peer uuids to something readable.
+     */
+    QString summary(const QHash<QUuid, QString>& names) const;
+    QByteArray toJson(const QHash<QUuid, QString>& names) const;
+};
+}
+
+#endif  // PXMLATENCY_H
@@ -0,0 +1,35 @@
+#ifndef PXMLOG_H
+#define PXMLOG_H
+
+#include <QLoggingCategory>
+
+/*!
+ * Logging front end.
+ *
+ * qCDebug() and friends test the category before anything after the <<
+ * is evaluated, so a disabled line costs one atomic load.  The categories
+ * follow the debug verbosity, see PXMLog::Backend::setVerbosityLevel().
+ *
+ *   pxm.net     connection level events
+ *   pxm.packet  one line per packet or more, the hot path
+ *
+ * pxm.packet goes through pxmPacketDebug() and pxmPacketInfo() which
+ * compile to nothing in release builds unless PXM_PACKET_LOGGING is
+ * defined.
+ */
+Q_DECLARE_LOGGING_CATEGORY(pxmNet)
+Q_DECLARE_LOGGING_CATEGORY(pxmPacket)
+
+#if defined(QT_NO_DEBUG) && !defined(PXM_PACKET_LOGGING)
+#define pxmPacketDebug() \
+    while (false)        \
+    QMessageLogger().noDebug()
+#define pxmPacketInfo() \
+    while (false)       \
+    QMessageLogger().noDebug()
+#else
+#define pxmPacketDebug() qCDebug(pxmPacket)
+#define pxmPacketInfo() qCInfo(pxmPacket)
+#endif
+
+#endif  // PXMLOG_H
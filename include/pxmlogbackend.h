@@ -0,0 +1,137 @@
+#ifndef PXMLOGBACKEND_H
+#define PXMLOGBACKEND_H
+
+#include <QEvent>
+#include <QMutex>
+#include <QObject>
+#include <QScopedPointer>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <atomic>
+
+/*!
+ * Asynchronous log backend.
+ *
+ * The message handler only captures the time, the type and the message and
+ * pushes them onto a bounded lock free ring (Dmitry Vyukov's MPMC queue).
+ * Formatting, writing to stderr and the log file and updating the debug
+ * console all happen on the writer thread.  The writer wakes up every
+ * FLUSH_INTERVAL_MSECS, or early once WAKE_THRESHOLD entries are waiting, and
+ * writes everything it drained in one go.  The debug console gets at most one
+ * batch per CONSOLE_INTERVAL_MSECS.
+ *
+ * When the ring is full new entries are dropped and counted, the writer
+ * reports how many were lost.  The log file is rotated once it grows past
+ * ROTATE_BYTES keeping ROTATE_COUNT old files.
+ */
+namespace PXMLog
+{
+const int RING_SIZE               = 8192;
+const int WAKE_THRESHOLD          = RING_SIZE / 2;
+const int FLUSH_INTERVAL_MSECS    = 50;
+const int CONSOLE_INTERVAL_MSECS  = 100;
+const int CONSOLE_MAX_LINES       = 2000;
+const qint64 ROTATE_BYTES         = 4 * 1024 * 1024;
+const int ROTATE_COUNT            = 3;
+
+struct Entry {
+    QtMsgType type;
+    int msecsOfDay;
+    const char* file;
+    int line;
+    QString msg;
+};
+
+// Lines for the debug console, posted to the console sink
+class ConsoleEvent : public QEvent
+{
+   public:
+    struct Line {
+        QtMsgType type;
+        QString text;
+    };
+    ConsoleEvent(QVector<Line> lines) : QEvent(static_cast<Type>(type)), lines(lines) {}
+    QVector<Line> lines;
+    static int type;
+};
+
+class Ring
+{
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Entry entry;
+    };
+    static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "RING_SIZE must be a power of two");
+    QScopedArrayPointer<Slot> cells;
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+
+   public:
+    Ring();
+    bool push(Entry&& entry);
+    bool pop(Entry& entry);
+    size_t sizeApprox() const;
+};
+
+class Backend : public QThread
+{
+    Q_OBJECT
+    Ring ring;
+    std::atomic<int> verbosity;
+    std::atomic<bool> fileLogging;
+    std::atomic<bool> running;
+    std::atomic<quint64> dropped;
+    std::atomic<QObject*> consoleSink;
+    QMutex wakeMutex;
+    QWaitCondition wakeCondition;
+    QString logPath;
+
+    Backend();
+    static QByteArray format(const Entry& entry);
+
+   public:
+    static Backend* instance();
+    ~Backend();
+    Backend(Backend const&) = delete;
+    Backend& operator=(Backend const&) = delete;
+
+    /*!
+     * \brief log
+     *
+     * Queue a message, safe to call from any thread.  Messages below the
+     * verbosity level are dropped before anything is copied.
+     */
+    void log(QtMsgType type, const QMessageLogContext& context, const QString& msg);
+    bool isEnabled(QtMsgType type) const;
+    int verbosityLevel() const { return verbosity.load(std::memory_order_relaxed); }
+    void setVerbosityLevel(int level);
+    void setFileLogging(bool enabled);
+    size_t queueDepth() const { return ring.sizeApprox(); }
+    quint64 droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+    bool fileLoggingEnabled() const { return fileLogging.load(std::memory_order_relaxed); }
+    QString logFilePath() const { return logPath; }
+    // Receiver for ConsoleEvent, it is only posted to so any thread is fine
+    void setConsoleSink(QObject* sink) { consoleSink.store(sink); }
+    /*!
+     * \brief startWriter
+     *
+     * Until this is called messages are written straight to stderr.
+     */
+    void startWriter();
+    /*!
+     * \brief stop
+     *
+     * Writes everything still queued and stops the writer thread.  Messages
+     * logged afterwards are written straight to stderr.
+     */
+    void stop();
+
+   protected:
+    void run() Q_DECL_OVERRIDE;
+};
+}
+
+#endif  // PXMLOGBACKEND_H
@@ -4,10 +4,13 @@
 #include <QSystemTrayIcon>
 #include <QMainWindow>
 #include <QUuid>
+#include <QList>
+#include <QPointer>
 #include <QScopedPointer>
 #include <QTextEdit>
 
 #include "pxmconsts.h"
+#include "pxmhistory.h"
 //#include "ui_pxmmainwindow.h"
 #include "ui_pxmaboutdialog.h"
 #include "ui_pxmsettingsdialog.h"
@@ -20,7 +23,11 @@ class PXMWindow;
 class PXMAboutDialog;
 class PXMSettingsDialog;
 }
-class QListWidgetItem;
+namespace PXMPeerList {
+class Model;
+class FilterProxy;
+}
+class QModelIndex;
 
 class PXMWindow : public QMainWindow {
   Q_OBJECT
@@ -30,9 +37,20 @@ class PXMWindow : public QMainWindow {
   QMenu* sysTrayMenu;
   QSystemTrayIcon* sysTray;
   QFrame* fsep;
+  PXMPeerList::Model* peerModel;
+  PXMPeerList::FilterProxy* peerProxy;
   QString localHostname;
   QUuid globalChatUuid;
   QScopedPointer<PXMConsole::Window> debugWindow;
+  struct Offer {
+    QUuid id;
+    QString hostname;
+    QString name;
+    qint64 size;
+  };
+  // Incoming files waiting for an answer, the first one is being asked about
+  QList<Offer> offers;
+  QPointer<QWidget> offerPrompt;
   /*!
    * \brief focusWindow
    *
@@ -43,9 +61,9 @@ class PXMWindow : public QMainWindow {
   /*!
    * \brief changeListColor
    *
-   * Changes the color of the background for an item in a given row of the
-   * QListWidget.  Changes to either red or default.
-   * \param row Row of item in QListWidget to change
+   * Changes the color of the background for a peer in the peer list.
+   * Changes to either red or default.
+   * \param uuid Peer whose item should change
    * \param style Color to change to.  1 for red, 0 for default.
    */
   int changeListItemColor(QUuid uuid, int style);
@@ -59,8 +77,9 @@ class PXMWindow : public QMainWindow {
   /*!
    * \brief createListWidget
    *
-   * Initializes the QListWidget that holds the connected computers.  Two
-   * items are added, a seperator and a "Global Chat"
+   * Initializes the peer list model and the view that holds the connected
+   * computers.  The model starts with two rows, "Global Chat" and a
+   * seperator, which stay pinned to the top.
    */
   void initListWidget();
   /*!
@@ -78,7 +97,14 @@ class PXMWindow : public QMainWindow {
   void setupTooltips();
   void setupMenuBar();
   void setupGui();
-  int removeBodyFormatting(QByteArray& str);
+  /*!
+   * \brief showNextOffer
+   *
+   * Asks about the first waiting offer with a non-modal prompt, then for
+   * where to save it.  Only one offer is asked about at a time.
+   */
+  void showNextOffer();
+  void answerFirstOffer(QString path);
 
  public:
   PXMWindow(QString hostname,
@@ -94,10 +120,16 @@ class PXMWindow : public QMainWindow {
   PXMWindow(PXMWindow&&) noexcept = delete;
  public slots:
   void bloomActionsSlot();
-  int printToTextBrowser(QSharedPointer<QString> str, QUuid uuid, bool alert);
+  int printToTextBrowser(QSharedPointer<QString> str, QUuid uuid, bool alert, qint64 workerMicros = 0);
   void setItalicsOnItem(QUuid uuid, bool italics);
+  void peerDisconnected(QUuid uuid);
   void updateListWidget(QUuid uuid, QString hostname);
   void warnBox(QString title, QString msg);
+  void searchResults(QString query, QStringList results);
+  void historyPage(QUuid uuid, QStringList page, PXMHistory::Cursor next, bool more);
+  void fileOffered(QUuid id, QUuid uuid, QString hostname, QString name, qint64 size);
+  void transferProgress(QUuid id, QString description, qint64 done, qint64 size);
+  void transferFinished(QUuid id, bool ok, QString description);
 
  protected:
   void closeEvent(QCloseEvent* event) Q_DECL_OVERRIDE;
@@ -105,19 +137,26 @@ class PXMWindow : public QMainWindow {
  private slots:
   int sendButtonClicked();
   void quitButtonClicked();
-  void currentItemChanged(QListWidgetItem* item1);
+  void currentItemChanged(const QModelIndex& current);
   void textEditChanged();
   void systemTrayAction(QSystemTrayIcon::ActivationReason reason);
   void aboutActionSlot();
   void settingsActionsSlot();
   void debugActionSlot();
   void nameChange(QString hname);
+  void searchActionSlot();
+  void sendFileActionSlot();
  signals:
   void sendMsg(QByteArray, PXMConsts::MESSAGE_TYPE, QUuid);
   void sendUDP(const char*);
   void retryDiscover();
   void addMessageToPeer(QString, QUuid, bool, bool);
   void printInfoToDebug();
+  void searchHistory(QString);
+  void requestHistoryPage(QUuid, PXMHistory::Cursor, int);
+  void offerFile(QString, QUuid);
+  // An empty path declines
+  void answerOffer(QUuid, QString);
 };
 
 class PXMAboutDialog : public QDialog {
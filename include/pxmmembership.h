@@ -0,0 +1,378 @@
+#ifndef PXMMEMBERSHIP_H
+#define PXMMEMBERSHIP_H
+
+#include <QHash>
+#include <QVector>
+
+#include "pxmcache.h"
+#include "pxmlog.h"
+#include "timedvector.h"
+
+/*!
+ * Discovery, connection and sync decisions of the peer protocol.
+ *
+ * Membership decides who to connect to, which connection a peer keeps,
+ * who to ask for sync packets and which of them to believe.  It does no
+ * I/O itself, everything it wants done goes through the Transport, and
+ * time comes from Clock (see PXMCache).  PXMPeerWorker drives it with
+ * libevent and QTimers, tools/pxmsim with a simulated network on
+ * simulated time, so both run this code.
+ *
+ * Transport is held by value and provides the types
+ *
+ *   Peer     key of a peer, QUuid in the worker
+ *   Address  where a peer listens
+ *   Link     one connection, the bufferevent in the worker
+ *   Socket   the socket under a Link, -1 for none
+ *   Record   one entry of a sync packet
+ *
+ * and the functions
+ *
+ *   static Link noLink()
+ *   static Record record(const Peer&, const Address&)
+ *   static const Peer& recordPeer(const Record&)
+ *   static const Address& recordAddress(const Record&)
+ *   bool shareable(const Address&)      worth listing in a sync packet
+ *   unsigned int random()
+ *   void sendDiscover()
+ *   void connect(const Record* targets, size_t count)
+ *   void enable(Link)                   start reading an outgoing connection
+ *   void sendAuth(Link, const Peer*)    null for a connection we accepted
+ *   void sendSyncRequest(const Peer&, Link)
+ *   void sendSync(const Peer&, Link, const QVector<Record>&)
+ *   void freeLink(Link)                 drop it, the socket stays open
+ *   void closeSocket(Socket)
+ *   void startTimer(Timer, int msecs)   single shot, restarts a running one
+ *   void stopTimer(Timer)
+ *   void changed(const Peer&, const PeerState<Transport>&)
+ *   void authenticated(const Peer&)
+ *   void disconnected(const Peer&)
+ *   void syncStarted()
+ *
+ * changed() is called with the new state whenever a peer's state changes
+ * and before any link it had is freed, so the transport can stop using it.
+ */
+namespace PXMMembership
+{
+// Protocol timing
+const int SYNC_TIMEOUT_MSECS        = 2000;
+const int SYNC_TIMER                = 900000;
+const int SYNC_TIMER_SPREAD_MSECS   = 300000;
+const int SYNC_NEXT_MSECS           = 2000;
+const int DISCOVERY_FIRST_MSECS     = 5000;
+const int DISCOVERY_RETRY_MSECS     = 30000;
+const int CONNECT_BACKOFF_MSECS     = 10000;
+const int FAILED_CONNECT_CACHE_SIZE = 256;
+
+enum Timer { DISCOVERY_TIMER, ROUND_TIMER, NEXT_SYNC_TIMER };
+
+template <class Transport>
+struct PeerState {
+    typename Transport::Link link;
+    typename Transport::Socket socket;
+    typename Transport::Address address;
+    // Connected or being connected to, no other connection is started
+    bool connect;
+    bool authed;
+    PeerState() : link(Transport::noLink()), socket(-1), address(), connect(false), authed(false) {}
+};
+
+template <class Transport, class Clock = PXMCache::MonotonicClock>
+class Membership
+{
+   public:
+    typedef typename Transport::Peer Peer;
+    typedef typename Transport::Address Address;
+    typedef typename Transport::Link Link;
+    typedef typename Transport::Socket Socket;
+    typedef typename Transport::Record Record;
+    typedef PeerState<Transport> State;
+
+   private:
+    Transport transport;
+    QHash<Peer, State> peers;
+    // Connections we accepted that have not authenticated yet
+    QVector<Link> unclaimed;
+    // Peers we asked for a sync packet, one from anyone else is ignored.
+    // The timeout is in SECONDS, as the worker has always had it
+    TimedVector<Peer> syncable;
+    // Peers we recently failed to reach, every sync packet listing them
+    // would otherwise start another connect that runs into the timeout
+    PXMCache::Cache<Peer, bool, Clock> failedConnects;
+    // A sync round asks the peers that were authenticated when it began
+    QVector<Peer> syncList;
+    int syncPos;
+    bool syncing;
+    int syncInterval;
+
+    // Marks peer as being connected to, false if it already is, is us or
+    // failed too recently to try again
+    bool claim(const Peer& peer, const Address& address)
+    {
+        typename QHash<Peer, State>::const_iterator known = peers.constFind(peer);
+        if (known != peers.constEnd() && known->connect) {
+            return false;
+        }
+        if (failedConnects.contains(peer)) {
+            qCDebug(pxmNet) << "Not retrying" << peer << "yet, last connection attempt failed";
+            return false;
+        }
+        State& state  = peers[peer];
+        state.connect = true;
+        state.address = address;
+        transport.changed(peer, state);
+        return true;
+    }
+
+    void drop(const Peer& peer, State& state)
+    {
+        Link link     = state.link;
+        Socket socket = state.socket;
+        state.link    = Transport::noLink();
+        state.socket  = -1;
+        state.connect = false;
+        state.authed  = false;
+        transport.changed(peer, state);
+        if (link != Transport::noLink()) {
+            transport.freeLink(link);
+        }
+        transport.closeSocket(socket);
+        transport.disconnected(peer);
+    }
+
+    void requestSync(const Peer& peer, const State& state)
+    {
+        syncable.append(peer, Clock::now());
+        transport.sendSyncRequest(peer, state.link);
+    }
+
+    void syncNext()
+    {
+        while (syncPos < syncList.size()) {
+            const Peer& peer                                = syncList.at(syncPos++);
+            typename QHash<Peer, State>::const_iterator itr = peers.constFind(peer);
+            if (itr != peers.constEnd() && itr->authed) {
+                requestSync(peer, *itr);
+                return;
+            }
+        }
+        doneSync();
+    }
+
+    void beginSync()
+    {
+        if (syncing) {
+            return;
+        }
+        qCInfo(pxmNet) << "Beginning Sync of connected peers";
+        syncing = true;
+        syncList.clear();
+        for (typename QHash<Peer, State>::const_iterator itr = peers.constBegin(); itr != peers.constEnd(); ++itr) {
+            if (itr->authed) {
+                syncList.append(itr.key());
+            }
+        }
+        syncPos = 0;
+        transport.syncStarted();
+        transport.startTimer(NEXT_SYNC_TIMER, SYNC_NEXT_MSECS);
+        syncNext();
+    }
+
+    void doneSync()
+    {
+        syncing = false;
+        syncList.clear();
+        transport.stopTimer(NEXT_SYNC_TIMER);
+        qCInfo(pxmNet) << "Finished Syncing peers";
+    }
+
+    void discover()
+    {
+        // Nobody but ourselves yet
+        if (peers.size() < 2) {
+            qCInfo(pxmNet) << "Retrying discovery packet, looking for other computers...";
+            transport.sendDiscover();
+            transport.startTimer(DISCOVERY_TIMER, DISCOVERY_RETRY_MSECS);
+        } else {
+            qCInfo(pxmNet) << "Found enough peers";
+        }
+    }
+
+   public:
+    // self is marked as connected so we never dial our own /name:
+    Membership(const Transport& transport, const Peer& self)
+        : transport(transport),
+          syncable(SYNC_TIMEOUT_MSECS, SECONDS),
+          failedConnects(FAILED_CONNECT_CACHE_SIZE, CONNECT_BACKOFF_MSECS),
+          syncPos(0),
+          syncing(false),
+          syncInterval(SYNC_TIMER)
+    {
+        peers[self].connect = true;
+    }
+
+    // Starts the discovery retries and the periodic sync rounds
+    void start()
+    {
+        syncInterval = static_cast<int>(transport.random() % SYNC_TIMER_SPREAD_MSECS) + SYNC_TIMER;
+        transport.startTimer(DISCOVERY_TIMER, DISCOVERY_FIRST_MSECS);
+        transport.startTimer(ROUND_TIMER, syncInterval);
+    }
+
+    void timerFired(Timer timer)
+    {
+        switch (timer) {
+            case DISCOVERY_TIMER:
+                discover();
+                break;
+            case ROUND_TIMER:
+                transport.startTimer(ROUND_TIMER, syncInterval);
+                beginSync();
+                break;
+            case NEXT_SYNC_TIMER:
+                // A sync packet never came, move on to the next peer
+                if (syncing) {
+                    transport.startTimer(NEXT_SYNC_TIMER, SYNC_NEXT_MSECS);
+                    syncNext();
+                }
+                break;
+        }
+    }
+
+    // peer said it listens at address, e.g. in a /name: reply
+    void found(const Peer& peer, const Address& address)
+    {
+        if (claim(peer, address)) {
+            Record record = Transport::record(peer, address);
+            transport.connect(&record, 1);
+        }
+    }
+
+    void connectResult(const Peer& peer, Link link, Socket socket, bool success)
+    {
+        State& state = peers[peer];
+        if (success) {
+            qCInfo(pxmNet) << "Successful connection attempt to" << peer;
+            failedConnects.remove(peer);
+            transport.enable(link);
+            Link old     = state.link;
+            state.link   = link;
+            state.socket = socket;
+            transport.changed(peer, state);
+            // Freed without closing, the peer drops it once we authenticate
+            // on the new one
+            if (old != Transport::noLink() && old != link) {
+                transport.freeLink(old);
+            }
+            transport.sendAuth(link, &peer);
+        } else {
+            qCWarning(pxmNet) << "Unsuccessful connection attempt to" << peer;
+            failedConnects.insert(peer, true);
+            transport.freeLink(link);
+            transport.closeSocket(socket);
+            // It may have reached us meanwhile, that connection stays
+            if (!state.authed) {
+                state.link    = Transport::noLink();
+                state.socket  = -1;
+                state.connect = false;
+                transport.changed(peer, state);
+            }
+        }
+    }
+
+    void accepted(Link link)
+    {
+        unclaimed.append(link);
+        transport.sendAuth(link, nullptr);
+    }
+
+    // link is no longer a peer connection, e.g. it carries a file now
+    void release(Link link) { unclaimed.removeOne(link); }
+
+    void authenticated(const Peer& peer, const Address& address, Link link, Socket socket)
+    {
+        State& state = peers[peer];
+        if (state.link != Transport::noLink() && state.link != link) {
+            // Both sides connected at once, the connection that
+            // authenticated last is kept
+            drop(peer, state);
+        }
+        unclaimed.removeOne(link);
+        state.link    = link;
+        state.socket  = socket;
+        state.address = address;
+        state.connect = true;
+        state.authed  = true;
+        transport.changed(peer, state);
+        transport.authenticated(peer);
+        requestSync(peer, state);
+    }
+
+    // link on socket was closed by the peer or broke
+    void closed(Link link, Socket socket)
+    {
+        for (typename QHash<Peer, State>::iterator itr = peers.begin(); itr != peers.end(); ++itr) {
+            if (itr->link == link) {
+                qCInfo(pxmNet) << "Peer:" << itr.key() << "has disconnected";
+                drop(itr.key(), itr.value());
+                return;
+            }
+        }
+        int i = unclaimed.indexOf(link);
+        if (i >= 0) {
+            unclaimed.remove(i);
+            transport.freeLink(link);
+        }
+        qCInfo(pxmNet) << "Non-Authed Peer has quit";
+        transport.closeSocket(socket);
+    }
+
+    void syncRequested(const Peer& peer, Link link)
+    {
+        typename QHash<Peer, State>::const_iterator from = peers.constFind(peer);
+        if (from == peers.constEnd() || from->link != link) {
+            qCWarning(pxmNet) << "Sync request from" << peer << "on a connection that is not its own";
+            return;
+        }
+        QVector<Record> records;
+        records.reserve(peers.size());
+        for (typename QHash<Peer, State>::const_iterator itr = peers.constBegin(); itr != peers.constEnd(); ++itr) {
+            if (itr->authed && transport.shareable(itr->address)) {
+                records.append(Transport::record(itr.key(), itr->address));
+            }
+        }
+        transport.sendSync(peer, link, records);
+    }
+
+    // Connects to whoever in records we do not know yet.  records is
+    // reordered, what was connected to ends up at the front
+    void syncReceived(const Peer& sender, Record* records, size_t count)
+    {
+        qint64 now = Clock::now();
+        if (!syncable.contains(sender, now)) {
+            qCWarning(pxmNet) << "Sync packet from bad uuid -- timeout or not requested" << sender;
+            return;
+        }
+        size_t wanted = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (claim(Transport::recordPeer(records[i]), Transport::recordAddress(records[i]))) {
+                qSwap(records[wanted++], records[i]);
+            }
+        }
+        transport.connect(records, wanted);
+        qCInfo(pxmNet) << "End of sync packet from" << sender << "," << count << "peers," << wanted << "new";
+        syncable.remove(sender, now);
+
+        if (syncing) {
+            transport.startTimer(NEXT_SYNC_TIMER, SYNC_NEXT_MSECS);
+            syncNext();
+        }
+    }
+
+    // Peers known, ourselves included
+    int size() const { return peers.size(); }
+    int syncWaiting() { return syncable.length(Clock::now()); }
+};
+}
+
+#endif  // PXMMEMBERSHIP_H
@@ -0,0 +1,151 @@
+#ifndef PXMMETRICS_H
+#define PXMMETRICS_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+#include <atomic>
+
+#include "pxmconsts.h"
+
+/*!
+ * Runtime metrics.
+ *
+ * Every metric is a global object that registers itself on construction,
+ * updating one is a relaxed atomic add so they can be bumped from any
+ * thread on the hot path.  render() produces the Prometheus text exposition
+ * format, the server thread hands it to anyone connecting to the unix
+ * socket named by MetricsSocket in the ini, e.g.
+ *
+ *   socat - UNIX-CONNECT:/run/user/1000/pxmessenger.sock > pxm.prom
+ *
+ * for the node_exporter textfile collector.
+ */
+namespace PXMMetrics
+{
+class Metric
+{
+   public:
+    enum Kind { COUNTER, GAUGE, HISTOGRAM };
+    // labels is either null or the inside of the braces, e.g. kind="name"
+    Metric(const char* name, const char* help, Kind kind, const char* labels = nullptr);
+    virtual ~Metric() {}
+    Metric(Metric const&) = delete;
+    Metric& operator=(Metric const&) = delete;
+
+    const char* const name;
+    const char* const help;
+    const Kind kind;
+    const char* const labels;
+
+    // Sample lines only, the HELP and TYPE header is written by render()
+    virtual void renderSamples(QByteArray& out) const = 0;
+};
+
+class Counter : public Metric
+{
+    std::atomic<quint64> value;
+
+   public:
+    Counter(const char* name, const char* help, const char* labels = nullptr);
+    void inc(quint64 n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    quint64 get() const { return value.load(std::memory_order_relaxed); }
+    void renderSamples(QByteArray& out) const Q_DECL_OVERRIDE;
+};
+
+class Gauge : public Metric
+{
+    std::atomic<qint64> value;
+
+   public:
+    Gauge(const char* name, const char* help, const char* labels = nullptr);
+    void set(qint64 n) { value.store(n, std::memory_order_relaxed); }
+    void add(qint64 n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    void sub(qint64 n = 1) { value.fetch_sub(n, std::memory_order_relaxed); }
+    qint64 get() const { return value.load(std::memory_order_relaxed); }
+    void renderSamples(QByteArray& out) const Q_DECL_OVERRIDE;
+};
+
+// Gauge or counter whose value is read when rendering
+class Callback : public Metric
+{
+    qint64 (*const read)();
+
+   public:
+    Callback(const char* name, const char* help, Kind kind, qint64 (*read)());
+    void renderSamples(QByteArray& out) const Q_DECL_OVERRIDE;
+};
+
+// One counter per message type, labelled type="..."
+class TypeCounter : public Metric
+{
+   public:
+    static const int TYPE_COUNT = 19;
+
+    TypeCounter(const char* name, const char* help);
+    void inc(uint32_t type, quint64 n = 1) { values[typeIndex(type)].fetch_add(n, std::memory_order_relaxed); }
+    void renderSamples(QByteArray& out) const Q_DECL_OVERRIDE;
+
+    static int typeIndex(uint32_t type);
+    static const char* typeName(int index);
+
+   private:
+    std::atomic<quint64> values[TYPE_COUNT];
+};
+
+/*!
+ * Power of two histogram, bucket i holds values up to 2^i so every le
+ * bound in the output is exact.  Only the buckets from 2^firstBit to
+ * 2^lastBit are written out, larger values only show up in +Inf.
+ */
+class Histogram : public Metric
+{
+   public:
+    static const int BUCKETS = 64;
+
+    Histogram(const char* name, const char* help, int firstBit, int lastBit);
+    void record(quint64 value);
+    void renderSamples(QByteArray& out) const Q_DECL_OVERRIDE;
+
+   private:
+    const int firstBit;
+    const int lastBit;
+    std::atomic<quint64> counts[BUCKETS];
+    std::atomic<quint64> total;
+    std::atomic<quint64> sum;
+};
+
+// Every registered metric followed by the message latency summaries
+QByteArray render();
+
+extern TypeCounter framesReceived;
+extern TypeCounter bytesReceived;
+extern TypeCounter framesSent;
+extern TypeCounter bytesSent;
+extern Histogram receivedFrameBytes;
+extern Counter connectionsAccepted;
+extern Counter connectionsOpened;
+extern Counter connectFailures;
+extern Counter disconnects;
+extern Gauge peersAuthenticated;
+extern Counter syncRounds;
+extern Counter discoverReceived;
+extern Counter nameReceived;
+extern Counter discoverSent;
+extern Counter nameSent;
+extern Gauge workerQueueMessages;
+extern Counter bufferAllocations;
+extern Counter malformedFrames;
+extern Counter localConnections;
+extern Counter transferBytesSent;
+extern Counter transferBytesReceived;
+extern Counter transfersCompleted;
+extern Counter transfersFailed;
+extern Counter blobCacheHits;
+extern Counter transferRedirects;
+extern Gauge blobCacheBytes;
+extern Gauge ringConnections;
+extern Counter ringSubmits;
+}
+
+#endif  // PXMMETRICS_H
@@ -0,0 +1,82 @@
+#ifndef PXMPEERLIST_H
+#define PXMPEERLIST_H
+
+#include <QAbstractListModel>
+#include <QSortFilterProxyModel>
+#include <QHash>
+#include <QTimer>
+#include <QUuid>
+#include <QVector>
+
+namespace PXMPeerList {
+enum Roles : int {
+  UuidRole = Qt::UserRole,
+  // 0 for Global Chat, 1 for the seperator, 2 for everyone else
+  PinRole = Qt::UserRole + 1
+};
+enum Pin : int { PIN_GLOBAL = 0, PIN_SEPERATOR = 1, PIN_PEER = 2 };
+
+/*!
+ * \brief The Model class
+ *
+ * Source model for the peer list.  Rows are never removed so the uuid to row
+ * index stays valid for the lifetime of the model.  Peers added through
+ * addPeer() are queued and inserted into the model in a single batch on the
+ * next pass through the event loop.
+ */
+class Model : public QAbstractListModel {
+  Q_OBJECT
+  struct PeerRow {
+    QUuid uuid;
+    QString hostname;
+    int pin;
+    int unread;
+    bool italic;
+    bool alert;
+  };
+  QVector<PeerRow> rows;
+  QHash<QUuid, int> index;
+  QTimer batchTimer;
+  int insertedRows;
+
+  void rowChanged(int row);
+
+ public:
+  Model(QUuid globalUuid, QObject* parent = nullptr);
+  int rowCount(const QModelIndex& parent = QModelIndex()) const Q_DECL_OVERRIDE;
+  QVariant data(const QModelIndex& index, int role) const Q_DECL_OVERRIDE;
+  Qt::ItemFlags flags(const QModelIndex& index) const Q_DECL_OVERRIDE;
+
+  bool contains(const QUuid& uuid) const { return index.contains(uuid); }
+  QString hostname(const QUuid& uuid) const;
+  void addPeer(const QUuid& uuid, const QString& hostname);
+  void setHostname(const QUuid& uuid, const QString& hostname);
+  // Returns false if the item was already in the requested state
+  bool setItalic(const QUuid& uuid, bool italic);
+  void setAlert(const QUuid& uuid, bool alert);
+  bool alert(const QUuid& uuid) const;
+  void setUnread(const QUuid& uuid, int count);
+  QModelIndex seperatorIndex() const { return createIndex(1, 0); }
+ public slots:
+  void flushPending();
+};
+
+/*!
+ * \brief The FilterProxy class
+ *
+ * Keeps Global Chat and the seperator pinned to the top, sorts the rest by
+ * hostname and filters them against the search box.  Dynamic sorting is left
+ * on so only rows reported through dataChanged() or rowsInserted() are moved.
+ */
+class FilterProxy : public QSortFilterProxyModel {
+  Q_OBJECT
+ public:
+  FilterProxy(QObject* parent = nullptr);
+
+ protected:
+  bool lessThan(const QModelIndex& left, const QModelIndex& right) const Q_DECL_OVERRIDE;
+  bool filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const Q_DECL_OVERRIDE;
+};
+}
+
+#endif  // PXMPEERLIST_H
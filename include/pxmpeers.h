@@ -73,6 +73,8 @@ class PeerData {
   evutil_socket_t socket;
   bool connectTo;
   bool isAuthed;
+  // Set CAPABILITY_STAMPS in its MSG_CAPABILITIES
+  bool latencyStamps;
 
   // Default Constructor
   PeerData();
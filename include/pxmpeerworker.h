@@ -7,6 +7,7 @@
 #include <event2/bufferevent.h>
 
 #include "pxmpeers.h"
+#include "pxmsearch.h"
 #include "pxmconsts.h"
 
 class PXMPeerWorkerPrivate;
@@ -23,14 +24,22 @@ class PXMPeerWorker : public QObject
                            QString multicast,
                            unsigned short tcpPort,
                            unsigned short udpPort,
-                           QUuid globaluuid);
+                           QUuid globaluuid,
+                           QString historyDirectory = QString());
     ~PXMPeerWorker();
+    // Stamp outgoing messages for peers that understand it, see pxmlatency.h
+    void setLatencyStamps(bool enabled);
+    // Passed on to the server thread, see PXMMetrics
+    void setMetricsSocket(QString path);
+    void setLocalTransport(bool enabled);
+    // TCP on io_uring where built in and available, see pxmuring.h
+    void setIoUring(bool enabled);
+    // Where received files are kept, see pxmblobcache.h.  Empty for none
+    void setBlobCache(QString directory, qint64 capBytes);
     PXMPeerWorker(PXMPeerWorker const&) = delete;
     PXMPeerWorker& operator=(PXMPeerWorker const&) = delete;
     PXMPeerWorker& operator=(PXMPeerWorker&&) noexcept = delete;
     PXMPeerWorker(PXMPeerWorker&&) noexcept            = delete;
-    const int SYNC_TIMEOUT_MSECS                = 2000;
-    const int SYNC_TIMER                        = 900000;
    public slots:
     void setListenerPorts(unsigned short tcpport, unsigned short udpport);
     void syncPacketIterator(QSharedPointer<unsigned char> syncPacket, size_t len, QUuid senderUuid);
@@ -44,7 +53,7 @@ class PXMPeerWorker : public QObject
     void newIncomingConnection(bufferevent* bev);
     void peerQuit(evutil_socket_t s, bufferevent* bev);
     void peerNameChange(QString hname, QUuid uuid);
-    void sendSyncPacket(QSharedPointer<Peers::BevWrapper> bw, QUuid uuid);
+    void peerCapabilities(QUuid uuid, quint32 flags);
     void sendSyncPacketBev(const bufferevent *bev, QUuid uuid);
     void resultOfConnectionAttempt(evutil_socket_t socket, bool result,
                                    bufferevent* bev, QUuid uuid);
@@ -55,29 +64,44 @@ class PXMPeerWorker : public QObject
     void printInfoToDebug();
     void setlibeventBackend(QString str);
     int recieveServerMessage(QString str, QUuid uuid, const bufferevent* bev,
-                             bool global);
+                             bool global, qint64 parsedMicros);
     void addMessageToAllPeers(QString str, bool alert, bool formatAsMessage);
-    void printFullHistory(QUuid uuid);
+    void requestHistoryPage(QUuid uuid, PXMHistory::Cursor before, int count);
     void sendMsgAccessor(QByteArray msg, PXMConsts::MESSAGE_TYPE type,
                          QUuid uuid = QUuid());
-    void setSelfCommsBufferevent(bufferevent* bev);
     void multicastIsFunctional();
     void serverSetupFailure(QString error);
     void setLocalHostname(QString);
     void sendUDPAccessor(const char* msg);
     void setInternalBufferevent(bufferevent* bev);
+    void searchHistory(QString query);
+    // File transfers, see pxmtransfer.h
+    void offerFile(QString path, QUuid uuid);
+    // An empty path declines the offer
+    void answerOffer(QUuid id, QString path);
+    void transferMessage(QUuid uuid, const bufferevent* bev, PXMConsts::MESSAGE_TYPE type, QByteArray payload);
+    void transferConnection(bufferevent* bev, QUuid id, QUuid uuid);
+    void transferStreamProgress(QUuid id, qint64 done, qint64 size);
+    void transferStreamFinished(QUuid id, bool ok);
 
     // void restartServer();
    private slots:
-    void beginSync();
-    void doneSync();
-    void requestSyncPacket(QSharedPointer<Peers::BevWrapper> bw, QUuid uuid);
-    void discoveryTimerSingleShot();
+    void discoveryTimerFired();
     void midnightTimerPersistent();
-    void discoveryTimerPersistent();
+    void indexResults(QString query, QVector<PXMSearch::Hit> hits);
+    void fileHashed(QUuid id, QByteArray hash);
+    void fileCopied(QUuid id, bool ok);
    signals:
-    void printToTextBrowser(QSharedPointer<QString>, QUuid, bool);
-    void updateListWidget(QUuid, QString);
+    /*!
+     * \brief messageAdded
+     *
+     * A formatted message was added to a conversation.  workerMicros is
+     * PXMLatency::monotonicMicros() when a received message reached the
+     * worker, 0 for anything else.
+     */
+    void messageAdded(QSharedPointer<QString> msg, QUuid uuid, bool alert, qint64 workerMicros);
+    // A peer appeared or changed its name
+    void peerNameChanged(QUuid uuid, QString hostname);
     void sendMsg(QSharedPointer<Peers::BevWrapper>, QByteArray,
                  PXMConsts::MESSAGE_TYPE, QUuid = QUuid());
     void sendUDP(const char*, unsigned short);
@@ -85,11 +109,22 @@ class PXMPeerWorker : public QObject
                        PXMConsts::MESSAGE_TYPE, QUuid = QUuid());
     //void connectToPeer(evutil_socket_t, struct sockaddr_in,
     //                   QSharedPointer<Peers::BevWrapper>);
-    void updateMessServFDS(evutil_socket_t);
-    void setItalicsOnItem(QUuid, bool);
-    void ipsReceivedFrom(QUuid);
-    void warnBox(QString, QString);
-    void fullHistory(QLinkedList<QString*>, QUuid);
+    void peerDisconnected(QUuid uuid);
+    // The server is up, with the ports it ended up on
+    void listening(unsigned short tcpPort, unsigned short udpPort);
+    // Something the user should know about, e.g. the network is unusable
+    void warning(QString title, QString text);
+    void historyPage(QUuid, QStringList, PXMHistory::Cursor, bool);
+    void indexMessage(QString, qint64, quint32, quint32, QString);
+    void searchIndex(QString);
+    void searchResults(QString, QStringList);
+    // To the PXMBlobCache::Hasher
+    void hashFile(QUuid, QString, QByteArray, QString);
+    void copyFile(QUuid, QString, QString);
+    // A peer wants to send us a file, answer with answerOffer()
+    void fileOffered(QUuid id, QUuid uuid, QString hostname, QString name, qint64 size);
+    void transferProgress(QUuid id, QString description, qint64 done, qint64 size);
+    void transferFinished(QUuid id, bool ok, QString description);
 };
 
 #endif
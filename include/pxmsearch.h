@@ -0,0 +1,97 @@
+#ifndef PXMSEARCH_H
+#define PXMSEARCH_H
+
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "pxmhistory.h"
+
+/*!
+ * Full text search over the message history.
+ *
+ * Every message becomes a document, without the sender and time of day
+ * header so those do not match every message in a conversation.  Terms are
+ * lower cased runs of letters and digits with html tags skipped.  Each term
+ * keeps a postings list of
+ *
+ *   varint(doc - previous doc) varint(position count) varint(position delta)...
+ *
+ * so memory grows with the number of distinct (term, message) pairs rather
+ * than the size of the text.  Terms are kept sorted for prefix queries.
+ *
+ * A query is a space separated list of terms that must all match.  A term
+ * ending in '*' matches any term with that prefix and text in double quotes
+ * must appear as a phrase.
+ */
+namespace PXMSearch
+{
+const int MAX_RESULTS = 50;
+
+struct Hit {
+    QString conversation;
+    qint64 msecs;
+    PXMHistory::Cursor position;
+};
+
+class Index
+{
+    struct Doc {
+        int conversation;
+        qint64 msecs;
+        PXMHistory::Cursor position;
+    };
+    struct Postings {
+        QByteArray data;
+        quint32 lastDoc = 0;
+        quint32 docCount = 0;
+    };
+    QMap<QString, Postings> terms;
+    QVector<Doc> docs;
+    QStringList conversations;
+    QHash<QString, int> conversationIds;
+
+    QVector<quint32> docsForTerm(const QString& term) const;
+    QVector<quint32> docsForPrefix(const QString& prefix) const;
+    QVector<quint32> docsForPhrase(const QStringList& words) const;
+    QHash<quint32, QVector<quint32>> positionsForTerm(const QString& term, const QVector<quint32>& wanted) const;
+
+   public:
+    static QStringList tokenize(const QString& text);
+    void add(const QString& conversation, qint64 msecs, PXMHistory::Cursor position, const QString& text);
+    QVector<Hit> search(const QString& query, int limit = MAX_RESULTS) const;
+    int documentCount() const { return docs.size(); }
+    int termCount() const { return terms.size(); }
+};
+
+/*!
+ * \brief The Indexer class
+ *
+ * Owns an Index on its own thread.  On start it indexes everything already
+ * in the history directory, after that it indexes whatever it is handed
+ * through addMessage().
+ */
+class Indexer : public QObject
+{
+    Q_OBJECT
+    Index index;
+    QString directory;
+    QHash<QString, PXMHistory::Cursor> backfilled;
+
+   public:
+    Indexer(QString historyDirectory, QObject* parent = nullptr);
+   public slots:
+    void backfill();
+    void addMessage(QString conversation, qint64 msecs, quint32 segment, quint32 offset, QString text);
+    void search(QString query);
+   signals:
+    void searchResults(QString, QVector<PXMSearch::Hit>);
+};
+}
+
+Q_DECLARE_METATYPE(QVector<PXMSearch::Hit>)
+
+#endif  // PXMSEARCH_H
@@ -1,6 +1,8 @@
 #ifndef PXMSERVER_H
 #define PXMSERVER_H
 
+#include <QByteArray>
+#include <QString>
 #include <QThread>
 #include <QUuid>
 #include <QScopedPointer>
@@ -10,6 +12,8 @@
 
 #include <event2/util.h>
 
+#include "pxmconsts.h"
+
 struct bufferevent;
 struct event_base;
 class ServerThreadPrivate;
@@ -19,13 +23,27 @@ namespace PXMServer
 const timeval READ_TIMEOUT         = {1, 0};
 const timeval READ_TIMEOUT_RESET   = {3600, 0};
 const uint8_t PACKET_HEADER_LEN = 2;
+// Chat and everything else gets the middle of three event priorities, file
+// transfer connections the lowest
+const int EVENT_PRIORITIES = 3;
+const int BULK_PRIORITY    = 2;
 enum INTERNAL_MSG : uint16_t {
-    ADD_DEFAULT_BEV = 0x1111,
-    EXIT            = 0x2222,
-    CONNECT_TO_ADDR = 0x3333,
-    TCP_PORT_CHANGE = 0x8888,  // Under Construction
-    UDP_PORT_CHANGE = 0x9999   // Under Construction
+    ADD_DEFAULT_BEV  = 0x1111,
+    EXIT             = 0x2222,
+    CONNECT_TO_ADDR  = 0x3333,
+    TRANSFER_SEND    = 0x4444,  // [id][peer record][fd][size]
+    TRANSFER_RECEIVE = 0x5555,  // [bufferevent*][fd][size][id], fd -1 closes it
+    TCP_PORT_CHANGE  = 0x8888,  // Under Construction
+    UDP_PORT_CHANGE  = 0x9999   // Under Construction
+};
+// Flags byte after the uuid in a /name: reply, older clients stop reading
+// before it and send none
+enum NAME_FLAGS : uint8_t {
+    NAME_LOCAL_TRANSPORT = 0x01  // listening on localSocketPath()
 };
+// Where the instance with this uuid takes same host connections, empty
+// where there are no unix domain sockets
+QString localSocketPath(const QUuid& uuid);
 class ServerThread : public QThread
 {
     Q_OBJECT
@@ -50,9 +68,17 @@ class ServerThread : public QThread
     // Destructor
     ~ServerThread();
 
+    // Unix socket to serve PXMMetrics on, empty for none.  Call before start()
+    void setMetricsSocket(QString path);
+    // Take and prefer unix domain socket connections to instances on this
+    // host.  Call before start()
+    void setLocalTransport(bool enabled);
+    // Move TCP onto io_uring when built with it and the kernel allows,
+    // libevent carries it otherwise.  Call before start()
+    void setIoUring(bool enabled);
     void run() Q_DECL_OVERRIDE;
    signals:
-    void messageRecieved(QString, QUuid, const bufferevent*, bool);
+    void messageRecieved(QString, QUuid, const bufferevent*, bool, qint64);
     void newTCPConnection(bufferevent*);
     void authenticationReceived(QString, unsigned short, QString,
                                 evutil_socket_t, QUuid, bufferevent*);
@@ -66,11 +92,18 @@ class ServerThread : public QThread
     void setListenerPorts(unsigned short, unsigned short);
     void libeventBackend(QString);
     void setCloseBufferevent(bufferevent*);
-    void setSelfCommsBufferevent(bufferevent*);
     void multicastIsFunctional();
     void serverSetupFailure(QString);
     void nameChange(QString, QUuid);
+    // CAPABILITY_ flags from a peer's MSG_CAPABILITIES
+    void capabilitiesReceived(QUuid, quint32);
     void resultOfConnectionAttempt(evutil_socket_t, bool, bufferevent*, QUuid);
+    // File transfers, see pxmtransfer.h
+    void transferMessage(QUuid, const bufferevent*, PXMConsts::MESSAGE_TYPE, QByteArray);
+    // A bulk connection for transfer id, waiting for a TRANSFER_RECEIVE
+    void transferConnection(bufferevent*, QUuid, QUuid);
+    void transferProgress(QUuid, qint64, qint64);
+    void transferFinished(QUuid, bool);
 };
 }
 
@@ -6,6 +6,11 @@
 #include <QUuid>
 #include <QWidget>
 #include <QLabel>
+#include <QHash>
+#include <QLinkedList>
+#include <QStringList>
+
+#include "pxmhistory.h"
 
 namespace PXMMessageViewer {
 // subclass this to allow the stackwidget to search for it by uuid
@@ -22,19 +27,70 @@ class LabelWidget : public QLabel, public MVBase {
   LabelWidget(QWidget* parent, const QUuid& uuid);
 };
 
+// History is shown a page at a time.  A new TextWidget asks for the most
+// recent page and asks for the next older one whenever it is scrolled to the
+// top, so opening a conversation costs the same however long it is.  While
+// the pages shown are too short to need a scroll bar it keeps asking.
 class TextWidget : public QTextBrowser, public MVBase {
   Q_OBJECT
+  PXMHistory::Cursor older;
+  bool moreHistory;
+  bool loading;
+
  public:
-  TextWidget(QWidget* parent, const QUuid& uuid)
-      : QTextBrowser(parent), MVBase(uuid) {}
+  TextWidget(QWidget* parent, const QUuid& uuid);
+  bool awaitingFirstPage() const { return loading && older.isNull(); }
+  void requestPage();
+  /*!
+   * \brief addPage
+   *
+   * Puts a page of messages, oldest first, above what is already shown
+   * without moving the visible text.
+   */
+  void addPage(const QStringList& page, PXMHistory::Cursor next, bool more);
+
+ protected:
+  void showEvent(QShowEvent* event) override;
+  void resizeEvent(QResizeEvent* event) override;
+ private slots:
+  void fillViewport();
+  void scrolled(int value);
+ signals:
+  void historyRequested(QUuid, PXMHistory::Cursor, int);
 };
 
+// Conversations that have never been opened do not get a TextWidget.  Their
+// messages are held in a buffer capped at MESSAGE_HISTORY_LENGTH until the
+// page is created by switchToUuid() or createPage().  Once created the
+// buffer is kept until the first history page arrives, that page already
+// holds everything that was buffered.
 class StackedWidget : public QStackedWidget {
   Q_OBJECT
+  struct PendingConversation {
+    QLinkedList<QString> messages;
+  };
+  QHash<QUuid, TextWidget*> pages;
+  QHash<QUuid, PendingConversation> pending;
+  QHash<QUuid, int> unread;
+
  public:
   StackedWidget(QWidget* parent);
   int append(QString str, QUuid& uuid);
   int switchToUuid(QUuid& uuid);
+  /*!
+   * \brief createPage
+   *
+   * Returns the TextWidget for uuid, creating it and flushing any buffered
+   * messages into it if it does not exist yet.
+   */
+  TextWidget* createPage(const QUuid& uuid);
+  bool hasPage(const QUuid& uuid) const { return pages.contains(uuid); }
+  int unreadCount(const QUuid& uuid) const { return unread.value(uuid, 0); }
+  QUuid currentUuid() const;
+ public slots:
+  void historyPage(QUuid uuid, QStringList page, PXMHistory::Cursor next, bool more);
+ signals:
+  void historyRequested(QUuid, PXMHistory::Cursor, int);
 };
 }
 
@@ -0,0 +1,79 @@
+#ifndef PXMTRACE_H
+#define PXMTRACE_H
+
+#include <QString>
+#include <QtGlobal>
+
+class QObject;
+
+/*!
+ * Binary tracing of the message pipeline.
+ *
+ * Every thread that hits a trace point gets its own ring of RING_EVENTS
+ * fixed size events, so recording one is a clock read and four stores with
+ * no locking.  Names must be string literals, only the pointer is kept.
+ * Old events are overwritten, the rings always hold the most recent history
+ * of each thread.
+ *
+ * dump() writes all rings as Chrome trace JSON, it can be opened in
+ * chrome://tracing or ui.perfetto.dev.  It is reachable from the debug
+ * console and, on unix, by sending SIGUSR1 to the process.  Events being
+ * written while a dump runs may come out torn, good enough for a post
+ * mortem.
+ *
+ * Define PXM_NO_TRACE to compile the trace points out.
+ */
+namespace PXMTrace
+{
+const int RING_EVENTS = 16384;
+
+void record(const char* name, char phase, quint64 arg = 0);
+void setEnabled(bool enabled);
+bool isEnabled();
+/*!
+ * \brief dump
+ *
+ * Writes every ring to path as Chrome trace JSON.
+ * \return true on success
+ */
+bool dump(const QString& path);
+// Somewhere in the temp directory, unique per call
+QString defaultDumpPath();
+/*!
+ * \brief installDumpSignal
+ *
+ * Dump to defaultDumpPath() whenever SIGUSR1 arrives.  The handler only
+ * writes to a pipe, the dump happens on the thread parent lives in.
+ * Does nothing on Windows.
+ */
+void installDumpSignal(QObject* parent);
+
+class Scope
+{
+    const char* name;
+
+   public:
+    Scope(const char* name, quint64 arg = 0) : name(name) { record(name, 'B', arg); }
+    ~Scope() { record(name, 'E'); }
+    Scope(Scope const&) = delete;
+    Scope& operator=(Scope const&) = delete;
+};
+}
+
+#define PXM_TRACE_CONCAT_(a, b) a##b
+#define PXM_TRACE_CONCAT(a, b) PXM_TRACE_CONCAT_(a, b)
+
+#ifdef PXM_NO_TRACE
+#define PXM_TRACE_SCOPE(name)
+#define PXM_TRACE_SCOPE_ARG(name, arg)
+#define PXM_TRACE_INSTANT(name, arg)
+#else
+// Duration event covering the rest of the enclosing block
+#define PXM_TRACE_SCOPE(name) PXMTrace::Scope PXM_TRACE_CONCAT(pxmTraceScope, __LINE__)(name)
+// The same with a number shown on the begin event
+#define PXM_TRACE_SCOPE_ARG(name, arg) \
+    PXMTrace::Scope PXM_TRACE_CONCAT(pxmTraceScope, __LINE__)(name, static_cast<quint64>(arg))
+#define PXM_TRACE_INSTANT(name, arg) PXMTrace::record(name, 'i', arg)
+#endif
+
+#endif  // PXMTRACE_H
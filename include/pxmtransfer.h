@@ -0,0 +1,146 @@
+#ifndef PXMTRANSFER_H
+#define PXMTRANSFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <QByteArray>
+#include <QString>
+#include <QUuid>
+
+#include "netcompression.h"
+#include "pxmblobcache.h"
+
+struct evbuffer;
+
+/*!
+ * File transfers.
+ *
+ * The offer, accept and cancel messages travel over the normal peer
+ * connection:
+ *
+ *   MSG_FILE_OFFER    [16B transfer id][8B size][32B SHA-256][file name, UTF-8]
+ *   MSG_FILE_ACCEPT   [16B transfer id]
+ *   MSG_FILE_CANCEL   [16B transfer id]
+ *   MSG_FILE_HAVE     [16B transfer id]
+ *   MSG_FILE_REDIRECT [16B transfer id][16B uuid of a peer with the file]
+ *   MSG_FILE_PULL     [16B transfer id][32B SHA-256][8B size]
+ *
+ * Once an offer is accepted the sender opens a second connection to the
+ * receiver's listener and sends a MSG_FILE_STREAM frame holding the
+ * transfer id in place of the auth packet.  The file follows as raw bytes
+ * and the connection is closed once the whole file is in.
+ *
+ * The sender queues the file in CHUNK_BYTES ranges with evbuffer_add_file,
+ * which goes through sendfile where there is one.  The receiver writes
+ * straight from libevent's buffers into a file that was preallocated when
+ * the offer was accepted.  Those writes block, so they go WRITE_SLICE_BYTES
+ * at a time with the rest of the event loop run in between.  Neither side
+ * keeps more than a couple of chunks in memory whatever the size of the
+ * file, and the bulk connections run at a lower event priority than chat.
+ *
+ * Files are identified by their hash so nobody receives the same content
+ * twice, see pxmblobcache.h.  A receiver that already has it answers an
+ * offer with MSG_FILE_HAVE in place of MSG_FILE_ACCEPT.  A sender already
+ * streaming MAX_UPLOADS_PER_FILE copies of a file answers further accepts
+ * with MSG_FILE_REDIRECT to a peer that received it earlier, or holds them
+ * until one has.  The receiver then sends that peer MSG_FILE_PULL and it
+ * streams the file from its cache under the same transfer id, the receiver
+ * checks the hash and reports MSG_FILE_HAVE to the sender.  Should the
+ * other peer not have it any more, or what arrives not match, the receiver
+ * goes back to the sender with another MSG_FILE_ACCEPT and gets it from
+ * there.  Sending a file to everyone costs the sender a few copies and the
+ * rest spreads from peer to peer.
+ */
+namespace PXMTransfer
+{
+// File range queued per evbuffer_add_file
+const qint64 CHUNK_BYTES = 1 << 20;
+// Most the sender keeps queued on the bulk connection
+const qint64 SEND_BUFFER_BYTES = 2 * CHUNK_BYTES;
+// Read high watermark on the receiving end
+const size_t RECEIVE_BUFFER_BYTES = 256 * 1024;
+// Most the receiving end writes to the file per event loop pass
+const size_t WRITE_SLICE_BYTES = 64 * 1024;
+// A bulk connection moving nothing for this long is given up on
+const int STALL_TIMEOUT_SECS = 30;
+// Longest file name offered, in UTF-8 bytes
+const size_t MAX_NAME_BYTES = 255;
+// Streams of one file the sender runs at once before redirecting
+const int MAX_UPLOADS_PER_FILE = 2;
+const size_t OFFER_HEADER_LENGTH =
+    NetCompression::PACKED_UUID_LENGTH + sizeof(uint64_t) + PXMBlobCache::HASH_BYTES;
+const size_t REDIRECT_LENGTH = 2 * NetCompression::PACKED_UUID_LENGTH;
+const size_t PULL_LENGTH     = NetCompression::PACKED_UUID_LENGTH + PXMBlobCache::HASH_BYTES + sizeof(uint64_t);
+
+enum State {
+    HASHING,     // Outgoing, offer goes out once the hash is known
+    OFFERED,
+    QUEUED,      // Outgoing, accepted and waiting for an upload or a peer to redirect to
+    ACCEPTED,    // Incoming, waiting for the stream from source
+    REDIRECTED,  // Outgoing, the receiver is pulling it from source
+    STREAMING,
+    COPYING,     // Incoming, copying out of the cache
+    VERIFYING    // Incoming, checking what arrived against the hash
+};
+
+// A transfer as the worker tracks it, in either direction
+struct Transfer {
+    QUuid id;
+    QUuid peer;
+    QString name;
+    // File being sent, or where an accepted one is written
+    QString path;
+    QByteArray hash;
+    // Incoming, the peer streaming it to us.  Outgoing, the peer a
+    // REDIRECTED receiver was sent to
+    QUuid source;
+    qint64 size   = 0;
+    bool outgoing = false;
+    // Streaming a cached file for someone else's offer
+    bool relay  = false;
+    State state = OFFERED;
+    // Open file, held from accepting an offer until the stream takes it
+    int fd = -1;
+};
+
+QByteArray packOffer(const QUuid& id, qint64 size, const QByteArray& hash, const QString& name);
+/*!
+ * \brief unpackOffer reads an MSG_FILE_OFFER payload
+ *
+ * Any directory part of the name is dropped, the result is only ever
+ * used as a suggestion for where to save.
+ * \return false for a short payload, a null id, a malformed or empty name
+ */
+bool unpackOffer(const unsigned char* buf, size_t len, QUuid& id, qint64& size, QByteArray& hash, QString& name);
+QByteArray packRedirect(const QUuid& id, const QUuid& holder);
+QByteArray packPull(const QUuid& id, const QByteArray& hash, qint64 size);
+// false for a short payload or a null id
+bool unpackPull(const unsigned char* buf, size_t len, QUuid& id, QByteArray& hash, qint64& size);
+
+// Opens path for reading, size is set to its length. -1 on failure
+int openForSend(const QString& path, qint64& size);
+// Creates or truncates path and reserves size bytes for it. -1 on failure
+int openForReceive(const QString& path, qint64 size);
+void closeFile(int fd);
+
+/*!
+ * \brief addChunk queues length bytes of fd from offset on output
+ *
+ * evbuffer_add_file closes the descriptor it is handed once the range is
+ * sent, each chunk gets a duplicate of fd.
+ */
+bool addChunk(evbuffer* output, int fd, qint64 offset, qint64 length);
+/*!
+ * \brief writeOut writes the first len bytes of input to fd and drains them
+ *
+ * Straight from the buffer chains, nothing is copied on the way.
+ * \return false if the file could not be written
+ */
+bool writeOut(evbuffer* input, int fd, size_t len);
+
+// e.g. "3.2 MiB"
+QString sizeString(qint64 bytes);
+}
+
+#endif  // PXMTRANSFER_H
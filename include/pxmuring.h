@@ -0,0 +1,92 @@
+#ifndef PXMURING_H
+#define PXMURING_H
+
+#include <QScopedPointer>
+
+#include <event2/util.h>
+
+struct bufferevent;
+struct event_base;
+
+/*!
+ * io_uring transport for the TCP data path, built with CONFIG+=pxm_uring.
+ *
+ * libevent's readiness model costs an epoll_wait and a read for every
+ * readable socket and a write for every send.  With the ring, listeners
+ * are served by multishot accepts and every connection by one multishot
+ * recv that picks its buffers from a provided buffer ring, so data arrives
+ * without a syscall per read.  Sends are queued as chains of linked
+ * IORING_OP_SENDs straight from the outgoing evbuffer, and everything
+ * queued during one pass of the event loop goes to the kernel in a single
+ * io_uring_enter.  While readers keep up received data is not copied, the
+ * receive buffer itself is lent to the bufferevent and goes back to the
+ * ring once drained.  Completions wake the libevent loop through an eventfd,
+ * so UDP, timers and the metrics socket stay on libevent as before.
+ *
+ * The rest of the core keeps talking to bufferevents: a connection on the
+ * ring is one end of a bufferevent pair, the ring pumps the socket into
+ * and out of the other end.  The socket itself is dup()ed, the caller gets
+ * the original descriptor for getpeername and closes it as usual, the ring
+ * sends what is left and closes its copy once the caller's end has been
+ * freed.
+ *
+ * Needs Linux 6.0 for multishot recv.  start() probes for everything used,
+ * multishot recv by trying one, and fails on older kernels or where
+ * io_uring is blocked, the server then stays on libevent.
+ */
+namespace PXMUring
+{
+// Provided buffers for recv, shared by every connection
+const int RECV_BUFFERS           = 256;
+const unsigned RECV_BUFFER_BYTES = 16 * 1024;
+// Received data is copied out instead once this many buffers are held by
+// readers, so a few slow ones can not starve the rest
+const int RECV_BUFFERS_LENT      = RECV_BUFFERS / 2;
+// recv stops while this much is waiting for the reading end to take it
+const size_t RECV_BACKLOG_BYTES = 1024 * 1024;
+// Longest chain of linked sends, one per evbuffer chain
+const int SEND_CHAIN_MAX = 16;
+const int QUEUE_ENTRIES  = 512;
+// How often connections whose other end was freed are closed
+const int SWEEP_MSECS = 100;
+// How long data written before that gets to go out
+const int LINGER_MSECS = 5000;
+
+// New connection from a listener, bev is the end to use
+typedef void (*AcceptCallback)(bufferevent* bev, bool local, void* arg);
+
+struct RingPrivate;
+class Ring
+{
+    QScopedPointer<RingPrivate> d_ptr;
+
+   public:
+    Ring(event_base* base);
+    ~Ring();
+    Ring(Ring const&) = delete;
+    Ring& operator=(Ring const&) = delete;
+
+    // Sets up the ring, false if io_uring can not be used here, the reason
+    // is logged
+    bool start();
+    // Takes over accepting on a listening socket
+    bool listen(evutil_socket_t fd, bool local, AcceptCallback callback, void* arg);
+    /*!
+     * \brief adopt
+     *
+     * Moves a connected socket onto the ring.
+     * \return The bufferevent to use for it from now on, null on failure
+     * in which case fd is untouched
+     */
+    bufferevent* adopt(evutil_socket_t fd);
+    // bufferevent_priority_set() does nothing for the pair ends handed out,
+    // this runs the ring's work for that connection at priority instead
+    bool setPriority(bufferevent* bev, int priority);
+    // The socket behind a bufferevent from adopt() or an accept, -1 for
+    // any other bufferevent
+    evutil_socket_t socketOf(const bufferevent* bev) const;
+    int connections() const;
+};
+}
+
+#endif  // PXMURING_H
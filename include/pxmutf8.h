@@ -0,0 +1,34 @@
+#ifndef PXMUTF8_H
+#define PXMUTF8_H
+
+#include <stddef.h>
+
+#include <QString>
+
+/*!
+ * UTF-8 checks for text arriving from peers.
+ *
+ * Payloads are validated before anything is built from them and decoded
+ * to UTF-16 once.  Runs of ASCII, most of any chat message, are skipped
+ * 16 bytes at a time with SSE2 or 8 at a time without, only the bytes
+ * around a multibyte sequence go through the scalar checks.
+ *
+ * Well formed means RFC 3629: no overlong forms, no surrogates, nothing
+ * past U+10FFFF and no truncated sequences.
+ */
+namespace PXMUtf8
+{
+// Length of the leading run of bytes below 0x80
+size_t asciiPrefix(const unsigned char* buf, size_t len);
+
+bool isValid(const unsigned char* buf, size_t len);
+
+/*!
+ * \brief decode validates buf and converts it to UTF-16
+ * \param ok set to false for malformed input
+ * \return the text, or a null QString if buf was malformed
+ */
+QString decode(const unsigned char* buf, size_t len, bool* ok = nullptr);
+}
+
+#endif  // PXMUTF8_H
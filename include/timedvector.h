@@ -1,104 +1,205 @@
 #ifndef TIMEDVECTOR_H
 #define TIMEDVECTOR_H
-#include <QUuid>
+#include <QHash>
 #include <QVector>
-#include <QTimer>
-#include <QTime>
+
+#include "pxmclock.h"
 
 enum Time_Format : unsigned int { MSECONDS = 1, SECONDS = 1000 };
 
+/*!
+ * Set whose items expire a fixed time after they were last appended.
+ *
+ * Membership is an open addressing hash table with linear probing, expiry
+ * a ring of (item, expiry) in append order.  Every item lives equally long
+ * so append order is expiry order and the ring works as a timer wheel with
+ * a single slot per tick: expiring is popping from the front while the
+ * front is due.  Appending an item again or removing it leaves its old
+ * ring entry behind, those are recognised by their expiry no longer
+ * matching the table and skipped when they come up.
+ *
+ * append, contains, remove and expiry are amortized O(1).  Both tables
+ * are flat QVectors that grow by doubling, so nothing is allocated per
+ * item.  Time is monotonic milliseconds, every call has an overload taking
+ * the current time for callers that already have it.
+ */
 template <class T>
 class TimedVector
 {
-    struct TimedStruct {
-        T* t;
-        qint64 epoch;
-
-        TimedStruct() : t(new T()) {}
-        TimedStruct(T t1) : t(new T(t1)), epoch(QDateTime::currentMSecsSinceEpoch()) {}
-        ~TimedStruct() noexcept { delete t; }
-        TimedStruct(TimedStruct&& v) noexcept : t(v.t), epoch(v.epoch) { v.t = nullptr; }
-        TimedStruct(const TimedStruct& v) : t(new T(*(v.t))), epoch(v.epoch) {}
-        TimedStruct& operator=(const TimedStruct& v)
-        {
-            TimedStruct tmp(v);
-            *this = std::move(tmp);
-            return *this;
-        }
+    struct Slot {
+        T t;
+        qint64 expiry;
+        bool used;
+        Slot() : t(), expiry(0), used(false) {}
+    };
+    struct Entry {
+        T t;
+        qint64 expiry;
+        Entry() : t(), expiry(0) {}
+        Entry(const T& t, qint64 expiry) : t(t), expiry(expiry) {}
+    };
+    static const int MIN_CAPACITY = 16;
 
-        TimedStruct& operator=(TimedStruct&& v) noexcept
-        {
-            delete t;
-            t     = v.t;
-            v.t   = nullptr;
-            epoch = v.epoch;
-            return *this;
-        }
+    QVector<Slot> table;
+    int used;
+    QVector<Entry> ring;
+    int head;
+    int count;
+    qint64 ItemLifeMsecs;
 
-        inline bool operator==(TimedStruct v) { return (*v.t == *t && v.epoch == epoch); }
-    };
-    QVector<TimedStruct> rawVector;
-    unsigned int ItemLifeMsecs;
+    int home(const T& t) const { return static_cast<int>(qHash(t) & static_cast<uint>(table.size() - 1)); }
 
-   public:
-    TimedVector(unsigned int itemLife, Time_Format format) : ItemLifeMsecs(itemLife * format) {}
-    ~TimedVector() {}
-    TimedVector(const TimedVector& tv) : ItemLifeMsecs(tv.ItemLifeMsecs)
+    int find(const T& t) const
     {
-        for (TimedStruct itr : tv.rawVector) {
-            rawVector.append(TimedStruct(itr));
+        if (table.isEmpty()) {
+            return -1;
+        }
+        int mask = table.size() - 1;
+        for (int i = home(t);; i = (i + 1) & mask) {
+            const Slot& slot = table.at(i);
+            if (!slot.used) {
+                return -1;
+            }
+            if (slot.t == t) {
+                return i;
+            }
         }
     }
 
-    // TimedVector(TimedVector&& tv) noexcept {}
+    void insertSlot(const T& t, qint64 expiry)
+    {
+        // Keep the load under a half so probes stay short
+        if ((used + 1) * 2 > table.size()) {
+            rehash(qMax<int>(MIN_CAPACITY, table.size() * 2));
+        }
+        int mask = table.size() - 1;
+        int i    = home(t);
+        while (table.at(i).used) {
+            i = (i + 1) & mask;
+        }
+        Slot& slot  = table[i];
+        slot.t      = t;
+        slot.expiry = expiry;
+        slot.used   = true;
+        used++;
+    }
 
-    inline void append(const T t) { rawVector.append(TimedStruct(t)); }
-    bool contains(T t)
+    // Backward shift deletion, no tombstones to clean up later
+    void eraseSlot(int i)
     {
-        if (rawVector.isEmpty())
-            return false;
-
-        for (TimedStruct itr : rawVector) {
-            if (*(itr.t) == t) {
-                if (itr.epoch + ItemLifeMsecs > QDateTime::currentMSecsSinceEpoch())
-                    return true;
-                else {
-                    rawVector.takeAt(rawVector.indexOf(itr));
-                    return false;
-                }
+        int mask = table.size() - 1;
+        int j    = i;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (!table.at(j).used) {
+                break;
+            }
+            int k = home(table.at(j).t);
+            // Slot j may only move back if its home is not in (i, j]
+            bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stays) {
+                table[i] = table.at(j);
+                i        = j;
             }
         }
-        return false;
+        table[i] = Slot();
+        used--;
     }
 
-    int length()
+    void rehash(int capacity)
     {
-        pruneItems();
-        return rawVector.length();
+        QVector<Slot> old = table;
+        table             = QVector<Slot>(capacity);
+        used              = 0;
+        for (const Slot& slot : old) {
+            if (slot.used) {
+                insertSlot(slot.t, slot.expiry);
+            }
+        }
     }
 
-    int pruneItems()
+    void push(const T& t, qint64 expiry)
     {
-        int count = 0;
-        for (TimedVector::TimedStruct itr : rawVector) {
-            if (itr.epoch + ItemLifeMsecs < QDateTime::currentMSecsSinceEpoch()) {
-                int index = rawVector.indexOf(itr);
-                rawVector.takeAt(index);
-                count++;
+        if (count == ring.size()) {
+            // Unwrap into a ring twice the size
+            QVector<Entry> grown(qMax<int>(MIN_CAPACITY, ring.size() * 2));
+            for (int i = 0; i < count; i++) {
+                grown[i] = ring.at((head + i) & (ring.size() - 1));
             }
+            ring = grown;
+            head = 0;
+        }
+        ring[(head + count) & (ring.size() - 1)] = Entry(t, expiry);
+        count++;
+    }
+
+   public:
+    TimedVector(unsigned int itemLife, Time_Format format)
+        : used(0), head(0), count(0), ItemLifeMsecs(static_cast<qint64>(itemLife) * format)
+    {
+    }
+
+    static qint64 now() { return PXMClock::monotonicMsecs(); }
+
+    // Adds t, or restarts its lifetime if it is already here
+    void append(const T t) { append(t, now()); }
+    void append(const T& t, qint64 nowMsecs)
+    {
+        pruneItems(nowMsecs);
+        qint64 expiry = nowMsecs + ItemLifeMsecs;
+        int i         = find(t);
+        if (i >= 0) {
+            table[i].expiry = expiry;
+        } else {
+            insertSlot(t, expiry);
         }
-        return count;
+        push(t, expiry);
+    }
+
+    bool contains(T t) { return contains(t, now()); }
+    bool contains(const T& t, qint64 nowMsecs)
+    {
+        pruneItems(nowMsecs);
+        return find(t) >= 0;
+    }
+
+    int length() { return length(now()); }
+    int length(qint64 nowMsecs)
+    {
+        pruneItems(nowMsecs);
+        return used;
     }
 
-    int remove(T t)
+    // Drops everything that has expired, returns how many went
+    int pruneItems() { return pruneItems(now()); }
+    int pruneItems(qint64 nowMsecs)
     {
-        for (TimedVector::TimedStruct itr : rawVector) {
-            if (*(itr.t) == t) {
-                rawVector.takeAt(rawVector.indexOf(itr));
-                return 0;
+        int removed = 0;
+        while (count > 0 && ring.at(head).expiry <= nowMsecs) {
+            const Entry& entry = ring.at(head);
+            int i              = find(entry.t);
+            if (i >= 0 && table.at(i).expiry == entry.expiry) {
+                eraseSlot(i);
+                removed++;
             }
+            ring[head] = Entry();
+            head       = (head + 1) & (ring.size() - 1);
+            count--;
+        }
+        return removed;
+    }
+
+    // 0 if t was here and has not expired, -1 otherwise
+    int remove(T t) { return remove(t, now()); }
+    int remove(const T& t, qint64 nowMsecs)
+    {
+        pruneItems(nowMsecs);
+        int i = find(t);
+        if (i < 0) {
+            return -1;
         }
-        return -1;
+        eraseSlot(i);
+        return 0;
     }
 };
 #endif  // TIMEDVECTOR_H
@@ -1,44 +1,78 @@
 #include "netcompression.h"
-#include <QUuid>
-#ifdef _WIN32
-#include <winsock2.h>
-#elif __unix__
-#include <arpa/inet.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PXM_SYNC_SSE2
+#include <emmintrin.h>
+#endif
+
+static_assert(sizeof(QUuid) == NetCompression::PACKED_UUID_LENGTH, "QUuid is stored as its 16 bytes");
+
+namespace
+{
+#if defined(__SSSE3__) || defined(PXM_SYNC_SSE2)
+// RFC 4122 bytes to QUuid's in memory layout, x86 is little endian so
+// data1, data2 and data3 are byte swapped and data4 stays as it is
+inline __m128i uuidToHost(__m128i v)
+{
+#if defined(__SSSE3__)
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15));
 #else
-#error "include header that defines sockaddr_in"
+    // Swap the bytes of every 16 bit word, then the two words of data1
+    __m128i swapped = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    swapped         = _mm_shufflelo_epi16(swapped, _MM_SHUFFLE(3, 2, 0, 1));
+    // Low half from the swapped copy, data4 from the original
+    return _mm_castpd_si128(_mm_move_sd(_mm_castsi128_pd(v), _mm_castsi128_pd(swapped)));
 #endif
+}
 
-size_t NetCompression::unpackUUID(const unsigned char* src, QUuid& uuid)
+inline bool decodeRecord(const unsigned char* record, NetCompression::PeerRecord& out)
 {
-    // Use QT implementation of converting to NBO, its better
-    uuid = QUuid::fromRfc4122(QByteArray::fromRawData((const char*)&src[0], PACKED_UUID_LENGTH));
-    return PACKED_UUID_LENGTH;
+    __m128i uuid = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&record[NetCompression::PACKED_SOCKADDR_IN_LENGTH]));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(uuid, _mm_setzero_si128())) == 0xFFFF) {
+        return false;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&out.uuid), uuidToHost(uuid));
+    return true;
 }
-size_t NetCompression::packUUID(unsigned char* buf, const QUuid& uuid)
+#else
+inline bool decodeRecord(const unsigned char* record, NetCompression::PeerRecord& out)
 {
-    // Use QT implementation of converting from NBO, its better
-    // because it will return a null uuid if it fails
-    memcpy(&buf[0], uuid.toRfc4122().constData(), PACKED_UUID_LENGTH);
-    return PACKED_UUID_LENGTH;
+    out.uuid = NetCompression::readUUID(&record[NetCompression::PACKED_SOCKADDR_IN_LENGTH]);
+    return !out.uuid.isNull();
+}
+#endif
 }
 
-size_t NetCompression::packSockaddr_in(unsigned char* buf, const sockaddr_in& addr)
+size_t NetCompression::packPeerRecords(unsigned char* buf, const PeerRecord* records, size_t count)
 {
-    int index = 0;
-    memcpy(&buf[index], &(addr.sin_addr.s_addr), 4);
-    index += sizeof(uint32_t);
-    memcpy(&buf[index], &(addr.sin_port), 2);
-    index += sizeof(uint16_t);
-    return index;
+    for (size_t i = 0; i < count; i++) {
+        packPeerRecord(&buf[i * PACKED_PEER_RECORD_LENGTH], records[i].addr, records[i].uuid);
+    }
+    return count * PACKED_PEER_RECORD_LENGTH;
 }
 
-size_t NetCompression::unpackSockaddr_in(const unsigned char* buf, sockaddr_in& addr)
+size_t NetCompression::unpackPeerRecords(const unsigned char* buf,
+                                         size_t len,
+                                         PeerRecord* records,
+                                         size_t maxCount)
 {
-    int index = 0;
-    memcpy(&(addr.sin_addr.s_addr), &buf[index], 4);
-    index += sizeof(uint32_t);
-    memcpy(&(addr.sin_port), &buf[index], 2);
-    index += sizeof(uint16_t);
-
-    return index;
+    size_t total = qMin(len / PACKED_PEER_RECORD_LENGTH, maxCount);
+    size_t count = 0;
+    for (size_t i = 0; i < total; i++) {
+        const unsigned char* record = &buf[i * PACKED_PEER_RECORD_LENGTH];
+        PeerRecord& out             = records[count];
+        if (!decodeRecord(record, out)) {
+            continue;
+        }
+        memset(&out.addr, 0, sizeof(out.addr));
+        out.addr.sin_family = AF_INET;
+        unpackSockaddr_in(record, out.addr);
+        if (out.addr.sin_addr.s_addr == 0 || out.addr.sin_port == 0) {
+            continue;
+        }
+        count++;
+    }
+    return count;
 }
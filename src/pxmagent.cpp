@@ -3,26 +3,37 @@
 #include <pxminireader.h>
 #include <pxmmainwindow.h>
 #include <pxmpeerworker.h>
-#include <pxmconsole.h>
+#include <pxmtrace.h>
 
 #include <QAbstractButton>
 #include <QApplication>
 #include <QDebug>
 #include <QDir>
 #include <QElapsedTimer>
+#include <QFile>
 #include <QLockFile>
 #include <QMessageBox>
 #include <QPixmap>
 #include <QScopedPointer>
 #include <QSharedPointer>
+#include <QSocketNotifier>
 #include <QSplashScreen>
+#include <QStandardPaths>
+#include <QStringBuilder>
 #include <QThread>
+#include <QTimer>
+#include <QVector>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <lmcons.h>
 #elif __unix__
+#include <errno.h>
+#include <fcntl.h>
 #include <pwd.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <unistd.h>
 #else
@@ -69,6 +80,10 @@ struct PXMAgentPrivate {
     // Functions
     QByteArray getUsername();
     int setupHostname(const unsigned int uuidNum, QString& username);
+    void installQuitSignals(QObject* parent);
+    void raiseFileLimit();
+    void simulatePeers(int count, QElapsedTimer sinceInit);
+    static qint64 residentBytes();
 };
 
 PXMAgent::PXMAgent(QObject* parent) : QObject(parent), d_ptr(new PXMAgentPrivate)
@@ -86,16 +101,22 @@ PXMAgent::~PXMAgent()
     d_ptr->iniReader.resetUUID(d_ptr->presets.uuidNum, d_ptr->presets.uuid);
 }
 
-int PXMAgent::init()
+int PXMAgent::init(bool headless, int simulatePeers)
 {
+    QElapsedTimer initTimer;
+    initTimer.start();
+
 #ifndef QT_DEBUG
-    QImage splashImage(":/resources/PXMessenger_wBackground.png");
-    splashImage = splashImage.scaledToHeight(400);
-    QSplashScreen splash(QPixmap::fromImage(splashImage));
-    splash.show();
+    QScopedPointer<QSplashScreen> splash;
     QElapsedTimer startupTimer;
-    startupTimer.start();
-    qApp->processEvents();
+    if (!headless) {
+        QImage splashImage(":/resources/PXMessenger_wBackground.png");
+        splashImage = splashImage.scaledToHeight(400);
+        splash.reset(new QSplashScreen(QPixmap::fromImage(splashImage)));
+        splash->show();
+        startupTimer.start();
+        qApp->processEvents();
+    }
 #endif
 
 #ifdef _WIN32
@@ -106,8 +127,10 @@ int PXMAgent::init()
             throw("Failed WSAStartup error: " + WSAGetLastError());
         }
     } catch (const char* msg) {
-        QMessageBox msgBox(QMessageBox::Critical, "WSAStartup Error", QString::fromUtf8(msg));
-        msgBox.exec();
+        if (!headless) {
+            QMessageBox msgBox(QMessageBox::Critical, "WSAStartup Error", QString::fromUtf8(msg));
+            msgBox.exec();
+        }
         return -1;
     }
 
@@ -119,6 +142,7 @@ int PXMAgent::init()
     qRegisterMetaType<PXMConsts::MESSAGE_TYPE>();
     qRegisterMetaType<QSharedPointer<Peers::BevWrapper>>();
     qRegisterMetaType<QSharedPointer<QString>>();
+    qRegisterMetaType<PXMHistory::Cursor>();
 
     QString username      = d_ptr->getUsername();
     QString localHostname = d_ptr->iniReader.getHostname(username);
@@ -128,6 +152,10 @@ int PXMAgent::init()
     d_ptr->lockFile.reset(new QLockFile(tmpDir + "/pxmessenger_" + username + ".lock"));
     if (!allowMoreThanOne) {
         if (!d_ptr->lockFile->tryLock(100)) {
+            qCritical().noquote() << "PXMessenger is already running, only one instance is allowed";
+            if (headless) {
+                return -1;
+            }
             QMessageBox msgBox(QMessageBox::Warning, qApp->applicationName(),
                                "PXMessenger is already "
                                "running.\r\nOnly one instance "
@@ -137,6 +165,12 @@ int PXMAgent::init()
         }
     }
 
+    PXMTrace::installDumpSignal(this);
+    if (headless) {
+        d_ptr->installQuitSignals(this);
+        d_ptr->raiseFileLimit();
+    }
+
     d_ptr->logger = PXMConsole::Logger::getInstance();
     d_ptr->logger->setVerbosityLevel(d_ptr->iniReader.getVerbosity());
     d_ptr->logger->setLogStatus(d_ptr->iniReader.getLogActive());
@@ -152,7 +186,18 @@ int PXMAgent::init()
     d_ptr->presets.preventFocus = d_ptr->iniReader.getFocus();
     d_ptr->presets.multicast    = d_ptr->iniReader.getMulticastAddress();
     QUuid globalChat            = QUuid::createUuid();
-    if (!(d_ptr->iniReader.getFont().isEmpty())) {
+    QString historyDirectory;
+    if (d_ptr->iniReader.getHistoryEnabled()) {
+        historyDirectory = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/history";
+        if (d_ptr->presets.uuidNum > 0) {
+            historyDirectory.append(QString::number(d_ptr->presets.uuidNum));
+        }
+    }
+    QString blobDirectory = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/blobs";
+    if (d_ptr->presets.uuidNum > 0) {
+        blobDirectory.append(QString::number(d_ptr->presets.uuidNum));
+    }
+    if (!headless && !(d_ptr->iniReader.getFont().isEmpty())) {
         QFont font;
         font.fromString(d_ptr->iniReader.getFont());
         qApp->setFont(font);
@@ -162,20 +207,45 @@ int PXMAgent::init()
     d_ptr->workerThread->setObjectName("WorkerThread");
     d_ptr->peerWorker =
         new PXMPeerWorker(nullptr, d_ptr->presets.username, d_ptr->presets.uuid, d_ptr->presets.multicast,
-                          d_ptr->presets.tcpPort, d_ptr->presets.udpPort, globalChat);
+                          d_ptr->presets.tcpPort, d_ptr->presets.udpPort, globalChat, historyDirectory);
+    d_ptr->peerWorker->setLatencyStamps(d_ptr->iniReader.getLatencyStamps());
+    d_ptr->peerWorker->setMetricsSocket(d_ptr->iniReader.getMetricsSocket());
+    d_ptr->peerWorker->setLocalTransport(d_ptr->iniReader.getLocalTransport());
+    d_ptr->peerWorker->setIoUring(d_ptr->iniReader.getIoUring());
+    d_ptr->peerWorker->setBlobCache(blobDirectory,
+                                    static_cast<qint64>(d_ptr->iniReader.getBlobCacheMegabytes()) * 1024 * 1024);
     d_ptr->peerWorker->moveToThread(d_ptr->workerThread);
     QObject::connect(d_ptr->workerThread, &QThread::started, d_ptr->peerWorker, &PXMPeerWorker::currentThreadInit);
     QObject::connect(d_ptr->workerThread, &QThread::finished, d_ptr->peerWorker, &PXMPeerWorker::deleteLater);
+
+    if (headless) {
+        // Nobody to show a dialog to
+        QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::warning, this, [](QString title, QString text) {
+            qWarning().noquote() << title + ":" << text;
+        });
+        // Or to ask where to save a file, offers are declined
+        PXMPeerWorker* peerWorker = d_ptr->peerWorker;
+        QObject::connect(peerWorker, &PXMPeerWorker::fileOffered, peerWorker,
+                         [peerWorker](QUuid id, QUuid, QString hostname, QString name, qint64) {
+                             qInfo().noquote() << "Declining" << name << "from" << hostname << "while headless";
+                             peerWorker->answerOffer(id, QString());
+                         });
+        d_ptr->workerThread->start();
+        qInfo() << "Running headless";
+        qInfo() << "Our UUID:" << d_ptr->presets.uuid.toString();
+        return 0;
+    }
+
     d_ptr->window.reset(new PXMWindow(d_ptr->presets.username, d_ptr->presets.windowSize, d_ptr->presets.mute,
                                       d_ptr->presets.preventFocus, globalChat));
 
-    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::printToTextBrowser, d_ptr->window.data(),
+    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::messageAdded, d_ptr->window.data(),
                      &PXMWindow::printToTextBrowser, Qt::QueuedConnection);
-    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::setItalicsOnItem, d_ptr->window.data(),
-                     &PXMWindow::setItalicsOnItem, Qt::QueuedConnection);
-    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::updateListWidget, d_ptr->window.data(),
+    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::peerDisconnected, d_ptr->window.data(),
+                     &PXMWindow::peerDisconnected, Qt::QueuedConnection);
+    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::peerNameChanged, d_ptr->window.data(),
                      &PXMWindow::updateListWidget, Qt::QueuedConnection);
-    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::warnBox, d_ptr->window.data(), &PXMWindow::warnBox,
+    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::warning, d_ptr->window.data(), &PXMWindow::warnBox,
                      Qt::AutoConnection);
     QObject::connect(d_ptr->window.data(), &PXMWindow::addMessageToPeer, d_ptr->peerWorker,
                      &PXMPeerWorker::addMessageToPeer, Qt::QueuedConnection);
@@ -185,6 +255,24 @@ int PXMAgent::init()
                      Qt::QueuedConnection);
     QObject::connect(d_ptr->window.data(), &PXMWindow::printInfoToDebug, d_ptr->peerWorker,
                      &PXMPeerWorker::printInfoToDebug, Qt::QueuedConnection);
+    QObject::connect(d_ptr->window.data(), &PXMWindow::requestHistoryPage, d_ptr->peerWorker,
+                     &PXMPeerWorker::requestHistoryPage, Qt::QueuedConnection);
+    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::historyPage, d_ptr->window.data(), &PXMWindow::historyPage,
+                     Qt::QueuedConnection);
+    QObject::connect(d_ptr->window.data(), &PXMWindow::searchHistory, d_ptr->peerWorker,
+                     &PXMPeerWorker::searchHistory, Qt::QueuedConnection);
+    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::searchResults, d_ptr->window.data(),
+                     &PXMWindow::searchResults, Qt::QueuedConnection);
+    QObject::connect(d_ptr->window.data(), &PXMWindow::offerFile, d_ptr->peerWorker, &PXMPeerWorker::offerFile,
+                     Qt::QueuedConnection);
+    QObject::connect(d_ptr->window.data(), &PXMWindow::answerOffer, d_ptr->peerWorker, &PXMPeerWorker::answerOffer,
+                     Qt::QueuedConnection);
+    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::fileOffered, d_ptr->window.data(), &PXMWindow::fileOffered,
+                     Qt::QueuedConnection);
+    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::transferProgress, d_ptr->window.data(),
+                     &PXMWindow::transferProgress, Qt::QueuedConnection);
+    QObject::connect(d_ptr->peerWorker, &PXMPeerWorker::transferFinished, d_ptr->window.data(),
+                     &PXMWindow::transferFinished, Qt::QueuedConnection);
     d_ptr->workerThread->start();
 
 #ifdef QT_DEBUG
@@ -193,7 +281,7 @@ int PXMAgent::init()
 #else
     qInfo() << "Built in release mode";
     qInfo() << "Our UUID:" << d_ptr->presets.uuid.toString();
-    splash.finish(d_ptr->window.data());
+    splash->finish(d_ptr->window.data());
     qApp->processEvents();
     while (startupTimer.elapsed() < 1500) {
         qApp->processEvents();
@@ -202,9 +290,74 @@ int PXMAgent::init()
 #endif
 
     d_ptr->window->show();
+    if (simulatePeers > 0) {
+        d_ptr->simulatePeers(simulatePeers, initTimer);
+    }
     return 0;
 }
 
+void PXMAgentPrivate::simulatePeers(int count, QElapsedTimer sinceInit)
+{
+    // Runs once the event loop is up, the peers go into the list the same
+    // way peerNameChanged puts real ones there and their messages go in the
+    // way messageAdded does.  Nobody opens them, so every conversation stays
+    // a bounded buffer and an unread count
+    PXMWindow* target = window.data();
+    QTimer::singleShot(0, target, [target, count, sinceInit]() {
+        const int messagesPerPeer = 50;
+        qint64 shownMsecs         = sinceInit.elapsed();
+        qint64 rssBefore          = residentBytes();
+        QElapsedTimer timer;
+        timer.start();
+        QVector<QUuid> uuids;
+        uuids.reserve(count);
+        for (int i = 0; i < count; i++) {
+            uuids.append(QUuid::createUuid());
+            target->updateListWidget(uuids.last(), QStringLiteral("simulated@peer") + QString::number(i));
+        }
+        qint64 addedMsecs = timer.elapsed();
+        // Let the list lay itself out and paint before stopping the clock
+        qApp->processEvents();
+        qint64 shownPeersMsecs = timer.elapsed();
+        qint64 rssPeers        = residentBytes();
+
+        timer.restart();
+        for (int m = 0; m < messagesPerPeer; m++) {
+            for (int i = 0; i < count; i++) {
+                QSharedPointer<QString> str(new QString(QStringLiteral("<p>simulated message ") % QString::number(m) %
+                                                        QStringLiteral(" from peer ") % QString::number(i) %
+                                                        QStringLiteral("</p>")));
+                target->printToTextBrowser(str, uuids.at(i), false, 0);
+            }
+        }
+        qApp->processEvents();
+        qInfo().noquote() << "Simulated" << count << "peers: window up after" << shownMsecs << "ms, peers added in"
+                          << addedMsecs << "ms and shown in" << shownPeersMsecs << "ms," << messagesPerPeer
+                          << "messages each delivered in" << timer.elapsed() << "ms, RSS" << rssBefore / 1024
+                          << "KiB before," << rssPeers / 1024 << "KiB with the peers and" << residentBytes() / 1024
+                          << "KiB with their messages";
+    });
+}
+
+qint64 PXMAgentPrivate::residentBytes()
+{
+#ifdef __unix__
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if (statm.open(QIODevice::ReadOnly)) {
+        QList<QByteArray> fields = statm.readAll().split(' ');
+        if (fields.size() > 1) {
+            return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+        }
+    }
+    // Peak rather than current, in kilobytes
+    rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        return static_cast<qint64>(ru.ru_maxrss) * 1024;
+    }
+#endif
+    return -1;
+}
+
 QByteArray PXMAgentPrivate::getUsername()
 {
 #ifdef _WIN32
@@ -244,3 +397,65 @@ int PXMAgentPrivate::setupHostname(const unsigned int uuidNum, QString& username
     username.append(QString::fromLocal8Bit(computerHostname).left(PXMConsts::MAX_COMPUTER_NAME));
     return 0;
 }
+
+#ifdef __unix__
+namespace
+{
+int quitPipe[2] = {-1, -1};
+
+void quitSignalHandler(int)
+{
+    char c = 1;
+    if (write(quitPipe[1], &c, 1) < 0) {
+        // Nothing safe to do from here
+    }
+}
+}
+#endif
+
+void PXMAgentPrivate::installQuitSignals(QObject* parent)
+{
+#ifdef __unix__
+    // Leave the event loop on SIGINT and SIGTERM so the uuid and the lock
+    // file get released like they would by closing the window
+    if (pipe(quitPipe) < 0) {
+        qWarning() << "Could not create pipe for the quit signals";
+        return;
+    }
+    fcntl(quitPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(quitPipe[1], F_SETFL, O_NONBLOCK);
+
+    QSocketNotifier* notifier = new QSocketNotifier(quitPipe[0], QSocketNotifier::Read, parent);
+    QObject::connect(notifier, &QSocketNotifier::activated, [](int fd) {
+        char buf[16];
+        while (read(fd, buf, sizeof(buf)) > 0) {
+        }
+        qInfo() << "Quit signal received";
+        QCoreApplication::quit();
+    });
+
+    struct sigaction action = {};
+    action.sa_handler       = quitSignalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+#else
+    Q_UNUSED(parent);
+#endif
+}
+
+void PXMAgentPrivate::raiseFileLimit()
+{
+#ifdef __unix__
+    // Every peer is a socket, relays talking to hundreds of them would run
+    // into the usual soft limit of 1024
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+            qWarning().noquote() << "setrlimit: " + QString::fromUtf8(strerror(errno));
+        }
+    }
+#endif
+}
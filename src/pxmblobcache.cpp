@@ -0,0 +1,265 @@
+#include "pxmblobcache.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+#include <QStringBuilder>
+#include <QThread>
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include "pxmmetrics.h"
+
+using namespace PXMBlobCache;
+
+namespace
+{
+const char PARTIAL_SUFFIX[] = ".part";
+
+struct Entry {
+    qint64 size;
+    quint64 used;
+};
+
+bool interrupted()
+{
+    return QThread::currentThread()->isInterruptionRequested();
+}
+
+QString blobPath(const QString& directory, const QByteArray& hash)
+{
+    return directory % QChar('/') % QString::fromLatin1(hash.toHex());
+}
+
+// Copies from to to, nothing is left at to if it fails
+bool copyFile(const QString& from, const QString& to)
+{
+    QFile in(from);
+    QFile out(to);
+    if (!in.open(QIODevice::ReadOnly) || !out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    QByteArray block(static_cast<int>(IO_BLOCK_BYTES), Qt::Uninitialized);
+    bool ok = true;
+    for (;;) {
+        qint64 got = in.read(block.data(), block.size());
+        if (got == 0) {
+            break;
+        }
+        if (got < 0 || interrupted() || out.write(block.constData(), got) != got) {
+            ok = false;
+            break;
+        }
+    }
+    out.close();
+    if (!ok || out.error() != QFileDevice::NoError) {
+        out.remove();
+        return false;
+    }
+    return true;
+}
+}
+
+struct PXMBlobCache::StorePrivate {
+    QString directory;
+    qint64 capBytes;
+    qint64 bytes  = 0;
+    quint64 clock = 0;
+    QHash<QByteArray, Entry> entries;
+    // Least recently used first
+    QMap<quint64, QByteArray> order;
+
+    void touch(const QByteArray& hash, Entry& entry, bool stamp);
+    void remove(const QByteArray& hash, bool unlink);
+    void evict(qint64 room);
+};
+
+void StorePrivate::touch(const QByteArray& hash, Entry& entry, bool stamp)
+{
+    order.remove(entry.used);
+    entry.used = ++clock;
+    order.insert(entry.used, hash);
+    if (!stamp) {
+        return;
+    }
+    QString path = blobPath(directory, hash);
+#ifdef _WIN32
+    _wutime(reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(path).utf16()), nullptr);
+#else
+    utime(QFile::encodeName(path).constData(), nullptr);
+#endif
+}
+
+void StorePrivate::remove(const QByteArray& hash, bool unlink)
+{
+    QHash<QByteArray, Entry>::iterator itr = entries.find(hash);
+    if (itr == entries.end()) {
+        return;
+    }
+    order.remove(itr.value().used);
+    bytes -= itr.value().size;
+    entries.erase(itr);
+    // A blob still being streamed from can stay behind on Windows, it is
+    // picked up again on the next start
+    if (unlink && !QFile::remove(blobPath(directory, hash))) {
+        qWarning().noquote() << "Could not remove" << blobPath(directory, hash) << "from the file cache";
+    }
+    PXMMetrics::blobCacheBytes.set(bytes);
+}
+
+void StorePrivate::evict(qint64 room)
+{
+    while (bytes + room > capBytes && !order.isEmpty()) {
+        QByteArray hash = order.first();
+        qDebug().noquote() << "Evicting" << hash.toHex() << "from the file cache";
+        remove(hash, true);
+    }
+}
+
+Store::Store(QString directory, qint64 capBytes) : d_ptr(new StorePrivate)
+{
+    d_ptr->directory = directory;
+    d_ptr->capBytes  = capBytes;
+    QDir dir(directory);
+    if (!dir.mkpath(QStringLiteral("."))) {
+        qWarning().noquote() << "Could not create" << directory;
+        return;
+    }
+
+    // Oldest first, so the recency order comes back as it was
+    QFileInfoList files = dir.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+    for (const QFileInfo& info : files) {
+        if (info.fileName().endsWith(QLatin1String(PARTIAL_SUFFIX))) {
+            QFile::remove(info.absoluteFilePath());
+            continue;
+        }
+        QByteArray hex  = info.fileName().toLatin1();
+        QByteArray hash = QByteArray::fromHex(hex);
+        if (hash.size() != HASH_BYTES || hash.toHex() != hex) {
+            continue;
+        }
+        Entry entry = {info.size(), 0};
+        d_ptr->bytes += entry.size;
+        d_ptr->touch(hash, d_ptr->entries.insert(hash, entry).value(), false);
+    }
+    d_ptr->evict(0);
+    PXMMetrics::blobCacheBytes.set(d_ptr->bytes);
+    qInfo().noquote() << "File cache:" << d_ptr->entries.size() << "blobs," << d_ptr->bytes << "bytes in"
+                      << directory;
+}
+
+Store::~Store()
+{
+}
+
+QString Store::directory() const
+{
+    return d_ptr->directory;
+}
+
+qint64 Store::bytes() const
+{
+    return d_ptr->bytes;
+}
+
+int Store::count() const
+{
+    return d_ptr->entries.size();
+}
+
+QString Store::find(const QByteArray& hash, qint64 size)
+{
+    QHash<QByteArray, Entry>::iterator itr = d_ptr->entries.find(hash);
+    if (itr == d_ptr->entries.end() || itr.value().size != size) {
+        return QString();
+    }
+    QString path = blobPath(d_ptr->directory, hash);
+    // Removed behind our back
+    if (!QFileInfo::exists(path)) {
+        d_ptr->remove(hash, false);
+        return QString();
+    }
+    d_ptr->touch(hash, itr.value(), true);
+    return path;
+}
+
+bool Store::adopt(const QByteArray& hash)
+{
+    QFileInfo info(blobPath(d_ptr->directory, hash));
+    if (!info.isFile()) {
+        return false;
+    }
+    d_ptr->remove(hash, false);
+    if (info.size() > d_ptr->capBytes) {
+        QFile::remove(info.absoluteFilePath());
+        return false;
+    }
+    d_ptr->evict(info.size());
+    Entry entry = {info.size(), 0};
+    d_ptr->bytes += entry.size;
+    d_ptr->touch(hash, d_ptr->entries.insert(hash, entry).value(), true);
+    PXMMetrics::blobCacheBytes.set(d_ptr->bytes);
+    return true;
+}
+
+bool Store::copyIn(const QString& directory, const QByteArray& hash, const QString& path)
+{
+    QString target = blobPath(directory, hash);
+    QFileInfo existing(target);
+    if (existing.isFile() && existing.size() == QFileInfo(path).size()) {
+        return true;
+    }
+    QString partial = target % QLatin1String(PARTIAL_SUFFIX);
+    if (!copyFile(path, partial)) {
+        return false;
+    }
+    QFile::remove(target);
+    if (!QFile::rename(partial, target)) {
+        QFile::remove(partial);
+        return false;
+    }
+    return true;
+}
+
+QByteArray PXMBlobCache::hashFile(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    QCryptographicHash sha(QCryptographicHash::Sha256);
+    QByteArray block(static_cast<int>(IO_BLOCK_BYTES), Qt::Uninitialized);
+    for (;;) {
+        qint64 got = file.read(block.data(), block.size());
+        if (got == 0) {
+            break;
+        }
+        if (got < 0 || interrupted()) {
+            return QByteArray();
+        }
+        sha.addData(block.constData(), static_cast<int>(got));
+    }
+    return sha.result();
+}
+
+void Hasher::hash(QUuid id, QString path, QByteArray expected, QString directory)
+{
+    QByteArray digest = hashFile(path);
+    if (!digest.isEmpty() && digest == expected && !directory.isEmpty() && !Store::copyIn(directory, digest, path)) {
+        qWarning().noquote() << "Could not copy" << path << "into the file cache";
+    }
+    emit hashed(id, digest);
+}
+
+void Hasher::copy(QUuid id, QString from, QString to)
+{
+    emit copied(id, copyFile(from, to));
+}
@@ -10,6 +10,9 @@
 
 #include <QDebug>
 
+#include "pxmlatency.h"
+#include "pxmlog.h"
+#include "pxmmetrics.h"
 #include "pxmpeers.h"
 #include "netcompression.h"
 
@@ -89,6 +92,7 @@ int PXMClient::sendUDP(const char* msg, unsigned short port)
             qWarning().noquote() << "Partial UDP send on port" << port;
             return -1;
         }
+        PXMMetrics::discoverSent.inc();
     }
     evutil_closesocket(socketfd2);
     return -1;
@@ -105,41 +109,54 @@ void PXMClient::sendMsg(const QSharedPointer<Peers::BevWrapper> bw,
     uint16_t packetLenNBO;
     bool print = false;
 
-    if (msgLen > 65400) {
+    if (msgLen > MAX_MESSAGE_LENGTH) {
         emit resultOfTCPSend(-1, uuidReceiver, QString("Message too Long!"), print, bw);
         return;
     }
     packetLen = d_ptr->localUUIDLen + sizeof(type) + msgLen;
 
-    if (type == PXMConsts::MSG_TEXT)
+    bool stamped = type == PXMConsts::MSG_TEXT_STAMPED || type == PXMConsts::MSG_GLOBAL_STAMPED;
+    if (type == PXMConsts::MSG_TEXT || type == PXMConsts::MSG_TEXT_STAMPED)
         print = true;
 
-    QScopedArrayPointer<char> full_mess(new char[packetLen + 1]);
+    // Length prefix and frame in one buffer, one write and one evbuffer
+    // chain per message
+    size_t frameLen = sizeof(packetLenNBO) + packetLen;
+    QScopedArrayPointer<char> full_mess(new char[frameLen + 1]);
+    PXMMetrics::bufferAllocations.inc();
     // char full_mess[packetLen + 1];
 
     packetLenNBO     = htons(static_cast<uint16_t>(packetLen));
     uint32_t typeNBO = htonl(type);
 
-    memcpy(&full_mess[0], d_ptr->packedLocalUUID, d_ptr->localUUIDLen);
-    memcpy(&full_mess[d_ptr->localUUIDLen], &typeNBO, sizeof(typeNBO));
-    memcpy(&full_mess[d_ptr->localUUIDLen + sizeof(typeNBO)], msg, msgLen);
-    full_mess[packetLen] = 0;
+    size_t index = 0;
+    memcpy(&full_mess[index], &packetLenNBO, sizeof(packetLenNBO));
+    index += sizeof(packetLenNBO);
+    memcpy(&full_mess[index], d_ptr->packedLocalUUID, d_ptr->localUUIDLen);
+    index += d_ptr->localUUIDLen;
+    memcpy(&full_mess[index], &typeNBO, sizeof(typeNBO));
+    index += sizeof(typeNBO);
+    memcpy(&full_mess[index], msg, msgLen);
+    full_mess[frameLen] = 0;
 
     bw->lockBev();
 
     if ((bw->getBev() == nullptr) || !(bufferevent_get_enabled(bw->getBev()) & EV_WRITE)) {
         msg = "Peer is Disconnected, message not sent";
-    } else {
-        if (bufferevent_write(bw->getBev(), &packetLenNBO, sizeof(packetLenNBO)) == 0) {
-            if (bufferevent_write(bw->getBev(), full_mess.data(), packetLen) == 0) {
-                qDebug() << "Successful Send";
-                bytesSent = 0;
-            } else {
-                msg = "Message send failure, not sent";
-            }
-        } else {
-            msg = "Message send failure, not sent";
+    } else if (bufferevent_write(bw->getBev(), full_mess.data(), frameLen) == 0) {
+        pxmPacketDebug() << "Successful Send";
+        bytesSent = 0;
+        PXMMetrics::framesSent.inc(type);
+        PXMMetrics::bytesSent.inc(type, frameLen);
+        if (stamped && msgLen >= PXMLatency::STAMP_LENGTH) {
+            PXMLatency::Recorder::instance()->record(
+                PXMLatency::SEND_TO_WIRE, uuidReceiver,
+                PXMLatency::wallMicros() - PXMLatency::readStamp(reinterpret_cast<const unsigned char*>(msg)));
+            // Hand back the text without the stamp
+            msg += PXMLatency::STAMP_LENGTH;
         }
+    } else {
+        msg = "Message send failure, not sent";
     }
 
     bw->unlockBev();
@@ -1,5 +1,7 @@
 #include "pxmconsole.h"
+#include "pxmtrace.h"
 #include <QGridLayout>
+#include <QGuiApplication>
 #include <QLabel>
 #include <QPushButton>
 #include <QPushButton>
@@ -19,7 +21,6 @@ struct PXMConsole::WindowPrivate {
 };
 
 QTextEdit* Window::textEdit    = 0;
-int AppendTextEvent::type      = QEvent::registerEventType();
 Logger* Logger::loggerInstance = nullptr;
 
 Window::Window(QWidget* parent) : QMainWindow(parent), d_ptr(new PXMConsole::WindowPrivate())
@@ -44,12 +45,19 @@ Window::Window(QWidget* parent) : QMainWindow(parent), d_ptr(new PXMConsole::Win
     pushButton->setText("Print Info");
     pushButton->setMaximumSize(QSize(250, 16777215));
 
+    traceButton = new QPushButton(d_ptr->centralwidget);
+    traceButton->setText("Dump Trace");
+    traceButton->setToolTip("Write recent trace events as Chrome trace JSON");
+    traceButton->setMaximumSize(QSize(250, 16777215));
+    QObject::connect(traceButton, &QAbstractButton::clicked, this, &Window::dumpTrace);
+
     d_ptr->verbosity = new QLabel(d_ptr->centralwidget);
     d_ptr->verbosity->setText("Debug Verbosity: " % QString::number(Logger::getInstance()->getVerbosityLevel()));
-    d_ptr->gridLayout->addWidget(d_ptr->verbosity, 1, 2, 1, 2);
+    d_ptr->gridLayout->addWidget(d_ptr->verbosity, 1, 3, 1, 1);
 
     d_ptr->gridLayout->addWidget(textEdit, 0, 0, 1, 4);
-    d_ptr->gridLayout->addWidget(pushButton, 1, 0, 1, 2);
+    d_ptr->gridLayout->addWidget(pushButton, 1, 0, 1, 1);
+    d_ptr->gridLayout->addWidget(traceButton, 1, 1, 1, 1);
 
     d_ptr->gridLayout_2->addLayout(d_ptr->gridLayout, 0, 0, 1, 1);
 
@@ -62,15 +70,16 @@ Window::Window(QWidget* parent) : QMainWindow(parent), d_ptr(new PXMConsole::Win
     d_ptr->atMaximum = true;
     QObject::connect(d_ptr->sb, &QScrollBar::valueChanged, this, &Window::adjustScrollBar);
     QObject::connect(d_ptr->sb, &QScrollBar::rangeChanged, this, &Window::rangeChanged);
-
-    if (Logger::getInstance()->getLogStatus()) {
-        Logger::getInstance()->logFile->remove();
-        Logger::getInstance()->logFile->open(QIODevice::ReadWrite);
-    }
 }
 
 Window::~Window()
 {
+    Logger::getInstance()->setTextEdit(nullptr);
+    textEdit = 0;
+}
+void Window::dumpTrace()
+{
+    PXMTrace::dump(PXMTrace::defaultDumpPath());
 }
 void Window::adjustScrollBar(int i)
 {
@@ -91,30 +100,44 @@ void Window::verbosityChanged()
     d_ptr->verbosity->setText("Debug Verbosity: " % QString::number(Logger::getInstance()->getVerbosityLevel()));
 }
 
-void Logger::setLogStatus(bool stat)
+void Logger::customEvent(QEvent* event)
 {
-    if (logActive != stat && stat == true && logFile) {
-        logFile->remove();
-        if (logFile->open(QIODevice::ReadWrite)) {
-            logActive = true;
-        } else {
-            logActive = false;
+    if (event->type() != PXMLog::ConsoleEvent::type) {
+        QObject::customEvent(event);
+        return;
+    }
+    event->accept();
+    if (!logTextEdit) {
+        return;
+    }
+
+    // One insert per run of lines with the same color
+    const QVector<PXMLog::ConsoleEvent::Line>& lines = static_cast<PXMLog::ConsoleEvent*>(event)->lines;
+    logTextEdit->setUpdatesEnabled(false);
+    int i = 0;
+    while (i < lines.size()) {
+        QtMsgType type = lines.at(i).type;
+        QString text;
+        for (; i < lines.size() && lines.at(i).type == type; i++) {
+            text.append(lines.at(i).text);
         }
-    } else if (logActive != stat && stat == false && logFile) {
-        logActive = false;
-        logFile->flush();
-        logFile->close();
+        logTextEdit->setTextColor(colorFor(type));
+        logTextEdit->insertPlainText(text);
     }
+    logTextEdit->setUpdatesEnabled(true);
 }
 
-void Logger::customEvent(QEvent* event)
+QColor Logger::colorFor(QtMsgType type)
 {
-    AppendTextEvent* text = dynamic_cast<AppendTextEvent*>(event);
-    if (text) {
-        logTextEdit->setTextColor(text->getColor());
-        logTextEdit->insertPlainText(text->getText());
-        event->accept();
-    } else {
-        QObject::customEvent(event);
+    switch (type) {
+        case QtDebugMsg:
+            return Qt::gray;
+        case QtWarningMsg:
+            return Qt::darkYellow;
+        case QtCriticalMsg:
+        case QtFatalMsg:
+            return Qt::red;
+        default:
+            return QGuiApplication::palette().foreground().color();
     }
 }
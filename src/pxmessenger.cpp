@@ -1,107 +1,57 @@
 #include <QApplication>
 #include <QDebug>
+#include <QScopedPointer>
 #include <QStringBuilder>
 #include <QDateTime>
 
 #include "pxmagent.h"
-#include "pxmconsole.h"
-
-#ifdef _WIN32
-QLatin1Char seperator = QLatin1Char('\\');
-#else
-QLatin1Char seperator = QLatin1Char('/');
-#endif
+#include "pxmlogbackend.h"
 
 void debugMessageOutput(QtMsgType type, const QMessageLogContext& context, const QString& msg)
 {
-    using namespace PXMConsole;
-    Logger* logger = Logger::getInstance();
-
-    switch (logger->getVerbosityLevel()) {
-        case 0:
-            if (type == QtDebugMsg || type == QtWarningMsg)
-                return;
-            break;
-        case 1:
-            if (type == QtDebugMsg)
-                return;
-            break;
-        default:
-            break;
-    }
-
-    QString localMsg = QString();
-    localMsg.append(QDateTime::currentDateTime().time().toString(QStringLiteral("[hh:mm:ss:zzz] ")));
-
-    QColor msgColor;
-    switch (type) {
-        case QtDebugMsg:
-            localMsg.append(QString("%1").arg(QStringLiteral("DEBUG:"), -7, QChar(' ')));
-            msgColor = Qt::gray;
-            break;
-        case QtWarningMsg:
-            localMsg.append(QString("%1").arg(QStringLiteral("WARN:"), -7, QChar(' ')));
-            msgColor = Qt::darkYellow;
-            break;
-        case QtCriticalMsg:
-            localMsg.append(QString("%1").arg(QStringLiteral("CRIT:"), -7, QChar(' ')));
-            msgColor = Qt::red;
-            break;
-        case QtFatalMsg:
-            localMsg.append(QString("%1").arg(QStringLiteral("FATAL:"), -7, QChar(' ')));
-            abort();
-            break;
-        case QtInfoMsg:
-            localMsg.append(QString("%1").arg(QStringLiteral("INFO:"), -7, QChar(' ')));
-            msgColor = QGuiApplication::palette().foreground().color();
-            break;
-    }
-
-    QString filename = QString();
-#ifdef QT_DEBUG
-    filename = QString::fromUtf8(context.file);
-    filename = filename.right(filename.length() - filename.lastIndexOf(seperator) - 1);
-    filename = QString("%1").arg(filename.append(':' + QString::number(context.line)), -((int)PXMConsts::DEBUG_PADDING),
-                                 QChar(' '));
-#endif /* end QT_DEBUG */
-    localMsg.append(filename.toUtf8() % msg.toUtf8());
-
-    localMsg.append(QLatin1Char('\n'));
-    const char* cmsg = localMsg.toLatin1().constData();
-    fprintf(stderr, "%s", cmsg);
-    if (Window::textEdit) {
-        qApp->postEvent(logger, new AppendTextEvent(localMsg, msgColor), Qt::LowEventPriority);
-    }
-    if (logger->getLogStatus() && logger->logFile->isOpen()) {
-        logger->logFile->write(cmsg, strlen(cmsg));
-        logger->logFile->flush();
-    }
+    // Formatting and writing happen on the log writer thread
+    PXMLog::Backend::instance()->log(type, context, msg);
 }
 
 int main(int argc, char** argv)
 {
     qInstallMessageHandler(debugMessageOutput);
 
-    QApplication app(argc, argv);
+    // Decided before the application exists, a headless node never loads
+    // the gui platform plugin so it runs without a display
+    bool headless     = false;
+    int simulatePeers = 0;
+    for (int i = 1; i < argc; i++) {
+        if (qstrcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (qstrcmp(argv[i], "--simulate-peers") == 0 && i + 1 < argc) {
+            simulatePeers = QByteArray(argv[++i]).toInt();
+        }
+    }
+    QScopedPointer<QCoreApplication> app(headless ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
+
+    QCoreApplication::setApplicationName("PXMessenger");
+    QCoreApplication::setOrganizationName("PXMessenger");
+    QCoreApplication::setOrganizationDomain("PXMessenger");
+    QCoreApplication::setApplicationVersion("1.4.0");
 
-    app.setApplicationName("PXMessenger");
-    app.setOrganizationName("PXMessenger");
-    app.setOrganizationDomain("PXMessenger");
-    app.setApplicationVersion("1.4.0");
+    PXMLog::Backend::instance()->startWriter();
 
     int result;
     {
         PXMAgent overlord;
-        if (overlord.init()) {
+        if (overlord.init(headless, simulatePeers)) {
             qCritical().noquote() << QStringLiteral("PXMInit failed");
+            PXMLog::Backend::instance()->stop();
             return -1;
         }
 
-        result = app.exec();
+        result = app->exec();
 
         qInfo().noquote() << QStringLiteral("Exiting PXMessenger");
     }
     qInfo().noquote() << QStringLiteral("Successful Shutdown with code:") << result;
+    PXMLog::Backend::instance()->stop();
 
     return result;
 }
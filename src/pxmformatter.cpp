@@ -0,0 +1,111 @@
+#include "pxmformatter.h"
+
+#include <QDateTime>
+#include <QStringBuilder>
+
+namespace
+{
+// Every header formatMessage() builds starts and ends with these
+const QLatin1String HEADER_OPEN("<span style=\"white-space: nowrap\"");
+const QLatin1String HEADER_CLOSE(":&nbsp;</span>");
+}
+
+const QString& PXMFormatter::timestamp()
+{
+    // The one clock read, the local time is only worked out from it when
+    // the second changes
+    qint64 msecs = QDateTime::currentMSecsSinceEpoch();
+    if (msecs / 1000 != cachedSecond) {
+        cachedSecond    = msecs / 1000;
+        cachedTimestamp = QStringLiteral("(") %
+                          QDateTime::fromMSecsSinceEpoch(msecs).toString(QStringLiteral("hh:mm:ss")) %
+                          QStringLiteral(") ");
+    }
+    return cachedTimestamp;
+}
+
+int PXMFormatter::formatMessage(QString& str, const QUuid& uuid, const QString& hostname, const QString& color)
+{
+    int offset = paragraphEnd(str);
+    if (offset < 0) {
+        return -1;
+    }
+
+    Header& header = headers[uuid];
+    if (header.open.isEmpty() || header.color != color || header.hostname != hostname) {
+        header.color    = color;
+        header.hostname = hostname;
+        header.open     = HEADER_OPEN % QStringLiteral(" style=\"color: ") % color % QStringLiteral(";\">");
+        header.close    = hostname % HEADER_CLOSE;
+    }
+
+    const QString& date = timestamp();
+    str.insert(offset, QString(header.open % date % header.close));
+
+    return 0;
+}
+
+int PXMFormatter::formatUncached(QString& str, const QString& hostname, const QString& color)
+{
+    int offset = paragraphEnd(str);
+    if (offset < 0) {
+        return -1;
+    }
+    str.insert(offset, QString(HEADER_OPEN % QStringLiteral(" style=\"color: ") % color % QStringLiteral(";\">") %
+                               timestamp() % hostname % HEADER_CLOSE));
+    return 0;
+}
+
+int PXMFormatter::paragraphEnd(const QString& str)
+{
+    // Same result as the old "(<p.*?>)" match, '.' does not cross newlines
+    const QChar* data = str.constData();
+    const int len     = str.length();
+    for (int i = 0; i + 1 < len; i++) {
+        if (data[i] != QLatin1Char('<') || data[i + 1] != QLatin1Char('p')) {
+            continue;
+        }
+        for (int j = i + 2; j < len; j++) {
+            if (data[j] == QLatin1Char('>')) {
+                return j + 1;
+            } else if (data[j] == QLatin1Char('\n')) {
+                break;
+            }
+        }
+    }
+    return -1;
+}
+
+QString PXMFormatter::stripHeader(const QString& str)
+{
+    int start = paragraphEnd(str);
+    if (start < 0 || !str.midRef(start).startsWith(HEADER_OPEN)) {
+        return str;
+    }
+    int end = str.indexOf(HEADER_CLOSE, start);
+    if (end < 0) {
+        return str;
+    }
+    QString body = str;
+    body.remove(start, end + HEADER_CLOSE.size() - start);
+    return body;
+}
+
+int PXMFormatter::removeBodyFormatting(QByteArray& str)
+{
+    // Same result as the old "((?<=<body) style.*?\"(?=>))" match
+    int body = str.indexOf("<body style");
+    while (body >= 0) {
+        int start = body + 5;
+        for (int j = start; j + 1 < str.length(); j++) {
+            if (str.at(j) == '\n') {
+                break;
+            } else if (str.at(j) == '"' && str.at(j + 1) == '>') {
+                str.remove(start, j + 1 - start);
+                return 0;
+            }
+        }
+        body = str.indexOf("<body style", body + 1);
+    }
+    return -1;
+}
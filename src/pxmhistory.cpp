@@ -0,0 +1,675 @@
+#include "pxmhistory.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QLinkedList>
+#include <QMap>
+#include <QMutex>
+#include <QThread>
+#include <QTimer>
+#include <QWaitCondition>
+#include <QtEndian>
+
+#include <algorithm>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace PXMHistory;
+
+namespace
+{
+// The part of a segment that is not known to be on disk yet.  Records are
+// never split between diskSize, writing and pending
+struct Tail {
+    quint32 diskSize = 0;
+    // With the writer
+    QByteArray writing;
+    QByteArray pending;
+    quint32 size() const { return diskSize + static_cast<quint32>(writing.size() + pending.size()); }
+};
+
+struct Conversation {
+    QString path;
+    quint32 activeSegment = 0;
+    // The active segment and any older ones still being written
+    QMap<quint32, Tail> tails;
+    // Set while the writer has this conversation's last batch
+    bool writing = false;
+};
+
+struct MappedSegment {
+    QFile* file;
+    uchar* data;
+    qint64 size;
+};
+
+QString segmentName(quint32 segment)
+{
+    return QString::asprintf("%08u.seg", segment);
+}
+
+int syncFile(QFile& file)
+{
+    if (!file.flush()) {
+        return -1;
+    }
+#ifdef _WIN32
+    return _commit(file.handle());
+#else
+    return fsync(file.handle());
+#endif
+}
+
+// One conversation's share of a flush
+struct WriteJob {
+    QString conversation;
+    quint32 segment;
+    QString segmentPath;
+    qint64 offset;
+    QByteArray data;
+    bool written;
+};
+
+// Does the writes and fsyncs for a Store so the thread appending never waits
+// on the disk.  Jobs are handed over in batches, the Store's written() slot
+// is called once a batch is done and it picks up the results with takeDone().
+class Writer : public QThread
+{
+    QObject* store;
+    QMutex mutex;
+    QWaitCondition wake;
+    QWaitCondition idle;
+    QVector<WriteJob> queue;
+    QVector<WriteJob> done;
+    bool busy     = false;
+    bool stopping = false;
+
+    static void perform(WriteJob& job);
+
+   public:
+    Writer(QObject* notify) : store(notify) {}
+    void submit(const QVector<WriteJob>& jobs);
+    QVector<WriteJob> takeDone();
+    void waitIdle();
+    void stop();
+
+   protected:
+    void run() override;
+};
+
+void Writer::perform(WriteJob& job)
+{
+    job.written = false;
+    QFile file(job.segmentPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered)) {
+        qWarning().noquote() << "Could not open" << file.fileName();
+        return;
+    }
+    // Anything past offset is left over from a write that failed
+    if (file.size() > job.offset) {
+        file.resize(job.offset);
+    }
+    if (file.size() != job.offset) {
+        qWarning().noquote() << "History segment" << file.fileName() << "has" << file.size() << "bytes, expected"
+                             << job.offset;
+        return;
+    }
+    if (file.write(job.data) != job.data.size() || syncFile(file) != 0) {
+        qWarning().noquote() << "History write failed for" << file.fileName();
+        file.resize(job.offset);
+        return;
+    }
+    job.written = true;
+}
+
+void Writer::submit(const QVector<WriteJob>& jobs)
+{
+    QMutexLocker locker(&mutex);
+    queue += jobs;
+    wake.wakeAll();
+}
+
+QVector<WriteJob> Writer::takeDone()
+{
+    QMutexLocker locker(&mutex);
+    QVector<WriteJob> result;
+    result.swap(done);
+    return result;
+}
+
+void Writer::waitIdle()
+{
+    QMutexLocker locker(&mutex);
+    while (busy || !queue.isEmpty()) {
+        idle.wait(&mutex);
+    }
+}
+
+void Writer::stop()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        wake.wakeAll();
+    }
+    wait();
+}
+
+void Writer::run()
+{
+    QMutexLocker locker(&mutex);
+    for (;;) {
+        while (queue.isEmpty() && !stopping) {
+            wake.wait(&mutex);
+        }
+        if (queue.isEmpty()) {
+            break;
+        }
+        QVector<WriteJob> batch;
+        batch.swap(queue);
+        busy = true;
+        locker.unlock();
+
+        for (WriteJob& job : batch) {
+            perform(job);
+        }
+
+        locker.relock();
+        done += batch;
+        busy = false;
+        if (queue.isEmpty()) {
+            idle.wakeAll();
+        }
+        QMetaObject::invokeMethod(store, "written", Qt::QueuedConnection);
+    }
+}
+}
+
+struct PXMHistory::StorePrivate {
+    QString directory;
+    QHash<QString, Conversation> conversations;
+    QHash<QString, MappedSegment> maps;
+    QLinkedList<QString> mapOrder;
+    QTimer* flushTimer;
+    QScopedPointer<Writer> writer;
+    int pendingBytes = 0;
+
+    Conversation& open(const QString& name);
+    quint32 validSize(const QString& filePath, quint32 size);
+    bool submit();
+    bool collect();
+    void sync();
+    void settle(const QString& name, Conversation& conv, quint32 segment);
+    const MappedSegment* map(const QString& name, Conversation& conv, quint32 segment);
+    quint32 segmentSize(const QString& name, Conversation& conv, quint32 segment);
+    const uchar* locate(const QString& name, Conversation& conv, quint32 segment, quint32 offset, quint32 len);
+    void unmap(const QString& key);
+    void unmapAll(const QString& name);
+};
+
+Conversation& StorePrivate::open(const QString& name)
+{
+    QHash<QString, Conversation>::iterator itr = conversations.find(name);
+    if (itr != conversations.end()) {
+        return itr.value();
+    }
+
+    Conversation& conv = conversations[name];
+    conv.path          = directory + QLatin1Char('/') + name;
+    QDir dir(conv.path);
+    if (!dir.exists() && !dir.mkpath(QStringLiteral("."))) {
+        qWarning().noquote() << "Could not create history directory" << conv.path;
+    }
+    // Left by versions that kept a time index next to the segments
+    dir.remove(QStringLiteral("index"));
+
+    QStringList segments = dir.entryList(QStringList() << QStringLiteral("*.seg"), QDir::Files, QDir::Name);
+    Tail active;
+    if (!segments.isEmpty()) {
+        conv.activeSegment = segments.last().section(QLatin1Char('.'), 0, 0).toUInt();
+        QString activePath = dir.filePath(segments.last());
+        active.diskSize    = validSize(activePath, static_cast<quint32>(QFileInfo(activePath).size()));
+    }
+    conv.tails.insert(conv.activeSegment, active);
+    return conv;
+}
+
+quint32 StorePrivate::validSize(const QString& filePath, quint32 size)
+{
+    // Check the last record is whole, otherwise walk the segment forwards
+    // and cut it after the last complete record.
+    QFile file(filePath);
+    if (size < SEGMENT_HEADER_LEN) {
+        file.remove();
+        return 0;
+    }
+    if (!file.open(QIODevice::ReadWrite)) {
+        return size;
+    }
+    uchar* data = file.map(0, size);
+    if (!data) {
+        return size;
+    }
+
+    quint32 valid = SEGMENT_HEADER_LEN;
+    if (size >= SEGMENT_HEADER_LEN + RECORD_OVERHEAD) {
+        quint32 len = qFromLittleEndian<quint32>(&data[size - 4]);
+        if (len <= size - SEGMENT_HEADER_LEN - RECORD_OVERHEAD &&
+            qFromLittleEndian<quint32>(&data[size - RECORD_OVERHEAD - len]) == len) {
+            valid = size;
+        }
+    }
+    if (valid != size) {
+        quint32 pos = SEGMENT_HEADER_LEN;
+        while (pos + RECORD_OVERHEAD <= size) {
+            quint32 len = qFromLittleEndian<quint32>(&data[pos]);
+            if (len > size - pos - RECORD_OVERHEAD ||
+                qFromLittleEndian<quint32>(&data[pos + 12 + len]) != len) {
+                break;
+            }
+            pos += RECORD_OVERHEAD + len;
+        }
+        valid = pos;
+    }
+    file.unmap(data);
+
+    if (valid != size) {
+        qWarning().noquote() << "Truncating damaged history segment" << filePath << "from" << size << "to" << valid;
+        file.resize(valid);
+    }
+    return valid;
+}
+
+bool StorePrivate::submit()
+{
+    // Hands what is waiting to the writer.  Returns whether anything is
+    // being written.
+    QVector<WriteJob> jobs;
+    bool writing = false;
+    for (QHash<QString, Conversation>::iterator itr = conversations.begin(); itr != conversations.end(); ++itr) {
+        Conversation& conv = itr.value();
+        // One batch in flight per conversation, oldest segment first, keeps
+        // its records in order
+        for (QMap<quint32, Tail>::iterator tail = conv.tails.begin(); !conv.writing && tail != conv.tails.end();
+             ++tail) {
+            if (tail.value().pending.isEmpty()) {
+                continue;
+            }
+            WriteJob job;
+            job.conversation = itr.key();
+            job.segment      = tail.key();
+            job.segmentPath  = conv.path + QLatin1Char('/') + segmentName(tail.key());
+            job.offset       = tail.value().diskSize;
+            job.data.swap(tail.value().pending);
+            // Shared, reads are served from it until the write is done
+            tail.value().writing = job.data;
+            pendingBytes -= job.data.size();
+            conv.writing = true;
+            jobs.append(job);
+        }
+        writing = writing || conv.writing;
+    }
+    if (!jobs.isEmpty()) {
+        writer->submit(jobs);
+    }
+    return writing;
+}
+
+bool StorePrivate::collect()
+{
+    // Returns false if a write failed
+    bool ok = true;
+    for (const WriteJob& job : writer->takeDone()) {
+        Conversation& conv = conversations[job.conversation];
+        Tail& tail         = conv.tails[job.segment];
+        conv.writing       = false;
+        tail.writing.clear();
+        if (job.written) {
+            tail.diskSize += static_cast<quint32>(job.data.size());
+        } else {
+            // Goes out again ahead of anything appended since
+            tail.pending.prepend(job.data);
+            pendingBytes += job.data.size();
+            ok = false;
+        }
+        settle(job.conversation, conv, job.segment);
+    }
+    return ok;
+}
+
+void StorePrivate::sync()
+{
+    // Waits until everything appended is on disk, a failed write is retried
+    // once before giving up
+    int failures = 0;
+    collect();
+    while (failures < 2 && submit()) {
+        writer->waitIdle();
+        if (!collect()) {
+            failures++;
+        }
+    }
+}
+
+void StorePrivate::settle(const QString& name, Conversation& conv, quint32 segment)
+{
+    // A finished segment is read from its file alone once it is all on disk
+    QMap<quint32, Tail>::iterator itr = conv.tails.find(segment);
+    if (segment == conv.activeSegment || itr == conv.tails.end() || !itr.value().pending.isEmpty() ||
+        !itr.value().writing.isEmpty()) {
+        return;
+    }
+    conv.tails.erase(itr);
+    unmap(name + QLatin1Char('/') + segmentName(segment));
+}
+
+const MappedSegment* StorePrivate::map(const QString& name, Conversation& conv, quint32 segment)
+{
+    // Maps what is on disk, of a segment with a tail only up to diskSize
+    QMap<quint32, Tail>::const_iterator tail = conv.tails.constFind(segment);
+    QString key                              = name + QLatin1Char('/') + segmentName(segment);
+    QHash<QString, MappedSegment>::iterator itr = maps.find(key);
+    if (itr != maps.end()) {
+        // A segment with a tail may have grown since it was mapped
+        if (tail == conv.tails.constEnd() || itr.value().size == tail.value().diskSize) {
+            mapOrder.removeOne(key);
+            mapOrder.prepend(key);
+            return &itr.value();
+        }
+        unmap(key);
+    }
+
+    QFile* file = new QFile(conv.path + QLatin1Char('/') + segmentName(segment));
+    qint64 size = file->size();
+    if (tail != conv.tails.constEnd()) {
+        size = tail.value().diskSize;
+    }
+    uchar* data = nullptr;
+    if (size < SEGMENT_HEADER_LEN || !file->open(QIODevice::ReadOnly) || !(data = file->map(0, size))) {
+        delete file;
+        return nullptr;
+    }
+
+    while (mapOrder.size() >= MAX_MAPPED_SEGMENTS) {
+        MappedSegment old = maps.take(mapOrder.takeLast());
+        old.file->unmap(old.data);
+        delete old.file;
+    }
+    mapOrder.prepend(key);
+    return &(maps[key] = MappedSegment{file, data, size});
+}
+
+quint32 StorePrivate::segmentSize(const QString& name, Conversation& conv, quint32 segment)
+{
+    QMap<quint32, Tail>::const_iterator tail = conv.tails.constFind(segment);
+    if (tail != conv.tails.constEnd()) {
+        return tail.value().size();
+    }
+    const MappedSegment* seg = map(name, conv, segment);
+    return seg ? static_cast<quint32>(seg->size) : 0;
+}
+
+const uchar* StorePrivate::locate(const QString& name, Conversation& conv, quint32 segment, quint32 offset,
+                                  quint32 len)
+{
+    // len bytes at offset, from the mapped file, the batch with the writer or
+    // what is still pending.  Null if they are not all in one of those
+    QMap<quint32, Tail>::const_iterator tail = conv.tails.constFind(segment);
+    if (tail == conv.tails.constEnd() || offset < tail.value().diskSize) {
+        const MappedSegment* seg = map(name, conv, segment);
+        if (!seg || offset + static_cast<qint64>(len) > seg->size) {
+            return nullptr;
+        }
+        return &seg->data[offset];
+    }
+    offset -= tail.value().diskSize;
+    for (const QByteArray* part : {&tail.value().writing, &tail.value().pending}) {
+        if (offset < static_cast<quint32>(part->size())) {
+            if (offset + static_cast<qint64>(len) > part->size()) {
+                return nullptr;
+            }
+            return reinterpret_cast<const uchar*>(part->constData()) + offset;
+        }
+        offset -= static_cast<quint32>(part->size());
+    }
+    return nullptr;
+}
+
+void StorePrivate::unmap(const QString& key)
+{
+    QHash<QString, MappedSegment>::iterator itr = maps.find(key);
+    if (itr != maps.end()) {
+        itr.value().file->unmap(itr.value().data);
+        delete itr.value().file;
+        maps.erase(itr);
+        mapOrder.removeOne(key);
+    }
+}
+
+void StorePrivate::unmapAll(const QString& prefix)
+{
+    QHash<QString, MappedSegment>::iterator itr = maps.begin();
+    while (itr != maps.end()) {
+        if (prefix.isEmpty() || itr.key().startsWith(prefix + QLatin1Char('/'))) {
+            itr.value().file->unmap(itr.value().data);
+            delete itr.value().file;
+            mapOrder.removeOne(itr.key());
+            itr = maps.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+}
+
+Store::Store(QString directory, QObject* parent) : QObject(parent), d_ptr(new StorePrivate)
+{
+    d_ptr->directory = directory;
+    QDir().mkpath(directory);
+
+    d_ptr->flushTimer = new QTimer(this);
+    d_ptr->flushTimer->setSingleShot(true);
+    d_ptr->flushTimer->setInterval(FLUSH_INTERVAL_MSECS);
+    QObject::connect(d_ptr->flushTimer, &QTimer::timeout, this, &Store::flush);
+
+    d_ptr->writer.reset(new Writer(this));
+    d_ptr->writer->setObjectName("PXMHistory");
+    d_ptr->writer->start();
+}
+
+Store::~Store()
+{
+    d_ptr->sync();
+    d_ptr->writer->stop();
+    d_ptr->unmapAll(QString());
+}
+
+QString Store::directory() const
+{
+    return d_ptr->directory;
+}
+
+Cursor Store::append(const QString& conversation, const QString& text, qint64 msecs)
+{
+    Conversation& conv = d_ptr->open(conversation);
+    QByteArray utf8    = text.toUtf8();
+    quint32 len        = static_cast<quint32>(utf8.size());
+
+    Tail* tail       = &conv.tails[conv.activeSegment];
+    quint32 position = tail->size();
+    if (position + RECORD_OVERHEAD + len > SEGMENT_MAX_BYTES && position > SEGMENT_HEADER_LEN) {
+        // What the old segment still has to write goes out from its own tail
+        quint32 closed = conv.activeSegment++;
+        d_ptr->settle(conversation, conv, closed);
+        tail     = &conv.tails[conv.activeSegment];
+        position = 0;
+    }
+    if (position == 0) {
+        tail->pending.append(SEGMENT_MAGIC, SEGMENT_HEADER_LEN);
+        d_ptr->pendingBytes += SEGMENT_HEADER_LEN;
+        position = SEGMENT_HEADER_LEN;
+    }
+
+    uchar head[12];
+    qToLittleEndian<quint32>(len, head);
+    qToLittleEndian<qint64>(msecs, &head[4]);
+    tail->pending.append(reinterpret_cast<const char*>(head), sizeof(head));
+    tail->pending.append(utf8);
+    tail->pending.append(reinterpret_cast<const char*>(head), 4);
+    d_ptr->pendingBytes += RECORD_OVERHEAD + len;
+
+    if (d_ptr->pendingBytes >= FLUSH_THRESHOLD_BYTES) {
+        flush();
+    } else if (!d_ptr->flushTimer->isActive()) {
+        d_ptr->flushTimer->start();
+    }
+    return Cursor(conv.activeSegment, position);
+}
+
+void Store::flush()
+{
+    d_ptr->flushTimer->stop();
+    d_ptr->collect();
+    d_ptr->submit();
+}
+
+void Store::written()
+{
+    d_ptr->collect();
+    // Whatever came in while the batch was written, or failed to be, goes out
+    // with the next flush
+    if (d_ptr->pendingBytes > 0 && !d_ptr->flushTimer->isActive()) {
+        d_ptr->flushTimer->start();
+    }
+}
+
+QVector<Record> Store::readBefore(const QString& conversation, Cursor cursor, int count)
+{
+    QVector<Record> records;
+    Conversation& conv = d_ptr->open(conversation);
+    if (cursor.isNull()) {
+        cursor = Cursor(conv.activeSegment, d_ptr->segmentSize(conversation, conv, conv.activeSegment));
+    }
+
+    records.reserve(count);
+    while (records.size() < count) {
+        if (cursor.offset <= SEGMENT_HEADER_LEN) {
+            if (cursor.segment == 0) {
+                break;
+            }
+            quint32 previous = d_ptr->segmentSize(conversation, conv, cursor.segment - 1);
+            if (previous < SEGMENT_HEADER_LEN) {
+                break;
+            }
+            cursor = Cursor(cursor.segment - 1, previous);
+            continue;
+        }
+
+        const uchar* trailer = d_ptr->locate(conversation, conv, cursor.segment, cursor.offset - 4, 4);
+        if (!trailer) {
+            break;
+        }
+        quint32 len = qFromLittleEndian<quint32>(trailer);
+        if (cursor.offset < SEGMENT_HEADER_LEN + RECORD_OVERHEAD ||
+            len > cursor.offset - SEGMENT_HEADER_LEN - RECORD_OVERHEAD) {
+            qWarning().noquote() << "Corrupt history record in" << conversation;
+            break;
+        }
+        quint32 start    = cursor.offset - RECORD_OVERHEAD - len;
+        const uchar* raw = d_ptr->locate(conversation, conv, cursor.segment, start, RECORD_OVERHEAD + len);
+        if (!raw) {
+            qWarning().noquote() << "Corrupt history record in" << conversation;
+            break;
+        }
+        Record record;
+        record.msecs    = qFromLittleEndian<qint64>(&raw[4]);
+        record.text     = QString::fromUtf8(reinterpret_cast<const char*>(&raw[12]), len);
+        record.position = Cursor(cursor.segment, start);
+        records.append(record);
+        cursor = record.position;
+    }
+
+    std::reverse(records.begin(), records.end());
+    return records;
+}
+
+Record Store::readAt(const QString& conversation, Cursor cursor)
+{
+    Record record;
+    record.msecs       = 0;
+    Conversation& conv = d_ptr->open(conversation);
+    if (cursor.offset < SEGMENT_HEADER_LEN) {
+        return record;
+    }
+
+    const uchar* head = d_ptr->locate(conversation, conv, cursor.segment, cursor.offset, RECORD_OVERHEAD);
+    if (!head) {
+        return record;
+    }
+    quint32 len      = qFromLittleEndian<quint32>(head);
+    const uchar* raw = d_ptr->locate(conversation, conv, cursor.segment, cursor.offset, RECORD_OVERHEAD + len);
+    if (!raw || qFromLittleEndian<quint32>(&raw[12 + len]) != len) {
+        return record;
+    }
+    record.msecs    = qFromLittleEndian<qint64>(&raw[4]);
+    record.text     = QString::fromUtf8(reinterpret_cast<const char*>(&raw[12]), len);
+    record.position = cursor;
+    return record;
+}
+
+Cursor Store::scan(const QString& directory,
+                   const QString& conversation,
+                   Cursor from,
+                   const std::function<bool(const Record&)>& visitor)
+{
+    QDir dir(directory + QLatin1Char('/') + conversation);
+    QStringList segments = dir.entryList(QStringList() << QStringLiteral("*.seg"), QDir::Files, QDir::Name);
+    Cursor end           = from;
+    if (from.isNull()) {
+        end = Cursor(0, SEGMENT_HEADER_LEN);
+    }
+
+    for (const QString& name : segments) {
+        quint32 segment = name.section(QLatin1Char('.'), 0, 0).toUInt();
+        if (segment < end.segment) {
+            continue;
+        }
+        if (segment > end.segment) {
+            end = Cursor(segment, SEGMENT_HEADER_LEN);
+        }
+
+        QFile file(dir.filePath(name));
+        qint64 size = file.size();
+        uchar* data = nullptr;
+        if (size < SEGMENT_HEADER_LEN || !file.open(QIODevice::ReadOnly) || !(data = file.map(0, size))) {
+            continue;
+        }
+        Record record;
+        while (end.offset + RECORD_OVERHEAD <= size) {
+            quint32 len = qFromLittleEndian<quint32>(&data[end.offset]);
+            if (len > size - end.offset - RECORD_OVERHEAD ||
+                qFromLittleEndian<quint32>(&data[end.offset + 12 + len]) != len) {
+                // Incomplete, probably still being written
+                file.unmap(data);
+                return end;
+            }
+            record.msecs    = qFromLittleEndian<qint64>(&data[end.offset + 4]);
+            record.text     = QString::fromUtf8(reinterpret_cast<const char*>(&data[end.offset + 12]), len);
+            record.position = end;
+            end.offset += RECORD_OVERHEAD + len;
+            if (!visitor(record)) {
+                file.unmap(data);
+                return end;
+            }
+        }
+        file.unmap(data);
+    }
+    return end;
+}
@@ -1,4 +1,5 @@
 #include "pxminireader.h"
+#include "pxmblobcache.h"
 #include "pxmconsts.h"
 #include <QSettings>
 #include <QSize>
@@ -164,3 +165,51 @@ void PXMIniReader::setLogActive(bool status) const
 {
     iniFile->setValue("config/LogActive", status);
 }
+bool PXMIniReader::getHistoryEnabled()
+{
+    if (iniFile->contains("config/HistoryEnabled")) {
+        return iniFile->value("config/HistoryEnabled", true).toBool();
+    }
+    iniFile->setValue("config/HistoryEnabled", true);
+    return true;
+}
+bool PXMIniReader::getLatencyStamps()
+{
+    if (iniFile->contains("config/LatencyStamps")) {
+        return iniFile->value("config/LatencyStamps", false).toBool();
+    }
+    iniFile->setValue("config/LatencyStamps", false);
+    return false;
+}
+QString PXMIniReader::getMetricsSocket()
+{
+    if (iniFile->contains("config/MetricsSocket")) {
+        return iniFile->value("config/MetricsSocket", QString()).toString();
+    }
+    iniFile->setValue("config/MetricsSocket", QString());
+    return QString();
+}
+bool PXMIniReader::getLocalTransport()
+{
+    if (iniFile->contains("config/LocalTransport")) {
+        return iniFile->value("config/LocalTransport", true).toBool();
+    }
+    iniFile->setValue("config/LocalTransport", true);
+    return true;
+}
+bool PXMIniReader::getIoUring()
+{
+    if (iniFile->contains("config/IoUring")) {
+        return iniFile->value("config/IoUring", false).toBool();
+    }
+    iniFile->setValue("config/IoUring", false);
+    return false;
+}
+int PXMIniReader::getBlobCacheMegabytes()
+{
+    if (iniFile->contains("config/BlobCacheMegabytes")) {
+        return qMax(0, iniFile->value("config/BlobCacheMegabytes", PXMBlobCache::DEFAULT_MEGABYTES).toInt());
+    }
+    iniFile->setValue("config/BlobCacheMegabytes", PXMBlobCache::DEFAULT_MEGABYTES);
+    return PXMBlobCache::DEFAULT_MEGABYTES;
+}
@@ -0,0 +1,282 @@
+#include "pxmlatency.h"
+
+#include <QReadLocker>
+#include <QStringBuilder>
+#include <QWriteLocker>
+
+#include <chrono>
+
+using namespace PXMLatency;
+
+namespace
+{
+const double PERCENTILES[]     = {0.5, 0.99, 0.999};
+const char* PERCENTILE_NAMES[] = {"p50", "p99", "p999"};
+
+int highestBit(quint64 value)
+{
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+QString formatMicros(qint64 micros)
+{
+    if (micros < 10000) {
+        return QString::number(micros) % QStringLiteral("us");
+    }
+    return QString::number(static_cast<double>(micros) / 1000.0, 'f', 1) % QStringLiteral("ms");
+}
+
+QString histogramLine(const char* name, const Histogram& histogram)
+{
+    QString line = QStringLiteral("  ") % QString::fromLatin1(name).leftJustified(20) % QStringLiteral(" n=") %
+                   QString::number(histogram.count());
+    for (int i = 0; i < 3; i++) {
+        line.append(QChar(' ') % QLatin1String(PERCENTILE_NAMES[i]) % QChar('=') %
+                    formatMicros(histogram.percentile(PERCENTILES[i])));
+    }
+    line.append(QStringLiteral(" max=") % formatMicros(histogram.maxValue()) % QChar('\n'));
+    return line;
+}
+
+QByteArray histogramJson(const Histogram& histogram)
+{
+    QByteArray json = "{\"count\":" + QByteArray::number(histogram.count());
+    for (int i = 0; i < 3; i++) {
+        json.append(",\"" + QByteArray(PERCENTILE_NAMES[i]) + "_us\":" +
+                    QByteArray::number(histogram.percentile(PERCENTILES[i])));
+    }
+    json.append(",\"max_us\":" + QByteArray::number(histogram.maxValue()) + "}");
+    return json;
+}
+
+QByteArray jsonString(const QString& str)
+{
+    QByteArray out = "\"";
+    for (QChar c : str) {
+        if (c == QLatin1Char('"') || c == QLatin1Char('\\')) {
+            out.append('\\');
+            out.append(c.toLatin1());
+        } else if (c.unicode() < 0x20) {
+            out.append(' ');
+        } else {
+            out.append(QString(c).toUtf8());
+        }
+    }
+    out.append('"');
+    return out;
+}
+}
+
+const char* PXMLatency::stageName(Stage stage)
+{
+    switch (stage) {
+        case SEND_TO_WIRE:
+            return "send_to_wire";
+        case REMOTE_TO_PARSE:
+            return "remote_to_parse";
+        case WIRE_TO_PARSE:
+            return "wire_to_parse";
+        case PARSE_TO_WORKER:
+            return "parse_to_worker";
+        case WORKER_TO_RENDERED:
+            return "worker_to_rendered";
+        default:
+            return "unknown";
+    }
+}
+
+qint64 PXMLatency::monotonicMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+qint64 PXMLatency::wallMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+QByteArray PXMLatency::stamp(const QByteArray& msg)
+{
+    QByteArray out;
+    out.reserve(STAMP_LENGTH + msg.size());
+    quint64 now = static_cast<quint64>(wallMicros());
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out.append(static_cast<char>((now >> shift) & 0xFF));
+    }
+    out.append(msg);
+    return out;
+}
+
+qint64 PXMLatency::readStamp(const unsigned char* buf)
+{
+    quint64 value = 0;
+    for (int i = 0; i < STAMP_LENGTH; i++) {
+        value = (value << 8) | buf[i];
+    }
+    return static_cast<qint64>(value);
+}
+
+Histogram::Histogram() : total(0), max(0)
+{
+    for (std::atomic<quint64>& count : counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+int Histogram::bucketFor(quint64 value)
+{
+    if (value < static_cast<quint64>(LINEAR_MAX)) {
+        return static_cast<int>(value);
+    }
+    if (value >= (Q_UINT64_C(1) << MAX_BIT)) {
+        return BUCKETS - 1;
+    }
+    int bit   = highestBit(value);
+    int shift = bit - SUB_BITS;
+    int sub   = static_cast<int>((value >> shift) & ((1 << SUB_BITS) - 1));
+    return LINEAR_MAX + (bit - SUB_BITS - 1) * (1 << SUB_BITS) + sub;
+}
+
+quint64 Histogram::bucketLowerBound(int bucket)
+{
+    if (bucket < LINEAR_MAX) {
+        return static_cast<quint64>(bucket);
+    }
+    int offset = bucket - LINEAR_MAX;
+    int bit    = offset / (1 << SUB_BITS) + SUB_BITS + 1;
+    int sub    = offset % (1 << SUB_BITS);
+    return static_cast<quint64>((1 << SUB_BITS) + sub) << (bit - SUB_BITS);
+}
+
+quint64 Histogram::bucketUpperBound(int bucket)
+{
+    if (bucket < LINEAR_MAX) {
+        return static_cast<quint64>(bucket);
+    }
+    int bit = (bucket - LINEAR_MAX) / (1 << SUB_BITS) + SUB_BITS + 1;
+    return bucketLowerBound(bucket) + (Q_UINT64_C(1) << (bit - SUB_BITS)) - 1;
+}
+
+void Histogram::record(qint64 micros)
+{
+    quint64 value = micros > 0 ? static_cast<quint64>(micros) : 0;
+    counts[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    quint64 current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+qint64 Histogram::percentile(double fraction) const
+{
+    quint64 n = count();
+    if (n == 0) {
+        return 0;
+    }
+    quint64 target = static_cast<quint64>(fraction * static_cast<double>(n) + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+    quint64 seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return static_cast<qint64>(qMin(bucketUpperBound(i), static_cast<quint64>(maxValue())));
+        }
+    }
+    return maxValue();
+}
+
+Recorder* Recorder::instance()
+{
+    static Recorder* recorder = new Recorder;
+    return recorder;
+}
+
+Recorder::PeerHistograms* Recorder::peer(const QUuid& uuid)
+{
+    {
+        QReadLocker locker(&peersLock);
+        QHash<QUuid, QSharedPointer<PeerHistograms>>::const_iterator itr = peers.constFind(uuid);
+        if (itr != peers.constEnd()) {
+            return itr.value().data();
+        }
+    }
+    QWriteLocker locker(&peersLock);
+    QSharedPointer<PeerHistograms>& histograms = peers[uuid];
+    if (!histograms) {
+        histograms.reset(new PeerHistograms);
+    }
+    return histograms.data();
+}
+
+void Recorder::record(Stage stage, const QUuid& uuid, qint64 micros)
+{
+    overall[stage].record(micros);
+    if (!uuid.isNull()) {
+        peer(uuid)->stages[stage].record(micros);
+    }
+}
+
+QString Recorder::summary(const QHash<QUuid, QString>& names) const
+{
+    QString str = QStringLiteral("---Latency---\n") % QStringLiteral("Overall:\n");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (overall[i].count()) {
+            str.append(histogramLine(stageName(static_cast<Stage>(i)), overall[i]));
+        }
+    }
+
+    QReadLocker locker(&peersLock);
+    for (auto itr = peers.constBegin(); itr != peers.constEnd(); ++itr) {
+        str.append(names.value(itr.key(), itr.key().toString()) % QStringLiteral(":\n"));
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            if (itr.value()->stages[i].count()) {
+                str.append(histogramLine(stageName(static_cast<Stage>(i)), itr.value()->stages[i]));
+            }
+        }
+    }
+    return str;
+}
+
+QByteArray Recorder::toJson(const QHash<QUuid, QString>& names) const
+{
+    QByteArray json = "{\"overall\":{";
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (i) {
+            json.append(',');
+        }
+        json.append("\"" + QByteArray(stageName(static_cast<Stage>(i))) + "\":" + histogramJson(overall[i]));
+    }
+    json.append("},\"peers\":[");
+
+    QReadLocker locker(&peersLock);
+    bool first = true;
+    for (auto itr = peers.constBegin(); itr != peers.constEnd(); ++itr) {
+        if (!first) {
+            json.append(',');
+        }
+        first = false;
+        json.append("{\"uuid\":" + jsonString(itr.key().toString()) + ",\"name\":" +
+                    jsonString(names.value(itr.key())));
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            json.append(",\"" + QByteArray(stageName(static_cast<Stage>(i))) + "\":" +
+                        histogramJson(itr.value()->stages[i]));
+        }
+        json.append('}');
+    }
+    json.append("]}\n");
+    return json;
+}
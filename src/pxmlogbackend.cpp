@@ -0,0 +1,349 @@
+#include "pxmlogbackend.h"
+#include "pxmconsts.h"
+#include "pxmlog.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutexLocker>
+#include <QStringBuilder>
+#include <QTime>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace PXMLog;
+
+Q_LOGGING_CATEGORY(pxmNet, "pxm.net")
+Q_LOGGING_CATEGORY(pxmPacket, "pxm.packet")
+
+int ConsoleEvent::type = QEvent::registerEventType();
+
+Ring::Ring() : cells(new Slot[RING_SIZE]), enqueuePos(0), dequeuePos(0)
+{
+    for (size_t i = 0; i < static_cast<size_t>(RING_SIZE); i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool Ring::push(Entry&& entry)
+{
+    Slot* slot;
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        slot                = &cells[pos & (RING_SIZE - 1)];
+        size_t seq          = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (difference == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // Full
+            return false;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    slot->entry = std::move(entry);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool Ring::pop(Entry& entry)
+{
+    Slot* slot;
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        slot                = &cells[pos & (RING_SIZE - 1)];
+        size_t seq          = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (difference == 0) {
+            if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // Empty
+            return false;
+        } else {
+            pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+    entry = std::move(slot->entry);
+    slot->entry.msg = QString();
+    slot->sequence.store(pos + RING_SIZE, std::memory_order_release);
+    return true;
+}
+
+size_t Ring::sizeApprox() const
+{
+    size_t enq = enqueuePos.load(std::memory_order_relaxed);
+    size_t deq = dequeuePos.load(std::memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+}
+
+Backend::Backend() : QThread(), verbosity(0), fileLogging(false), running(false), dropped(0), consoleSink(nullptr)
+{
+    this->setObjectName("PXMLogWriter");
+#ifdef __WIN32
+    logPath = QDir::currentPath() + "/log.txt";
+#else
+    logPath = QDir::homePath() + "/.pxmessenger-log";
+#endif
+}
+
+Backend::~Backend()
+{
+    stop();
+}
+
+Backend* Backend::instance()
+{
+    static Backend* backend = new Backend;
+    return backend;
+}
+
+bool Backend::isEnabled(QtMsgType type) const
+{
+    switch (verbosity.load(std::memory_order_relaxed)) {
+        case 0:
+            return type != QtDebugMsg && type != QtWarningMsg;
+        case 1:
+            return type != QtDebugMsg;
+        default:
+            return true;
+    }
+}
+
+QByteArray Backend::format(const Entry& entry)
+{
+    const char* label = "";
+    switch (entry.type) {
+        case QtDebugMsg:
+            label = "DEBUG: ";
+            break;
+        case QtWarningMsg:
+            label = "WARN:  ";
+            break;
+        case QtCriticalMsg:
+            label = "CRIT:  ";
+            break;
+        case QtFatalMsg:
+            label = "FATAL: ";
+            break;
+        case QtInfoMsg:
+            label = "INFO:  ";
+            break;
+    }
+
+    QByteArray msg = entry.msg.toUtf8();
+    QByteArray out;
+    out.reserve(msg.size() + 24 + static_cast<int>(PXMConsts::DEBUG_PADDING));
+
+    int ms = entry.msecsOfDay;
+    char stamp[24];
+    snprintf(stamp, sizeof(stamp), "[%02d:%02d:%02d:%03d] ", ms / 3600000, (ms / 60000) % 60, (ms / 1000) % 60,
+             ms % 1000);
+    out.append(stamp);
+    out.append(label);
+
+#ifdef QT_DEBUG
+    if (entry.file) {
+        const char* base = entry.file;
+        for (const char* c = entry.file; *c; c++) {
+            if (*c == '/' || *c == '\\') {
+                base = c + 1;
+            }
+        }
+        int start = out.size();
+        out.append(base);
+        out.append(':');
+        out.append(QByteArray::number(entry.line));
+        int padding = static_cast<int>(PXMConsts::DEBUG_PADDING) - (out.size() - start);
+        if (padding > 0) {
+            out.append(padding, ' ');
+        }
+    }
+#endif /* end QT_DEBUG */
+
+    out.append(msg);
+    out.append('\n');
+    return out;
+}
+
+void Backend::log(QtMsgType type, const QMessageLogContext& context, const QString& msg)
+{
+    if (!isEnabled(type)) {
+        return;
+    }
+
+    Entry entry{type, QTime::currentTime().msecsSinceStartOfDay(), context.file, context.line, msg};
+
+    if (type == QtFatalMsg) {
+        // Get whatever is still queued out before dying
+        Entry queued;
+        while (ring.pop(queued)) {
+            fputs(format(queued).constData(), stderr);
+        }
+        fputs(format(entry).constData(), stderr);
+        fflush(stderr);
+        abort();
+    }
+
+    if (!running.load(std::memory_order_acquire)) {
+        fputs(format(entry).constData(), stderr);
+        return;
+    }
+
+    if (!ring.push(std::move(entry))) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        wakeCondition.wakeOne();
+        return;
+    }
+    if (ring.sizeApprox() >= static_cast<size_t>(WAKE_THRESHOLD)) {
+        wakeCondition.wakeOne();
+    }
+}
+
+void Backend::setVerbosityLevel(int level)
+{
+    verbosity.store(level, std::memory_order_relaxed);
+
+    // Switch the categories off at the source as well so callers skip
+    // building messages that would be dropped here anyway
+    switch (level) {
+        case 0:
+            QLoggingCategory::setFilterRules(QStringLiteral("pxm.*.debug=false\npxm.*.warning=false"));
+            break;
+        case 1:
+            QLoggingCategory::setFilterRules(QStringLiteral("pxm.*.debug=false\npxm.*.warning=true"));
+            break;
+        default:
+            QLoggingCategory::setFilterRules(QStringLiteral("pxm.*.debug=true\npxm.*.warning=true"));
+            break;
+    }
+}
+
+void Backend::setFileLogging(bool enabled)
+{
+    fileLogging.store(enabled, std::memory_order_relaxed);
+    wakeCondition.wakeOne();
+}
+
+void Backend::startWriter()
+{
+    if (running.exchange(true)) {
+        return;
+    }
+    setVerbosityLevel(verbosityLevel());
+    this->start(QThread::LowPriority);
+}
+
+void Backend::stop()
+{
+    if (!running.exchange(false)) {
+        return;
+    }
+    wakeCondition.wakeOne();
+    this->wait();
+
+    // Anything that slipped in after the writer's last pass
+    Entry entry;
+    while (ring.pop(entry)) {
+        fputs(format(entry).constData(), stderr);
+    }
+}
+
+namespace
+{
+void rotate(QFile& file)
+{
+    QString path = file.fileName();
+    file.close();
+    QFile::remove(path % QChar('.') % QString::number(ROTATE_COUNT));
+    for (int i = ROTATE_COUNT - 1; i > 0; i--) {
+        QFile::rename(path % QChar('.') % QString::number(i), path % QChar('.') % QString::number(i + 1));
+    }
+    QFile::rename(path, path % QStringLiteral(".1"));
+    file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+}
+}
+
+void Backend::run()
+{
+    QFile file(logPath);
+    QByteArray batch;
+    QVector<ConsoleEvent::Line> console;
+    QElapsedTimer consoleTimer;
+    consoleTimer.start();
+
+    for (;;) {
+        bool stopping = !running.load(std::memory_order_acquire);
+
+        bool wantFile = fileLogging.load(std::memory_order_relaxed);
+        if (wantFile && !file.isOpen()) {
+            file.remove();
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                fprintf(stderr, "Could not open log file %s\n", qPrintable(logPath));
+                fileLogging.store(false, std::memory_order_relaxed);
+            }
+        } else if (!wantFile && file.isOpen()) {
+            file.close();
+        }
+
+        QObject* sink = consoleSink.load();
+        Entry entry;
+        while (ring.pop(entry)) {
+            QByteArray line = format(entry);
+            batch.append(line);
+            if (sink) {
+                console.append(ConsoleEvent::Line{entry.type, QString::fromUtf8(line)});
+            }
+        }
+        quint64 lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost) {
+            batch.append("Log ring full, dropped ");
+            batch.append(QByteArray::number(lost));
+            batch.append(" messages\n");
+        }
+
+        if (!batch.isEmpty()) {
+            fwrite(batch.constData(), 1, static_cast<size_t>(batch.size()), stderr);
+            fflush(stderr);
+            if (file.isOpen()) {
+                file.write(batch);
+                file.flush();
+                if (file.size() > ROTATE_BYTES) {
+                    rotate(file);
+                }
+            }
+            // Keeps the capacity for the next batch
+            batch.resize(0);
+        }
+
+        if (console.size() > CONSOLE_MAX_LINES) {
+            console.remove(0, console.size() - CONSOLE_MAX_LINES);
+        }
+        if (!console.isEmpty() && sink && QCoreApplication::instance() &&
+            (stopping || consoleTimer.elapsed() >= CONSOLE_INTERVAL_MSECS)) {
+            QCoreApplication::postEvent(sink, new ConsoleEvent(console), Qt::LowEventPriority);
+            console.clear();
+            consoleTimer.restart();
+        }
+
+        if (stopping) {
+            break;
+        }
+
+        QMutexLocker locker(&wakeMutex);
+        if (ring.sizeApprox() < static_cast<size_t>(WAKE_THRESHOLD) && running.load(std::memory_order_acquire)) {
+            wakeCondition.wait(&wakeMutex, FLUSH_INTERVAL_MSECS);
+        }
+    }
+
+    if (file.isOpen()) {
+        file.close();
+    }
+}
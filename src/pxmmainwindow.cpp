@@ -1,6 +1,11 @@
 #include "pxmmainwindow.h"
 #include "pxmconsole.h"
+#include "pxmformatter.h"
 #include "pxminireader.h"
+#include "pxmlatency.h"
+#include "pxmpeerlist.h"
+#include "pxmtrace.h"
+#include "pxmtransfer.h"
 #include "ui_pxmaboutdialog.h"
 #include "ui_pxmmainwindow.h"
 #include "ui_pxmsettingsdialog.h"
@@ -18,14 +23,21 @@
 #include <QCloseEvent>
 #include <QDateTime>
 #include <QDebug>
-#include <QListWidget>
+#include <QFileDialog>
+#include <QInputDialog>
+#include <QItemSelectionModel>
+#include <QListView>
 #include <QMenu>
 #include <QMessageBox>
 #include <QSound>
+#include <QStandardPaths>
+#include <QStatusBar>
 #include <QStringBuilder>
 #include <QScopedPointer>
 #include <QDir>
+#include <QTextBrowser>
 #include <QTextEdit>
+#include <QVBoxLayout>
 #include <QKeyEvent>
 
 using namespace PXMMessageViewer;
@@ -63,20 +75,28 @@ PXMWindow::~PXMWindow()
 void PXMWindow::setupMenuBar()
 {
     QMenu* fileMenu;
-    QAction* quitAction = new QAction("&Quit", this);
+    QAction* sendFileAction = new QAction("Send &File...", this);
+    QAction* quitAction     = new QAction("&Quit", this);
 
     fileMenu = menuBar()->addMenu("&File");
+    fileMenu->addAction(sendFileAction);
+    fileMenu->addSeparator();
     fileMenu->addAction(quitAction);
+    QObject::connect(sendFileAction, &QAction::triggered, this, &PXMWindow::sendFileActionSlot);
     QObject::connect(quitAction, &QAction::triggered, this, &PXMWindow::quitButtonClicked);
 
     QMenu* optionsMenu;
     QAction* settingsAction = new QAction("&Settings", this);
     QAction* bloomAction    = new QAction("&Bloom", this);
+    QAction* searchAction   = new QAction("Search &History", this);
+    searchAction->setShortcut(QKeySequence::Find);
     optionsMenu             = menuBar()->addMenu("&Tools");
     optionsMenu->addAction(settingsAction);
     optionsMenu->addAction(bloomAction);
+    optionsMenu->addAction(searchAction);
     QObject::connect(settingsAction, &QAction::triggered, this, &PXMWindow::settingsActionsSlot);
     QObject::connect(bloomAction, &QAction::triggered, this, &PXMWindow::bloomActionsSlot);
+    QObject::connect(searchAction, &QAction::triggered, this, &PXMWindow::searchActionSlot);
 
     QMenu* helpMenu;
     QAction* aboutAction = new QAction("&About", this);
@@ -90,18 +110,15 @@ void PXMWindow::setupMenuBar()
 
 void PXMWindow::initListWidget()
 {
-    ui->listWidget->setSortingEnabled(false);
-    ui->listWidget->insertItem(0, QStringLiteral("Global Chat"));
-    QListWidgetItem* seperator = new QListWidgetItem(ui->listWidget);
-    seperator->setSizeHint(QSize(200, 10));
-    seperator->setFlags(Qt::NoItemFlags);
-    ui->listWidget->insertItem(1, seperator);
-    fsep = new QFrame(ui->listWidget);
+    peerModel = new PXMPeerList::Model(globalChatUuid, this);
+    peerProxy = new PXMPeerList::FilterProxy(this);
+    peerProxy->setSourceModel(peerModel);
+    peerProxy->sort(0);
+    ui->peerListView->setModel(peerProxy);
+    fsep = new QFrame(ui->peerListView);
     fsep->setFrameStyle(QFrame::HLine | QFrame::Plain);
     fsep->setLineWidth(2);
-    ui->listWidget->setItemWidget(seperator, fsep);
-    ui->listWidget->item(0)->setData(Qt::UserRole, globalChatUuid);
-    ui->stackedWidget->addWidget(new TextWidget(ui->stackedWidget, globalChatUuid));
+    ui->peerListView->setIndexWidget(peerProxy->mapFromSource(peerModel->seperatorIndex()), fsep);
 }
 void PXMWindow::createSystemTray()
 {
@@ -139,8 +156,12 @@ void PXMWindow::connectGuiSignalsAndSlots()
 {
     QObject::connect(ui->sendButton, &QAbstractButton::clicked, this, &PXMWindow::sendButtonClicked);
     QObject::connect(ui->quitButton, &QAbstractButton::clicked, this, &PXMWindow::quitButtonClicked);
-    QObject::connect(ui->listWidget, &QListWidget::currentItemChanged, this, &PXMWindow::currentItemChanged);
+    QObject::connect(ui->peerListView->selectionModel(), &QItemSelectionModel::currentChanged, this,
+                     &PXMWindow::currentItemChanged);
+    QObject::connect(ui->searchLineEdit, &QLineEdit::textChanged, peerProxy,
+                     &QSortFilterProxyModel::setFilterFixedString);
     QObject::connect(ui->textEdit, &PXMTextEdit::returnPressed, this, &PXMWindow::sendButtonClicked);
+    QObject::connect(ui->stackedWidget, &StackedWidget::historyRequested, this, &PXMWindow::requestHistoryPage);
     QObject::connect(sysTray, &QSystemTrayIcon::activated, this, &PXMWindow::systemTrayAction);
     QObject::connect(sysTray, &QObject::destroyed, sysTrayMenu, &QObject::deleteLater);
     QObject::connect(ui->textEdit, &QTextEdit::textChanged, this, &PXMWindow::textEditChanged);
@@ -188,6 +209,141 @@ void PXMWindow::bloomActionsSlot()
     }
 }
 
+void PXMWindow::searchActionSlot()
+{
+    bool ok;
+    QString query = QInputDialog::getText(this, "Search History",
+                                          "Words to find, end a word with * to match a prefix "
+                                          "and use \"quotes\" for a phrase:",
+                                          QLineEdit::Normal, QString(), &ok);
+    if (ok && !query.trimmed().isEmpty()) {
+        emit searchHistory(query);
+    }
+}
+
+void PXMWindow::searchResults(QString query, QStringList results)
+{
+    if (results.isEmpty()) {
+        QMessageBox::information(this, "Search History", "No messages found for " % query.toHtmlEscaped());
+        return;
+    }
+    QDialog* dialog = new QDialog(this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->setWindowTitle("Search History: " % query);
+    dialog->resize(600, 400);
+    QTextBrowser* browser = new QTextBrowser(dialog);
+    // Each result is a whole html document, append() gives each its own block
+    for (const QString& result : results) {
+        browser->append(result);
+    }
+    browser->moveCursor(QTextCursor::Start);
+    QVBoxLayout* layout = new QVBoxLayout(dialog);
+    layout->addWidget(browser);
+    dialog->show();
+}
+
+void PXMWindow::sendFileActionSlot()
+{
+    QUuid uuid = ui->peerListView->currentIndex().data(PXMPeerList::UuidRole).toUuid();
+    QString title;
+    // Global Chat, or nothing selected, offers it to everyone
+    if (uuid.isNull() || uuid == globalChatUuid) {
+        uuid  = globalChatUuid;
+        title = "Send File to everyone";
+    } else {
+        title = "Send File to " % peerModel->hostname(uuid);
+    }
+    QString path = QFileDialog::getOpenFileName(this, title);
+    if (!path.isEmpty()) {
+        emit offerFile(path, uuid);
+    }
+}
+
+void PXMWindow::fileOffered(QUuid id, QUuid uuid, QString hostname, QString name, qint64 size)
+{
+    Q_UNUSED(uuid);
+    // Offers wait their turn instead of stacking prompts on top of each other
+    offers.append(Offer{id, hostname, name, size});
+    if (!offerPrompt) {
+        showNextOffer();
+    }
+}
+
+void PXMWindow::showNextOffer()
+{
+    if (offers.isEmpty()) {
+        return;
+    }
+    const Offer& offer = offers.first();
+    QString question   = offer.hostname.toHtmlEscaped() % " wants to send you " % offer.name.toHtmlEscaped() % " (" %
+                         PXMTransfer::sizeString(offer.size) % ")";
+    QMessageBox* box = new QMessageBox(QMessageBox::Question, "Incoming File", question,
+                                       QMessageBox::Yes | QMessageBox::No, this);
+    box->setAttribute(Qt::WA_DeleteOnClose);
+    box->setWindowModality(Qt::NonModal);
+    QObject::connect(box, &QMessageBox::finished, this, [this](int result) {
+        if (result != QMessageBox::Yes) {
+            answerFirstOffer(QString());
+            return;
+        }
+        QString suggestion = QDir(QStandardPaths::writableLocation(QStandardPaths::DownloadLocation))
+                                 .filePath(offers.first().name);
+        QFileDialog* dialog = new QFileDialog(this, "Save File", suggestion);
+        dialog->setAttribute(Qt::WA_DeleteOnClose);
+        dialog->setAcceptMode(QFileDialog::AcceptSave);
+        dialog->setWindowModality(Qt::NonModal);
+        QObject::connect(dialog, &QFileDialog::finished, this, [this, dialog](int saveResult) {
+            QStringList files = dialog->selectedFiles();
+            answerFirstOffer(saveResult == QDialog::Accepted && !files.isEmpty() ? files.first() : QString());
+        });
+        offerPrompt = dialog;
+        dialog->show();
+    });
+    offerPrompt = box;
+    box->show();
+}
+
+void PXMWindow::answerFirstOffer(QString path)
+{
+    if (offers.isEmpty()) {
+        return;
+    }
+    emit answerOffer(offers.takeFirst().id, path);
+    offerPrompt = nullptr;
+    showNextOffer();
+}
+
+void PXMWindow::transferProgress(QUuid id, QString description, qint64 done, qint64 size)
+{
+    Q_UNUSED(id);
+    int percent = size > 0 ? static_cast<int>(done * 100 / size) : 100;
+    statusBar()->showMessage(description % ": " % PXMTransfer::sizeString(done) % " of " %
+                             PXMTransfer::sizeString(size) % " (" % QString::number(percent) % "%)");
+}
+
+void PXMWindow::transferFinished(QUuid id, bool ok, QString description)
+{
+    Q_UNUSED(ok);
+    statusBar()->showMessage(description, 10000);
+
+    // An offer that ends before it is answered, the sender cancelled or went
+    // away, is no longer asked about
+    for (int i = 0; i < offers.size(); i++) {
+        if (offers.at(i).id != id) {
+            continue;
+        }
+        offers.removeAt(i);
+        if (i == 0 && offerPrompt) {
+            // Closing the prompt must not answer the offer that replaced it
+            QObject::disconnect(offerPrompt.data(), nullptr, this, nullptr);
+            offerPrompt->close();
+            offerPrompt = nullptr;
+            showNextOffer();
+        }
+        break;
+    }
+}
+
 void PXMWindow::warnBox(QString title, QString msg)
 {
     QMessageBox::warning(this, title, msg);
@@ -203,22 +359,19 @@ void PXMWindow::debugActionSlot()
 
 void PXMWindow::setItalicsOnItem(QUuid uuid, bool italics)
 {
-    for (int i = 0; i < ui->listWidget->count(); i++) {
-        if (ui->listWidget->item(i)->data(Qt::UserRole) == uuid) {
-            QFont mfont = ui->listWidget->item(i)->font();
-            if (mfont.italic() == italics)
-                return;
-            mfont.setItalic(italics);
-            ui->listWidget->item(i)->setFont(mfont);
-            QString changeInConnection;
-            if (italics)
-                changeInConnection = " disconnected";
-            else
-                changeInConnection = " reconnected";
-            emit addMessageToPeer(ui->listWidget->item(i)->text() % changeInConnection, uuid, false, true);
-            return;
-        }
+    if (!peerModel->setItalic(uuid, italics)) {
+        return;
     }
+    QString changeInConnection;
+    if (italics)
+        changeInConnection = " disconnected";
+    else
+        changeInConnection = " reconnected";
+    emit addMessageToPeer(peerModel->hostname(uuid) % changeInConnection, uuid, false, true);
+}
+void PXMWindow::peerDisconnected(QUuid uuid)
+{
+    setItalicsOnItem(uuid, true);
 }
 void PXMWindow::textEditChanged()
 {
@@ -255,16 +408,17 @@ void PXMWindow::changeEvent(QEvent* event)
     }
     QMainWindow::changeEvent(event);
 }
-void PXMWindow::currentItemChanged(QListWidgetItem* item1)
+void PXMWindow::currentItemChanged(const QModelIndex& current)
 {
-    QUuid uuid = item1->data(Qt::UserRole).toString();
+    QUuid uuid = current.data(PXMPeerList::UuidRole).toUuid();
 
-    if (item1->background() != QGuiApplication::palette().base()) {
+    if (peerModel->alert(uuid)) {
         this->changeListItemColor(uuid, 0);
     }
     if (ui->stackedWidget->switchToUuid(uuid)) {
         // Some Exception here
     }
+    peerModel->setUnread(uuid, 0);
     return;
 }
 void PXMWindow::quitButtonClicked()
@@ -273,33 +427,17 @@ void PXMWindow::quitButtonClicked()
 }
 void PXMWindow::updateListWidget(QUuid uuid, QString hostname)
 {
-    ui->listWidget->setUpdatesEnabled(false);
-    for (int i = 2; i < ui->listWidget->count(); i++) {
-        if (ui->listWidget->item(i)->data(Qt::UserRole).toUuid() == uuid) {
-            if (ui->listWidget->item(i)->text() != hostname) {
-                emit addMessageToPeer(ui->listWidget->item(i)->text() % " has changed their name to " % hostname, uuid,
-                                      false, false);
-                ui->listWidget->item(i)->setText(hostname);
-                QListWidgetItem* global = ui->listWidget->takeItem(0);
-                ui->listWidget->sortItems();
-                ui->listWidget->insertItem(0, global);
-            }
-            setItalicsOnItem(uuid, 0);
-            ui->listWidget->setUpdatesEnabled(true);
-            return;
+    if (peerModel->contains(uuid)) {
+        QString oldHostname = peerModel->hostname(uuid);
+        if (oldHostname != hostname) {
+            emit addMessageToPeer(oldHostname % " has changed their name to " % hostname, uuid, false, false);
+            peerModel->setHostname(uuid, hostname);
         }
+        setItalicsOnItem(uuid, 0);
+        return;
     }
 
-    QListWidgetItem* global = ui->listWidget->takeItem(0);
-    QListWidgetItem* item   = new QListWidgetItem(hostname, ui->listWidget);
-
-    item->setData(Qt::UserRole, uuid);
-    ui->listWidget->addItem(item);
-    ui->stackedWidget->addWidget(new TextWidget(ui->stackedWidget, uuid));
-    ui->listWidget->sortItems();
-    ui->listWidget->insertItem(0, global);
-
-    ui->listWidget->setUpdatesEnabled(true);
+    peerModel->addPeer(uuid, hostname);
 }
 
 void PXMWindow::closeEvent(QCloseEvent* event)
@@ -321,34 +459,20 @@ void PXMWindow::closeEvent(QCloseEvent* event)
     debugWindow->hide();
     event->accept();
 }
-int PXMWindow::removeBodyFormatting(QByteArray& str)
-{
-    QRegularExpression qre("((?<=<body) style.*?\"(?=>))");
-    QRegularExpressionMatch qrem = qre.match(str);
-    if (qrem.hasMatch()) {
-        int startoffset = qrem.capturedStart(1);
-        int endoffset   = qrem.capturedEnd(1);
-        str.remove(startoffset, endoffset - startoffset);
-        return 0;
-    } else
-        return -1;
-}
-
 int PXMWindow::sendButtonClicked()
 {
-    if (!ui->listWidget->currentItem()) {
+    if (!ui->peerListView->currentIndex().isValid()) {
         return -1;
     }
 
     if (!(ui->textEdit->toPlainText().isEmpty())) {
         QByteArray msg = ui->textEdit->toHtml().toUtf8();
-        if (removeBodyFormatting(msg)) {
+        if (PXMFormatter::removeBodyFormatting(msg)) {
             qWarning() << "Bad Html";
             qWarning() << msg;
             return -1;
         }
-        int index                = ui->listWidget->currentRow();
-        QUuid uuidOfSelectedItem = ui->listWidget->item(index)->data(Qt::UserRole).toString();
+        QUuid uuidOfSelectedItem = ui->peerListView->currentIndex().data(PXMPeerList::UuidRole).toUuid();
 
         if (uuidOfSelectedItem.isNull())
             return -1;
@@ -369,16 +493,7 @@ int PXMWindow::sendButtonClicked()
 }
 int PXMWindow::changeListItemColor(QUuid uuid, int style)
 {
-    for (int i = 0; i < ui->listWidget->count(); i++) {
-        if (ui->listWidget->item(i)->data(Qt::UserRole) == uuid) {
-            if (!style)
-                ui->listWidget->item(i)->setBackground(QGuiApplication::palette().base());
-            else {
-                ui->listWidget->item(i)->setBackground(QBrush(QColor(0xFFCD5C5C)));
-            }
-            break;
-        }
-    }
+    peerModel->setAlert(uuid, style);
     return 0;
 }
 int PXMWindow::focusWindow()
@@ -402,27 +517,38 @@ int PXMWindow::focusWindow()
     }
     return 0;
 }
-int PXMWindow::printToTextBrowser(QSharedPointer<QString> str, QUuid uuid, bool alert)
+int PXMWindow::printToTextBrowser(QSharedPointer<QString> str, QUuid uuid, bool alert, qint64 workerMicros)
 {
+    PXM_TRACE_SCOPE("printToTextBrowser");
     if (str->isEmpty()) {
         return -1;
     }
     if (alert) {
-        if (ui->listWidget->currentItem()) {
-            if (ui->listWidget->currentItem()->data(Qt::UserRole) != uuid) {
-                changeListItemColor(uuid, 1);
-            }
-        } else {
+        if (ui->peerListView->currentIndex().data(PXMPeerList::UuidRole).toUuid() != uuid) {
             changeListItemColor(uuid, 1);
         }
+        // Pages are normally built the first time a conversation is opened,
+        // an alert is the exception since the user is about to look at it
+        ui->stackedWidget->createPage(uuid);
         this->focusWindow();
     }
 
     ui->stackedWidget->append(*str.data(), uuid);
 
+    peerModel->setUnread(uuid, ui->stackedWidget->unreadCount(uuid));
+
+    if (workerMicros) {
+        PXMLatency::Recorder::instance()->record(PXMLatency::WORKER_TO_RENDERED, uuid,
+                                                 PXMLatency::monotonicMicros() - workerMicros);
+    }
     return 0;
 }
 
+void PXMWindow::historyPage(QUuid uuid, QStringList page, PXMHistory::Cursor next, bool more)
+{
+    ui->stackedWidget->historyPage(uuid, page, next, more);
+}
+
 PXMAboutDialog::PXMAboutDialog(QWidget* parent, QIcon icon) : QDialog(parent), ui(new Ui::PXMAboutDialog), icon(icon)
 {
     ui->setupUi(this);
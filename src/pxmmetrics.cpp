@@ -0,0 +1,297 @@
+#include "pxmmetrics.h"
+
+#include <QVector>
+
+#include "pxmlatency.h"
+#include "pxmlogbackend.h"
+
+using namespace PXMMetrics;
+
+namespace
+{
+// Metrics are globals, the registry has to exist before the first of them
+QVector<Metric*>& registry()
+{
+    static QVector<Metric*> metrics;
+    return metrics;
+}
+
+const char* kindName(Metric::Kind kind)
+{
+    switch (kind) {
+        case Metric::COUNTER:
+            return "counter";
+        case Metric::GAUGE:
+            return "gauge";
+        case Metric::HISTOGRAM:
+            return "histogram";
+    }
+    return "untyped";
+}
+
+void sample(QByteArray& out, const char* name, const char* suffix, const QByteArray& labels, const QByteArray& value)
+{
+    out.append(name);
+    out.append(suffix);
+    if (!labels.isEmpty()) {
+        out.append('{');
+        out.append(labels);
+        out.append('}');
+    }
+    out.append(' ');
+    out.append(value);
+    out.append('\n');
+}
+
+int highestBit(quint64 value)
+{
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+qint64 logQueueDepth()
+{
+    return static_cast<qint64>(PXMLog::Backend::instance()->queueDepth());
+}
+
+qint64 logDropped()
+{
+    return static_cast<qint64>(PXMLog::Backend::instance()->droppedCount());
+}
+}
+
+Metric::Metric(const char* name, const char* help, Kind kind, const char* labels)
+    : name(name), help(help), kind(kind), labels(labels)
+{
+    registry().append(this);
+}
+
+Counter::Counter(const char* name, const char* help, const char* labels)
+    : Metric(name, help, COUNTER, labels), value(0)
+{
+}
+
+void Counter::renderSamples(QByteArray& out) const
+{
+    sample(out, name, "", labels, QByteArray::number(get()));
+}
+
+Gauge::Gauge(const char* name, const char* help, const char* labels) : Metric(name, help, GAUGE, labels), value(0)
+{
+}
+
+void Gauge::renderSamples(QByteArray& out) const
+{
+    sample(out, name, "", labels, QByteArray::number(get()));
+}
+
+Callback::Callback(const char* name, const char* help, Kind kind, qint64 (*read)())
+    : Metric(name, help, kind), read(read)
+{
+}
+
+void Callback::renderSamples(QByteArray& out) const
+{
+    sample(out, name, "", labels, QByteArray::number(read()));
+}
+
+TypeCounter::TypeCounter(const char* name, const char* help) : Metric(name, help, COUNTER)
+{
+    for (std::atomic<quint64>& value : values) {
+        value.store(0, std::memory_order_relaxed);
+    }
+}
+
+int TypeCounter::typeIndex(uint32_t type)
+{
+    using namespace PXMConsts;
+    switch (type) {
+        case MSG_TEXT:
+            return 0;
+        case MSG_GLOBAL:
+            return 1;
+        case MSG_SYNC:
+            return 2;
+        case MSG_SYNC_REQUEST:
+            return 3;
+        case MSG_AUTH:
+            return 4;
+        case MSG_NAME:
+            return 5;
+        case MSG_DISOVER:
+            return 6;
+        case MSG_ID:
+            return 7;
+        case MSG_TEXT_STAMPED:
+            return 8;
+        case MSG_GLOBAL_STAMPED:
+            return 9;
+        case MSG_FILE_OFFER:
+            return 10;
+        case MSG_FILE_ACCEPT:
+            return 11;
+        case MSG_FILE_CANCEL:
+            return 12;
+        case MSG_FILE_STREAM:
+            return 13;
+        case MSG_FILE_HAVE:
+            return 14;
+        case MSG_FILE_REDIRECT:
+            return 15;
+        case MSG_FILE_PULL:
+            return 16;
+        case MSG_CAPABILITIES:
+            return 17;
+        default:
+            return TYPE_COUNT - 1;
+    }
+}
+
+const char* TypeCounter::typeName(int index)
+{
+    static const char* names[TYPE_COUNT] = {"text",         "global",         "sync",       "sync_request",
+                                            "auth",         "name",           "discover",   "id",
+                                            "text_stamped", "global_stamped", "file_offer", "file_accept",
+                                            "file_cancel",  "file_stream",    "file_have",  "file_redirect",
+                                            "file_pull",    "capabilities",   "unknown"};
+    return names[index];
+}
+
+void TypeCounter::renderSamples(QByteArray& out) const
+{
+    for (int i = 0; i < TYPE_COUNT; i++) {
+        quint64 value = values[i].load(std::memory_order_relaxed);
+        // Unused types stay out of the output
+        if (value) {
+            sample(out, name, "", QByteArray("type=\"") + typeName(i) + '"', QByteArray::number(value));
+        }
+    }
+}
+
+Histogram::Histogram(const char* name, const char* help, int firstBit, int lastBit)
+    : Metric(name, help, HISTOGRAM), firstBit(firstBit), lastBit(lastBit), total(0), sum(0)
+{
+    for (std::atomic<quint64>& count : counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::record(quint64 value)
+{
+    // Smallest i with value <= 2^i
+    int bucket = value <= 1 ? 0 : highestBit(value - 1) + 1;
+    counts[qMin(bucket, BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Histogram::renderSamples(QByteArray& out) const
+{
+    quint64 cumulative = 0;
+    for (int i = 0; i <= lastBit && i < BUCKETS; i++) {
+        cumulative += counts[i].load(std::memory_order_relaxed);
+        if (i >= firstBit) {
+            sample(out, name, "_bucket", "le=\"" + QByteArray::number(Q_UINT64_C(1) << i) + '"',
+                   QByteArray::number(cumulative));
+        }
+    }
+    // Read total last so +Inf is never below a finite bucket
+    quint64 count = qMax(total.load(std::memory_order_relaxed), cumulative);
+    sample(out, name, "_bucket", "le=\"+Inf\"", QByteArray::number(count));
+    sample(out, name, "_sum", QByteArray(), QByteArray::number(sum.load(std::memory_order_relaxed)));
+    sample(out, name, "_count", QByteArray(), QByteArray::number(count));
+}
+
+QByteArray PXMMetrics::render()
+{
+    QByteArray out;
+    out.reserve(4096);
+    const char* previous = nullptr;
+    for (const Metric* metric : registry()) {
+        // Labelled metrics sharing a name are registered next to each other
+        if (!previous || qstrcmp(previous, metric->name) != 0) {
+            out.append("# HELP ");
+            out.append(metric->name);
+            out.append(' ');
+            out.append(metric->help);
+            out.append("\n# TYPE ");
+            out.append(metric->name);
+            out.append(' ');
+            out.append(kindName(metric->kind));
+            out.append('\n');
+        }
+        previous = metric->name;
+        metric->renderSamples(out);
+    }
+
+    using namespace PXMLatency;
+    const double quantiles[] = {0.5, 0.99, 0.999};
+    out.append(
+        "# HELP pxm_message_latency_microseconds Received message latency by stage, see pxmlatency.h\n"
+        "# TYPE pxm_message_latency_microseconds summary\n");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const PXMLatency::Histogram& histogram = Recorder::instance()->overallHistogram(static_cast<Stage>(i));
+        QByteArray stage = QByteArray("stage=\"") + stageName(static_cast<Stage>(i)) + '"';
+        for (double quantile : quantiles) {
+            sample(out, "pxm_message_latency_microseconds", "",
+                   stage + ",quantile=\"" + QByteArray::number(quantile) + '"',
+                   QByteArray::number(histogram.percentile(quantile)));
+        }
+        sample(out, "pxm_message_latency_microseconds", "_count", stage, QByteArray::number(histogram.count()));
+    }
+    return out;
+}
+
+TypeCounter PXMMetrics::framesReceived("pxm_frames_received_total", "Frames read from peers by message type");
+TypeCounter PXMMetrics::bytesReceived("pxm_bytes_received_total",
+                                      "Bytes read from peers by message type, headers included");
+TypeCounter PXMMetrics::framesSent("pxm_frames_sent_total", "Frames written to peers by message type");
+TypeCounter PXMMetrics::bytesSent("pxm_bytes_sent_total", "Bytes written to peers by message type, headers included");
+Histogram PXMMetrics::receivedFrameBytes("pxm_received_frame_bytes", "Size of frames read from peers", 4, 16);
+Counter PXMMetrics::connectionsAccepted("pxm_connections_total", "TCP connections established", "direction=\"in\"");
+Counter PXMMetrics::connectionsOpened("pxm_connections_total", "TCP connections established", "direction=\"out\"");
+Counter PXMMetrics::connectFailures("pxm_connect_failures_total", "Outgoing TCP connections that failed");
+Counter PXMMetrics::disconnects("pxm_disconnects_total", "Peer connections closed, authenticated or not");
+Gauge PXMMetrics::peersAuthenticated("pxm_peers_authenticated", "Peers currently connected and authenticated");
+Counter PXMMetrics::syncRounds("pxm_sync_rounds_total", "Peer list sync rounds started");
+Counter PXMMetrics::discoverReceived("pxm_discovery_packets_received_total", "Multicast discovery packets read",
+                                     "kind=\"discover\"");
+Counter PXMMetrics::nameReceived("pxm_discovery_packets_received_total", "Multicast discovery packets read",
+                                 "kind=\"name\"");
+Counter PXMMetrics::discoverSent("pxm_discovery_packets_sent_total", "Multicast discovery packets sent",
+                                 "kind=\"discover\"");
+Counter PXMMetrics::nameSent("pxm_discovery_packets_sent_total", "Multicast discovery packets sent",
+                             "kind=\"name\"");
+Gauge PXMMetrics::workerQueueMessages("pxm_worker_queue_messages",
+                                      "Parsed messages waiting for the worker thread");
+Counter PXMMetrics::bufferAllocations("pxm_buffer_allocations_total", "Heap buffers allocated for frames");
+Counter PXMMetrics::malformedFrames("pxm_malformed_frames_total", "Text frames discarded for invalid UTF-8");
+Counter PXMMetrics::localConnections("pxm_local_connections_total",
+                                     "Connections made over the same host unix socket, either direction");
+Counter PXMMetrics::transferBytesSent("pxm_transfer_bytes_total", "File bytes moved over bulk connections",
+                                      "direction=\"out\"");
+Counter PXMMetrics::transferBytesReceived("pxm_transfer_bytes_total", "File bytes moved over bulk connections",
+                                          "direction=\"in\"");
+Counter PXMMetrics::transfersCompleted("pxm_transfers_total", "File transfers that ended", "result=\"ok\"");
+Counter PXMMetrics::transfersFailed("pxm_transfers_total", "File transfers that ended", "result=\"failed\"");
+Counter PXMMetrics::blobCacheHits("pxm_blob_cache_hits_total", "File offers answered from the file cache");
+Counter PXMMetrics::transferRedirects("pxm_transfer_redirects_total",
+                                      "Receivers sent to another peer that already has the file");
+Gauge PXMMetrics::blobCacheBytes("pxm_blob_cache_bytes", "Size of the received file cache");
+Gauge PXMMetrics::ringConnections("pxm_uring_connections", "Connections on the io_uring transport");
+Counter PXMMetrics::ringSubmits("pxm_uring_submits_total", "io_uring_submit calls on the io_uring transport");
+
+namespace
+{
+Callback logQueue("pxm_log_queue_entries", "Log messages waiting for the writer thread", Metric::GAUGE,
+                  logQueueDepth);
+Callback logDroppedTotal("pxm_log_dropped_total", "Log messages dropped because the queue was full",
+                         Metric::COUNTER, logDropped);
+}
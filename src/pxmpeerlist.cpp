@@ -0,0 +1,203 @@
+#include "pxmpeerlist.h"
+
+#include <QBrush>
+#include <QColor>
+#include <QFont>
+#include <QGuiApplication>
+#include <QPalette>
+#include <QSize>
+#include <QStringBuilder>
+
+using namespace PXMPeerList;
+
+Model::Model(QUuid globalUuid, QObject* parent) : QAbstractListModel(parent), insertedRows(0)
+{
+    rows.append(PeerRow{globalUuid, QStringLiteral("Global Chat"), PIN_GLOBAL, 0, false, false});
+    rows.append(PeerRow{QUuid(), QString(), PIN_SEPERATOR, 0, false, false});
+    index.insert(globalUuid, 0);
+    insertedRows = rows.size();
+
+    batchTimer.setSingleShot(true);
+    batchTimer.setInterval(0);
+    QObject::connect(&batchTimer, &QTimer::timeout, this, &Model::flushPending);
+}
+
+int Model::rowCount(const QModelIndex& parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return insertedRows;
+}
+
+QVariant Model::data(const QModelIndex& idx, int role) const
+{
+    if (!idx.isValid() || idx.row() >= insertedRows) {
+        return QVariant();
+    }
+
+    const PeerRow& row = rows.at(idx.row());
+    switch (role) {
+        case Qt::DisplayRole:
+            return row.hostname;
+        case UuidRole:
+            if (row.pin == PIN_SEPERATOR) {
+                return QVariant();
+            }
+            return row.uuid;
+        case PinRole:
+            return row.pin;
+        case Qt::FontRole:
+            if (row.italic) {
+                QFont font;
+                font.setItalic(true);
+                return font;
+            }
+            break;
+        case Qt::BackgroundRole:
+            if (row.alert) {
+                return QBrush(QColor(0xFFCD5C5C));
+            }
+            break;
+        case Qt::ToolTipRole:
+            if (row.unread) {
+                return QString(QString::number(row.unread) % QStringLiteral(" unread"));
+            }
+            break;
+        case Qt::SizeHintRole:
+            if (row.pin == PIN_SEPERATOR) {
+                return QSize(200, 10);
+            }
+            break;
+        default:
+            break;
+    }
+    return QVariant();
+}
+
+Qt::ItemFlags Model::flags(const QModelIndex& idx) const
+{
+    if (!idx.isValid() || idx.row() >= insertedRows || rows.at(idx.row()).pin == PIN_SEPERATOR) {
+        return Qt::NoItemFlags;
+    }
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable;
+}
+
+void Model::rowChanged(int row)
+{
+    // Rows still waiting in the batch are picked up by flushPending()
+    if (row < insertedRows) {
+        QModelIndex idx = createIndex(row, 0);
+        emit dataChanged(idx, idx);
+    }
+}
+
+QString Model::hostname(const QUuid& uuid) const
+{
+    int row = index.value(uuid, -1);
+    if (row < 0) {
+        return QString();
+    }
+    return rows.at(row).hostname;
+}
+
+void Model::addPeer(const QUuid& uuid, const QString& hostname)
+{
+    if (index.contains(uuid)) {
+        setHostname(uuid, hostname);
+        return;
+    }
+    index.insert(uuid, rows.size());
+    rows.append(PeerRow{uuid, hostname, PIN_PEER, 0, false, false});
+    if (!batchTimer.isActive()) {
+        batchTimer.start();
+    }
+}
+
+void Model::flushPending()
+{
+    if (insertedRows == rows.size()) {
+        return;
+    }
+    beginInsertRows(QModelIndex(), insertedRows, rows.size() - 1);
+    insertedRows = rows.size();
+    endInsertRows();
+}
+
+void Model::setHostname(const QUuid& uuid, const QString& hostname)
+{
+    int row = index.value(uuid, -1);
+    if (row < 0 || rows.at(row).hostname == hostname) {
+        return;
+    }
+    rows[row].hostname = hostname;
+    rowChanged(row);
+}
+
+bool Model::setItalic(const QUuid& uuid, bool italic)
+{
+    int row = index.value(uuid, -1);
+    if (row < 0 || rows.at(row).italic == italic) {
+        return false;
+    }
+    rows[row].italic = italic;
+    rowChanged(row);
+    return true;
+}
+
+void Model::setAlert(const QUuid& uuid, bool alert)
+{
+    int row = index.value(uuid, -1);
+    if (row < 0 || rows.at(row).alert == alert) {
+        return;
+    }
+    rows[row].alert = alert;
+    rowChanged(row);
+}
+
+bool Model::alert(const QUuid& uuid) const
+{
+    int row = index.value(uuid, -1);
+    if (row < 0) {
+        return false;
+    }
+    return rows.at(row).alert;
+}
+
+void Model::setUnread(const QUuid& uuid, int count)
+{
+    int row = index.value(uuid, -1);
+    if (row < 0 || rows.at(row).unread == count) {
+        return;
+    }
+    rows[row].unread = count;
+    rowChanged(row);
+}
+
+FilterProxy::FilterProxy(QObject* parent) : QSortFilterProxyModel(parent)
+{
+    this->setDynamicSortFilter(true);
+    this->setSortCaseSensitivity(Qt::CaseInsensitive);
+    this->setFilterCaseSensitivity(Qt::CaseInsensitive);
+    this->setFilterKeyColumn(0);
+}
+
+bool FilterProxy::lessThan(const QModelIndex& left, const QModelIndex& right) const
+{
+    int leftPin  = left.data(PinRole).toInt();
+    int rightPin = right.data(PinRole).toInt();
+    if (leftPin != rightPin) {
+        return leftPin < rightPin;
+    }
+    return QString::compare(left.data(Qt::DisplayRole).toString(), right.data(Qt::DisplayRole).toString(),
+                            Qt::CaseInsensitive) < 0;
+}
+
+bool FilterProxy::filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const
+{
+    QModelIndex idx = sourceModel()->index(sourceRow, 0, sourceParent);
+    if (idx.data(PinRole).toInt() != PIN_PEER) {
+        return true;
+    }
+    return QSortFilterProxyModel::filterAcceptsRow(sourceRow, sourceParent);
+}
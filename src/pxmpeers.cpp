@@ -26,7 +26,8 @@ PeerData::PeerData()
       bw(QSharedPointer<BevWrapper>(new BevWrapper)),
       socket(-1),
       connectTo(false),
-      isAuthed(false)
+      isAuthed(false),
+      latencyStamps(false)
 {
     textColor = textColors.at(textColorsNext % textColors.length());
     textColorsNext++;
@@ -42,7 +43,8 @@ PeerData::PeerData(const PeerData& pd)
       bw(pd.bw),
       socket(pd.socket),
       connectTo(pd.connectTo),
-      isAuthed(pd.isAuthed)
+      isAuthed(pd.isAuthed),
+      latencyStamps(pd.latencyStamps)
 {
 }
 
@@ -56,7 +58,8 @@ PeerData::PeerData(PeerData&& pd) noexcept
       bw(pd.bw),
       socket(pd.socket),
       connectTo(pd.connectTo),
-      isAuthed(pd.isAuthed)
+      isAuthed(pd.isAuthed),
+      latencyStamps(pd.latencyStamps)
 {
     pd.bw.clear();
 }
@@ -66,15 +69,16 @@ PeerData& PeerData::operator=(PeerData&& p) noexcept
     if (this != &p) {
         bw = p.bw;
         p.bw.clear();
-        uuid        = p.uuid;
-        addrRaw     = p.addrRaw;
-        hostname    = p.hostname;
-        textColor   = p.textColor;
-        progVersion = p.progVersion;
-        messages    = p.messages;
-        socket      = p.socket;
-        connectTo   = p.connectTo;
-        isAuthed    = p.isAuthed;
+        uuid          = p.uuid;
+        addrRaw       = p.addrRaw;
+        hostname      = p.hostname;
+        textColor     = p.textColor;
+        progVersion   = p.progVersion;
+        messages      = p.messages;
+        socket        = p.socket;
+        connectTo     = p.connectTo;
+        isAuthed      = p.isAuthed;
+        latencyStamps = p.latencyStamps;
     }
     return *this;
 }
@@ -94,7 +98,8 @@ QString PeerData::toInfoString()
         QStringLiteral("\nIP Address: ") % QString::fromLocal8Bit(inet_ntoa(addrRaw.sin_addr)) % QStringLiteral(":") %
         QString::number(ntohs(addrRaw.sin_port)) % QStringLiteral("\nIsAuthenticated: ") %
         QString::fromLocal8Bit((isAuthed ? "true" : "false")) % QStringLiteral("\npreventAttemptConnection: ") %
-        QString::fromLocal8Bit((connectTo ? "true" : "false")) % QStringLiteral("\nSocketDescriptor: ") %
+        QString::fromLocal8Bit((connectTo ? "true" : "false")) % QStringLiteral("\nLatency Stamps: ") %
+        QString::fromLocal8Bit((latencyStamps ? "true" : "false")) % QStringLiteral("\nSocketDescriptor: ") %
         QString::number(socket) % QStringLiteral("\nHistory Length: ") % QString::number(messages.count()) %
         QStringLiteral("\nBufferevent: ") %
         (bw->getBev() ? QString::asprintf("%8p", static_cast<void*>(bw->getBev())) : QStringLiteral("NULL")) %
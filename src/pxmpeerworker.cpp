@@ -1,18 +1,32 @@
 #include <pxmpeerworker.h>
 
-#include <QApplication>
+#include <QCoreApplication>
+#include <QDateTime>
 #include <QDebug>
-#include <QRegularExpression>
-#include <QRegularExpressionMatch>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QStringBuilder>
 #include <QThread>
 #include <QTimer>
 #include <QSharedPointer>
+#include <QVarLengthArray>
 
+#include "pxmblobcache.h"
 #include "pxmclient.h"
+#include "pxmformatter.h"
+#include "pxmhistory.h"
+#include "pxmlatency.h"
+#include "pxmlog.h"
+#include "pxmmembership.h"
+#include "pxmmetrics.h"
+#include "pxmsearch.h"
 #include "pxmserver.h"
-#include "pxmsync.h"
-#include "timedvector.h"
+#include "pxmtrace.h"
+#include "pxmtransfer.h"
+
+#include <errno.h>
+#include <string.h>
 
 #include <event2/event.h>
 
@@ -35,26 +49,70 @@ static_assert(sizeof(uint32_t) == 4, "uint32_t not defined as 4 bytes");
 
 using namespace PXMConsts;
 
+class PXMPeerWorkerPrivate;
+
+// How PXMMembership reaches the network: the server thread through
+// internalBev, the client through the worker's signals
+struct WorkerTransport {
+    typedef QUuid Peer;
+    typedef sockaddr_in Address;
+    typedef bufferevent* Link;
+    typedef evutil_socket_t Socket;
+    typedef NetCompression::PeerRecord Record;
+
+    PXMPeerWorkerPrivate* d;
+
+    static bufferevent* noLink() { return nullptr; }
+    static Record record(const QUuid& uuid, const sockaddr_in& addr)
+    {
+        Record record = {addr, uuid};
+        return record;
+    }
+    static const QUuid& recordPeer(const Record& record) { return record.uuid; }
+    static const sockaddr_in& recordAddress(const Record& record) { return record.addr; }
+    // Peers only reached over the local socket have no address to share
+    bool shareable(const sockaddr_in& addr) { return addr.sin_addr.s_addr != 0; }
+    unsigned int random() { return static_cast<unsigned int>(rand()); }
+    void sendDiscover();
+    void connect(const Record* targets, size_t count);
+    void enable(bufferevent* bev);
+    void sendAuth(bufferevent* bev, const QUuid* uuid);
+    void sendSyncRequest(const QUuid& uuid, bufferevent* bev);
+    void sendSync(const QUuid& uuid, bufferevent* bev, const QVector<Record>& records);
+    void freeLink(bufferevent* bev);
+    void closeSocket(evutil_socket_t s);
+    void startTimer(PXMMembership::Timer timer, int msecs);
+    void stopTimer(PXMMembership::Timer timer);
+    void changed(const QUuid& uuid, const PXMMembership::PeerState<WorkerTransport>& state);
+    void authenticated(const QUuid& uuid);
+    void disconnected(const QUuid& uuid);
+    void syncStarted();
+};
+
 class PXMPeerWorkerPrivate
 {
     Q_DISABLE_COPY(PXMPeerWorkerPrivate)
     Q_DECLARE_PUBLIC(PXMPeerWorker)
 
    public:
-    PXMPeerWorkerPrivate(PXMPeerWorker* q) : q_ptr(q) {}
+    PXMPeerWorkerPrivate(PXMPeerWorker* q) : q_ptr(q), membership(WorkerTransport{this}, QUuid())
+    {
+    }
     PXMPeerWorkerPrivate(PXMPeerWorker* q,
                          QString username,
                          QUuid selfUUID,
                          QString multicast,
                          unsigned short tcpPort,
                          unsigned short udpPort,
-                         QUuid globaluuid)
+                         QUuid globaluuid,
+                         QString historyDir)
         : q_ptr(q),
           localHostname(username),
           localUUID(selfUUID),
           multicastAddress(multicast),
           globalUUID(globaluuid),
-          syncablePeers(new TimedVector<QUuid>(q_ptr->SYNC_TIMEOUT_MSECS, SECONDS)),
+          historyDirectory(historyDir),
+          membership(WorkerTransport{this}, selfUUID),
           serverTCPPort(tcpPort),
           serverUDPPort(udpPort)
     {
@@ -68,28 +126,81 @@ class PXMPeerWorkerPrivate
     QString multicastAddress;
     QString libeventBackend;
     QUuid globalUUID;
+    QString historyDirectory;
+    PXMHistory::Store* history = nullptr;
+    bool latencyStamps         = false;
+    QString metricsSocket;
+    bool localTransport = true;
+    bool ioUring        = false;
+    QThread* indexerThread     = nullptr;
+    // The timers of PXMMembership, all single shot
     QTimer* syncTimer;
     QTimer* nextSyncTimer;
     QTimer* discoveryTimer;
-    QTimer* discoveryTimerSingle;
     QTimer* midnightTimer;
-    PXMSync* syncer;
     QVector<Peers::BevWrapper*> bwShortLife;
     PXMServer::ServerThread* messServer;
     PXMClient* messClient;
     bufferevent* internalBev;
+    // Connections we accepted, until they authenticate
     QVector<QSharedPointer<Peers::BevWrapper>> extraBevs;
-    QScopedPointer<TimedVector<QUuid>> syncablePeers;
+    // Who to connect to and sync with, peersHash follows its state
+    PXMMembership::Membership<WorkerTransport> membership;
+    QHash<QUuid, PXMTransfer::Transfer> transfers;
+    // Peers that have a file we are offering, by its hash, with how many
+    // receivers are pulling from each
+    QHash<QByteArray, QHash<QUuid, int>> holders;
+    QString blobDirectory;
+    qint64 blobCapBytes = 0;
+    QScopedPointer<PXMBlobCache::Store> blobs;
+    QThread* hasherThread = nullptr;
+    PXMFormatter formatter;
     unsigned short serverTCPPort;
     unsigned short serverUDPPort;
-    bool areWeSyncing;
     bool multicastIsFunctioning;
+    // The first discovery timeout warns when not even our own multicast
+    // came back
+    bool discoveryWarned = false;
 
     // Functions
     void sendAuthPacket(QSharedPointer<Peers::BevWrapper> bw);
     void startServer();
     void connectClient();
     int formatMessage(QString& str, QUuid uuid, QString color);
+    QString historyKey(const QUuid& uuid) const;
+    // workerMicros is when a received message reached us, 0 for anything else
+    int addMessage(QString& str, QUuid uuid, bool alert, qint64 workerMicros);
+    void updateAuthenticatedGauge();
+    QTimer* timer(PXMMembership::Timer timer) const;
+    // Hands claimed peers to the server thread to connect, in a single write
+    void requestConnections(const NetCompression::PeerRecord* records, size_t count);
+    // Shows a message we sent ourselves the way a received one would be
+    void deliverToSelf(const QByteArray& msg, MESSAGE_TYPE type);
+    // MSG_FILE_ACCEPT or MSG_FILE_CANCEL for transfer
+    void sendTransferControl(const PXMTransfer::Transfer& transfer, MESSAGE_TYPE type);
+    void sendTransferMessage(const QUuid& uuid, const QByteArray& payload, MESSAGE_TYPE type);
+    // cached if we can pass the file on
+    void sendHave(const PXMTransfer::Transfer& transfer, bool cached);
+    // Opens the file and asks the sender for it
+    void acceptTransfer(PXMTransfer::Transfer& transfer);
+    // Getting it from elsewhere failed, back to the sender
+    void fallBack(PXMTransfer::Transfer& transfer);
+    void pullFrom(PXMTransfer::Transfer& transfer, const QUuid& holder);
+    void servePull(const QUuid& uuid, const unsigned char* buf, size_t len);
+    // Streams an accepted offer, redirects it or queues it
+    void dispatchTransfer(PXMTransfer::Transfer& transfer);
+    void dispatchQueued(const QByteArray& hash);
+    void streamTransfer(PXMTransfer::Transfer& transfer);
+    void releaseHolder(PXMTransfer::Transfer& transfer);
+    // Ends what was waiting on uuid, which has disconnected
+    void dropTransfers(const QUuid& uuid);
+    // Hands the open file to the server thread to connect and stream
+    void startSending(const PXMTransfer::Transfer& transfer, int32_t fd);
+    // Forgets transfer id, note goes to the conversation and the window
+    void endTransfer(const QUuid& id, bool ok, const QString& note);
+    // Plain text, escaped here
+    void addTransferNote(const QString& note, const QUuid& uuid);
+    QString transferDescription(const PXMTransfer::Transfer& transfer) const;
 
     // Slots
 };
@@ -99,12 +210,19 @@ PXMPeerWorker::PXMPeerWorker(QObject* parent,
                              QString multicast,
                              unsigned short tcpPort,
                              unsigned short udpPort,
-                             QUuid globaluuid)
+                             QUuid globaluuid,
+                             QString historyDirectory)
     : QObject(parent),
-      d_ptr(new PXMPeerWorkerPrivate(this, username, selfUUID, multicast, tcpPort, udpPort, globaluuid))
+      d_ptr(new PXMPeerWorkerPrivate(this,
+                                     username,
+                                     selfUUID,
+                                     multicast,
+                                     tcpPort,
+                                     udpPort,
+                                     globaluuid,
+                                     historyDirectory))
 {
-    d_ptr->areWeSyncing = false;
-    d_ptr->messClient   = nullptr;
+    d_ptr->messClient = nullptr;
     // End of Init
 
     // Prevent race condition when starting threads, a bufferevent
@@ -114,7 +232,7 @@ PXMPeerWorker::PXMPeerWorker(QObject* parent,
     selfComms.hostname    = d_ptr->localHostname;
     selfComms.connectTo   = true;
     selfComms.isAuthed    = false;
-    selfComms.progVersion = qApp->applicationVersion();
+    selfComms.progVersion = QCoreApplication::applicationVersion();
     d_ptr->peersHash.insert(d_ptr->localUUID, selfComms);
 
     Peers::PeerData globalPeer;
@@ -129,16 +247,11 @@ PXMPeerWorker::~PXMPeerWorker()
     using namespace PXMServer;
     d_ptr->syncTimer->stop();
     d_ptr->nextSyncTimer->stop();
-    // delete d_ptr->syncablePeers;
 
     for (auto& itr : d_ptr->peersHash) {
         // qDeleteAll(itr.messages);
         evutil_closesocket(itr.socket);
     }
-    // Strange memory interaction with libevent, for now set ourSelfComms
-    // bufferevent to null to prevent it being auto freed when its removed
-    // from the hash
-    d_ptr->peersHash[d_ptr->localUUID].bw->setBev(nullptr);
     // This must be done before PXMServer is shutdown;
     d_ptr->peersHash.clear();
 
@@ -148,47 +261,109 @@ PXMPeerWorker::~PXMPeerWorker()
         d_ptr->messServer->wait(5000);
     }
 
+    if (d_ptr->indexerThread) {
+        d_ptr->indexerThread->quit();
+        d_ptr->indexerThread->wait(5000);
+    }
+
+    if (d_ptr->hasherThread) {
+        d_ptr->hasherThread->requestInterruption();
+        d_ptr->hasherThread->quit();
+        d_ptr->hasherThread->wait(5000);
+    }
+
     qDebug() << "Shutdown of PXMPeerWorker Successful";
 }
+void PXMPeerWorker::setLatencyStamps(bool enabled)
+{
+    d_ptr->latencyStamps = enabled;
+}
+void PXMPeerWorker::setMetricsSocket(QString path)
+{
+    d_ptr->metricsSocket = path;
+}
+void PXMPeerWorker::setLocalTransport(bool enabled)
+{
+    d_ptr->localTransport = enabled;
+}
+void PXMPeerWorker::setIoUring(bool enabled)
+{
+    d_ptr->ioUring = enabled;
+}
+void PXMPeerWorker::setBlobCache(QString directory, qint64 capBytes)
+{
+    d_ptr->blobDirectory = directory;
+    d_ptr->blobCapBytes  = capBytes;
+}
 void PXMPeerWorker::setInternalBufferevent(bufferevent* bev)
 {
     d_ptr->internalBev = bev;
 }
 void PXMPeerWorker::currentThreadInit()
 {
-    d_ptr->syncer = new PXMSync(this, d_ptr->peersHash);
-    QObject::connect(d_ptr->syncer, &PXMSync::requestIps, this, &PXMPeerWorker::requestSyncPacket);
-    QObject::connect(d_ptr->syncer, &PXMSync::syncComplete, this, &PXMPeerWorker::doneSync);
-
     srand(static_cast<unsigned int>(time(NULL)));
 
     d_ptr->syncTimer = new QTimer(this);
-    d_ptr->syncTimer->setInterval((rand() % 300000) + SYNC_TIMER);
-    QObject::connect(d_ptr->syncTimer, &QTimer::timeout, this, &PXMPeerWorker::beginSync);
-    d_ptr->syncTimer->start();
+    d_ptr->syncTimer->setSingleShot(true);
+    QObject::connect(d_ptr->syncTimer, &QTimer::timeout, this,
+                     [this] { d_ptr->membership.timerFired(PXMMembership::ROUND_TIMER); });
 
     d_ptr->nextSyncTimer = new QTimer(this);
-    d_ptr->nextSyncTimer->setInterval(2000);
-    QObject::connect(d_ptr->nextSyncTimer, &QTimer::timeout, d_ptr->syncer, &PXMSync::syncNext);
+    d_ptr->nextSyncTimer->setSingleShot(true);
+    QObject::connect(d_ptr->nextSyncTimer, &QTimer::timeout, this,
+                     [this] { d_ptr->membership.timerFired(PXMMembership::NEXT_SYNC_TIMER); });
 
-    d_ptr->discoveryTimerSingle = new QTimer(this);
-    d_ptr->discoveryTimerSingle->setSingleShot(true);
-    d_ptr->discoveryTimerSingle->setInterval(5000);
-    QObject::connect(d_ptr->discoveryTimerSingle, &QTimer::timeout, this, &PXMPeerWorker::discoveryTimerSingleShot);
-    d_ptr->discoveryTimerSingle->start();
+    d_ptr->discoveryTimer = new QTimer(this);
+    d_ptr->discoveryTimer->setSingleShot(true);
+    QObject::connect(d_ptr->discoveryTimer, &QTimer::timeout, this, &PXMPeerWorker::discoveryTimerFired);
+
+    d_ptr->membership.start();
 
     d_ptr->midnightTimer = new QTimer(this);
     d_ptr->midnightTimer->setInterval(MIDNIGHT_TIMER_INTERVAL_MINUTES * 60000);
     QObject::connect(d_ptr->midnightTimer, &QTimer::timeout, this, &PXMPeerWorker::midnightTimerPersistent);
     d_ptr->midnightTimer->start();
 
-    d_ptr->discoveryTimer = new QTimer(this);
+    if (!d_ptr->historyDirectory.isEmpty()) {
+        d_ptr->history = new PXMHistory::Store(d_ptr->historyDirectory, this);
+
+        // Indexing happens off this thread so a large backfill does not
+        // hold up connections
+        d_ptr->indexerThread       = new QThread(this);
+        PXMSearch::Indexer* indexer = new PXMSearch::Indexer(d_ptr->historyDirectory);
+        indexer->moveToThread(d_ptr->indexerThread);
+        QObject::connect(d_ptr->indexerThread, &QThread::started, indexer, &PXMSearch::Indexer::backfill);
+        QObject::connect(d_ptr->indexerThread, &QThread::finished, indexer, &QObject::deleteLater);
+        QObject::connect(this, &PXMPeerWorker::indexMessage, indexer, &PXMSearch::Indexer::addMessage);
+        QObject::connect(this, &PXMPeerWorker::searchIndex, indexer, &PXMSearch::Indexer::search);
+        QObject::connect(indexer, &PXMSearch::Indexer::searchResults, this, &PXMPeerWorker::indexResults);
+        d_ptr->indexerThread->setObjectName("PXMIndexer");
+        d_ptr->indexerThread->start(QThread::LowPriority);
+    }
+
+    if (!d_ptr->blobDirectory.isEmpty() && d_ptr->blobCapBytes > 0) {
+        d_ptr->blobs.reset(new PXMBlobCache::Store(d_ptr->blobDirectory, d_ptr->blobCapBytes));
+    }
+    // Hashing and copying files, a large one would hold up everything else
+    d_ptr->hasherThread          = new QThread(this);
+    PXMBlobCache::Hasher* hasher = new PXMBlobCache::Hasher;
+    hasher->moveToThread(d_ptr->hasherThread);
+    QObject::connect(d_ptr->hasherThread, &QThread::finished, hasher, &QObject::deleteLater);
+    QObject::connect(this, &PXMPeerWorker::hashFile, hasher, &PXMBlobCache::Hasher::hash);
+    QObject::connect(this, &PXMPeerWorker::copyFile, hasher, &PXMBlobCache::Hasher::copy);
+    QObject::connect(hasher, &PXMBlobCache::Hasher::hashed, this, &PXMPeerWorker::fileHashed);
+    QObject::connect(hasher, &PXMBlobCache::Hasher::copied, this, &PXMPeerWorker::fileCopied);
+    d_ptr->hasherThread->setObjectName("PXMHasher");
+    d_ptr->hasherThread->start(QThread::LowPriority);
 
     in_addr multicast_in_addr;
     multicast_in_addr.s_addr = inet_addr(d_ptr->multicastAddress.toLatin1().constData());
     d_ptr->messClient        = new PXMClient(this, multicast_in_addr, d_ptr->localUUID);
     d_ptr->messServer = new PXMServer::ServerThread(this, d_ptr->localUUID, multicast_in_addr, d_ptr->serverTCPPort,
                                                     d_ptr->serverUDPPort);
+    d_ptr->messServer->setMetricsSocket(d_ptr->metricsSocket);
+    d_ptr->messServer->setLocalTransport(d_ptr->localTransport);
+    d_ptr->messServer->setIoUring(d_ptr->ioUring);
 
     d_ptr->connectClient();
     d_ptr->startServer();
@@ -218,8 +393,6 @@ void PXMPeerWorkerPrivate::startServer()
                      Qt::QueuedConnection);
     QObject::connect(messServer, &PXMServer::ServerThread::setCloseBufferevent, q_ptr,
                      &PXMPeerWorker::setInternalBufferevent, Qt::QueuedConnection);
-    QObject::connect(messServer, &PXMServer::ServerThread::setSelfCommsBufferevent, q_ptr,
-                     &PXMPeerWorker::setSelfCommsBufferevent, Qt::QueuedConnection);
     QObject::connect(messServer, &PXMServer::ServerThread::multicastIsFunctional, q_ptr,
                      &PXMPeerWorker::multicastIsFunctional, Qt::QueuedConnection);
     QObject::connect(messServer, &PXMServer::ServerThread::serverSetupFailure, q_ptr,
@@ -228,8 +401,18 @@ void PXMPeerWorkerPrivate::startServer()
                      Qt::QueuedConnection);
     QObject::connect(messServer, &PXMServer::ServerThread::nameChange, q_ptr, &PXMPeerWorker::peerNameChange,
                      Qt::QueuedConnection);
+    QObject::connect(messServer, &PXMServer::ServerThread::capabilitiesReceived, q_ptr,
+                     &PXMPeerWorker::peerCapabilities, Qt::QueuedConnection);
     QObject::connect(messServer, &PXMServer::ServerThread::resultOfConnectionAttempt, q_ptr,
                      &PXMPeerWorker::resultOfConnectionAttempt, Qt::QueuedConnection);
+    QObject::connect(messServer, &PXMServer::ServerThread::transferMessage, q_ptr, &PXMPeerWorker::transferMessage,
+                     Qt::QueuedConnection);
+    QObject::connect(messServer, &PXMServer::ServerThread::transferConnection, q_ptr,
+                     &PXMPeerWorker::transferConnection, Qt::QueuedConnection);
+    QObject::connect(messServer, &PXMServer::ServerThread::transferProgress, q_ptr,
+                     &PXMPeerWorker::transferStreamProgress, Qt::QueuedConnection);
+    QObject::connect(messServer, &PXMServer::ServerThread::transferFinished, q_ptr,
+                     &PXMPeerWorker::transferStreamFinished, Qt::QueuedConnection);
     messServer->start();
 }
 void PXMPeerWorkerPrivate::connectClient()
@@ -245,196 +428,91 @@ void PXMPeerWorker::setListenerPorts(unsigned short tcpport, unsigned short udpp
 {
     d_ptr->serverTCPPort = tcpport;
     d_ptr->serverUDPPort = udpport;
-}
-void PXMPeerWorker::doneSync()
-{
-    d_ptr->areWeSyncing = false;
-    d_ptr->nextSyncTimer->stop();
-    qInfo() << "Finished Syncing peers";
-}
-void PXMPeerWorker::beginSync()
-{
-    if (d_ptr->areWeSyncing) {
-        return;
-    }
-
-    qInfo() << "Beginning Sync of connected peers";
-    d_ptr->areWeSyncing = true;
-    d_ptr->syncer->setsyncHash(d_ptr->peersHash);
-    d_ptr->syncer->setIteratorToStart();
-    d_ptr->syncer->syncNext();
-    d_ptr->nextSyncTimer->start();
+    // We can message ourselves from here on
+    emit peerNameChanged(d_ptr->localUUID, d_ptr->localHostname);
+    emit listening(tcpport, udpport);
 }
 void PXMPeerWorker::syncPacketIterator(QSharedPointer<unsigned char> syncPacket, size_t len, QUuid senderUuid)
 {
-    if (!d_ptr->syncablePeers->contains(senderUuid)) {
-        qWarning() << "Sync packet from bad uuid -- timeout or not "
-                      "requested"
-                   << senderUuid;
-        return;
-    }
     qInfo() << "Sync packet from" << senderUuid.toString();
 
-    size_t index = 0;
-    while (index + NetCompression::PACKED_UUID_LENGTH + 6 <= len) {
-        struct sockaddr_in addr;
-        index += NetCompression::unpackSockaddr_in(&syncPacket.data()[index], addr);
-        addr.sin_family = AF_INET;
-        QUuid uuid      = QUuid();
-        index += NetCompression::unpackUUID(&syncPacket.data()[index], uuid);
-
-        qInfo() << inet_ntoa(addr.sin_addr) << ":" << ntohs(addr.sin_port) << ":" << uuid.toString();
-        attemptConnection(addr, uuid);
-    }
-    qInfo() << "End of sync packet";
-
-    d_ptr->syncablePeers->remove(senderUuid);
-
-    if (d_ptr->areWeSyncing) {
-        d_ptr->nextSyncTimer->start(2000);
-        d_ptr->syncer->syncNext();
-    }
+    QVector<NetCompression::PeerRecord> records(static_cast<int>(len / NetCompression::PACKED_PEER_RECORD_LENGTH));
+    size_t count = NetCompression::unpackPeerRecords(syncPacket.data(), len, records.data(),
+                                                     static_cast<size_t>(records.size()));
+    d_ptr->membership.syncReceived(senderUuid, records.data(), count);
 }
 void PXMPeerWorker::newIncomingConnection(bufferevent* bev)
 {
     QSharedPointer<Peers::BevWrapper> bw(new Peers::BevWrapper);
     bw->setBev(bev);
     d_ptr->extraBevs.push_back(bw);
-    d_ptr->sendAuthPacket(bw);
+    d_ptr->membership.accepted(bev);
 }
 void PXMPeerWorkerPrivate::sendAuthPacket(QSharedPointer<Peers::BevWrapper> bw)
 {
     // Auth packet format "Hostname:::12345:::001.001.001
     emit q_ptr->sendMsg(bw, (localHostname % QString::fromLatin1(AUTH_SEPERATOR) % QString::number(serverTCPPort) %
-                             QString::fromLatin1(AUTH_SEPERATOR) % qApp->applicationVersion())
+                             QString::fromLatin1(AUTH_SEPERATOR) % QCoreApplication::applicationVersion())
                                 .toUtf8(),
                         MSG_AUTH);
+    // Stamped frames are always understood, LatencyStamps only decides
+    // whether we send them
+    QByteArray capabilities(sizeof(uint32_t), Qt::Uninitialized);
+    NetCompression::writeUint32(reinterpret_cast<unsigned char*>(capabilities.data()), CAPABILITY_STAMPS);
+    emit q_ptr->sendMsg(bw, capabilities, MSG_CAPABILITIES);
 }
-void PXMPeerWorker::requestSyncPacket(QSharedPointer<Peers::BevWrapper> bw, QUuid uuid)
+void PXMPeerWorker::attemptConnection(struct sockaddr_in addr, QUuid uuid)
 {
-    d_ptr->syncablePeers->append(uuid);
-    qInfo() << "Requesting ips from" << d_ptr->peersHash.value(uuid).hostname;
-    emit sendMsg(bw, QByteArray(), MSG_SYNC_REQUEST);
+    if (uuid.isNull()) {
+        return;
+    }
+    d_ptr->membership.found(uuid, addr);
 }
-void PXMPeerWorker::attemptConnection(struct sockaddr_in addr, QUuid uuid)
+void PXMPeerWorkerPrivate::requestConnections(const NetCompression::PeerRecord* records, size_t count)
 {
-    if (d_ptr->peersHash.value(uuid).connectTo || uuid.isNull()) {
+    if (count == 0) {
         return;
     }
-
-    d_ptr->peersHash[uuid].uuid      = uuid;
-    d_ptr->peersHash[uuid].connectTo = true;
-    d_ptr->peersHash[uuid].addrRaw   = addr;
-
-    // Tell Server to connect
-    size_t index                   = 0;
-    PXMServer::INTERNAL_MSG addBev = PXMServer::INTERNAL_MSG::CONNECT_TO_ADDR;
-    size_t msgLen                  = sizeof(addr) + sizeof(addBev) + NetCompression::PACKED_UUID_LENGTH;
-    unsigned char bevPtr[msgLen];
-    memcpy(&bevPtr[index], &addBev, sizeof(addBev));
-    index += sizeof(addBev);
-    memcpy(&bevPtr[index], &(addr.sin_addr.s_addr), sizeof(addr.sin_addr.s_addr));
-    index += sizeof(addr.sin_addr.s_addr);
-    memcpy(&bevPtr[index], &(addr.sin_port), sizeof(addr.sin_port));
-    index += sizeof(addr.sin_port);
-    index += NetCompression::packUUID(&bevPtr[index], uuid);
-    bufferevent_write(d_ptr->internalBev, &bevPtr[0], msgLen);
+    // Tell Server to connect, one CONNECT_TO_ADDR message per peer
+    const PXMServer::INTERNAL_MSG connectTo = PXMServer::INTERNAL_MSG::CONNECT_TO_ADDR;
+    const size_t msgLen                     = sizeof(connectTo) + NetCompression::PACKED_PEER_RECORD_LENGTH;
+    QVarLengthArray<unsigned char, 16 * msgLen> msgs(static_cast<int>(count * msgLen));
+    size_t index = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(&msgs[static_cast<int>(index)], &connectTo, sizeof(connectTo));
+        index += sizeof(connectTo);
+        index += NetCompression::packPeerRecord(&msgs[static_cast<int>(index)], records[i].addr, records[i].uuid);
+    }
+    bufferevent_write(internalBev, msgs.constData(), index);
 }
 void PXMPeerWorker::peerNameChange(QString hname, QUuid uuid)
 {
     if (d_ptr->peersHash.contains(uuid)) {
         d_ptr->peersHash[uuid].hostname = hname.left(PXMConsts::MAX_HOSTNAME_LENGTH + PXMConsts::MAX_COMPUTER_NAME);
-        emit updateListWidget(uuid, d_ptr->peersHash.value(uuid).hostname);
+        emit peerNameChanged(uuid, d_ptr->peersHash.value(uuid).hostname);
     }
 }
-void PXMPeerWorker::peerQuit(evutil_socket_t s, bufferevent* bev)
+void PXMPeerWorker::peerCapabilities(QUuid uuid, quint32 flags)
 {
-    for (Peers::PeerData& itr : d_ptr->peersHash) {
-        if (itr.bw->getBev() == bev) {
-            d_ptr->peersHash[itr.uuid].connectTo = false;
-            d_ptr->peersHash[itr.uuid].isAuthed  = false;
-            d_ptr->peersHash[itr.uuid].bw->lockBev();
-            qInfo().noquote() << "Peer:" << itr.uuid.toString() << "has disconnected";
-            d_ptr->peersHash[itr.uuid].bw->setBev(nullptr);
-            bufferevent_free(bev);
-            d_ptr->peersHash[itr.uuid].bw->unlockBev();
-            evutil_closesocket(itr.socket);
-            d_ptr->peersHash[itr.uuid].socket = -1;
-            emit setItalicsOnItem(itr.uuid, 1);
-            return;
-        }
-    }
-    for (QSharedPointer<Peers::BevWrapper>& itr : d_ptr->extraBevs) {
-        d_ptr->extraBevs.removeAll(itr);
+    if (d_ptr->peersHash.contains(uuid)) {
+        d_ptr->peersHash[uuid].latencyStamps = flags & PXMConsts::CAPABILITY_STAMPS;
     }
-    qInfo().noquote() << "Non-Authed Peer has quit";
-    evutil_closesocket(s);
 }
-void PXMPeerWorker::sendSyncPacketBev(const bufferevent* bev, QUuid uuid)
+void PXMPeerWorker::peerQuit(evutil_socket_t s, bufferevent* bev)
 {
-    if (d_ptr->peersHash.contains(uuid) && d_ptr->peersHash.value(uuid).bw->getBev() == bev) {
-        this->sendSyncPacket(d_ptr->peersHash.value(uuid).bw, uuid);
-    } else {
-        qCritical() << "sendIpsBev:error";
-    }
+    PXMMetrics::disconnects.inc();
+    d_ptr->membership.closed(bev, s);
 }
-void PXMPeerWorker::sendSyncPacket(QSharedPointer<Peers::BevWrapper> bw, QUuid uuid)
+void PXMPeerWorker::sendSyncPacketBev(const bufferevent* bev, QUuid uuid)
 {
-    qInfo() << "Sending ips to" << d_ptr->peersHash.value(uuid).hostname;
-    QSharedPointer<unsigned char> msgRaw(
-        new unsigned char[static_cast<size_t>(d_ptr->peersHash.size()) *
-                              (NetCompression::PACKED_SOCKADDR_IN_LENGTH + NetCompression::PACKED_UUID_LENGTH) +
-                          1]);
-    size_t index = 0;
-    for (Peers::PeerData& itr : d_ptr->peersHash) {
-        if (itr.isAuthed) {
-            index += NetCompression::packSockaddr_in(&msgRaw.data()[index], itr.addrRaw);
-            index += NetCompression::packUUID(&msgRaw.data()[index], itr.uuid);
-        }
-    }
-    msgRaw.data()[index + 1] = 0;
-
-    if (d_ptr->messClient) {
-        emit sendIpsPacket(bw, msgRaw, index, MSG_SYNC);
-    } else {
-        qCritical() << "messClient not initialized";
-    }
+    d_ptr->membership.syncRequested(uuid, const_cast<bufferevent*>(bev));
 }
 void PXMPeerWorker::resultOfConnectionAttempt(evutil_socket_t socket, bool result, bufferevent* bev, QUuid uuid)
 {
     if (uuid.isNull()) {
         return;
     }
-
-    if (result) {
-        qInfo() << "Successful connection attempt to" << uuid.toString();
-        // send internal comms for this bev to be enabled
-        PXMServer::INTERNAL_MSG addBev                     = PXMServer::INTERNAL_MSG::ADD_DEFAULT_BEV;
-        unsigned char bevPtr[sizeof(addBev) + sizeof(bev)] = {};
-        memcpy(&bevPtr[0], &addBev, sizeof(addBev));
-        memcpy(&bevPtr[sizeof(addBev)], &bev, sizeof(bev));
-        bufferevent_write(d_ptr->internalBev, &bevPtr[0], sizeof(addBev) + sizeof(bev));
-
-        d_ptr->peersHash[uuid].bw->lockBev();
-        if (d_ptr->peersHash.value(uuid).bw->getBev() != nullptr && d_ptr->peersHash.value(uuid).bw->getBev() != bev) {
-            bufferevent_free(d_ptr->peersHash.value(uuid).bw->getBev());
-        }
-
-        d_ptr->peersHash.value(uuid).bw->setBev(bev);
-        d_ptr->peersHash.value(uuid).bw->unlockBev();
-
-        d_ptr->sendAuthPacket(d_ptr->peersHash.value(uuid).bw);
-    } else {
-        qWarning() << "Unsuccessful connection attempt to " << uuid.toString();
-        d_ptr->peersHash[uuid].bw->lockBev();
-        d_ptr->peersHash[uuid].bw->setBev(nullptr);
-        bufferevent_free(bev);
-        evutil_closesocket(socket);
-        d_ptr->peersHash[uuid].bw->unlockBev();
-        d_ptr->peersHash[uuid].connectTo = false;
-        d_ptr->peersHash[uuid].isAuthed  = false;
-        d_ptr->peersHash[uuid].socket    = -1;
-    }
+    d_ptr->membership.connectResult(uuid, bev, socket, result);
 }
 void PXMPeerWorker::resultOfTCPSend(int levelOfSuccess,
                                     QUuid uuid,
@@ -469,89 +547,230 @@ void PXMPeerWorker::authenticationReceived(QString hname,
         bufferevent_free(bev);
         return;
     }
-    struct sockaddr_in addr;
-    socklen_t socklen = sizeof(addr);
-    memset(&addr, 0, socklen);
+    struct sockaddr_storage peer;
+    socklen_t socklen = sizeof(peer);
+    memset(&peer, 0, socklen);
+    getpeername(s, reinterpret_cast<struct sockaddr*>(&peer), &socklen);
 
-    getpeername(s, reinterpret_cast<struct sockaddr*>(&addr), &socklen);
-    addr.sin_port = htons(port);
-
-    qInfo().noquote() << hname << "on port" << QString::number(port) << "authenticated!";
-
-    if (d_ptr->peersHash[uuid].bw->getBev() != nullptr && d_ptr->peersHash[uuid].bw->getBev() != bev) {
-        peerQuit(-1, d_ptr->peersHash.value(uuid).bw->getBev());
+    struct sockaddr_in addr;
+    if (peer.ss_family == AF_INET) {
+        memcpy(&addr, &peer, sizeof(addr));
     } else {
-        for (QSharedPointer<Peers::BevWrapper>& itr : d_ptr->extraBevs) {
-            if (itr->getBev() == bev) {
-                d_ptr->peersHash[uuid].bw = itr;
-                d_ptr->extraBevs.removeAll(itr);
-                break;
-            }
+        // Same host unix socket, keep the address the peer was discovered
+        // at.  If it connected to us that is unknown and sync packets skip it
+        addr = d_ptr->peersHash.value(uuid).addrRaw;
+        if (addr.sin_family != AF_INET) {
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
         }
     }
-    d_ptr->peersHash[uuid].uuid        = uuid;
-    d_ptr->peersHash[uuid].addrRaw     = addr;
-    d_ptr->peersHash[uuid].hostname    = hname;
-    d_ptr->peersHash[uuid].progVersion = version;
-    d_ptr->peersHash[uuid].bw->lockBev();
-    d_ptr->peersHash[uuid].bw->setBev(bev);
-    d_ptr->peersHash[uuid].bw->unlockBev();
-    d_ptr->peersHash[uuid].socket    = s;
-    d_ptr->peersHash[uuid].connectTo = true;
-    d_ptr->peersHash[uuid].isAuthed  = true;
+    addr.sin_port = htons(port);
+
+    qInfo().noquote() << hname << "on port" << QString::number(port) << "authenticated!";
 
-    emit updateListWidget(uuid, d_ptr->peersHash.value(uuid).hostname);
-    emit requestSyncPacket(d_ptr->peersHash.value(uuid).bw, uuid);
+    Peers::PeerData& data = d_ptr->peersHash[uuid];
+    data.uuid             = uuid;
+    data.hostname         = hname;
+    data.progVersion      = version;
+    // Until its MSG_CAPABILITIES says otherwise
+    data.latencyStamps = false;
+    d_ptr->membership.authenticated(uuid, addr, bev, s);
 }
-int PXMPeerWorker::recieveServerMessage(QString str, QUuid uuid, const bufferevent* bev, bool global)
+int PXMPeerWorker::recieveServerMessage(QString str,
+                                        QUuid uuid,
+                                        const bufferevent* bev,
+                                        bool global,
+                                        qint64 parsedMicros)
 {
-    if (uuid != d_ptr->localUUID) {
-        if (!(d_ptr->peersHash.contains(uuid))) {
-            qWarning() << "Message from invalid uuid, rejection";
-            return -1;
-        }
+    PXM_TRACE_SCOPE("recieveServerMessage");
+    PXMMetrics::workerQueueMessages.sub();
+    qint64 workerMicros = PXMLatency::monotonicMicros();
+    PXMLatency::Recorder::instance()->record(PXMLatency::PARSE_TO_WORKER, uuid, workerMicros - parsedMicros);
+    // Our own messages never come through the server, see deliverToSelf()
+    if (!(d_ptr->peersHash.contains(uuid))) {
+        qWarning() << "Message from invalid uuid, rejection";
+        return -1;
+    }
 
-        if (d_ptr->peersHash.value(uuid).bw->getBev() != bev) {
-            bool foundIt      = false;
-            QUuid uuidSpoofer = QUuid();
-            for (auto& itr : d_ptr->peersHash) {
-                if (itr.bw->getBev() == bev) {
-                    foundIt     = true;
-                    uuidSpoofer = itr.uuid;
-                    continue;
-                }
+    if (d_ptr->peersHash.value(uuid).bw->getBev() != bev) {
+        bool foundIt      = false;
+        QUuid uuidSpoofer = QUuid();
+        for (auto& itr : d_ptr->peersHash) {
+            if (itr.bw->getBev() == bev) {
+                foundIt     = true;
+                uuidSpoofer = itr.uuid;
+                continue;
             }
-            if (foundIt) {
-                addMessageToPeer(
-                    "This user is trying to spoof another "
-                    "users uuid!",
-                    uuidSpoofer, true, false);
-            } else {
-                addMessageToPeer(
-                    "Someone is trying to spoof this users "
-                    "uuid!",
-                    uuid, true, false);
-            }
-
-            return -1;
         }
-    }
-
-    if (global) {
-        if (uuid == d_ptr->localUUID) {
-            d_ptr->formatMessage(str, uuid, Peers::selfColor);
+        if (foundIt) {
+            addMessageToPeer(
+                "This user is trying to spoof another "
+                "users uuid!",
+                uuidSpoofer, true, false);
         } else {
-            d_ptr->formatMessage(str, uuid, d_ptr->peersHash.value(uuid).textColor);
+            addMessageToPeer(
+                "Someone is trying to spoof this users "
+                "uuid!",
+                uuid, true, false);
         }
 
+        return -1;
+    }
+
+    if (global) {
+        d_ptr->formatMessage(str, uuid, d_ptr->peersHash.value(uuid).textColor);
         uuid = d_ptr->globalUUID;
     } else {
         d_ptr->formatMessage(str, uuid, Peers::peerColor);
     }
 
-    addMessageToPeer(str, uuid, true, true);
+    d_ptr->addMessage(str, uuid, true, workerMicros);
     return 0;
 }
+void PXMPeerWorkerPrivate::updateAuthenticatedGauge()
+{
+    qint64 authed = 0;
+    for (const Peers::PeerData& itr : peersHash) {
+        if (itr.isAuthed && itr.uuid != localUUID) {
+            authed++;
+        }
+    }
+    PXMMetrics::peersAuthenticated.set(authed);
+}
+QTimer* PXMPeerWorkerPrivate::timer(PXMMembership::Timer timer) const
+{
+    switch (timer) {
+        case PXMMembership::DISCOVERY_TIMER:
+            return discoveryTimer;
+        case PXMMembership::ROUND_TIMER:
+            return syncTimer;
+        case PXMMembership::NEXT_SYNC_TIMER:
+            break;
+    }
+    return nextSyncTimer;
+}
+void WorkerTransport::sendDiscover()
+{
+    emit d->q_ptr->sendUDP("/discover", d->serverUDPPort);
+}
+void WorkerTransport::connect(const Record* targets, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        qCDebug(pxmNet) << "Connecting to" << inet_ntoa(targets[i].addr.sin_addr) << ":"
+                        << ntohs(targets[i].addr.sin_port) << ":" << targets[i].uuid.toString();
+    }
+    d->requestConnections(targets, count);
+}
+void WorkerTransport::enable(bufferevent* bev)
+{
+    // send internal comms for this bev to be enabled
+    PXMServer::INTERNAL_MSG addBev                     = PXMServer::INTERNAL_MSG::ADD_DEFAULT_BEV;
+    unsigned char bevPtr[sizeof(addBev) + sizeof(bev)] = {};
+    memcpy(&bevPtr[0], &addBev, sizeof(addBev));
+    memcpy(&bevPtr[sizeof(addBev)], &bev, sizeof(bev));
+    bufferevent_write(d->internalBev, &bevPtr[0], sizeof(addBev) + sizeof(bev));
+}
+void WorkerTransport::sendAuth(bufferevent* bev, const QUuid* uuid)
+{
+    if (uuid) {
+        d->sendAuthPacket(d->peersHash.value(*uuid).bw);
+        return;
+    }
+    for (const QSharedPointer<Peers::BevWrapper>& itr : d->extraBevs) {
+        if (itr->getBev() == bev) {
+            d->sendAuthPacket(itr);
+            return;
+        }
+    }
+}
+void WorkerTransport::sendSyncRequest(const QUuid& uuid, bufferevent*)
+{
+    qInfo() << "Requesting ips from" << d->peersHash.value(uuid).hostname;
+    emit d->q_ptr->sendMsg(d->peersHash.value(uuid).bw, QByteArray(), MSG_SYNC_REQUEST);
+}
+void WorkerTransport::sendSync(const QUuid& uuid, bufferevent*, const QVector<Record>& records)
+{
+    qInfo() << "Sending ips to" << d->peersHash.value(uuid).hostname;
+    QSharedPointer<unsigned char> msgRaw(
+        new unsigned char[static_cast<size_t>(records.size()) * NetCompression::PACKED_PEER_RECORD_LENGTH + 1]);
+    size_t index = 0;
+    for (const Record& record : records) {
+        index += NetCompression::packPeerRecord(&msgRaw.data()[index], record.addr, record.uuid);
+    }
+    msgRaw.data()[index] = 0;
+
+    if (d->messClient) {
+        emit d->q_ptr->sendIpsPacket(d->peersHash.value(uuid).bw, msgRaw, index, MSG_SYNC);
+    } else {
+        qCritical() << "messClient not initialized";
+    }
+}
+void WorkerTransport::freeLink(bufferevent* bev)
+{
+    for (int i = 0; i < d->extraBevs.size(); i++) {
+        if (d->extraBevs.at(i)->getBev() == bev) {
+            d->extraBevs.at(i)->lockBev();
+            d->extraBevs.at(i)->setBev(nullptr);
+            d->extraBevs.at(i)->unlockBev();
+            d->extraBevs.remove(i);
+            break;
+        }
+    }
+    bufferevent_free(bev);
+}
+void WorkerTransport::closeSocket(evutil_socket_t s)
+{
+    if (s >= 0) {
+        evutil_closesocket(s);
+    }
+}
+void WorkerTransport::startTimer(PXMMembership::Timer timer, int msecs)
+{
+    d->timer(timer)->start(msecs);
+}
+void WorkerTransport::stopTimer(PXMMembership::Timer timer)
+{
+    d->timer(timer)->stop();
+}
+void WorkerTransport::changed(const QUuid& uuid, const PXMMembership::PeerState<WorkerTransport>& state)
+{
+    Peers::PeerData& peer = d->peersHash[uuid];
+    peer.uuid             = uuid;
+    peer.addrRaw          = state.address;
+    peer.socket           = state.socket;
+    peer.connectTo        = state.connect;
+    peer.isAuthed         = state.authed;
+    if (peer.bw->getBev() == state.link) {
+        return;
+    }
+    // A connection we accepted keeps the wrapper its auth packet went out on
+    for (int i = 0; state.link && i < d->extraBevs.size(); i++) {
+        if (d->extraBevs.at(i)->getBev() == state.link) {
+            peer.bw = d->extraBevs.at(i);
+            d->extraBevs.remove(i);
+            return;
+        }
+    }
+    peer.bw->lockBev();
+    peer.bw->setBev(state.link);
+    peer.bw->unlockBev();
+}
+void WorkerTransport::authenticated(const QUuid& uuid)
+{
+    d->updateAuthenticatedGauge();
+    emit d->q_ptr->peerNameChanged(uuid, d->peersHash.value(uuid).hostname);
+}
+void WorkerTransport::disconnected(const QUuid& uuid)
+{
+    d->formatter.forget(uuid);
+    emit d->q_ptr->peerDisconnected(uuid);
+    d->updateAuthenticatedGauge();
+    d->dropTransfers(uuid);
+}
+void WorkerTransport::syncStarted()
+{
+    PXMMetrics::syncRounds.inc();
+}
 void PXMPeerWorker::addMessageToAllPeers(QString str, bool alert, bool formatAsMessage)
 {
     for (Peers::PeerData& itr : d_ptr->peersHash) {
@@ -561,83 +780,749 @@ void PXMPeerWorker::addMessageToAllPeers(QString str, bool alert, bool formatAsM
 
 int PXMPeerWorkerPrivate::formatMessage(QString& str, QUuid uuid, QString color)
 {
-    QRegularExpression qre("(<p.*?>)");
-    QRegularExpressionMatch qrem = qre.match(str);
-    int offset                   = qrem.capturedEnd(1);
-    QDateTime dt                 = QDateTime::currentDateTime();
-    QString date                 = QStringLiteral("(") % dt.time().toString("hh:mm:ss") % QStringLiteral(") ");
-    str.insert(offset, QString("<span style=\"white-space: nowrap\" style=\"color: " % color % ";\">" % date %
-                               peersHash.value(uuid).hostname % ":&nbsp;</span>"));
+    PXM_TRACE_SCOPE("formatMessage");
+    QHash<QUuid, Peers::PeerData>::const_iterator itr = peersHash.constFind(uuid);
+    if (itr == peersHash.constEnd()) {
+        return formatter.formatUncached(str, uuid.toString(), color);
+    }
+    return formatter.formatMessage(str, uuid, itr.value().hostname, color);
+}
 
-    return 0;
+QString PXMPeerWorkerPrivate::historyKey(const QUuid& uuid) const
+{
+    // The global chat uuid is regenerated every run
+    if (uuid == globalUUID) {
+        return QString::fromLatin1(PXMHistory::GLOBAL_CONVERSATION);
+    }
+    return uuid.toString().mid(1, 36);
 }
 
 int PXMPeerWorker::addMessageToPeer(QString str, QUuid uuid, bool alert, bool)
 {
-    if (!d_ptr->peersHash.contains(uuid)) {
+    return d_ptr->addMessage(str, uuid, alert, 0);
+}
+int PXMPeerWorkerPrivate::addMessage(QString& str, QUuid uuid, bool alert, qint64 workerMicros)
+{
+    PXM_TRACE_SCOPE("addMessageToPeer");
+    if (!peersHash.contains(uuid)) {
         return -1;
     }
 
-    QSharedPointer<QString> pStr(new QString(str.toUtf8()));
-    d_ptr->peersHash[uuid].messages.append(pStr);
-    if (d_ptr->peersHash[uuid].messages.size() > MESSAGE_HISTORY_LENGTH) {
-        d_ptr->peersHash[uuid].messages.takeFirst();
+    if (history) {
+        QString key                 = historyKey(uuid);
+        qint64 msecs                = QDateTime::currentMSecsSinceEpoch();
+        PXMHistory::Cursor position = history->append(key, str, msecs);
+        emit q_ptr->indexMessage(key, msecs, position.segment, position.offset, str);
     }
-    emit printToTextBrowser(pStr, uuid, alert);
+
+    QSharedPointer<QString> pStr(new QString(str));
+    peersHash[uuid].messages.append(pStr);
+    if (peersHash[uuid].messages.size() > MESSAGE_HISTORY_LENGTH) {
+        peersHash[uuid].messages.takeFirst();
+    }
+    emit q_ptr->messageAdded(pStr, uuid, alert, workerMicros);
     return 0;
 }
-void PXMPeerWorker::setSelfCommsBufferevent(bufferevent* bev)
+void PXMPeerWorker::searchHistory(QString query)
 {
-    d_ptr->peersHash.value(d_ptr->localUUID).bw->lockBev();
-    d_ptr->peersHash.value(d_ptr->localUUID).bw->setBev(bev);
-    d_ptr->peersHash.value(d_ptr->localUUID).bw->unlockBev();
-
-    updateListWidget(d_ptr->localUUID, d_ptr->localHostname);
-    // addMessageToPeer("<!DOCTYPE html><html><body><style>h2, p {margin:"
-    // "0;}h2 {text-align: center;}p {text-align: left;}</style><h2>" %
-    // d_ptr->localHostname % "</h2></body></html>",
-    // d_ptr->localUUID, false, false);
+    if (!d_ptr->indexerThread) {
+        emit searchResults(query, QStringList());
+        return;
+    }
+    emit searchIndex(query);
+}
+void PXMPeerWorker::indexResults(QString query, QVector<PXMSearch::Hit> hits)
+{
+    QStringList results;
+    for (const PXMSearch::Hit& hit : hits) {
+        PXMHistory::Record record = d_ptr->history->readAt(hit.conversation, hit.position);
+        if (record.position.isNull()) {
+            continue;
+        }
+        QString name;
+        if (hit.conversation == QLatin1String(PXMHistory::GLOBAL_CONVERSATION)) {
+            name = QStringLiteral("Global Chat");
+        } else {
+            QHash<QUuid, Peers::PeerData>::const_iterator itr = d_ptr->peersHash.constFind(QUuid(hit.conversation));
+            name = itr != d_ptr->peersHash.constEnd() ? itr.value().hostname : hit.conversation;
+        }
+        // The stored header only has the time of day, swap it for one that
+        // says where and when the message is from
+        QString label = QStringLiteral("<b>") % name.toHtmlEscaped() % QStringLiteral("</b> (") %
+                        QDateTime::fromMSecsSinceEpoch(hit.msecs).toString(QStringLiteral("yyyy-MM-dd hh:mm:ss")) %
+                        QStringLiteral("):&nbsp;");
+        QString text = PXMFormatter::stripHeader(record.text);
+        text.insert(qMax(PXMFormatter::paragraphEnd(text), 0), label);
+        results.append(text);
+    }
+    emit searchResults(query, results);
+}
+void PXMPeerWorkerPrivate::deliverToSelf(const QByteArray& msg, MESSAGE_TYPE type)
+{
+    // Same order and formatting as the client's send result followed by the
+    // server parsing our own frame, without either of them
+    if (static_cast<size_t>(msg.size()) > PXMClient::MAX_MESSAGE_LENGTH) {
+        return;
+    }
+    QString text = QString::fromUtf8(msg);
+    switch (type) {
+        case MSG_TEXT: {
+            q_ptr->resultOfTCPSend(0, localUUID, text, true, peersHash.value(localUUID).bw);
+            formatMessage(text, localUUID, Peers::peerColor);
+            addMessage(text, localUUID, true, PXMLatency::monotonicMicros());
+            break;
+        }
+        case MSG_GLOBAL:
+            formatMessage(text, localUUID, Peers::selfColor);
+            addMessage(text, globalUUID, true, PXMLatency::monotonicMicros());
+            break;
+        case MSG_NAME:
+            q_ptr->peerNameChange(text, localUUID);
+            break;
+        default:
+            break;
+    }
 }
 void PXMPeerWorker::sendMsgAccessor(QByteArray msg, MESSAGE_TYPE type, QUuid uuid)
 {
     switch (type) {
         case MSG_TEXT:
-            if (!uuid.isNull())
-                emit sendMsg(d_ptr->peersHash.value(uuid).bw, msg, MSG_TEXT, uuid);
-            else
+            if (uuid == d_ptr->localUUID) {
+                d_ptr->deliverToSelf(msg, MSG_TEXT);
+            } else if (!uuid.isNull()) {
+                const Peers::PeerData& peer = d_ptr->peersHash.value(uuid);
+                if (d_ptr->latencyStamps && peer.latencyStamps) {
+                    emit sendMsg(peer.bw, PXMLatency::stamp(msg), MSG_TEXT_STAMPED, uuid);
+                } else {
+                    emit sendMsg(peer.bw, msg, MSG_TEXT, uuid);
+                }
+            } else {
                 qWarning() << "Bad recipient uuid for normal message";
+            }
             break;
-        case MSG_GLOBAL:
+        case MSG_GLOBAL: {
+            QByteArray stamped;
+            if (d_ptr->latencyStamps) {
+                stamped = PXMLatency::stamp(msg);
+            }
             for (auto& itr : d_ptr->peersHash) {
-                if (itr.isAuthed || itr.uuid == d_ptr->localUUID) {
-                    emit sendMsg(itr.bw, msg, MSG_GLOBAL);
+                if (itr.isAuthed && itr.uuid != d_ptr->localUUID) {
+                    if (d_ptr->latencyStamps && itr.latencyStamps) {
+                        emit sendMsg(itr.bw, stamped, MSG_GLOBAL_STAMPED);
+                    } else {
+                        emit sendMsg(itr.bw, msg, MSG_GLOBAL);
+                    }
                 }
             }
+            d_ptr->deliverToSelf(msg, MSG_GLOBAL);
             break;
+        }
         case MSG_NAME:
             d_ptr->peersHash[d_ptr->localUUID].hostname = QString(msg);
             d_ptr->localHostname                        = QString(msg);
             for (auto& itr : d_ptr->peersHash) {
-                if (itr.isAuthed || itr.uuid == d_ptr->localUUID) {
+                if (itr.isAuthed && itr.uuid != d_ptr->localUUID) {
                     emit sendMsg(itr.bw, msg, MSG_NAME);
                 }
             }
+            d_ptr->deliverToSelf(msg, MSG_NAME);
             break;
         default:
             qWarning() << "Bad message type in sendMsgAccessor";
             break;
     }
 }
-void PXMPeerWorker::printFullHistory(QUuid uuid)
+void PXMPeerWorker::offerFile(QString path, QUuid uuid)
+{
+    QVector<QUuid> recipients;
+    for (const Peers::PeerData& itr : d_ptr->peersHash) {
+        if (itr.isAuthed && itr.uuid != d_ptr->localUUID && (uuid == d_ptr->globalUUID || itr.uuid == uuid)) {
+            recipients.append(itr.uuid);
+        }
+    }
+    if (recipients.isEmpty()) {
+        emit warning(QStringLiteral("File Transfer"), QStringLiteral("Files can only be sent to a connected peer"));
+        return;
+    }
+    QFileInfo info(path);
+    if (!info.isFile() || !info.isReadable()) {
+        emit warning(QStringLiteral("File Transfer"), QStringLiteral("Could not read ") % path);
+        return;
+    }
+
+    // One transfer per recipient, all waiting on the same hash
+    QUuid first;
+    for (const QUuid& recipient : recipients) {
+        PXMTransfer::Transfer transfer;
+        transfer.id       = QUuid::createUuid();
+        transfer.peer     = recipient;
+        transfer.name     = info.fileName();
+        transfer.path     = info.absoluteFilePath();
+        transfer.size     = info.size();
+        transfer.outgoing = true;
+        transfer.state    = PXMTransfer::HASHING;
+        d_ptr->transfers.insert(transfer.id, transfer);
+        if (first.isNull()) {
+            first = transfer.id;
+        }
+    }
+    qInfo().noquote() << "Offering" << info.absoluteFilePath() << "to" << recipients.size() << "peers";
+    emit hashFile(first, info.absoluteFilePath(), QByteArray(), QString());
+
+    QString note = QStringLiteral("Offered ") % info.fileName() % QStringLiteral(" (") %
+                   PXMTransfer::sizeString(info.size()) % QChar(')');
+    if (uuid == d_ptr->globalUUID) {
+        note.append(QStringLiteral(" to ") % QString::number(recipients.size()) % QStringLiteral(" peers"));
+    }
+    d_ptr->addTransferNote(note, uuid);
+}
+void PXMPeerWorker::answerOffer(QUuid id, QString path)
+{
+    QHash<QUuid, PXMTransfer::Transfer>::iterator itr = d_ptr->transfers.find(id);
+    if (itr == d_ptr->transfers.end() || itr.value().outgoing || itr.value().state != PXMTransfer::OFFERED) {
+        return;
+    }
+    PXMTransfer::Transfer& transfer = itr.value();
+    if (path.isEmpty()) {
+        d_ptr->sendTransferControl(transfer, MSG_FILE_CANCEL);
+        d_ptr->endTransfer(id, false, QStringLiteral("Declined ") % transfer.name);
+        return;
+    }
+    transfer.path = path;
+
+    QString cached = d_ptr->blobs ? d_ptr->blobs->find(transfer.hash, transfer.size) : QString();
+    if (!cached.isEmpty()) {
+        qInfo().noquote() << transfer.name << "is in the file cache, copying it to" << path;
+        transfer.state = PXMTransfer::COPYING;
+        emit copyFile(id, cached, path);
+        return;
+    }
+    d_ptr->acceptTransfer(transfer);
+}
+void PXMPeerWorker::transferMessage(QUuid uuid, const bufferevent* bev, MESSAGE_TYPE type, QByteArray payload)
+{
+    QHash<QUuid, Peers::PeerData>::const_iterator peer = d_ptr->peersHash.constFind(uuid);
+    if (peer == d_ptr->peersHash.constEnd() || peer.value().bw->getBev() != bev) {
+        qWarning() << "File transfer message from invalid uuid, rejection";
+        return;
+    }
+    const unsigned char* buf = reinterpret_cast<const unsigned char*>(payload.constData());
+    size_t len               = static_cast<size_t>(payload.size());
+
+    if (type == MSG_FILE_OFFER) {
+        PXMTransfer::Transfer transfer;
+        transfer.peer   = uuid;
+        transfer.source = uuid;
+        if (!PXMTransfer::unpackOffer(buf, len, transfer.id, transfer.size, transfer.hash, transfer.name) ||
+            d_ptr->transfers.contains(transfer.id)) {
+            qWarning() << "Bad file offer from" << uuid.toString();
+            return;
+        }
+        d_ptr->transfers.insert(transfer.id, transfer);
+        d_ptr->addTransferNote(peer.value().hostname % QStringLiteral(" offered ") % transfer.name %
+                                   QStringLiteral(" (") % PXMTransfer::sizeString(transfer.size) % QChar(')'),
+                               uuid);
+        emit fileOffered(transfer.id, uuid, peer.value().hostname, transfer.name, transfer.size);
+        return;
+    }
+    if (type == MSG_FILE_PULL) {
+        d_ptr->servePull(uuid, buf, len);
+        return;
+    }
+    // With the hash it can pass the file on, even once its own transfer
+    // from us is over
+    if (type == MSG_FILE_HAVE && len >= NetCompression::PACKED_UUID_LENGTH + PXMBlobCache::HASH_BYTES) {
+        QHash<QByteArray, QHash<QUuid, int>>::iterator holder =
+            d_ptr->holders.find(payload.mid(NetCompression::PACKED_UUID_LENGTH, PXMBlobCache::HASH_BYTES));
+        if (holder != d_ptr->holders.end() && !holder.value().contains(uuid)) {
+            holder.value().insert(uuid, 0);
+        }
+    }
+
+    if (len < NetCompression::PACKED_UUID_LENGTH) {
+        qWarning() << "Short file transfer message from" << uuid.toString();
+        return;
+    }
+    QUuid id                                          = NetCompression::readUUID(buf);
+    QHash<QUuid, PXMTransfer::Transfer>::iterator itr = d_ptr->transfers.find(id);
+    if (itr == d_ptr->transfers.end() || (itr.value().peer != uuid && itr.value().source != uuid)) {
+        if (type == MSG_FILE_HAVE) {
+            return;
+        }
+        qWarning() << "File transfer message for an unknown transfer from" << uuid.toString();
+        return;
+    }
+    PXMTransfer::Transfer& transfer = itr.value();
+
+    // From a peer we were sent to pull from, it does not have the file
+    if (transfer.peer != uuid) {
+        if (type == MSG_FILE_CANCEL && !transfer.outgoing && transfer.state == PXMTransfer::ACCEPTED) {
+            d_ptr->fallBack(transfer);
+        }
+        return;
+    }
+
+    switch (type) {
+        case MSG_FILE_ACCEPT:
+            // Accepted again from REDIRECTED, the receiver could not get it
+            // from the peer we sent it to
+            if (transfer.outgoing && transfer.state == PXMTransfer::REDIRECTED) {
+                d_ptr->releaseHolder(transfer);
+                d_ptr->streamTransfer(transfer);
+            } else if (transfer.outgoing && transfer.state == PXMTransfer::OFFERED) {
+                d_ptr->dispatchTransfer(transfer);
+            }
+            break;
+        case MSG_FILE_CANCEL:
+            // A stream under way ends on its own
+            if (transfer.state == PXMTransfer::STREAMING || transfer.state == PXMTransfer::VERIFYING) {
+                break;
+            }
+            d_ptr->endTransfer(id, false,
+                               (transfer.outgoing ? QStringLiteral("Declined: ") : QStringLiteral("Cancelled: ")) %
+                                   transfer.name);
+            break;
+        case MSG_FILE_HAVE:
+            if (!transfer.outgoing) {
+                break;
+            }
+            if (transfer.state == PXMTransfer::OFFERED) {
+                d_ptr->endTransfer(id, true, peer.value().hostname % QStringLiteral(" already had ") % transfer.name);
+            } else if (transfer.state == PXMTransfer::REDIRECTED) {
+                d_ptr->endTransfer(id, true,
+                                   peer.value().hostname % QStringLiteral(" got ") % transfer.name %
+                                       QStringLiteral(" from ") % d_ptr->peersHash.value(transfer.source).hostname);
+            }
+            break;
+        case MSG_FILE_REDIRECT:
+            if (!transfer.outgoing && transfer.state == PXMTransfer::ACCEPTED &&
+                len >= PXMTransfer::REDIRECT_LENGTH) {
+                d_ptr->pullFrom(transfer, NetCompression::readUUID(&buf[NetCompression::PACKED_UUID_LENGTH]));
+            }
+            break;
+        default:
+            break;
+    }
+}
+void PXMPeerWorker::transferConnection(bufferevent* bev, QUuid id, QUuid uuid)
+{
+    // Whatever it is for, this connection is not a peer waiting to authenticate
+    for (int i = 0; i < d_ptr->extraBevs.size(); i++) {
+        if (d_ptr->extraBevs.at(i)->getBev() == bev) {
+            d_ptr->extraBevs.at(i)->lockBev();
+            d_ptr->extraBevs.at(i)->setBev(nullptr);
+            d_ptr->extraBevs.at(i)->unlockBev();
+            d_ptr->extraBevs.remove(i);
+            break;
+        }
+    }
+    d_ptr->membership.release(bev);
+
+    int32_t fd    = -1;
+    uint64_t size = 0;
+    QHash<QUuid, PXMTransfer::Transfer>::iterator itr = d_ptr->transfers.find(id);
+    if (itr != d_ptr->transfers.end() && !itr.value().outgoing && itr.value().state == PXMTransfer::ACCEPTED &&
+        itr.value().source == uuid) {
+        // The server thread owns the file from here
+        fd                = itr.value().fd;
+        size              = static_cast<uint64_t>(itr.value().size);
+        itr.value().fd    = -1;
+        itr.value().state = PXMTransfer::STREAMING;
+    } else {
+        qWarning() << "Transfer connection from" << uuid.toString() << "for nothing we accepted, closing";
+    }
+
+    const PXMServer::INTERNAL_MSG receive = PXMServer::INTERNAL_MSG::TRANSFER_RECEIVE;
+    unsigned char msg[sizeof(receive) + sizeof(bev) + sizeof(fd) + sizeof(size) + NetCompression::PACKED_UUID_LENGTH];
+    size_t index = 0;
+    memcpy(&msg[index], &receive, sizeof(receive));
+    index += sizeof(receive);
+    memcpy(&msg[index], &bev, sizeof(bev));
+    index += sizeof(bev);
+    memcpy(&msg[index], &fd, sizeof(fd));
+    index += sizeof(fd);
+    index += NetCompression::writeUint64(&msg[index], size);
+    index += NetCompression::packUUID(&msg[index], id);
+    bufferevent_write(d_ptr->internalBev, msg, index);
+}
+void PXMPeerWorker::transferStreamProgress(QUuid id, qint64 done, qint64 size)
+{
+    QHash<QUuid, PXMTransfer::Transfer>::const_iterator itr = d_ptr->transfers.constFind(id);
+    if (itr != d_ptr->transfers.constEnd()) {
+        emit transferProgress(id, d_ptr->transferDescription(itr.value()), done, size);
+    }
+}
+void PXMPeerWorker::transferStreamFinished(QUuid id, bool ok)
+{
+    QHash<QUuid, PXMTransfer::Transfer>::iterator itr = d_ptr->transfers.find(id);
+    if (itr == d_ptr->transfers.end()) {
+        return;
+    }
+    PXMTransfer::Transfer& transfer = itr.value();
+    if (transfer.outgoing && !ok) {
+        d_ptr->endTransfer(id, false, d_ptr->transferDescription(transfer) % QStringLiteral(" failed"));
+    } else if (transfer.outgoing && transfer.relay) {
+        d_ptr->endTransfer(id, true,
+                           QStringLiteral("Shared a cached file with ") % d_ptr->peersHash.value(transfer.peer).hostname);
+    } else if (transfer.outgoing) {
+        d_ptr->endTransfer(id, true, QStringLiteral("Sent ") % transfer.name);
+    } else if (!ok && transfer.source != transfer.peer) {
+        qWarning().noquote() << "Pulling" << transfer.name << "failed, asking the sender";
+        d_ptr->fallBack(transfer);
+    } else if (!ok) {
+        d_ptr->endTransfer(id, false, d_ptr->transferDescription(transfer) % QStringLiteral(" failed"));
+    } else {
+        // Nothing is kept or passed on before it is known to be what was offered
+        transfer.state = PXMTransfer::VERIFYING;
+        emit hashFile(id, transfer.path, transfer.hash, d_ptr->blobs ? d_ptr->blobs->directory() : QString());
+    }
+}
+void PXMPeerWorker::fileHashed(QUuid id, QByteArray hash)
+{
+    QHash<QUuid, PXMTransfer::Transfer>::iterator itr = d_ptr->transfers.find(id);
+    if (itr == d_ptr->transfers.end()) {
+        return;
+    }
+    PXMTransfer::Transfer& transfer = itr.value();
+
+    if (transfer.outgoing && transfer.state == PXMTransfer::HASHING) {
+        // Offers of the same file, to everyone or queued behind this one,
+        // all go out now
+        QString path = transfer.path;
+        QVector<QUuid> ids;
+        for (const PXMTransfer::Transfer& other : d_ptr->transfers) {
+            if (other.outgoing && other.state == PXMTransfer::HASHING && other.path == path) {
+                ids.append(other.id);
+            }
+        }
+        for (const QUuid& offerId : ids) {
+            PXMTransfer::Transfer& offer = d_ptr->transfers[offerId];
+            Peers::PeerData peer         = d_ptr->peersHash.value(offer.peer);
+            if (hash.isEmpty()) {
+                d_ptr->endTransfer(offerId, false, QStringLiteral("Could not read ") % offer.name);
+            } else if (!peer.isAuthed) {
+                d_ptr->endTransfer(offerId, false, peer.hostname % QStringLiteral(" disconnected"));
+            } else {
+                offer.hash  = hash;
+                offer.state = PXMTransfer::OFFERED;
+                // Receivers that report having it are collected from now
+                if (!d_ptr->holders.contains(hash)) {
+                    d_ptr->holders.insert(hash, QHash<QUuid, int>());
+                }
+                emit sendMsg(peer.bw, PXMTransfer::packOffer(offer.id, offer.size, offer.hash, offer.name),
+                             MSG_FILE_OFFER);
+            }
+        }
+    } else if (!transfer.outgoing && transfer.state == PXMTransfer::VERIFYING) {
+        if (hash != transfer.hash) {
+            qWarning().noquote() << transfer.name << "from" << transfer.source.toString() << "does not match its hash";
+            if (transfer.source != transfer.peer) {
+                d_ptr->fallBack(transfer);
+            } else {
+                d_ptr->endTransfer(id, false, transfer.name % QStringLiteral(" arrived damaged"));
+            }
+            return;
+        }
+        bool cached = d_ptr->blobs && d_ptr->blobs->adopt(hash);
+        // The sender learns of pulls only from us, and of anyone it can
+        // send others to
+        if (cached || transfer.source != transfer.peer) {
+            d_ptr->sendHave(transfer, cached);
+        }
+        d_ptr->endTransfer(id, true,
+                           QStringLiteral("Received ") % transfer.name % QStringLiteral(", saved to ") % transfer.path);
+    }
+}
+void PXMPeerWorker::fileCopied(QUuid id, bool ok)
+{
+    QHash<QUuid, PXMTransfer::Transfer>::iterator itr = d_ptr->transfers.find(id);
+    if (itr == d_ptr->transfers.end() || itr.value().state != PXMTransfer::COPYING) {
+        return;
+    }
+    PXMTransfer::Transfer& transfer = itr.value();
+    if (!ok) {
+        qWarning().noquote() << "Copying" << transfer.name << "out of the file cache failed, fetching it";
+        d_ptr->acceptTransfer(transfer);
+        return;
+    }
+    PXMMetrics::blobCacheHits.inc();
+    d_ptr->sendHave(transfer, true);
+    d_ptr->endTransfer(id, true, QStringLiteral("Already had ") % transfer.name % QStringLiteral(", saved to ") %
+                                     transfer.path);
+}
+void PXMPeerWorkerPrivate::sendTransferControl(const PXMTransfer::Transfer& transfer, MESSAGE_TYPE type)
+{
+    unsigned char id[NetCompression::PACKED_UUID_LENGTH];
+    NetCompression::packUUID(id, transfer.id);
+    sendTransferMessage(transfer.peer, QByteArray(reinterpret_cast<const char*>(id), sizeof(id)), type);
+}
+void PXMPeerWorkerPrivate::sendTransferMessage(const QUuid& uuid, const QByteArray& payload, MESSAGE_TYPE type)
+{
+    emit q_ptr->sendMsg(peersHash.value(uuid).bw, payload, type);
+}
+void PXMPeerWorkerPrivate::sendHave(const PXMTransfer::Transfer& transfer, bool cached)
+{
+    unsigned char id[NetCompression::PACKED_UUID_LENGTH];
+    NetCompression::packUUID(id, transfer.id);
+    QByteArray have(reinterpret_cast<const char*>(id), sizeof(id));
+    if (cached) {
+        have.append(transfer.hash);
+    }
+    sendTransferMessage(transfer.peer, have, MSG_FILE_HAVE);
+}
+void PXMPeerWorkerPrivate::acceptTransfer(PXMTransfer::Transfer& transfer)
+{
+    int fd = PXMTransfer::openForReceive(transfer.path, transfer.size);
+    if (fd < 0) {
+        QString error = QString::fromUtf8(strerror(errno));
+        emit q_ptr->warning(QStringLiteral("File Transfer"),
+                            QStringLiteral("Could not create ") % transfer.path % ": " % error);
+        sendTransferControl(transfer, MSG_FILE_CANCEL);
+        endTransfer(transfer.id, false, QStringLiteral("Could not save ") % transfer.name);
+        return;
+    }
+    transfer.fd     = fd;
+    transfer.source = transfer.peer;
+    transfer.state  = PXMTransfer::ACCEPTED;
+    qInfo().noquote() << "Accepted" << transfer.name << "saving to" << transfer.path;
+    sendTransferControl(transfer, MSG_FILE_ACCEPT);
+}
+void PXMPeerWorkerPrivate::fallBack(PXMTransfer::Transfer& transfer)
+{
+    PXMTransfer::closeFile(transfer.fd);
+    transfer.fd = -1;
+    acceptTransfer(transfer);
+}
+void PXMPeerWorkerPrivate::pullFrom(PXMTransfer::Transfer& transfer, const QUuid& holder)
+{
+    // Anyone we cannot reach, the sender sends it itself
+    if (holder == localUUID || holder == transfer.peer || !peersHash.value(holder).isAuthed) {
+        sendTransferControl(transfer, MSG_FILE_ACCEPT);
+        return;
+    }
+    qInfo().noquote() << "Pulling" << transfer.name << "from" << peersHash.value(holder).hostname;
+    transfer.source = holder;
+    sendTransferMessage(holder, PXMTransfer::packPull(transfer.id, transfer.hash, transfer.size), MSG_FILE_PULL);
+}
+void PXMPeerWorkerPrivate::servePull(const QUuid& uuid, const unsigned char* buf, size_t len)
+{
+    PXMTransfer::Transfer transfer;
+    if (!PXMTransfer::unpackPull(buf, len, transfer.id, transfer.hash, transfer.size)) {
+        qWarning() << "Bad file pull from" << uuid.toString();
+        return;
+    }
+    QString path = blobs ? blobs->find(transfer.hash, transfer.size) : QString();
+    qint64 size  = 0;
+    int fd       = path.isEmpty() ? -1 : PXMTransfer::openForSend(path, size);
+    transfer.peer = uuid;
+    if (fd < 0 || size != transfer.size || transfers.contains(transfer.id)) {
+        PXMTransfer::closeFile(fd);
+        sendTransferControl(transfer, MSG_FILE_CANCEL);
+        return;
+    }
+    transfer.name     = QString::fromLatin1(transfer.hash.toHex().left(12));
+    transfer.path     = path;
+    transfer.outgoing = true;
+    transfer.relay    = true;
+    transfer.state    = PXMTransfer::STREAMING;
+    transfers.insert(transfer.id, transfer);
+    startSending(transfer, fd);
+}
+void PXMPeerWorkerPrivate::dispatchTransfer(PXMTransfer::Transfer& transfer)
+{
+    int uploads = 0;
+    for (const PXMTransfer::Transfer& other : transfers) {
+        if (other.outgoing && !other.relay && other.state == PXMTransfer::STREAMING && other.hash == transfer.hash) {
+            uploads++;
+        }
+    }
+    if (uploads < PXMTransfer::MAX_UPLOADS_PER_FILE) {
+        streamTransfer(transfer);
+        return;
+    }
+
+    // Least busy peer that has it
+    QUuid holder;
+    int load = PXMTransfer::MAX_UPLOADS_PER_FILE;
+    QHash<QUuid, int>& candidates = holders[transfer.hash];
+    for (QHash<QUuid, int>::const_iterator itr = candidates.constBegin(); itr != candidates.constEnd(); ++itr) {
+        if (itr.value() < load && itr.key() != transfer.peer && peersHash.value(itr.key()).isAuthed) {
+            holder = itr.key();
+            load   = itr.value();
+        }
+    }
+    if (holder.isNull()) {
+        transfer.state = PXMTransfer::QUEUED;
+        return;
+    }
+    candidates[holder]++;
+    transfer.source = holder;
+    transfer.state  = PXMTransfer::REDIRECTED;
+    PXMMetrics::transferRedirects.inc();
+    sendTransferMessage(transfer.peer, PXMTransfer::packRedirect(transfer.id, holder), MSG_FILE_REDIRECT);
+}
+void PXMPeerWorkerPrivate::dispatchQueued(const QByteArray& hash)
+{
+    QVector<QUuid> ids;
+    for (const PXMTransfer::Transfer& other : transfers) {
+        if (other.outgoing && other.state == PXMTransfer::QUEUED && other.hash == hash) {
+            ids.append(other.id);
+        }
+    }
+    for (const QUuid& id : ids) {
+        QHash<QUuid, PXMTransfer::Transfer>::iterator itr = transfers.find(id);
+        if (itr == transfers.end() || itr.value().state != PXMTransfer::QUEUED) {
+            continue;
+        }
+        dispatchTransfer(itr.value());
+        // Still no room, neither will the rest have
+        if (transfers.value(id).state == PXMTransfer::QUEUED) {
+            break;
+        }
+    }
+}
+void PXMPeerWorkerPrivate::streamTransfer(PXMTransfer::Transfer& transfer)
 {
-    QString* str = new QString();
+    // The offer stands for the file as it was then
+    qint64 size = 0;
+    int fd      = PXMTransfer::openForSend(transfer.path, size);
+    if (fd < 0 || size != transfer.size) {
+        PXMTransfer::closeFile(fd);
+        sendTransferControl(transfer, MSG_FILE_CANCEL);
+        endTransfer(transfer.id, false, transfer.name % QStringLiteral(" changed before it could be sent"));
+        return;
+    }
+    transfer.state = PXMTransfer::STREAMING;
+    startSending(transfer, fd);
+}
+void PXMPeerWorkerPrivate::releaseHolder(PXMTransfer::Transfer& transfer)
+{
+    if (!transfer.outgoing || transfer.state != PXMTransfer::REDIRECTED) {
+        return;
+    }
+    QHash<QByteArray, QHash<QUuid, int>>::iterator itr = holders.find(transfer.hash);
+    if (itr != holders.end() && itr.value().value(transfer.source) > 0) {
+        itr.value()[transfer.source]--;
+    }
+    transfer.source = QUuid();
+}
+void PXMPeerWorkerPrivate::dropTransfers(const QUuid& uuid)
+{
+    QVector<QUuid> ended;
+    QVector<QUuid> pulling;
+    for (const PXMTransfer::Transfer& transfer : transfers) {
+        // Streams, and the file work after them, end on their own
+        if (transfer.state == PXMTransfer::HASHING || transfer.state == PXMTransfer::STREAMING ||
+            transfer.state == PXMTransfer::COPYING || transfer.state == PXMTransfer::VERIFYING) {
+            continue;
+        }
+        if (transfer.peer == uuid) {
+            ended.append(transfer.id);
+        } else if (!transfer.outgoing && transfer.state == PXMTransfer::ACCEPTED && transfer.source == uuid) {
+            pulling.append(transfer.id);
+        }
+    }
+    for (const QUuid& id : ended) {
+        endTransfer(id, false, peersHash.value(uuid).hostname % QStringLiteral(" disconnected"));
+    }
+    for (const QUuid& id : pulling) {
+        fallBack(transfers[id]);
+    }
+}
+void PXMPeerWorkerPrivate::startSending(const PXMTransfer::Transfer& transfer, int32_t fd)
+{
+    const PXMServer::INTERNAL_MSG send = PXMServer::INTERNAL_MSG::TRANSFER_SEND;
+    unsigned char msg[sizeof(send) + NetCompression::PACKED_UUID_LENGTH + NetCompression::PACKED_PEER_RECORD_LENGTH +
+                      sizeof(fd) + sizeof(uint64_t)];
+    size_t index = 0;
+    memcpy(&msg[index], &send, sizeof(send));
+    index += sizeof(send);
+    index += NetCompression::packUUID(&msg[index], transfer.id);
+    index += NetCompression::packPeerRecord(&msg[index], peersHash.value(transfer.peer).addrRaw, transfer.peer);
+    memcpy(&msg[index], &fd, sizeof(fd));
+    index += sizeof(fd);
+    index += NetCompression::writeUint64(&msg[index], static_cast<uint64_t>(transfer.size));
+    bufferevent_write(internalBev, msg, index);
+}
+void PXMPeerWorkerPrivate::endTransfer(const QUuid& id, bool ok, const QString& note)
+{
+    QHash<QUuid, PXMTransfer::Transfer>::iterator itr = transfers.find(id);
+    if (itr == transfers.end()) {
+        return;
+    }
+    releaseHolder(itr.value());
+    PXMTransfer::Transfer transfer = itr.value();
+    transfers.erase(itr);
+    PXMTransfer::closeFile(transfer.fd);
+    // Nothing is left of a file we failed to receive
+    if (!ok && !transfer.outgoing && transfer.state != PXMTransfer::OFFERED) {
+        QFile::remove(transfer.path);
+    }
+    qInfo().noquote() << note;
+    if (!transfer.relay) {
+        addTransferNote(note, transfer.peer);
+    }
+    emit q_ptr->transferFinished(id, ok, note);
 
-    for (QSharedPointer<QString> const& itr : d_ptr->peersHash.value(uuid).messages) {
-        str->append(itr.data());
+    if (!transfer.outgoing || transfer.relay || transfer.hash.isEmpty()) {
+        return;
+    }
+    bool offering = false;
+    for (const PXMTransfer::Transfer& other : transfers) {
+        if (other.outgoing && !other.relay && other.hash == transfer.hash) {
+            offering = true;
+            break;
+        }
+    }
+    if (offering) {
+        // An upload or a peer to redirect to may have come free
+        dispatchQueued(transfer.hash);
+    } else {
+        holders.remove(transfer.hash);
+    }
+}
+void PXMPeerWorkerPrivate::addTransferNote(const QString& note, const QUuid& uuid)
+{
+    QString str = QStringLiteral("<center>") % note.toHtmlEscaped() % QStringLiteral("</center>");
+    addMessage(str, uuid, false, 0);
+}
+QString PXMPeerWorkerPrivate::transferDescription(const PXMTransfer::Transfer& transfer) const
+{
+    QString hostname = peersHash.value(transfer.peer).hostname;
+    if (transfer.relay) {
+        return QStringLiteral("Sharing a cached file with ") % hostname;
+    }
+    if (transfer.outgoing) {
+        return QStringLiteral("Sending ") % transfer.name % QStringLiteral(" to ") % hostname;
+    }
+    return QStringLiteral("Receiving ") % transfer.name % QStringLiteral(" from ") %
+           peersHash.value(transfer.source).hostname;
+}
+void PXMPeerWorker::requestHistoryPage(QUuid uuid, PXMHistory::Cursor before, int count)
+{
+    QStringList page;
+    if (d_ptr->history) {
+        QVector<PXMHistory::Record> records = d_ptr->history->readBefore(d_ptr->historyKey(uuid), before, count);
+        page.reserve(records.size());
+        for (const PXMHistory::Record& record : records) {
+            page.append(record.text);
+        }
+        PXMHistory::Cursor next = records.isEmpty() ? PXMHistory::Cursor() : records.first().position;
+        emit historyPage(uuid, page, next, records.size() == count);
+        return;
     }
-    QSharedPointer<QString> pStr(str);
 
-    emit printToTextBrowser(pStr, uuid, false);
+    // Without a history store only the in memory messages are available,
+    // they are already bounded so they go out as a single page
+    if (before.isNull()) {
+        QHash<QUuid, Peers::PeerData>::const_iterator itr = d_ptr->peersHash.constFind(uuid);
+        if (itr != d_ptr->peersHash.constEnd()) {
+            for (QSharedPointer<QString> const& msg : itr.value().messages) {
+                page.append(*msg);
+            }
+        }
+    }
+    emit historyPage(uuid, page, PXMHistory::Cursor(), false);
 }
 
 void PXMPeerWorker::setlibeventBackend(QString str)
@@ -651,7 +1536,7 @@ void PXMPeerWorker::printInfoToDebug()
     str.reserve((330 + (DEBUG_PADDING * 16) + (d_ptr->peersHash.size() * (260 + (9 * DEBUG_PADDING)))));
 
     str.append(QChar('\n') % QStringLiteral("---Program Info---\n") % QStringLiteral("Program Name: ") %
-               qApp->applicationName() % QChar('\n') % QStringLiteral("Version: ") % qApp->applicationVersion() %
+               QCoreApplication::applicationName() % QChar('\n') % QStringLiteral("Version: ") % QCoreApplication::applicationVersion() %
                QChar('\n') % QStringLiteral("---Network Info---\n") % QStringLiteral("Libevent Backend: ") %
                d_ptr->libeventBackend % QChar('\n') % QStringLiteral("Multicast Address: ") % d_ptr->multicastAddress %
                QChar('\n') % QStringLiteral("TCP Listener Port: ") % QString::number(d_ptr->serverTCPPort) %
@@ -659,7 +1544,9 @@ void PXMPeerWorker::printInfoToDebug()
                QChar('\n') % QStringLiteral("Our UUID: ") % d_ptr->localUUID.toString() % QChar('\n') %
                QStringLiteral("MulticastIsFunctioning: ") %
                QString::fromLocal8Bit((d_ptr->multicastIsFunctioning ? "true" : "false")) % QChar('\n') %
-               QStringLiteral("Sync waiting list: ") % QString::number(d_ptr->syncablePeers->length()) % QChar('\n') %
+               QStringLiteral("Sync waiting list: ") % QString::number(d_ptr->membership.syncWaiting()) % QChar('\n') %
+               QStringLiteral("History Directory: ") %
+               (d_ptr->history ? d_ptr->history->directory() : QStringLiteral("disabled")) % QChar('\n') %
                QStringLiteral("---Peer Details---\n"));
 
     int peerCount = 0;
@@ -671,37 +1558,32 @@ void PXMPeerWorker::printInfoToDebug()
 
     str.append(QStringLiteral("-------------\n") % QStringLiteral("Total Peers: ") % QString::number(peerCount) %
                QChar('\n'));
+
+    QHash<QUuid, QString> names;
+    for (const Peers::PeerData& itr : d_ptr->peersHash) {
+        names.insert(itr.uuid, itr.hostname);
+    }
+    str.append(PXMLatency::Recorder::instance()->summary(names));
+    QFile latencyFile(QDir::tempPath() % QStringLiteral("/pxmessenger-latency-") %
+                      QString::number(QCoreApplication::applicationPid()) % QStringLiteral(".json"));
+    if (latencyFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        latencyFile.write(PXMLatency::Recorder::instance()->toJson(names));
+        str.append(QStringLiteral("Latency JSON: ") % latencyFile.fileName() % QChar('\n'));
+    }
+
     str.squeeze();
     qInfo().noquote() << str;
 }
-void PXMPeerWorker::discoveryTimerPersistent()
+void PXMPeerWorker::discoveryTimerFired()
 {
-    if (d_ptr->peersHash.count() < 3) {
-        emit sendUDP("/discover", d_ptr->serverUDPPort);
-    } else {
-        qInfo() << "Found enough peers";
-        d_ptr->discoveryTimer->stop();
-    }
-}
-void PXMPeerWorker::discoveryTimerSingleShot()
-{
-    if (!d_ptr->multicastIsFunctioning) {
-        warnBox(QStringLiteral("Network Problem"), QStringLiteral("Could not find anyone, even ourselves, on "
+    if (!d_ptr->discoveryWarned && !d_ptr->multicastIsFunctioning) {
+        emit warning(QStringLiteral("Network Problem"), QStringLiteral("Could not find anyone, even ourselves, on "
                                                                   "the network.\nThis could indicate a "
                                                                   "problem with your configuration."
                                                                   "\n\nWe'll keep looking..."));
     }
-    if (d_ptr->peersHash.count() < 3) {
-        d_ptr->discoveryTimer->setInterval(30000);
-        QObject::connect(d_ptr->discoveryTimer, &QTimer::timeout, this, &PXMPeerWorker::discoveryTimerPersistent);
-        emit sendUDP("/discover", d_ptr->serverUDPPort);
-        qInfo().noquote() << QStringLiteral(
-            "Retrying discovery packet, looking "
-            "for other computers...");
-        d_ptr->discoveryTimer->start();
-    } else {
-        qInfo() << "Found enough peers";
-    }
+    d_ptr->discoveryWarned = true;
+    d_ptr->membership.timerFired(PXMMembership::DISCOVERY_TIMER);
 }
 
 void PXMPeerWorker::midnightTimerPersistent()
@@ -728,8 +1610,7 @@ void PXMPeerWorker::multicastIsFunctional()
 void PXMPeerWorker::serverSetupFailure(QString error)
 {
     d_ptr->discoveryTimer->stop();
-    d_ptr->discoveryTimerSingle->stop();
-    emit warnBox(QStringLiteral("Server Setup Failure"), QStringLiteral("Server Setup failure:") % "\n" % error % "\n" %
+    emit warning(QStringLiteral("Server Setup Failure"), QStringLiteral("Server Setup failure:") % "\n" % error % "\n" %
                                                              QStringLiteral("Settings for your network conditions will "
                                                                             "have to be adjusted and the program "
                                                                             "restarted."));
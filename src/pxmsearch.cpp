@@ -0,0 +1,331 @@
+#include "pxmsearch.h"
+#include "pxmformatter.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+
+#include <algorithm>
+
+using namespace PXMSearch;
+
+namespace
+{
+const int MAX_TERM_LENGTH = 64;
+
+void putVarint(QByteArray& out, quint32 value)
+{
+    while (value >= 0x80) {
+        out.append(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+quint32 getVarint(const uchar*& pos)
+{
+    quint32 value = 0;
+    int shift     = 0;
+    while (*pos & 0x80) {
+        value |= static_cast<quint32>(*pos & 0x7F) << shift;
+        shift += 7;
+        pos++;
+    }
+    value |= static_cast<quint32>(*pos) << shift;
+    pos++;
+    return value;
+}
+
+QVector<quint32> intersect(const QVector<quint32>& a, const QVector<quint32>& b)
+{
+    QVector<quint32> result;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+}
+
+QStringList Index::tokenize(const QString& text)
+{
+    QStringList tokens;
+    QString current;
+    const QChar* data = text.constData();
+    const int len     = text.length();
+    for (int i = 0; i < len; i++) {
+        QChar c = data[i];
+        if (c == QLatin1Char('<')) {
+            // Skip the whole tag
+            while (i < len && data[i] != QLatin1Char('>')) {
+                i++;
+            }
+        } else if (c == QLatin1Char('&')) {
+            // Skip entities like &nbsp;
+            int j = i + 1;
+            while (j < len && j - i < 8 && data[j].isLetterOrNumber()) {
+                j++;
+            }
+            if (j < len && data[j] == QLatin1Char(';')) {
+                i = j;
+            }
+        } else if (c.isLetterOrNumber()) {
+            if (current.length() < MAX_TERM_LENGTH) {
+                current.append(c.toLower());
+            }
+            continue;
+        }
+        if (!current.isEmpty()) {
+            tokens.append(current);
+            current.clear();
+        }
+    }
+    if (!current.isEmpty()) {
+        tokens.append(current);
+    }
+    return tokens;
+}
+
+void Index::add(const QString& conversation, qint64 msecs, PXMHistory::Cursor position, const QString& text)
+{
+    int convId = conversationIds.value(conversation, -1);
+    if (convId < 0) {
+        convId = conversations.size();
+        conversations.append(conversation);
+        conversationIds.insert(conversation, convId);
+    }
+    const quint32 docId = static_cast<quint32>(docs.size());
+    docs.append(Doc{convId, msecs, position});
+
+    QStringList tokens = tokenize(text);
+    QHash<QString, QVector<quint32>> positions;
+    QStringList order;
+    for (int i = 0; i < tokens.size(); i++) {
+        QVector<quint32>& termPositions = positions[tokens.at(i)];
+        if (termPositions.isEmpty()) {
+            order.append(tokens.at(i));
+        }
+        termPositions.append(static_cast<quint32>(i));
+    }
+
+    for (const QString& term : order) {
+        const QVector<quint32>& termPositions = positions.value(term);
+        Postings& postings                    = terms[term];
+        putVarint(postings.data, docId - postings.lastDoc);
+        putVarint(postings.data, static_cast<quint32>(termPositions.size()));
+        quint32 previous = 0;
+        for (quint32 pos : termPositions) {
+            putVarint(postings.data, pos - previous);
+            previous = pos;
+        }
+        postings.lastDoc = docId;
+        postings.docCount++;
+    }
+}
+
+QVector<quint32> Index::docsForTerm(const QString& term) const
+{
+    QVector<quint32> result;
+    QMap<QString, Postings>::const_iterator itr = terms.constFind(term);
+    if (itr == terms.constEnd()) {
+        return result;
+    }
+    result.reserve(static_cast<int>(itr.value().docCount));
+    const uchar* pos = reinterpret_cast<const uchar*>(itr.value().data.constData());
+    const uchar* end = pos + itr.value().data.size();
+    quint32 doc      = 0;
+    while (pos < end) {
+        doc += getVarint(pos);
+        quint32 count = getVarint(pos);
+        for (quint32 i = 0; i < count; i++) {
+            getVarint(pos);
+        }
+        result.append(doc);
+    }
+    return result;
+}
+
+QVector<quint32> Index::docsForPrefix(const QString& prefix) const
+{
+    QVector<quint32> result;
+    for (QMap<QString, Postings>::const_iterator itr = terms.lowerBound(prefix);
+         itr != terms.constEnd() && itr.key().startsWith(prefix); ++itr) {
+        result += docsForTerm(itr.key());
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+QHash<quint32, QVector<quint32>> Index::positionsForTerm(const QString& term, const QVector<quint32>& wanted) const
+{
+    // Only positions of the wanted docs are kept so common terms stay cheap
+    QHash<quint32, QVector<quint32>> result;
+    QMap<QString, Postings>::const_iterator itr = terms.constFind(term);
+    if (itr == terms.constEnd() || wanted.isEmpty()) {
+        return result;
+    }
+    result.reserve(wanted.size());
+    QVector<quint32>::const_iterator next = wanted.constBegin();
+    const uchar* pos = reinterpret_cast<const uchar*>(itr.value().data.constData());
+    const uchar* end = pos + itr.value().data.size();
+    quint32 doc      = 0;
+    while (pos < end && next != wanted.constEnd()) {
+        doc += getVarint(pos);
+        quint32 count = getVarint(pos);
+        while (next != wanted.constEnd() && *next < doc) {
+            ++next;
+        }
+        if (next == wanted.constEnd() || *next != doc) {
+            for (quint32 i = 0; i < count; i++) {
+                getVarint(pos);
+            }
+            continue;
+        }
+        QVector<quint32>& docPositions = result[doc];
+        quint32 position               = 0;
+        for (quint32 i = 0; i < count; i++) {
+            position += getVarint(pos);
+            docPositions.append(position);
+        }
+    }
+    return result;
+}
+
+QVector<quint32> Index::docsForPhrase(const QStringList& words) const
+{
+    QVector<quint32> candidates = docsForTerm(words.first());
+    for (int i = 1; i < words.size() && !candidates.isEmpty(); i++) {
+        candidates = intersect(candidates, docsForTerm(words.at(i)));
+    }
+    if (candidates.isEmpty()) {
+        return candidates;
+    }
+
+    QVector<QHash<quint32, QVector<quint32>>> positions;
+    for (const QString& word : words) {
+        positions.append(positionsForTerm(word, candidates));
+    }
+
+    QVector<quint32> result;
+    for (quint32 doc : candidates) {
+        for (quint32 start : positions.first().value(doc)) {
+            bool matched = true;
+            for (int i = 1; i < words.size() && matched; i++) {
+                matched = positions.at(i).value(doc).contains(start + static_cast<quint32>(i));
+            }
+            if (matched) {
+                result.append(doc);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+QVector<Hit> Index::search(const QString& query, int limit) const
+{
+    // Split into clauses, quoted text stays together as a phrase
+    QStringList clauses;
+    QVector<bool> phrase;
+    QString current;
+    bool quoted = false;
+    for (const QChar c : query) {
+        if (c == QLatin1Char('"') || (!quoted && c.isSpace())) {
+            if (!current.trimmed().isEmpty()) {
+                clauses.append(current);
+                phrase.append(quoted);
+            }
+            current.clear();
+            if (c == QLatin1Char('"')) {
+                quoted = !quoted;
+            }
+        } else {
+            current.append(c);
+        }
+    }
+    if (!current.trimmed().isEmpty()) {
+        clauses.append(current);
+        phrase.append(quoted);
+    }
+
+    QVector<quint32> matches;
+    bool first = true;
+    for (int i = 0; i < clauses.size(); i++) {
+        QStringList words = tokenize(clauses.at(i));
+        if (words.isEmpty()) {
+            continue;
+        }
+        QVector<quint32> clauseDocs;
+        if (!phrase.at(i) && words.size() == 1 && clauses.at(i).endsWith(QLatin1Char('*'))) {
+            clauseDocs = docsForPrefix(words.first());
+        } else if (words.size() == 1) {
+            clauseDocs = docsForTerm(words.first());
+        } else {
+            clauseDocs = docsForPhrase(words);
+        }
+        matches = first ? clauseDocs : intersect(matches, clauseDocs);
+        first   = false;
+        if (matches.isEmpty()) {
+            break;
+        }
+    }
+
+    // Newest first.  Doc ids follow indexing order, which is not time order
+    // once the backfill and live messages mix, so every match is ranked by
+    // its timestamp and the doc id only breaks ties
+    auto newer = [this](quint32 a, quint32 b) {
+        const qint64 aMsecs = docs.at(static_cast<int>(a)).msecs;
+        const qint64 bMsecs = docs.at(static_cast<int>(b)).msecs;
+        return aMsecs != bMsecs ? aMsecs > bMsecs : a > b;
+    };
+    const int count = qMin(qMax(limit, 0), matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), newer);
+
+    QVector<Hit> hits;
+    hits.reserve(count);
+    for (int i = 0; i < count; i++) {
+        const Doc& doc = docs.at(static_cast<int>(matches.at(i)));
+        hits.append(Hit{conversations.at(doc.conversation), doc.msecs, doc.position});
+    }
+    return hits;
+}
+
+Indexer::Indexer(QString historyDirectory, QObject* parent) : QObject(parent), directory(historyDirectory)
+{
+    qRegisterMetaType<QVector<PXMSearch::Hit>>();
+}
+
+void Indexer::backfill()
+{
+    QElapsedTimer timer;
+    timer.start();
+    QStringList names = QDir(directory).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString& conversation : names) {
+        backfilled[conversation] = PXMHistory::Store::scan(
+            directory, conversation, PXMHistory::Cursor(), [this, &conversation](const PXMHistory::Record& record) {
+                index.add(conversation, record.msecs, record.position, PXMFormatter::stripHeader(record.text));
+                return true;
+            });
+    }
+    qInfo().noquote() << "Indexed" << index.documentCount() << "messages with" << index.termCount() << "terms in"
+                      << timer.elapsed() << "ms";
+}
+
+void Indexer::addMessage(QString conversation, qint64 msecs, quint32 segment, quint32 offset, QString text)
+{
+    PXMHistory::Cursor position(segment, offset);
+    QHash<QString, PXMHistory::Cursor>::const_iterator itr = backfilled.constFind(conversation);
+    if (itr != backfilled.constEnd() && position < itr.value()) {
+        // Already on disk when backfill() ran
+        return;
+    }
+    index.add(conversation, msecs, position, PXMFormatter::stripHeader(text));
+}
+
+void Indexer::search(QString query)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QVector<Hit> hits = index.search(query);
+    qDebug().noquote() << "Search for" << query << "found" << hits.size() << "results in" << timer.nsecsElapsed() / 1000
+                       << "us";
+    emit searchResults(query, hits);
+}
@@ -1,5 +1,8 @@
 #include <pxmserver.h>
 #include <QDebug>
+#include <QFile>
+#include <QSet>
+#include <QStandardPaths>
 #include <QUuid>
 
 #include <stdint.h>
@@ -22,12 +25,23 @@
 #include <netinet/in.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #else
 #error "include headers for BSD socket implementation"
 #endif
 
 #include "pxmconsts.h"
+#include "pxmlatency.h"
+#include "pxmlog.h"
+#include "pxmmetrics.h"
 #include "pxmpeers.h"
+#include "pxmtrace.h"
+#include "pxmtransfer.h"
+#include "pxmutf8.h"
+
+#ifdef PXM_URING
+#include "pxmuring.h"
+#endif
 
 static_assert(sizeof(uint8_t) == 1, "uint8_t not defined as 1 byte");
 static_assert(sizeof(uint16_t) == 2, "uint16_t not defined as 2 bytes");
@@ -37,9 +51,30 @@ Q_DECLARE_METATYPE(QSharedPointer<unsigned char>)
 
 using namespace PXMServer;
 
+// One file on a bulk connection, owned by the connection's callbacks
+struct TransferStream {
+    QUuid id;
+    ServerThreadPrivate* st;
+    int fd;
+    qint64 size;
+    // Bytes through the connection so far, and on the sending end the
+    // bytes queued on it
+    qint64 done     = 0;
+    qint64 queued   = 0;
+    qint64 reported = 0;
+    // Receiving end, runs bulkRead() again for data left in the buffer
+    event* resume    = nullptr;
+    bufferevent* bev = nullptr;
+};
+
 struct UUIDStruct {
     QUuid uuid;
     ServerThreadPrivate* st;
+    sockaddr_in addr;
+    // Trying the peer's unix socket, TCP to addr is the fallback
+    bool local;
+    // Set for the bulk connection of a file we are sending
+    TransferStream* stream = nullptr;
 };
 
 class ServerThreadPrivate
@@ -49,25 +84,65 @@ class ServerThreadPrivate
     ServerThread* q_ptr;
     // Data Members
     QUuid localUUID;
-    struct event *eventAccept, *eventDiscover;
+    struct event* eventAccept = nullptr;
+    struct event* eventDiscover;
     QSharedPointer<struct event_base> base;
     in_addr multicastAddress;
     unsigned short tcpPortNumber;
     unsigned short udpPortNumber;
     bool gotDiscover;
+    QString metricsPath;
+    struct event* eventMetrics = nullptr;
+    bool localTransport        = false;
+    QString localPath;
+    evutil_socket_t localSocket = -1;
+    struct event* eventLocal    = nullptr;
+    bool ioUring                = false;
+#ifdef PXM_URING
+    QScopedPointer<PXMUring::Ring> ring;
+#endif
+    // Peers whose /name: reply says they take same host connections
+    QSet<QUuid> localPeers;
 
     // Functions
     evutil_socket_t newUDPSocket(unsigned short portNumber = 0);
     evutil_socket_t newListenerSocket(unsigned short portNumber = 0);
     unsigned short getPortNumber(evutil_socket_t socket);
-    int singleMessageIterator(const bufferevent* bev, const unsigned char* buf, uint16_t len, const QUuid quuid);
+    evutil_socket_t newUnixSocket(const QString& path);
+    // The socket under bev, also for bufferevents on the io_uring transport
+    evutil_socket_t socketOf(bufferevent* bev);
+    // bufferevent_priority_set that also holds for bufferevents on the
+    // io_uring transport
+    void setPriority(bufferevent* bev, int priority);
+    bool startRing();
+    bool ringListen(evutil_socket_t s, bool local);
+    void accepted(bufferevent* bev, bool local);
+    int singleMessageIterator(const bufferevent* bev,
+                              const unsigned char* buf,
+                              uint16_t len,
+                              const QUuid quuid,
+                              qint64 readMicros);
     static void internalCommsRead(bufferevent* bev, void*);
+    static void internalCommsMessage(const unsigned char* readBev, ServerThreadPrivate* st);
     static void accept_new(evutil_socket_t socketfd, short, void* arg);
+    static void ringAccept(bufferevent* bev, bool local, void* arg);
     static void udpRecieve(evutil_socket_t socketfd, short, void* args);
     static void tcpRead(bufferevent* bev, void* arg);
     static void tcpErr(bufferevent* bev, short error, void* arg);
     static void tcpAuth(bufferevent* bev, void* arg);
+    static void startConnect(UUIDStruct* target);
     static void connectCB(bufferevent* bev, short error, void* arg);
+    static void bulkConnected(bufferevent* bev, TransferStream* stream);
+    static void bulkWritten(bufferevent* bev, void* arg);
+    static void bulkRead(bufferevent* bev, void* arg);
+    static void bulkResume(evutil_socket_t, short, void* arg);
+    static void bulkDrain(bufferevent* bev, void*);
+    static void bulkErr(bufferevent* bev, short error, void* arg);
+    static void bulkFinish(bufferevent* bev, TransferStream* stream, bool ok);
+    static void bulkProgress(TransferStream* stream);
+    static void metricsAccept(evutil_socket_t socketfd, short, void* arg);
+    static void metricsWritten(bufferevent* bev, void*);
+    static void metricsErr(bufferevent* bev, short, void*);
 };
 
 ServerThread::ServerThread(QObject* parent,
@@ -97,6 +172,9 @@ ServerThread::ServerThread(QObject* parent,
 #endif
 
     d_ptr->base = QSharedPointer<struct event_base>(event_base_new(), event_base_free);
+    if (d_ptr->base) {
+        event_base_priority_init(d_ptr->base.data(), EVENT_PRIORITIES);
+    }
     qRegisterMetaType<QSharedPointer<unsigned char>>();
 }
 
@@ -104,13 +182,40 @@ ServerThread::~ServerThread()
 {
     qDebug() << "Shutdown of PXMServer Successful";
 }
+void ServerThread::setMetricsSocket(QString path)
+{
+    d_ptr->metricsPath = path;
+}
+void ServerThread::setLocalTransport(bool enabled)
+{
+    d_ptr->localTransport = enabled;
+}
+void ServerThread::setIoUring(bool enabled)
+{
+    d_ptr->ioUring = enabled;
+}
+QString PXMServer::localSocketPath(const QUuid& uuid)
+{
+#ifdef __unix__
+    // Per user, so instances of other users on the host stay on TCP
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (dir.isEmpty()) {
+        return QString();
+    }
+    return dir + QStringLiteral("/pxmessenger-") + uuid.toString().mid(1, 36) + QStringLiteral(".sock");
+#else
+    Q_UNUSED(uuid);
+    return QString();
+#endif
+}
 void ServerThreadPrivate::accept_new(evutil_socket_t s, short, void* arg)
 {
     evutil_socket_t result;
 
     ServerThreadPrivate* st = static_cast<ServerThreadPrivate*>(arg);
 
-    struct sockaddr_in ss;
+    // TCP or the same host unix socket
+    struct sockaddr_storage ss;
     socklen_t addr_size = sizeof(ss);
 
     result = accept(s, reinterpret_cast<struct sockaddr*>(&ss), &addr_size);
@@ -120,12 +225,72 @@ void ServerThreadPrivate::accept_new(evutil_socket_t s, short, void* arg)
         struct bufferevent* bev;
         evutil_make_socket_nonblocking(result);
         bev = bufferevent_socket_new(st->base.data(), result, BEV_OPT_THREADSAFE);
-        bufferevent_setcb(bev, ServerThreadPrivate::tcpAuth, NULL, ServerThreadPrivate::tcpErr, st);
-        bufferevent_setwatermark(bev, EV_READ, PACKET_HEADER_LEN, PACKET_HEADER_LEN);
-        bufferevent_enable(bev, EV_READ | EV_WRITE);
+        st->accepted(bev, ss.ss_family != AF_INET);
+    }
+}
+void ServerThreadPrivate::ringAccept(bufferevent* bev, bool local, void* arg)
+{
+    static_cast<ServerThreadPrivate*>(arg)->accepted(bev, local);
+}
+void ServerThreadPrivate::accepted(bufferevent* bev, bool local)
+{
+    bufferevent_setcb(bev, ServerThreadPrivate::tcpAuth, NULL, ServerThreadPrivate::tcpErr, this);
+    bufferevent_setwatermark(bev, EV_READ, PACKET_HEADER_LEN, PACKET_HEADER_LEN);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
 
-        st->q_ptr->newTCPConnection(bev);
+    PXMMetrics::connectionsAccepted.inc();
+    if (local) {
+        PXMMetrics::localConnections.inc();
     }
+    q_ptr->newTCPConnection(bev);
+}
+evutil_socket_t ServerThreadPrivate::socketOf(bufferevent* bev)
+{
+#ifdef PXM_URING
+    if (ring) {
+        evutil_socket_t s = ring->socketOf(bev);
+        if (s >= 0) {
+            return s;
+        }
+    }
+#endif
+    return bufferevent_getfd(bev);
+}
+void ServerThreadPrivate::setPriority(bufferevent* bev, int priority)
+{
+#ifdef PXM_URING
+    if (ring && ring->setPriority(bev, priority)) {
+        return;
+    }
+#endif
+    bufferevent_priority_set(bev, priority);
+}
+bool ServerThreadPrivate::startRing()
+{
+#ifdef PXM_URING
+    if (!ioUring) {
+        return false;
+    }
+    ring.reset(new PXMUring::Ring(base.data()));
+    if (!ring->start()) {
+        qInfo() << "Falling back to libevent for TCP";
+        ring.reset();
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+bool ServerThreadPrivate::ringListen(evutil_socket_t s, bool local)
+{
+#ifdef PXM_URING
+    return ring && ring->listen(s, local, ServerThreadPrivate::ringAccept, this);
+#else
+    Q_UNUSED(s);
+    Q_UNUSED(local);
+    return false;
+#endif
 }
 
 void ServerThreadPrivate::tcpAuth(struct bufferevent* bev, void* arg)
@@ -134,7 +299,7 @@ void ServerThreadPrivate::tcpAuth(struct bufferevent* bev, void* arg)
     ServerThreadPrivate* st = static_cast<ServerThreadPrivate*>(arg);
     uint16_t nboBufLen;
     uint16_t bufLen;
-    evutil_socket_t socket = bufferevent_getfd(bev);
+    evutil_socket_t socket = st->socketOf(bev);
 
     if (evbuffer_get_length(bufferevent_get_input(bev)) == PACKET_HEADER_LEN) {
         evbuffer_copyout(bufferevent_get_input(bev), &nboBufLen, PACKET_HEADER_LEN);
@@ -161,7 +326,7 @@ void ServerThreadPrivate::tcpAuth(struct bufferevent* bev, void* arg)
     }
     QUuid quuid = QUuid();
     bufLen -= NetCompression::unpackUUID(bufUUID, quuid);
-    if (quuid.isNull()) {
+    if (quuid.isNull() || bufLen < sizeof(MESSAGE_TYPE)) {
         qWarning() << "Bad Auth packet UUID, closing socket...";
         bufferevent_disable(bev, EV_READ | EV_WRITE);
         st->q_ptr->peerQuit(socket, bev);
@@ -171,13 +336,17 @@ void ServerThreadPrivate::tcpAuth(struct bufferevent* bev, void* arg)
     QScopedArrayPointer<unsigned char> buf(new unsigned char[bufLen + 1]);
     bufferevent_read(bev, buf.data(), bufLen);
     buf[bufLen] = 0;
+    PXMMetrics::bufferAllocations.inc();
 
     MESSAGE_TYPE* type = reinterpret_cast<MESSAGE_TYPE*>(&buf[0]);
+    PXMMetrics::framesReceived.inc(ntohl(*type));
+    PXMMetrics::bytesReceived.inc(ntohl(*type), bufLen + NetCompression::PACKED_UUID_LENGTH + PACKET_HEADER_LEN);
     if (*type == MSG_AUTH) {
         // Auth packet format "Hostname:::12345:::001.001.001"
         bufLen -= sizeof(MESSAGE_TYPE);
-        QStringList hpsplit = (QString::fromUtf8((char*)&buf[sizeof(MESSAGE_TYPE)], bufLen)).split(AUTH_SEPERATOR);
-        if (hpsplit.length() != 3) {
+        bool utf8Ok         = false;
+        QStringList hpsplit = PXMUtf8::decode(&buf[sizeof(MESSAGE_TYPE)], bufLen, &utf8Ok).split(AUTH_SEPERATOR);
+        if (!utf8Ok || hpsplit.length() != 3) {
             qWarning() << "Bad Auth packet, closing socket...";
             bufferevent_disable(bev, EV_READ | EV_WRITE);
             st->q_ptr->peerQuit(socket, bev);
@@ -191,8 +360,20 @@ void ServerThreadPrivate::tcpAuth(struct bufferevent* bev, void* arg)
             return;
         }
         st->q_ptr->authenticationReceived(hpsplit[0], port, hpsplit[2], socket, quuid, bev);
-        bufferevent_setwatermark(bev, EV_READ, PACKET_HEADER_LEN, PACKET_HEADER_LEN);
+        // tcpRead takes whatever is there and splits it into frames itself
+        bufferevent_setwatermark(bev, EV_READ, PACKET_HEADER_LEN, 0);
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+        bufferevent_set_max_single_read(bev, PACKET_HEADER_LEN + UINT16_MAX);
+#endif
         bufferevent_setcb(bev, ServerThreadPrivate::tcpRead, NULL, ServerThreadPrivate::tcpErr, st);
+    } else if (ntohl(*type) == MSG_FILE_STREAM && bufLen >= sizeof(MESSAGE_TYPE) + NetCompression::PACKED_UUID_LENGTH) {
+        // Bulk connection for a file, park it until the worker says which
+        // file if any it belongs to
+        QUuid id = NetCompression::readUUID(&buf[sizeof(MESSAGE_TYPE)]);
+        qCInfo(pxmNet) << "Transfer connection for" << id.toString() << "from" << quuid.toString();
+        bufferevent_disable(bev, EV_READ);
+        bufferevent_setcb(bev, NULL, NULL, NULL, NULL);
+        st->q_ptr->transferConnection(bev, id, quuid);
     } else {
         qWarning() << "Non-Auth packet, closing socket...";
         bufferevent_disable(bev, EV_READ | EV_WRITE);
@@ -201,93 +382,93 @@ void ServerThreadPrivate::tcpAuth(struct bufferevent* bev, void* arg)
 }
 void ServerThreadPrivate::tcpRead(struct bufferevent* bev, void* arg)
 {
+    PXM_TRACE_SCOPE("tcpRead");
     ServerThreadPrivate* st = static_cast<ServerThreadPrivate*>(arg);
-    uint16_t nboBufLen;
-    uint16_t bufLen;
-    evbuffer* input = bufferevent_get_input(bev);
-    if (evbuffer_get_length(input) == 1) {
-        qDebug().noquote() << "Setting timeout, 1 byte recieved";
-        bufferevent_set_timeouts(bev, &READ_TIMEOUT, NULL);
-    } else if (evbuffer_get_length(input) == PACKET_HEADER_LEN) {
-        qDebug().noquote() << "Recieved bufferlength value";
+    evbuffer* input         = bufferevent_get_input(bev);
+    // No high watermark, so one read can bring in several frames.  Handle
+    // every whole one here and leave the watermark at the end of the next
+    for (;;) {
+        size_t available = evbuffer_get_length(input);
+        if (available < PACKET_HEADER_LEN) {
+            bufferevent_setwatermark(bev, EV_READ, PACKET_HEADER_LEN, 0);
+            if (available == 0) {
+                // reset timeout -- this is a bug with the libevent
+                // timeout is set to 1 day, a value of null in the read
+                // parameter does nothing.  Timeing out should not cause a
+                // problem
+                bufferevent_set_timeouts(bev, &READ_TIMEOUT_RESET, NULL);
+            } else {
+                pxmPacketDebug().noquote() << "Setting timeout, 1 byte recieved";
+                bufferevent_set_timeouts(bev, &READ_TIMEOUT, NULL);
+            }
+            return;
+        }
+
+        uint16_t nboBufLen;
         evbuffer_copyout(input, &nboBufLen, PACKET_HEADER_LEN);
-        bufLen = ntohs(nboBufLen);
+        // convert from NBO to host endianness
+        uint16_t bufLen = ntohs(nboBufLen);
         if (bufLen == 0) {
             qWarning().noquote() << "Bad buffer length, draining...";
-            evbuffer_drain(input, UINT16_MAX);
+            evbuffer_drain(input, PACKET_HEADER_LEN);
+            continue;
+        }
+        size_t frameLen = PACKET_HEADER_LEN + bufLen;
+        if (available < frameLen) {
+            // Called again once the rest of the frame is in
+            bufferevent_setwatermark(bev, EV_READ, frameLen, 0);
+            bufferevent_set_timeouts(bev, &READ_TIMEOUT, NULL);
+            pxmPacketDebug().noquote() << "Setting watermark to" << frameLen << "bytes";
             return;
         }
-        bufferevent_setwatermark(bev, EV_READ, bufLen + PACKET_HEADER_LEN, bufLen + PACKET_HEADER_LEN);
-        bufferevent_set_timeouts(bev, &READ_TIMEOUT, NULL);
-        qDebug().noquote() << "Setting watermark to" << QString::number(bufLen) << "bytes";
-        qDebug().noquote() << "Setting timeout to"
-                           << QString::asprintf("%ld.%06ld", READ_TIMEOUT.tv_sec, READ_TIMEOUT.tv_usec) << "seconds";
-    } else {
-        qDebug() << "Full packet received";
-        bufferevent_setwatermark(bev, EV_READ, PACKET_HEADER_LEN, PACKET_HEADER_LEN);
 
-        bufferevent_read(bev, &nboBufLen, PACKET_HEADER_LEN);
-
-        // convert from NBO to host endianness
-        bufLen = ntohs(nboBufLen);
-        // check if packet is too small to contain a UUID
-        if (bufLen <= NetCompression::PACKED_UUID_LENGTH) {
-            evbuffer_drain(bufferevent_get_input(bev), UINT16_MAX);
-            return;
+        pxmPacketDebug() << "Full packet received";
+        qint64 readMicros = PXMLatency::monotonicMicros();
+        PXMMetrics::receivedFrameBytes.record(frameLen);
+        // check if packet is too small to contain a UUID and a type
+        if (bufLen < NetCompression::PACKED_UUID_LENGTH + sizeof(PXMConsts::MESSAGE_TYPE)) {
+            evbuffer_drain(input, frameLen);
+            continue;
         }
 
-        // Extract and Unpack uuid from the packet
-        unsigned char rawUUID[NetCompression::PACKED_UUID_LENGTH];
-        bufferevent_read(bev, rawUUID, NetCompression::PACKED_UUID_LENGTH);
-        QUuid uuid = QUuid();
-        bufLen -= NetCompression::unpackUUID(rawUUID, uuid);
+        // Handle the frame where it sits in the input buffer, pullup only
+        // copies when it straddles two chains
+        const unsigned char* frame = evbuffer_pullup(input, static_cast<ev_ssize_t>(frameLen));
+        QUuid uuid                 = NetCompression::readUUID(&frame[PACKET_HEADER_LEN]);
+        bufLen -= NetCompression::PACKED_UUID_LENGTH;
 
         // Check if uuid is null
         if (uuid.isNull()) {
-            evbuffer_drain(bufferevent_get_input(bev), UINT16_MAX);
-            return;
+            evbuffer_drain(input, frameLen);
+            continue;
         }
 
-        // Change length of msg with respect to uuid length
-        unsigned char* buf = new unsigned char[bufLen + 1];
-        // QScopedArrayPointer<char> buf(new char[bufLen +1]);
-
-        // Read rest of message
-        bufferevent_read(bev, buf, bufLen);
-        buf[bufLen] = 0;
-
         // Handle message type and send it along to peerworker for
         // further
         // processing
-        st->singleMessageIterator(bev, buf, bufLen, uuid);
-
-        // reset timeout -- this is a bug with the libevent
-        // timeout is set to 1 day, a value of null in the read
-        // parameter does nothing.  Timeing out should not cause a
-        // problem
-        bufferevent_set_timeouts(bev, &READ_TIMEOUT_RESET, NULL);
-
-        delete[] buf;
+        st->singleMessageIterator(bev, &frame[PACKET_HEADER_LEN + NetCompression::PACKED_UUID_LENGTH], bufLen,
+                                  uuid, readMicros);
+        evbuffer_drain(input, frameLen);
     }
 }
 
 void ServerThreadPrivate::tcpErr(struct bufferevent* bev, short error, void* arg)
 {
     ServerThreadPrivate* st = static_cast<ServerThreadPrivate*>(arg);
-    evutil_socket_t i       = bufferevent_getfd(bev);
+    evutil_socket_t i       = st->socketOf(bev);
     // EOF should be for close, ERROR could be for closed if we miss an ACK
     // somewhere. TIMEOUT should be happening only if we get a packet of a
     // size that is smaller than what the sender has told us it will be
     if (error & BEV_EVENT_EOF) {
-        qDebug() << "BEV EOF";
+        qCDebug(pxmNet) << "BEV EOF";
         bufferevent_disable(bev, EV_READ | EV_WRITE);
         st->q_ptr->peerQuit(i, bev);
     } else if (error & BEV_EVENT_ERROR) {
-        qDebug() << "BEV ERROR";
+        qCDebug(pxmNet) << "BEV ERROR";
         bufferevent_disable(bev, EV_READ | EV_WRITE);
         st->q_ptr->peerQuit(i, bev);
     } else if (error & BEV_EVENT_TIMEOUT) {
-        qDebug() << "BEV TIMEOUT";
+        qCDebug(pxmNet) << "BEV TIMEOUT";
         // Reset watermark for accepting a length arguement
         bufferevent_setwatermark(bev, EV_READ, PACKET_HEADER_LEN, PACKET_HEADER_LEN);
         // Reset timeout to 1 day
@@ -297,20 +478,23 @@ void ServerThreadPrivate::tcpErr(struct bufferevent* bev, short error, void* arg
         evbuffer* input = bufferevent_get_input(bev);
         size_t len      = evbuffer_get_length(input);
         if (len > 0) {
-            qDebug() << "Length:" << len;
-            qDebug() << "Draining...";
+            qCDebug(pxmNet) << "Length:" << len;
+            qCDebug(pxmNet) << "Draining...";
             evbuffer_drain(input, UINT16_MAX);
             len = evbuffer_get_length(input);
-            qDebug() << "Length: " << len;
+            qCDebug(pxmNet) << "Length: " << len;
         }
     }
 }
 int ServerThreadPrivate::singleMessageIterator(const bufferevent* bev,
                                                const unsigned char* buf,
                                                uint16_t bufLen,
-                                               const QUuid quuid)
+                                               const QUuid quuid,
+                                               qint64 readMicros)
 {
+    PXM_TRACE_SCOPE_ARG("singleMessageIterator", bufLen);
     using namespace PXMConsts;
+    using namespace PXMLatency;
     // Should always have something for in the buffer
     if (bufLen == 0) {
         qCritical() << "Blank message! -- Not Good!";
@@ -318,15 +502,46 @@ int ServerThreadPrivate::singleMessageIterator(const bufferevent* bev,
     }
     MESSAGE_TYPE type = *reinterpret_cast<const MESSAGE_TYPE*>(&buf[0]);
     type              = static_cast<MESSAGE_TYPE>(htonl(type));
+    PXMMetrics::framesReceived.inc(type);
+    PXMMetrics::bytesReceived.inc(type, bufLen + NetCompression::PACKED_UUID_LENGTH + PACKET_HEADER_LEN);
     buf               = &buf[sizeof(MESSAGE_TYPE)];
     bufLen -= sizeof(MESSAGE_TYPE);
+
+    if (type == MSG_TEXT_STAMPED || type == MSG_GLOBAL_STAMPED) {
+        if (bufLen < STAMP_LENGTH) {
+            qWarning().noquote() << "Stamped message too short, discarding";
+            return -1;
+        }
+        Recorder::instance()->record(REMOTE_TO_PARSE, quuid, wallMicros() - readStamp(buf));
+        buf = &buf[STAMP_LENGTH];
+        bufLen -= STAMP_LENGTH;
+        type = (type == MSG_TEXT_STAMPED) ? MSG_TEXT : MSG_GLOBAL;
+    }
+
+    // Text is validated before anything is built from it, and decoded once
+    QString text;
+    if (type == MSG_TEXT || type == MSG_GLOBAL || type == MSG_NAME) {
+        bool utf8Ok = false;
+        text        = PXMUtf8::decode(buf, bufLen, &utf8Ok);
+        if (!utf8Ok) {
+            PXMMetrics::malformedFrames.inc();
+            qWarning().noquote() << "Malformed UTF-8 from" << quuid.toString() << "discarding";
+            return -1;
+        }
+    }
+
     int result = 0;
     switch (type) {
-        case MSG_TEXT:
-            qInfo().noquote() << "Message from" << quuid.toString();
-            qDebug().noquote() << "MSG :" << QString::fromUtf8((char*)&buf[0], bufLen);
-            emit q_ptr->messageRecieved(QString::fromUtf8((char*)&buf[0], bufLen), quuid, bev, false);
+        case MSG_TEXT: {
+            const QString& msg = text;
+            pxmPacketInfo().noquote() << "Message from" << quuid.toString();
+            pxmPacketDebug().noquote() << "MSG :" << msg;
+            qint64 parsedMicros = monotonicMicros();
+            Recorder::instance()->record(WIRE_TO_PARSE, quuid, parsedMicros - readMicros);
+            PXMMetrics::workerQueueMessages.add();
+            emit q_ptr->messageRecieved(msg, quuid, bev, false, parsedMicros);
             break;
+        }
         case MSG_SYNC: {
             // QT data structures seem to mangle this packet (i suspect
             // because it has null characters in it)
@@ -334,7 +549,8 @@ int ServerThreadPrivate::singleMessageIterator(const bufferevent* bev,
             // in a smart pointer
             QSharedPointer<unsigned char> syncPacket(new unsigned char[bufLen]);
             memcpy(syncPacket.data(), &buf[0], bufLen);
-            qInfo().noquote() << "SYNC received from" << quuid.toString();
+            PXMMetrics::bufferAllocations.inc();
+            qCInfo(pxmNet).noquote() << "SYNC received from" << quuid.toString();
             emit q_ptr->syncPacketIterator(syncPacket, bufLen, quuid);
             break;
         }
@@ -343,14 +559,37 @@ int ServerThreadPrivate::singleMessageIterator(const bufferevent* bev,
                               << quuid.toString();
             emit q_ptr->sendSyncPacket(bev, quuid);
             break;
-        case MSG_GLOBAL:
-            qInfo().noquote() << "Global message from" << quuid.toString();
-            qDebug().noquote() << "GLOBAL :" << QString::fromUtf8((char*)&buf[0], bufLen);
-            emit q_ptr->messageRecieved(QString::fromUtf8((char*)&buf[0], bufLen), quuid, bev, true);
+        case MSG_GLOBAL: {
+            const QString& msg = text;
+            pxmPacketInfo().noquote() << "Global message from" << quuid.toString();
+            pxmPacketDebug().noquote() << "GLOBAL :" << msg;
+            qint64 parsedMicros = monotonicMicros();
+            Recorder::instance()->record(WIRE_TO_PARSE, quuid, parsedMicros - readMicros);
+            PXMMetrics::workerQueueMessages.add();
+            emit q_ptr->messageRecieved(msg, quuid, bev, true, parsedMicros);
             break;
+        }
         case MSG_NAME:
-            qInfo().noquote() << "NAME :" << QString::fromUtf8((char*)&buf[0], bufLen) << "from" << quuid.toString();
-            emit q_ptr->nameChange(QString::fromUtf8((char*)&buf[0], bufLen), quuid);
+            qInfo().noquote() << "NAME :" << text << "from" << quuid.toString();
+            emit q_ptr->nameChange(text, quuid);
+            break;
+        case MSG_CAPABILITIES:
+            if (bufLen < sizeof(uint32_t)) {
+                qWarning().noquote() << "Capabilities from" << quuid.toString() << "too short, discarding";
+                result = -1;
+                break;
+            }
+            emit q_ptr->capabilitiesReceived(quuid, NetCompression::readUint32(buf));
+            break;
+        case MSG_FILE_OFFER:
+        case MSG_FILE_ACCEPT:
+        case MSG_FILE_CANCEL:
+        case MSG_FILE_HAVE:
+        case MSG_FILE_REDIRECT:
+        case MSG_FILE_PULL:
+            qCInfo(pxmNet).noquote() << "File transfer message from" << quuid.toString();
+            emit q_ptr->transferMessage(quuid, bev, type,
+                                        QByteArray(reinterpret_cast<const char*>(buf), static_cast<int>(bufLen)));
             break;
         case MSG_AUTH:
             qWarning().noquote() << "AUTH packet recieved after alread "
@@ -375,11 +614,13 @@ void ServerThreadPrivate::udpRecieve(evutil_socket_t socketfd, short int, void*
     char buf[200] = {};
 
     // Non libevent read from this socket, maybe change in future
-    recvfrom(socketfd, buf, sizeof(buf) - 1, 0, reinterpret_cast<struct sockaddr*>(&si_other), &si_other_len);
+    ssize_t received =
+        recvfrom(socketfd, buf, sizeof(buf) - 1, 0, reinterpret_cast<struct sockaddr*>(&si_other), &si_other_len);
 
     // Discovery packet handler
     if (strncmp(&buf[0], "/discover", 9) == 0) {
-        qDebug() << "Discovery Packet:" << buf;
+        qCDebug(pxmNet) << "Discovery Packet:" << buf;
+        PXMMetrics::discoverReceived.inc();
 
         // This confirms we got a multicast packet, first one should be
         // our own.
@@ -401,7 +642,8 @@ void ServerThreadPrivate::udpRecieve(evutil_socket_t socketfd, short int, void*
         si_other.sin_port = htons(st->udpPortNumber);
 
         // Format reply message
-        constexpr size_t len = sizeof(uint16_t) + NetCompression::PACKED_UUID_LENGTH + PXMConsts::ct_strlen("/name:");
+        constexpr size_t len =
+            sizeof(uint16_t) + NetCompression::PACKED_UUID_LENGTH + PXMConsts::ct_strlen("/name:") + sizeof(uint8_t);
 
         char name[len + 1];
 
@@ -410,6 +652,7 @@ void ServerThreadPrivate::udpRecieve(evutil_socket_t socketfd, short int, void*
         uint16_t port = htons(st->tcpPortNumber);
         memcpy(&name[strlen("/name:")], &(port), sizeof(port));
         NetCompression::packUUID((unsigned char*)&name[strlen("/name:") + sizeof(port)], st->localUUID);
+        name[len - 1] = static_cast<char>(st->localSocket >= 0 ? NAME_LOCAL_TRANSPORT : 0);
 
         name[len] = 0;
 
@@ -417,19 +660,29 @@ void ServerThreadPrivate::udpRecieve(evutil_socket_t socketfd, short int, void*
         for (int k = 0; k < 2; k++) {
             if (sendto(replySocket, name, len, 0, reinterpret_cast<struct sockaddr*>(&si_other), si_other_len) != len)
                 qCritical().noquote() << "sendto: " + QString::fromUtf8(strerror(errno));
+            else
+                PXMMetrics::nameSent.inc();
         }
 
         // close reply socket
         evutil_closesocket(replySocket);
 
     } else if ((strncmp(&buf[0], "/name:", 6)) == 0) {
+        PXMMetrics::nameReceived.inc();
         // Get port number of their TCP listener
         memcpy(&si_other.sin_port, &buf[6], sizeof(uint16_t));
         // Get their uuid
         QUuid uuid;
         NetCompression::unpackUUID(reinterpret_cast<unsigned char*>(&buf[8]), uuid);
-        qDebug() << "Name Packet:" << inet_ntoa(si_other.sin_addr) << ":" << ntohs(si_other.sin_port)
+        qCDebug(pxmNet) << "Name Packet:" << inet_ntoa(si_other.sin_addr) << ":" << ntohs(si_other.sin_port)
                  << "with id:" << uuid.toString();
+        // Flags are the byte after the uuid, absent from older clients
+        const ssize_t flagsOffset = 8 + static_cast<ssize_t>(NetCompression::PACKED_UUID_LENGTH);
+        if (st->localSocket >= 0 && received > flagsOffset && (buf[flagsOffset] & NAME_LOCAL_TRANSPORT)) {
+            st->localPeers.insert(uuid);
+        } else {
+            st->localPeers.remove(uuid);
+        }
         /* Send this info along to peerworker */
         st->q_ptr->attemptConnection(si_other, uuid);
     } else {
@@ -539,22 +792,114 @@ evutil_socket_t ServerThreadPrivate::newListenerSocket(unsigned short portNumber
 
     return tcpSockets.first();
 }
+#ifdef __unix__
+static bool unixAddress(const QString& path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family    = AF_UNIX;
+    QByteArray pathRaw = QFile::encodeName(path);
+    if (pathRaw.isEmpty() || pathRaw.size() >= static_cast<int>(sizeof(addr.sun_path))) {
+        qWarning().noquote() << "Unix socket path is empty or too long:" << path;
+        return false;
+    }
+    memcpy(addr.sun_path, pathRaw.constData(), pathRaw.size());
+    return true;
+}
+#endif
+evutil_socket_t ServerThreadPrivate::newUnixSocket(const QString& path)
+{
+#ifdef __unix__
+    struct sockaddr_un addr;
+    if (!unixAddress(path, addr)) {
+        return -1;
+    }
+
+    evutil_socket_t socketUnix = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketUnix < 0) {
+        qWarning().noquote() << "socket: " + QString::fromUtf8(strerror(errno));
+        return -1;
+    }
+    // A socket left behind by an earlier run would fail the bind
+    unlink(addr.sun_path);
+    if (bind(socketUnix, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        qWarning().noquote() << "bind: " + QString::fromUtf8(strerror(errno));
+        evutil_closesocket(socketUnix);
+        return -1;
+    }
+    if (listen(socketUnix, SOMAXCONN) < 0) {
+        qWarning().noquote() << "listen: " + QString::fromUtf8(strerror(errno));
+        evutil_closesocket(socketUnix);
+        return -1;
+    }
+    evutil_make_socket_nonblocking(socketUnix);
+    return socketUnix;
+#else
+    Q_UNUSED(path);
+    qWarning() << "Unix domain sockets are only supported on unix";
+    return -1;
+#endif
+}
+// Whole length of an internal message including its type, 0 if unknown
+static size_t internalMessageLength(INTERNAL_MSG type)
+{
+    switch (type) {
+        case ADD_DEFAULT_BEV:
+            return sizeof(INTERNAL_MSG) + sizeof(bufferevent*);
+        case EXIT:
+            return sizeof(INTERNAL_MSG);
+        case CONNECT_TO_ADDR:
+            return sizeof(INTERNAL_MSG) + NetCompression::PACKED_PEER_RECORD_LENGTH;
+        case TRANSFER_SEND:
+            return sizeof(INTERNAL_MSG) + NetCompression::PACKED_UUID_LENGTH +
+                   NetCompression::PACKED_PEER_RECORD_LENGTH + sizeof(int32_t) + sizeof(uint64_t);
+        case TRANSFER_RECEIVE:
+            return sizeof(INTERNAL_MSG) + sizeof(bufferevent*) + sizeof(int32_t) + sizeof(uint64_t) +
+                   NetCompression::PACKED_UUID_LENGTH;
+        case TCP_PORT_CHANGE:
+        case UDP_PORT_CHANGE:
+            return sizeof(INTERNAL_MSG) + sizeof(unsigned short);
+    }
+    return 0;
+}
 void ServerThreadPrivate::internalCommsRead(bufferevent* bev, void* args)
 {
-    // Other than the exit message this is under heavy construction and not
-    // in use yet
-    unsigned char readBev[100] = {};
-    ServerThreadPrivate* st    = static_cast<ServerThreadPrivate*>(args);
-    bufferevent_read(bev, readBev, 100);
-    INTERNAL_MSG* type = reinterpret_cast<INTERNAL_MSG*>(&readBev[0]);
-    int index          = sizeof(INTERNAL_MSG);
+    // The worker may queue several messages before this runs, a whole sync
+    // packet worth of connects for one, so take every complete one
+    ServerThreadPrivate* st = static_cast<ServerThreadPrivate*>(args);
+    evbuffer* input         = bufferevent_get_input(bev);
+    for (;;) {
+        size_t available = evbuffer_get_length(input);
+        INTERNAL_MSG type;
+        if (available < sizeof(type)) {
+            return;
+        }
+        evbuffer_copyout(input, &type, sizeof(type));
+        size_t len = internalMessageLength(type);
+        if (len == 0) {
+            qCritical() << "Unknown internal message" << type;
+            evbuffer_drain(input, available);
+            return;
+        }
+        if (available < len) {
+            return;
+        }
+        unsigned char readBev[100] = {};
+        evbuffer_remove(input, readBev, len);
+        internalCommsMessage(readBev, st);
+    }
+}
+void ServerThreadPrivate::internalCommsMessage(const unsigned char* readBev, ServerThreadPrivate* st)
+{
+    const INTERNAL_MSG* type = reinterpret_cast<const INTERNAL_MSG*>(&readBev[0]);
+    int index                = sizeof(INTERNAL_MSG);
     switch (*type) {
         case ADD_DEFAULT_BEV: {
             // copy out a pointer address that we are adding with a default
             // setup
-            struct bufferevent** bev = reinterpret_cast<struct bufferevent**>(&readBev[sizeof(INTERNAL_MSG)]);
+            struct bufferevent* const* bev =
+                reinterpret_cast<struct bufferevent* const*>(&readBev[sizeof(INTERNAL_MSG)]);
 
-            evutil_make_socket_nonblocking(bufferevent_getfd(*bev));
+            evutil_make_socket_nonblocking(st->socketOf(*bev));
             bufferevent_setcb(*bev, ServerThreadPrivate::tcpAuth, NULL, ServerThreadPrivate::tcpErr, st);
             bufferevent_setwatermark(*bev, EV_READ, PXMServer::PACKET_HEADER_LEN, PXMServer::PACKET_HEADER_LEN);
             bufferevent_enable(*bev, EV_READ | EV_WRITE);
@@ -570,15 +915,61 @@ void ServerThreadPrivate::internalCommsRead(bufferevent* bev, void* args)
             index += NetCompression::unpackUUID(&readBev[index], uuid);
             addr.sin_family = AF_INET;
 
-            evutil_socket_t socketfd = socket(AF_INET, SOCK_STREAM, 0);
-            evutil_make_socket_nonblocking(socketfd);
-            struct bufferevent* bev = bufferevent_socket_new(st->base.data(), socketfd, BEV_OPT_THREADSAFE);
-
-            UUIDStruct* uuidStruct = new UUIDStruct{uuid, st};
-            bufferevent_setcb(bev, NULL, NULL, ServerThreadPrivate::connectCB, uuidStruct);
-            timeval timeout = {5, 0};
-            bufferevent_set_timeouts(bev, &timeout, &timeout);
-            bufferevent_socket_connect(bev, reinterpret_cast<struct sockaddr*>(&addr), sizeof(sockaddr_in));
+            // Same host peers get their unix socket if it is really here
+            bool local = st->localPeers.contains(uuid) && QFile::exists(localSocketPath(uuid));
+            startConnect(new UUIDStruct{uuid, st, addr, local});
+        } break;
+        case TRANSFER_SEND: {
+            TransferStream* stream = new TransferStream{QUuid(), st, -1, 0};
+            NetCompression::PeerRecord peer;
+            int32_t fd;
+            memset(&peer.addr, 0, sizeof(peer.addr));
+            index += NetCompression::unpackUUID(&readBev[index], stream->id);
+            index += NetCompression::unpackSockaddr_in(&readBev[index], peer.addr);
+            index += NetCompression::unpackUUID(&readBev[index], peer.uuid);
+            memcpy(&fd, &readBev[index], sizeof(fd));
+            index += sizeof(fd);
+            stream->fd           = fd;
+            stream->size         = static_cast<qint64>(NetCompression::readUint64(&readBev[index]));
+            peer.addr.sin_family = AF_INET;
+
+            bool local         = st->localPeers.contains(peer.uuid) && QFile::exists(localSocketPath(peer.uuid));
+            UUIDStruct* target = new UUIDStruct{peer.uuid, st, peer.addr, local};
+            target->stream     = stream;
+            startConnect(target);
+        } break;
+        case TRANSFER_RECEIVE: {
+            struct bufferevent* bev;
+            int32_t fd;
+            memcpy(&bev, &readBev[index], sizeof(bev));
+            index += sizeof(bev);
+            memcpy(&fd, &readBev[index], sizeof(fd));
+            index += sizeof(fd);
+            if (fd < 0) {
+                evutil_socket_t socketfd = st->socketOf(bev);
+                bufferevent_free(bev);
+                evutil_closesocket(socketfd);
+                break;
+            }
+            TransferStream* stream = new TransferStream{QUuid(), st, fd, 0};
+            stream->size           = static_cast<qint64>(NetCompression::readUint64(&readBev[index]));
+            index += sizeof(uint64_t);
+            NetCompression::unpackUUID(&readBev[index], stream->id);
+            if (stream->size == 0) {
+                bulkFinish(bev, stream, true);
+                break;
+            }
+
+            // Reading stops at the watermark until the file has caught up
+            timeval stall = {PXMTransfer::STALL_TIMEOUT_SECS, 0};
+            bufferevent_setcb(bev, ServerThreadPrivate::bulkRead, NULL, ServerThreadPrivate::bulkErr, stream);
+            bufferevent_setwatermark(bev, EV_READ, 0, PXMTransfer::RECEIVE_BUFFER_BYTES);
+            bufferevent_set_timeouts(bev, &stall, NULL);
+            st->setPriority(bev, BULK_PRIORITY);
+            bufferevent_enable(bev, EV_READ);
+            if (evbuffer_get_length(bufferevent_get_input(bev)) > 0) {
+                bulkRead(bev, stream);
+            }
         } break;
         case TCP_PORT_CHANGE:
             /*
@@ -641,21 +1032,240 @@ void ServerThreadPrivate::internalCommsRead(bufferevent* bev, void* args)
                 }
                 */
             break;
-        default:
-            bufferevent_flush(bev, EV_READ, BEV_FLUSH);
-            break;
     }
 }
+void ServerThreadPrivate::startConnect(UUIDStruct* target)
+{
+    evutil_socket_t socketfd;
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    memset(&addr, 0, sizeof(addr));
+#ifdef __unix__
+    if (target->local && unixAddress(localSocketPath(target->uuid), reinterpret_cast<sockaddr_un&>(addr))) {
+        socketfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        addrLen  = sizeof(sockaddr_un);
+    } else
+#endif
+    {
+        target->local = false;
+        memcpy(&addr, &target->addr, sizeof(sockaddr_in));
+        socketfd = socket(AF_INET, SOCK_STREAM, 0);
+        addrLen  = sizeof(sockaddr_in);
+    }
+    evutil_make_socket_nonblocking(socketfd);
+    struct bufferevent* bev = bufferevent_socket_new(target->st->base.data(), socketfd, BEV_OPT_THREADSAFE);
+
+    bufferevent_setcb(bev, NULL, NULL, ServerThreadPrivate::connectCB, target);
+    timeval timeout = {5, 0};
+    bufferevent_set_timeouts(bev, &timeout, &timeout);
+    bufferevent_socket_connect(bev, reinterpret_cast<struct sockaddr*>(&addr), addrLen);
+}
 void ServerThreadPrivate::connectCB(struct bufferevent* bev, short event, void* arg)
 {
     UUIDStruct* st = static_cast<UUIDStruct*>(arg);
+    if (!(event & BEV_EVENT_CONNECTED) && st->local) {
+        // A stale socket file or a peer that stopped listening on it, the
+        // worker never hears of this attempt
+        qCInfo(pxmNet) << "Local connection to" << st->uuid.toString() << "failed, falling back to TCP";
+        evutil_socket_t socketfd = bufferevent_getfd(bev);
+        bufferevent_free(bev);
+        evutil_closesocket(socketfd);
+        st->st->localPeers.remove(st->uuid);
+        st->local = false;
+        startConnect(st);
+        return;
+    }
+    if (st->stream) {
+        if (event & BEV_EVENT_CONNECTED) {
+            PXMMetrics::connectionsOpened.inc();
+            bulkConnected(bev, st->stream);
+        } else {
+            PXMMetrics::connectFailures.inc();
+            qWarning().noquote() << "Could not open a transfer connection to" << st->uuid.toString();
+            bulkFinish(bev, st->stream, false);
+        }
+        delete st;
+        return;
+    }
     if (event & BEV_EVENT_CONNECTED) {
-        st->st->q_ptr->resultOfConnectionAttempt(bufferevent_getfd(bev), true, bev, st->uuid);
+        PXMMetrics::connectionsOpened.inc();
+        if (st->local) {
+            PXMMetrics::localConnections.inc();
+        }
+#ifdef PXM_URING
+        // libevent only did the connect, the ring carries it from here
+        if (st->st->ring) {
+            evutil_socket_t socketfd = bufferevent_getfd(bev);
+            bufferevent* adopted     = st->st->ring->adopt(socketfd);
+            if (adopted) {
+                bufferevent_free(bev);
+                bev = adopted;
+            }
+        }
+#endif
+        st->st->q_ptr->resultOfConnectionAttempt(st->st->socketOf(bev), true, bev, st->uuid);
     } else {
+        PXMMetrics::connectFailures.inc();
         st->st->q_ptr->resultOfConnectionAttempt(bufferevent_getfd(bev), false, bev, st->uuid);
     }
     delete st;
 }
+void ServerThreadPrivate::bulkConnected(bufferevent* bev, TransferStream* stream)
+{
+    using namespace PXMConsts;
+    // The stream frame stands in for the auth packet, the file follows it
+    unsigned char header[PACKET_HEADER_LEN + NetCompression::PACKED_UUID_LENGTH + sizeof(MESSAGE_TYPE) +
+                         NetCompression::PACKED_UUID_LENGTH];
+    size_t index = NetCompression::writeUint16(header, sizeof(header) - PACKET_HEADER_LEN);
+    index += NetCompression::packUUID(&header[index], stream->st->localUUID);
+    index += NetCompression::writeUint32(&header[index], MSG_FILE_STREAM);
+    index += NetCompression::packUUID(&header[index], stream->id);
+    bufferevent_write(bev, header, index);
+    PXMMetrics::framesSent.inc(MSG_FILE_STREAM);
+    PXMMetrics::bytesSent.inc(MSG_FILE_STREAM, index);
+
+    // Topped up whenever less than a chunk is left to send
+    timeval stall = {PXMTransfer::STALL_TIMEOUT_SECS, 0};
+    bufferevent_setcb(bev, ServerThreadPrivate::bulkDrain, ServerThreadPrivate::bulkWritten,
+                      ServerThreadPrivate::bulkErr, stream);
+    bufferevent_setwatermark(bev, EV_WRITE, PXMTransfer::CHUNK_BYTES, 0);
+    bufferevent_set_timeouts(bev, NULL, &stall);
+    stream->st->setPriority(bev, BULK_PRIORITY);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+    qCInfo(pxmNet) << "Sending" << stream->size << "bytes for transfer" << stream->id.toString();
+    bulkWritten(bev, stream);
+}
+void ServerThreadPrivate::bulkWritten(bufferevent* bev, void* arg)
+{
+    TransferStream* stream = static_cast<TransferStream*>(arg);
+    evbuffer* output       = bufferevent_get_output(bev);
+    qint64 sent            = stream->queued - static_cast<qint64>(evbuffer_get_length(output));
+    PXMMetrics::transferBytesSent.inc(static_cast<quint64>(sent - stream->done));
+    stream->done = sent;
+    bulkProgress(stream);
+
+    while (stream->queued < stream->size &&
+           static_cast<qint64>(evbuffer_get_length(output)) < PXMTransfer::SEND_BUFFER_BYTES) {
+        qint64 length = qMin(PXMTransfer::CHUNK_BYTES, stream->size - stream->queued);
+        if (!PXMTransfer::addChunk(output, stream->fd, stream->queued, length)) {
+            qWarning().noquote() << "Could not queue file data for transfer" << stream->id.toString();
+            bulkFinish(bev, stream, false);
+            return;
+        }
+        stream->queued += length;
+    }
+    if (stream->queued == stream->size) {
+        if (evbuffer_get_length(output) == 0) {
+            bulkFinish(bev, stream, true);
+            return;
+        }
+        // Called again once the last of it is out
+        bufferevent_setwatermark(bev, EV_WRITE, 0, 0);
+    }
+}
+void ServerThreadPrivate::bulkRead(bufferevent* bev, void* arg)
+{
+    TransferStream* stream = static_cast<TransferStream*>(arg);
+    evbuffer* input        = bufferevent_get_input(bev);
+    size_t available       = evbuffer_get_length(input);
+    size_t length          = static_cast<size_t>(qMin(static_cast<qint64>(available), stream->size - stream->done));
+    length                 = qMin(length, PXMTransfer::WRITE_SLICE_BYTES);
+    if (!PXMTransfer::writeOut(input, stream->fd, length)) {
+        qWarning().noquote() << "Could not write file data for transfer" << stream->id.toString() << ":"
+                             << QString::fromUtf8(strerror(errno));
+        bulkFinish(bev, stream, false);
+        return;
+    }
+    PXMMetrics::transferBytesReceived.inc(length);
+    stream->done += static_cast<qint64>(length);
+    bulkProgress(stream);
+    if (stream->done == stream->size) {
+        bulkFinish(bev, stream, true);
+        return;
+    }
+    if (evbuffer_get_length(input) > 0) {
+        // The file writes block, whatever else is ready on this thread runs
+        // before the next slice
+        if (!stream->resume) {
+            stream->bev    = bev;
+            stream->resume = event_new(stream->st->base.data(), -1, 0, ServerThreadPrivate::bulkResume, stream);
+            event_priority_set(stream->resume, BULK_PRIORITY);
+        }
+        event_active(stream->resume, EV_TIMEOUT, 0);
+    }
+}
+void ServerThreadPrivate::bulkResume(evutil_socket_t, short, void* arg)
+{
+    TransferStream* stream = static_cast<TransferStream*>(arg);
+    bulkRead(stream->bev, stream);
+}
+void ServerThreadPrivate::bulkDrain(bufferevent* bev, void*)
+{
+    // The receiving end says nothing on this connection that matters
+    evbuffer* input = bufferevent_get_input(bev);
+    evbuffer_drain(input, evbuffer_get_length(input));
+}
+void ServerThreadPrivate::bulkErr(bufferevent* bev, short error, void* arg)
+{
+    TransferStream* stream = static_cast<TransferStream*>(arg);
+    // Both ends finish as soon as the last byte is through, anything
+    // before that is a failure
+    qWarning().noquote() << "Transfer" << stream->id.toString() << "stopped after" << stream->done << "of"
+                         << stream->size << "bytes" << ((error & BEV_EVENT_TIMEOUT) ? "(stalled)" : "");
+    bulkFinish(bev, stream, false);
+}
+void ServerThreadPrivate::bulkFinish(bufferevent* bev, TransferStream* stream, bool ok)
+{
+    evutil_socket_t socketfd = stream->st->socketOf(bev);
+    bufferevent_free(bev);
+    evutil_closesocket(socketfd);
+    if (stream->resume) {
+        event_free(stream->resume);
+    }
+    PXMTransfer::closeFile(stream->fd);
+    if (ok) {
+        PXMMetrics::transfersCompleted.inc();
+    } else {
+        PXMMetrics::transfersFailed.inc();
+    }
+    emit stream->st->q_ptr->transferFinished(stream->id, ok);
+    delete stream;
+}
+void ServerThreadPrivate::bulkProgress(TransferStream* stream)
+{
+    // Every chunk or percent, whichever is larger
+    qint64 step = qMax(PXMTransfer::CHUNK_BYTES, stream->size / 100);
+    if (stream->done - stream->reported >= step || (stream->done == stream->size && stream->reported != stream->done)) {
+        stream->reported = stream->done;
+        emit stream->st->q_ptr->transferProgress(stream->id, stream->done, stream->size);
+    }
+}
+void ServerThreadPrivate::metricsAccept(evutil_socket_t s, short, void* arg)
+{
+    ServerThreadPrivate* st = static_cast<ServerThreadPrivate*>(arg);
+
+    evutil_socket_t result = accept(s, NULL, NULL);
+    if (result < 0) {
+        qWarning() << "accept: " << QString::fromUtf8(strerror(errno));
+        return;
+    }
+    // One scrape per connection, the connection is closed once it has all
+    // been written
+    evutil_make_socket_nonblocking(result);
+    struct bufferevent* bev = bufferevent_socket_new(st->base.data(), result, BEV_OPT_CLOSE_ON_FREE);
+    QByteArray metrics      = PXMMetrics::render();
+    bufferevent_setcb(bev, NULL, ServerThreadPrivate::metricsWritten, ServerThreadPrivate::metricsErr, NULL);
+    bufferevent_write(bev, metrics.constData(), metrics.size());
+    bufferevent_enable(bev, EV_WRITE);
+}
+void ServerThreadPrivate::metricsWritten(bufferevent* bev, void*)
+{
+    bufferevent_free(bev);
+}
+void ServerThreadPrivate::metricsErr(bufferevent* bev, short, void*)
+{
+    bufferevent_free(bev);
+}
 
 void ServerThread::run()
 {
@@ -671,20 +1281,14 @@ void ServerThread::run()
     }
 
     // Communicate backend to peerworker
-    qInfo().noquote() << "Using " + QString::fromUtf8(event_base_get_method(d_ptr->base.data())) +
-                             " as the libevent backend";
-    emit libeventBackend(QString::fromUtf8(event_base_get_method(d_ptr->base.data())));
+    QString backend = QString::fromUtf8(event_base_get_method(d_ptr->base.data()));
+    if (d_ptr->startRing()) {
+        backend += QStringLiteral(" with io_uring for TCP");
+    }
+    qInfo().noquote() << "Using " + backend + " as the libevent backend";
+    emit libeventBackend(backend);
 
     // Pair for self communication
-    struct bufferevent* selfCommsPair[2];
-    bufferevent_pair_new(d_ptr->base.data(), BEV_OPT_THREADSAFE, selfCommsPair);
-    bufferevent_setcb(selfCommsPair[0], ServerThreadPrivate::tcpRead, NULL, ServerThreadPrivate::tcpErr, d_ptr.data());
-    bufferevent_setwatermark(selfCommsPair[0], EV_READ, PACKET_HEADER_LEN, PACKET_HEADER_LEN);
-    bufferevent_enable(selfCommsPair[0], EV_READ);
-    bufferevent_enable(selfCommsPair[1], EV_WRITE);
-
-    emit setSelfCommsBufferevent(selfCommsPair[1]);
-
     // TCP listener socket setup
     s_listen = d_ptr->newListenerSocket(d_ptr->tcpPortNumber);
     if (s_listen < 0) {
@@ -724,15 +1328,17 @@ void ServerThread::run()
             throw("FATAL:event_add returned -1");
         }
 
-        d_ptr->eventAccept =
-            event_new(d_ptr->base.data(), s_listen, EV_READ | EV_PERSIST, d_ptr->accept_new, d_ptr.data());
-        if (!d_ptr->eventAccept) {
-            throw("FATAL:event_new returned NULL");
-        }
-
-        failureCodes = event_add(d_ptr->eventAccept, NULL);
-        if (failureCodes < 0) {
-            throw("FATAL:event_add returned -1");
+        if (!d_ptr->ringListen(s_listen, false)) {
+            d_ptr->eventAccept =
+                event_new(d_ptr->base.data(), s_listen, EV_READ | EV_PERSIST, d_ptr->accept_new, d_ptr.data());
+            if (!d_ptr->eventAccept) {
+                throw("FATAL:event_new returned NULL");
+            }
+
+            failureCodes = event_add(d_ptr->eventAccept, NULL);
+            if (failureCodes < 0) {
+                throw("FATAL:event_add returned -1");
+            }
         }
     } catch (const char* errorMsg) {
         qCritical() << errorMsg;
@@ -744,6 +1350,49 @@ void ServerThread::run()
         return;
     }
 
+    // Metrics are optional, a failure here only gets logged
+    if (!d_ptr->metricsPath.isEmpty()) {
+        evutil_socket_t s_metrics = d_ptr->newUnixSocket(d_ptr->metricsPath);
+        if (s_metrics >= 0) {
+            d_ptr->eventMetrics = event_new(d_ptr->base.data(), s_metrics, EV_READ | EV_PERSIST,
+                                            ServerThreadPrivate::metricsAccept, d_ptr.data());
+            if (!d_ptr->eventMetrics) {
+                qWarning() << "Could not watch the metrics socket";
+                evutil_closesocket(s_metrics);
+            } else if (event_add(d_ptr->eventMetrics, NULL) < 0) {
+                qWarning() << "Could not watch the metrics socket";
+            } else {
+                qInfo().noquote() << "Serving metrics on" << d_ptr->metricsPath;
+            }
+        }
+    }
+
+    // Same host transport is optional too, without it everything uses TCP
+    if (d_ptr->localTransport) {
+        d_ptr->localPath          = localSocketPath(d_ptr->localUUID);
+        evutil_socket_t s_local = d_ptr->localPath.isEmpty() ? -1 : d_ptr->newUnixSocket(d_ptr->localPath);
+        if (s_local >= 0 && d_ptr->ringListen(s_local, true)) {
+            d_ptr->localSocket = s_local;
+        } else if (s_local >= 0) {
+            d_ptr->eventLocal =
+                event_new(d_ptr->base.data(), s_local, EV_READ | EV_PERSIST, d_ptr->accept_new, d_ptr.data());
+            if (!d_ptr->eventLocal || event_add(d_ptr->eventLocal, NULL) < 0) {
+                qWarning() << "Could not watch the local socket";
+                if (d_ptr->eventLocal) {
+                    event_free(d_ptr->eventLocal);
+                    d_ptr->eventLocal = nullptr;
+                }
+                evutil_closesocket(s_local);
+                QFile::remove(d_ptr->localPath);
+            } else {
+                d_ptr->localSocket = s_local;
+            }
+        }
+        if (d_ptr->localSocket >= 0) {
+            qInfo().noquote() << "Same host connections on" << d_ptr->localPath;
+        }
+    }
+
     // send our discover packet to find other computers
     emit sendUDP("/discover", d_ptr->udpPortNumber);
 
@@ -765,14 +1414,30 @@ void ServerThread::run()
 
     // Free libevent data structures before exiting the thread
     qDebug() << "Freeing events...";
-    event_free(d_ptr->eventAccept);
+#ifdef PXM_URING
+    // Before the listeners go, the ring may still be accepting on them
+    d_ptr->ring.reset();
+#endif
+    if (d_ptr->eventAccept) {
+        event_free(d_ptr->eventAccept);
+    }
+    evutil_closesocket(s_listen);
     event_free(d_ptr->eventDiscover);
+    if (d_ptr->eventMetrics) {
+        evutil_closesocket(event_get_fd(d_ptr->eventMetrics));
+        event_free(d_ptr->eventMetrics);
+        QFile::remove(d_ptr->metricsPath);
+    }
+    if (d_ptr->eventLocal) {
+        event_free(d_ptr->eventLocal);
+    }
+    if (d_ptr->localSocket >= 0) {
+        evutil_closesocket(d_ptr->localSocket);
+        QFile::remove(d_ptr->localPath);
+    }
 
     bufferevent_free(internalCommsPair[1]);
     bufferevent_free(internalCommsPair[0]);
 
-    bufferevent_free(selfCommsPair[1]);
-    bufferevent_free(selfCommsPair[0]);
-
     qDebug() << "Events free, returning from PXMServer::run()";
 }
@@ -1,7 +1,11 @@
 #include "pxmstackwidget.h"
+#include "pxmconsts.h"
 #include <QFile>
 #include <QLabel>
+#include <QScrollBar>
 #include <QStringBuilder>
+#include <QTextCursor>
+#include <QTimer>
 
 using namespace PXMMessageViewer;
 
@@ -15,30 +19,149 @@ StackedWidget::StackedWidget(QWidget* parent) : QStackedWidget(parent)
 
 int StackedWidget::append(QString str, QUuid& uuid)
 {
-    for (int i = 0; i < this->count(); i++) {
-        MVBase* mvb = dynamic_cast<MVBase*>(this->widget(i));
-        if (mvb && mvb->getIdentifier() == uuid) {
-            TextWidget* tw = qobject_cast<TextWidget*>(this->widget(i));
-            if (tw) {
-                tw->append(str);
-                return 0;
-            } else {
-                return -1;
-            }
-        }
+    if (uuid != currentUuid()) {
+        unread[uuid]++;
+    }
+
+    TextWidget* tw = pages.value(uuid);
+    if (tw && !tw->awaitingFirstPage()) {
+        tw->append(str);
+        return 0;
     }
-    return -1;
+
+    // No page yet, keep a bounded backlog for when it is opened
+    QLinkedList<QString>& backlog = pending[uuid].messages;
+    backlog.append(str);
+    if (backlog.size() > PXMConsts::MESSAGE_HISTORY_LENGTH) {
+        backlog.removeFirst();
+    }
+    return 0;
 }
 int StackedWidget::switchToUuid(QUuid& uuid)
 {
-    for (int i = 0; i < this->count(); i++) {
-        MVBase* mvb = dynamic_cast<MVBase*>(this->widget(i));
-        if (mvb->getIdentifier() == uuid) {
-            this->setCurrentIndex(i);
-            return 0;
+    TextWidget* tw = createPage(uuid);
+    if (!tw) {
+        return -1;
+    }
+    this->setCurrentWidget(tw);
+    unread.remove(uuid);
+    return 0;
+}
+
+TextWidget* StackedWidget::createPage(const QUuid& uuid)
+{
+    if (uuid.isNull()) {
+        return nullptr;
+    }
+
+    TextWidget* tw = pages.value(uuid);
+    if (tw) {
+        return tw;
+    }
+
+    tw = new TextWidget(this, uuid);
+    pages.insert(uuid, tw);
+    this->addWidget(tw);
+    QObject::connect(tw, &TextWidget::historyRequested, this, &StackedWidget::historyRequested);
+    tw->requestPage();
+    return tw;
+}
+
+void StackedWidget::historyPage(QUuid uuid, QStringList page, PXMHistory::Cursor next, bool more)
+{
+    TextWidget* tw = pages.value(uuid);
+    if (!tw) {
+        return;
+    }
+    if (tw->awaitingFirstPage()) {
+        pending.remove(uuid);
+    }
+    tw->addPage(page, next, more);
+}
+
+TextWidget::TextWidget(QWidget* parent, const QUuid& uuid)
+    : QTextBrowser(parent), MVBase(uuid), moreHistory(true), loading(false)
+{
+    QObject::connect(this->verticalScrollBar(), &QScrollBar::valueChanged, this, &TextWidget::scrolled);
+}
+
+void TextWidget::requestPage()
+{
+    if (loading || !moreHistory) {
+        return;
+    }
+    loading = true;
+    emit historyRequested(getIdentifier(), older, PXMConsts::HISTORY_PAGE_SIZE);
+}
+
+void TextWidget::scrolled(int value)
+{
+    if (value == this->verticalScrollBar()->minimum() && this->verticalScrollBar()->maximum() > 0) {
+        requestPage();
+    }
+}
+
+void TextWidget::fillViewport()
+{
+    // Without a scroll bar there is nothing to scroll to the top of, keep
+    // loading until there is one or the history runs out
+    if (this->isVisible() && this->verticalScrollBar()->maximum() == 0) {
+        requestPage();
+    }
+}
+
+void TextWidget::showEvent(QShowEvent* event)
+{
+    QTextBrowser::showEvent(event);
+    fillViewport();
+}
+
+void TextWidget::resizeEvent(QResizeEvent* event)
+{
+    QTextBrowser::resizeEvent(event);
+    fillViewport();
+}
+
+void TextWidget::addPage(const QStringList& page, PXMHistory::Cursor next, bool more)
+{
+    bool first  = older.isNull();
+    loading     = false;
+    moreHistory = more && !next.isNull();
+    older       = next;
+    if (page.isEmpty()) {
+        return;
+    }
+
+    this->setUpdatesEnabled(false);
+    if (first) {
+        for (const QString& msg : page) {
+            this->append(msg);
+        }
+    } else {
+        QScrollBar* bar = this->verticalScrollBar();
+        int fromBottom  = bar->maximum() - bar->value();
+        QTextCursor cursor(this->document());
+        cursor.beginEditBlock();
+        cursor.movePosition(QTextCursor::Start);
+        for (const QString& msg : page) {
+            cursor.insertHtml(msg);
+            cursor.insertBlock();
         }
+        cursor.endEditBlock();
+        bar->setValue(bar->maximum() - fromBottom);
+    }
+    this->setUpdatesEnabled(true);
+    // The scroll bar range is only known once the document is laid out
+    QTimer::singleShot(0, this, &TextWidget::fillViewport);
+}
+
+QUuid StackedWidget::currentUuid() const
+{
+    MVBase* mvb = dynamic_cast<MVBase*>(this->currentWidget());
+    if (mvb) {
+        return mvb->getIdentifier();
     }
-    return -1;
+    return QUuid();
 }
 
 LabelWidget::LabelWidget(QWidget* parent, const QUuid& uuid) : QLabel(parent), MVBase(uuid)
@@ -0,0 +1,214 @@
+#include "pxmtrace.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSocketNotifier>
+#include <QThread>
+#include <QVector>
+
+#include <atomic>
+#include <chrono>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+struct Event {
+    quint64 nsecs;
+    const char* name;
+    quint64 arg;
+    char phase;
+};
+
+struct ThreadRing {
+    Event events[PXMTrace::RING_EVENTS];
+    std::atomic<quint32> head;
+    int tid;
+    QString threadName;
+};
+
+static_assert((PXMTrace::RING_EVENTS & (PXMTrace::RING_EVENTS - 1)) == 0, "RING_EVENTS must be a power of two");
+
+std::atomic<bool> enabled(true);
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+// Rings are never freed so a thread that has exited can still be dumped
+QMutex ringsMutex;
+QVector<ThreadRing*> rings;
+
+ThreadRing* newRing()
+{
+    ThreadRing* ring = new ThreadRing;
+    ring->head.store(0, std::memory_order_relaxed);
+
+    QThread* thread = QThread::currentThread();
+    if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()) {
+        ring->threadName = QStringLiteral("Main");
+    } else if (thread) {
+        ring->threadName = thread->objectName();
+    }
+
+    QMutexLocker locker(&ringsMutex);
+    ring->tid = rings.size() + 1;
+    if (ring->threadName.isEmpty()) {
+        ring->threadName = QStringLiteral("Thread ") + QString::number(ring->tid);
+    }
+    rings.append(ring);
+    return ring;
+}
+
+thread_local ThreadRing* localRing = nullptr;
+
+#ifdef __unix__
+int signalPipe[2] = {-1, -1};
+
+void dumpSignalHandler(int)
+{
+    char c = 1;
+    if (write(signalPipe[1], &c, 1) < 0) {
+        // Nothing safe to do from here
+    }
+}
+#endif
+}
+
+void PXMTrace::record(const char* name, char phase, quint64 arg)
+{
+    if (!enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (!localRing) {
+        localRing = newRing();
+    }
+    quint32 head = localRing->head.load(std::memory_order_relaxed);
+    Event& event = localRing->events[head & (RING_EVENTS - 1)];
+    event.nsecs  = static_cast<quint64>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+    event.name  = name;
+    event.arg   = arg;
+    event.phase = phase;
+    localRing->head.store(head + 1, std::memory_order_release);
+}
+
+void PXMTrace::setEnabled(bool on)
+{
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+bool PXMTrace::isEnabled()
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+bool PXMTrace::dump(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning().noquote() << "Could not open trace file" << path;
+        return false;
+    }
+
+    QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray out;
+    out.reserve(1024 * 1024);
+    out.append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    int count  = 0;
+
+    QMutexLocker locker(&ringsMutex);
+    for (ThreadRing* ring : rings) {
+        QByteArray tid = QByteArray::number(ring->tid);
+        if (!first) {
+            out.append(",\n");
+        }
+        first = false;
+        out.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + tid +
+                   ",\"args\":{\"name\":\"" + ring->threadName.toUtf8() + "\"}}");
+
+        quint32 head  = ring->head.load(std::memory_order_acquire);
+        quint32 start = head > static_cast<quint32>(RING_EVENTS) ? head - RING_EVENTS : 0;
+        for (quint32 i = start; i < head; i++) {
+            const Event& event = ring->events[i & (RING_EVENTS - 1)];
+            if (!event.name) {
+                continue;
+            }
+            out.append(",\n{\"name\":\"");
+            out.append(event.name);
+            out.append("\",\"ph\":\"");
+            out.append(event.phase);
+            out.append("\",\"ts\":");
+            // Microseconds with the nanoseconds kept as decimals
+            out.append(QByteArray::number(event.nsecs / 1000));
+            out.append('.');
+            out.append(QByteArray::number(event.nsecs % 1000).rightJustified(3, '0'));
+            out.append(",\"pid\":" + pid + ",\"tid\":" + tid);
+            if (event.phase == 'i') {
+                out.append(",\"s\":\"t\"");
+            }
+            if (event.arg) {
+                out.append(",\"args\":{\"v\":" + QByteArray::number(event.arg) + "}");
+            }
+            out.append('}');
+            count++;
+
+            if (out.size() > 512 * 1024) {
+                file.write(out);
+                out.resize(0);
+            }
+        }
+    }
+    locker.unlock();
+
+    out.append("\n]}\n");
+    file.write(out);
+    file.close();
+    qInfo().noquote() << "Wrote" << count << "trace events to" << path;
+    return true;
+}
+
+QString PXMTrace::defaultDumpPath()
+{
+    return QDir::tempPath() + QStringLiteral("/pxmessenger-trace-") +
+           QString::number(QCoreApplication::applicationPid()) + QLatin1Char('-') +
+           QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd-hhmmss-zzz")) + QStringLiteral(".json");
+}
+
+void PXMTrace::installDumpSignal(QObject* parent)
+{
+#ifdef __unix__
+    if (signalPipe[0] >= 0) {
+        return;
+    }
+    if (pipe(signalPipe) < 0) {
+        qWarning() << "Could not create pipe for the trace signal";
+        return;
+    }
+    fcntl(signalPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(signalPipe[1], F_SETFL, O_NONBLOCK);
+
+    QSocketNotifier* notifier = new QSocketNotifier(signalPipe[0], QSocketNotifier::Read, parent);
+    QObject::connect(notifier, &QSocketNotifier::activated, [](int fd) {
+        char buf[16];
+        while (read(fd, buf, sizeof(buf)) > 0) {
+        }
+        dump(defaultDumpPath());
+    });
+
+    struct sigaction action = {};
+    action.sa_handler       = dumpSignalHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+#else
+    Q_UNUSED(parent);
+#endif
+}
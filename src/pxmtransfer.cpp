@@ -0,0 +1,230 @@
+#include "pxmtransfer.h"
+
+#include <QFile>
+#include <QFileInfo>
+
+#include <errno.h>
+#include <string.h>
+
+#include <event2/buffer.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#elif __unix__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#error "include headers for file descriptors"
+#endif
+
+#include "pxmutf8.h"
+
+QByteArray PXMTransfer::packOffer(const QUuid& id, qint64 size, const QByteArray& hash, const QString& name)
+{
+    QByteArray nameRaw = name.toUtf8();
+    // Cut at a character boundary, never in the middle of a sequence
+    while (static_cast<size_t>(nameRaw.size()) > MAX_NAME_BYTES) {
+        int cut = static_cast<int>(MAX_NAME_BYTES);
+        while (cut > 0 && (static_cast<unsigned char>(nameRaw.at(cut)) & 0xC0) == 0x80) {
+            cut--;
+        }
+        nameRaw.truncate(cut);
+    }
+    QByteArray offer(static_cast<int>(OFFER_HEADER_LENGTH), Qt::Uninitialized);
+    unsigned char* buf = reinterpret_cast<unsigned char*>(offer.data());
+    size_t index       = NetCompression::packUUID(buf, id);
+    index += NetCompression::writeUint64(&buf[index], static_cast<uint64_t>(size));
+    memcpy(&buf[index], hash.constData(), PXMBlobCache::HASH_BYTES);
+    offer.append(nameRaw);
+    return offer;
+}
+
+bool PXMTransfer::unpackOffer(const unsigned char* buf,
+                              size_t len,
+                              QUuid& id,
+                              qint64& size,
+                              QByteArray& hash,
+                              QString& name)
+{
+    if (len <= OFFER_HEADER_LENGTH || len > OFFER_HEADER_LENGTH + MAX_NAME_BYTES) {
+        return false;
+    }
+    size_t index = NetCompression::unpackUUID(buf, id);
+    uint64_t raw = NetCompression::readUint64(&buf[index]);
+    index += sizeof(uint64_t);
+    if (id.isNull() || raw > static_cast<uint64_t>(INT64_MAX)) {
+        return false;
+    }
+    size = static_cast<qint64>(raw);
+    hash = QByteArray(reinterpret_cast<const char*>(&buf[index]), PXMBlobCache::HASH_BYTES);
+    index += PXMBlobCache::HASH_BYTES;
+
+    bool utf8Ok = false;
+    name        = QFileInfo(PXMUtf8::decode(&buf[index], len - index, &utf8Ok).replace(QChar('\\'), QChar('/')))
+               .fileName();
+    return utf8Ok && !name.isEmpty() && name != QLatin1String(".") && name != QLatin1String("..");
+}
+
+QByteArray PXMTransfer::packRedirect(const QUuid& id, const QUuid& holder)
+{
+    QByteArray redirect(static_cast<int>(REDIRECT_LENGTH), Qt::Uninitialized);
+    unsigned char* buf = reinterpret_cast<unsigned char*>(redirect.data());
+    size_t index       = NetCompression::packUUID(buf, id);
+    NetCompression::packUUID(&buf[index], holder);
+    return redirect;
+}
+
+QByteArray PXMTransfer::packPull(const QUuid& id, const QByteArray& hash, qint64 size)
+{
+    QByteArray pull(static_cast<int>(PULL_LENGTH), Qt::Uninitialized);
+    unsigned char* buf = reinterpret_cast<unsigned char*>(pull.data());
+    size_t index       = NetCompression::packUUID(buf, id);
+    memcpy(&buf[index], hash.constData(), PXMBlobCache::HASH_BYTES);
+    index += PXMBlobCache::HASH_BYTES;
+    NetCompression::writeUint64(&buf[index], static_cast<uint64_t>(size));
+    return pull;
+}
+
+bool PXMTransfer::unpackPull(const unsigned char* buf, size_t len, QUuid& id, QByteArray& hash, qint64& size)
+{
+    if (len < PULL_LENGTH) {
+        return false;
+    }
+    size_t index = NetCompression::unpackUUID(buf, id);
+    hash         = QByteArray(reinterpret_cast<const char*>(&buf[index]), PXMBlobCache::HASH_BYTES);
+    index += PXMBlobCache::HASH_BYTES;
+    uint64_t raw = NetCompression::readUint64(&buf[index]);
+    if (id.isNull() || raw > static_cast<uint64_t>(INT64_MAX)) {
+        return false;
+    }
+    size = static_cast<qint64>(raw);
+    return true;
+}
+
+int PXMTransfer::openForSend(const QString& path, qint64& size)
+{
+#ifdef _WIN32
+    int fd = _wopen(reinterpret_cast<const wchar_t*>(path.utf16()), _O_RDONLY | _O_BINARY);
+    struct _stat64 info;
+    bool statOk = fd >= 0 && _fstat64(fd, &info) == 0;
+#else
+    int fd      = open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    bool statOk = fd >= 0 && fstat(fd, &info) == 0;
+#endif
+    if (!statOk) {
+        closeFile(fd);
+        return -1;
+    }
+    size = static_cast<qint64>(info.st_size);
+    return fd;
+}
+
+int PXMTransfer::openForReceive(const QString& path, qint64 size)
+{
+#ifdef _WIN32
+    int fd = _wopen(reinterpret_cast<const wchar_t*>(path.utf16()), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                    _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+#endif
+    if (fd < 0) {
+        return -1;
+    }
+#ifdef __unix__
+    // Take the blocks now so a full disk shows up before anything is sent,
+    // file systems without fallocate get the file extended as it arrives
+    int result = size > 0 ? posix_fallocate(fd, 0, static_cast<off_t>(size)) : 0;
+    if (result != 0 && result != EINVAL && result != EOPNOTSUPP) {
+        closeFile(fd);
+        errno = result;
+        return -1;
+    }
+#else
+    Q_UNUSED(size);
+#endif
+    return fd;
+}
+
+void PXMTransfer::closeFile(int fd)
+{
+    if (fd < 0) {
+        return;
+    }
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+bool PXMTransfer::addChunk(evbuffer* output, int fd, qint64 offset, qint64 length)
+{
+#ifdef _WIN32
+    int chunkFd = _dup(fd);
+#else
+    int chunkFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+#endif
+    if (chunkFd < 0) {
+        return false;
+    }
+    if (evbuffer_add_file(output, chunkFd, offset, length) != 0) {
+        // Only handed over on success
+        closeFile(chunkFd);
+        return false;
+    }
+    return true;
+}
+
+bool PXMTransfer::writeOut(evbuffer* input, int fd, size_t len)
+{
+    while (len > 0) {
+        evbuffer_iovec vec[16];
+        int count   = qMin(evbuffer_peek(input, static_cast<ev_ssize_t>(len), NULL, vec, 16), 16);
+        size_t pass = 0;
+        for (int i = 0; i < count && pass < len; i++) {
+            const char* data = static_cast<const char*>(vec[i].iov_base);
+            size_t want      = qMin(vec[i].iov_len, len - pass);
+            while (want > 0) {
+#ifdef _WIN32
+                int written = _write(fd, data, static_cast<unsigned int>(want));
+#else
+                ssize_t written = write(fd, data, want);
+#endif
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    return false;
+                }
+                data += written;
+                want -= static_cast<size_t>(written);
+                pass += static_cast<size_t>(written);
+            }
+        }
+        if (pass == 0) {
+            return false;
+        }
+        evbuffer_drain(input, pass);
+        len -= pass;
+    }
+    return true;
+}
+
+QString PXMTransfer::sizeString(qint64 bytes)
+{
+    static const char* const units[] = {"KiB", "MiB", "GiB", "TiB"};
+    if (bytes < 1024) {
+        return QString::number(bytes) + QStringLiteral(" B");
+    }
+    double value = bytes / 1024.0;
+    int unit     = 0;
+    while (value >= 1024.0 && unit < 3) {
+        value /= 1024.0;
+        unit++;
+    }
+    return QString::number(value, 'f', 1) + QChar(' ') + QLatin1String(units[unit]);
+}
@@ -0,0 +1,816 @@
+#include "pxmuring.h"
+
+#include <QDebug>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QVector>
+
+#include <atomic>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <liburing.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+
+#include "pxmlog.h"
+#include "pxmmetrics.h"
+
+using namespace PXMUring;
+
+namespace
+{
+const int BUFFER_GROUP = 0;
+// Completions taken from the ring at a time
+const unsigned REAP_BATCH = 64;
+
+// Low bits of the user data, the rest is the Listener or Connection
+enum Op : uint64_t { ACCEPT = 0, RECV = 1, SEND = 2, CANCEL = 3, PROBE = 4, OP_MASK = 7 };
+
+// Receive buffers are lent to the bufferevents by reference and come back
+// when whoever reads the data drains it, which may be after the ring is
+// gone or on another thread
+struct RecvBuffers {
+    QMutex lock;
+    // Null once the ring is shut down, buffers are then only let go of
+    io_uring_buf_ring* ring = nullptr;
+    unsigned char* memory   = nullptr;
+    // Activated when a buffer comes back while connections wait for one
+    event* wake = nullptr;
+    std::atomic<bool> starving{false};
+    // One for the ring and one for every buffer lent out
+    std::atomic<int> refs{1};
+
+    void put(int bid);
+    void unref();
+};
+
+struct Listener {
+    RingPrivate* ring;
+    evutil_socket_t fd;
+    bool local;
+    AcceptCallback callback;
+    void* arg;
+};
+
+struct Connection {
+    RingPrivate* ring;
+    // Every operation uses this copy of the socket, appFd is the one handed
+    // out and closed by whoever holds appEnd
+    evutil_socket_t fd;
+    evutil_socket_t appFd;
+    bufferevent* ringEnd;
+    bufferevent* appEnd;
+    // Taken from ringEnd's input and left alone while sends from it are in
+    // flight, so the kernel never sees memory move under it
+    evbuffer* sending;
+    int sendsInFlight = 0;
+    size_t sent       = 0;
+    bool sendFailed   = false;
+    // Nothing goes out any more after a failed send
+    bool broken    = false;
+    bool receiving = false;
+    // recv stopped until appEnd catches up
+    bool paused = false;
+    // recv stopped until a buffer comes back
+    bool starved = false;
+    // EOF passed on to appEnd
+    bool finished = false;
+    bool closing  = false;
+    // Sweeps left for unsent data to go out once appEnd is freed, -1 while
+    // it is in use
+    int lingering = -1;
+    // Operations the kernel still holds
+    int pending = 0;
+    // For a connection with its own priority, received data waits in
+    // incoming and sends wait for deliver to run at that priority
+    event* deliver     = nullptr;
+    evbuffer* incoming = nullptr;
+};
+
+uint64_t tag(void* p, Op op)
+{
+    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(p)) | op;
+}
+
+void RecvBuffers::put(int bid)
+{
+    QMutexLocker locker(&lock);
+    if (ring) {
+        io_uring_buf_ring_add(ring, &memory[static_cast<size_t>(bid) * RECV_BUFFER_BYTES], RECV_BUFFER_BYTES,
+                              static_cast<unsigned short>(bid), io_uring_buf_ring_mask(RECV_BUFFERS), 0);
+        io_uring_buf_ring_advance(ring, 1);
+        if (wake && starving.exchange(false)) {
+            event_active(wake, EV_TIMEOUT, 0);
+        }
+    }
+}
+
+void RecvBuffers::unref()
+{
+    if (refs.fetch_sub(1) == 1) {
+        delete[] memory;
+        delete this;
+    }
+}
+
+void returned(const void* data, size_t, void* extra)
+{
+    RecvBuffers* buffers = static_cast<RecvBuffers*>(extra);
+    buffers->put(static_cast<int>((static_cast<const unsigned char*>(data) - buffers->memory) / RECV_BUFFER_BYTES));
+    buffers->unref();
+}
+}
+
+struct PXMUring::RingPrivate {
+    event_base* base;
+    io_uring ring;
+    bool ringUp             = false;
+    RecvBuffers* buffers    = nullptr;
+    int eventFd             = -1;
+    event* eventCompletions = nullptr;
+    event* eventSubmit      = nullptr;
+    event* eventSweep       = nullptr;
+    event* eventWake        = nullptr;
+    bool submitQueued       = false;
+    QVector<Listener*> listeners;
+    QSet<Connection*> connections;
+    QSet<Connection*> starved;
+    QHash<const bufferevent*, Connection*> byApp;
+
+    io_uring_sqe* sqe();
+    void submit();
+    void queueSubmit();
+    void reap();
+    void complete(const io_uring_cqe* cqe);
+    bool armAccept(Listener* l);
+    void accepted(Listener* l, int res, unsigned flags);
+    Connection* connect(evutil_socket_t fd);
+    void armRecv(Connection* c);
+    void received(Connection* c, int res, unsigned flags);
+    void pause(Connection* c);
+    void send(Connection* c);
+    void sendDone(Connection* c, int res);
+    void finish(Connection* c);
+    void close(Connection* c);
+    void release(Connection* c);
+    void free(Connection* c);
+    void feed();
+    void sweep();
+    bool probeRecv();
+
+    static void completions(evutil_socket_t fd, short, void* arg);
+    static void submitCB(evutil_socket_t, short, void* arg);
+    static void sweepCB(evutil_socket_t, short, void* arg);
+    static void wakeCB(evutil_socket_t, short, void* arg);
+    static void deliverCB(evutil_socket_t, short, void* arg);
+    static void outgoing(bufferevent*, void* arg);
+    static void drained(bufferevent*, void* arg);
+};
+
+io_uring_sqe* RingPrivate::sqe()
+{
+    io_uring_sqe* s = io_uring_get_sqe(&ring);
+    if (!s) {
+        // Full, hand over what is there and try again
+        submit();
+        s = io_uring_get_sqe(&ring);
+    }
+    if (s) {
+        queueSubmit();
+    } else {
+        qWarning() << "io_uring submission queue is full";
+    }
+    return s;
+}
+
+void RingPrivate::submit()
+{
+    submitQueued = false;
+    int result   = io_uring_submit(&ring);
+    PXMMetrics::ringSubmits.inc();
+    if (result < 0) {
+        qWarning().noquote() << "io_uring_submit:" << QString::fromUtf8(strerror(-result));
+    }
+}
+
+void RingPrivate::queueSubmit()
+{
+    // Everything queued during this pass of the loop goes in one call
+    if (!submitQueued) {
+        submitQueued = true;
+        event_active(eventSubmit, EV_TIMEOUT, 0);
+    }
+}
+
+void RingPrivate::reap()
+{
+    io_uring_cqe* cqes[REAP_BATCH];
+    for (;;) {
+        unsigned count = io_uring_peek_batch_cqe(&ring, cqes, REAP_BATCH);
+        if (count == 0) {
+            return;
+        }
+        for (unsigned i = 0; i < count; i++) {
+            complete(cqes[i]);
+        }
+        io_uring_cq_advance(&ring, count);
+    }
+}
+
+void RingPrivate::complete(const io_uring_cqe* cqe)
+{
+    uint64_t data = io_uring_cqe_get_data64(cqe);
+    void* target  = reinterpret_cast<void*>(static_cast<uintptr_t>(data & ~static_cast<uint64_t>(OP_MASK)));
+    switch (static_cast<Op>(data & OP_MASK)) {
+        case ACCEPT:
+            accepted(static_cast<Listener*>(target), cqe->res, cqe->flags);
+            break;
+        case RECV:
+            received(static_cast<Connection*>(target), cqe->res, cqe->flags);
+            break;
+        case SEND:
+            sendDone(static_cast<Connection*>(target), cqe->res);
+            break;
+        case CANCEL: {
+            Connection* c = static_cast<Connection*>(target);
+            c->pending--;
+            release(c);
+        } break;
+        default:
+            qCritical() << "Unknown io_uring completion";
+            break;
+    }
+}
+
+bool RingPrivate::armAccept(Listener* l)
+{
+    io_uring_sqe* s = sqe();
+    if (!s) {
+        return false;
+    }
+    io_uring_prep_multishot_accept(s, l->fd, nullptr, nullptr, SOCK_CLOEXEC);
+    io_uring_sqe_set_data64(s, tag(l, ACCEPT));
+    return true;
+}
+
+void RingPrivate::accepted(Listener* l, int res, unsigned flags)
+{
+    // A multishot accept ends on errors, and now and then on its own
+    if (!(flags & IORING_CQE_F_MORE)) {
+        armAccept(l);
+    }
+    if (res < 0) {
+        qCritical() << "accept: " << QString::fromUtf8(strerror(-res));
+        return;
+    }
+    evutil_make_socket_nonblocking(res);
+    Connection* c = connect(res);
+    if (!c) {
+        evutil_closesocket(res);
+        return;
+    }
+    l->callback(c->appEnd, l->local, l->arg);
+}
+
+Connection* RingPrivate::connect(evutil_socket_t fd)
+{
+    evutil_socket_t own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own < 0) {
+        qWarning().noquote() << "dup:" << QString::fromUtf8(strerror(errno));
+        return nullptr;
+    }
+    // Callbacks of both ends run on the loop, whichever thread writes
+    bufferevent* pair[2];
+    if (bufferevent_pair_new(base, BEV_OPT_THREADSAFE | BEV_OPT_DEFER_CALLBACKS, pair) < 0) {
+        evutil_closesocket(own);
+        return nullptr;
+    }
+    Connection* c = new Connection;
+    c->ring       = this;
+    c->fd         = own;
+    c->appFd      = fd;
+    c->ringEnd    = pair[0];
+    c->appEnd     = pair[1];
+    c->sending    = evbuffer_new();
+    bufferevent_setcb(c->ringEnd, RingPrivate::outgoing, RingPrivate::drained, nullptr, c);
+    bufferevent_enable(c->ringEnd, EV_READ | EV_WRITE);
+    connections.insert(c);
+    byApp.insert(c->appEnd, c);
+    PXMMetrics::ringConnections.add();
+    armRecv(c);
+    return c;
+}
+
+void RingPrivate::armRecv(Connection* c)
+{
+    if (c->receiving || c->paused || c->starved || c->finished || c->closing) {
+        return;
+    }
+    io_uring_sqe* s = sqe();
+    if (!s) {
+        finish(c);
+        return;
+    }
+    // One recv for the life of the connection, buffers come from the ring
+    io_uring_prep_recv_multishot(s, c->fd, nullptr, 0, 0);
+    s->flags |= IOSQE_BUFFER_SELECT;
+    s->buf_group = BUFFER_GROUP;
+    io_uring_sqe_set_data64(s, tag(c, RECV));
+    c->receiving = true;
+    c->pending++;
+}
+
+void RingPrivate::received(Connection* c, int res, unsigned flags)
+{
+    if (!(flags & IORING_CQE_F_MORE)) {
+        c->receiving = false;
+        c->pending--;
+    }
+    evbuffer* output = bufferevent_get_output(c->ringEnd);
+    if (flags & IORING_CQE_F_BUFFER) {
+        int bid = static_cast<int>(flags >> IORING_CQE_BUFFER_SHIFT);
+        unsigned char* data = &buffers->memory[static_cast<size_t>(bid) * RECV_BUFFER_BYTES];
+        evbuffer* target    = c->deliver ? c->incoming : output;
+        if (res <= 0 || c->closing || c->lingering >= 0) {
+            buffers->put(bid);
+        } else if (buffers->refs - 1 < RECV_BUFFERS_LENT) {
+            // Lent to appEnd as it is, the buffer goes back to the ring once
+            // the reader has drained it
+            buffers->refs++;
+            evbuffer_add_reference(target, data, static_cast<size_t>(res), returned, buffers);
+        } else {
+            evbuffer_add(target, data, static_cast<size_t>(res));
+            buffers->put(bid);
+        }
+        if (res > 0 && c->deliver) {
+            event_active(c->deliver, EV_TIMEOUT, 0);
+        }
+    }
+    if (c->closing) {
+        release(c);
+        return;
+    }
+    size_t backlog = evbuffer_get_length(output) + (c->incoming ? evbuffer_get_length(c->incoming) : 0);
+    if (!c->paused && backlog > RECV_BACKLOG_BYTES) {
+        pause(c);
+    }
+    if (c->receiving) {
+        return;
+    }
+    if (res == -ENOBUFS) {
+        // Every buffer is lent out, recv goes on when one comes back
+        c->starved = true;
+        starved.insert(c);
+        buffers->starving = true;
+    } else if (res > 0 || res == -ECANCELED) {
+        armRecv(c);
+    } else {
+        if (res < 0) {
+            qCDebug(pxmNet).noquote() << "recv:" << QString::fromUtf8(strerror(-res));
+        }
+        finish(c);
+    }
+}
+
+void RingPrivate::pause(Connection* c)
+{
+    c->paused = true;
+    if (!c->receiving) {
+        return;
+    }
+    io_uring_sqe* s = sqe();
+    if (!s) {
+        return;
+    }
+    io_uring_prep_cancel64(s, tag(c, RECV), 0);
+    io_uring_sqe_set_data64(s, tag(c, CANCEL));
+    c->pending++;
+}
+
+void RingPrivate::send(Connection* c)
+{
+    evbuffer* input = bufferevent_get_input(c->ringEnd);
+    if (c->broken) {
+        evbuffer_drain(input, evbuffer_get_length(input));
+        return;
+    }
+    if (c->closing || c->sendsInFlight > 0) {
+        return;
+    }
+    if (evbuffer_get_length(c->sending) == 0) {
+        if (evbuffer_get_length(input) == 0) {
+            return;
+        }
+        // Moves the chains, nothing is copied
+        evbuffer_add_buffer(c->sending, input);
+    }
+
+    evbuffer_iovec vecs[SEND_CHAIN_MAX];
+    int count = qMin(evbuffer_peek(c->sending, -1, nullptr, vecs, SEND_CHAIN_MAX), SEND_CHAIN_MAX);
+    // A chain must not be split over two submissions
+    if (io_uring_sq_space_left(&ring) < static_cast<unsigned>(count)) {
+        submit();
+    }
+    io_uring_sqe* previous = nullptr;
+    for (int i = 0; i < count; i++) {
+        io_uring_sqe* s = sqe();
+        if (!s) {
+            // Send what made it in, the rest goes once that is through
+            if (previous) {
+                previous->flags &= ~IOSQE_IO_LINK;
+            }
+            count = i;
+            break;
+        }
+        // MSG_WAITALL has the kernel finish a short send before the next one
+        // in the chain starts, a failure cancels the rest of it
+        io_uring_prep_send(s, c->fd, vecs[i].iov_base, vecs[i].iov_len, MSG_NOSIGNAL | MSG_WAITALL);
+        if (i + 1 < count) {
+            s->flags |= IOSQE_IO_LINK;
+        }
+        io_uring_sqe_set_data64(s, tag(c, SEND));
+        previous = s;
+    }
+    c->sendsInFlight = count;
+    c->sent          = 0;
+    c->sendFailed    = false;
+    c->pending += count;
+}
+
+void RingPrivate::sendDone(Connection* c, int res)
+{
+    c->pending--;
+    c->sendsInFlight--;
+    if (res > 0) {
+        c->sent += static_cast<size_t>(res);
+    } else if (res < 0 && res != -ECANCELED) {
+        c->sendFailed = true;
+    }
+    if (c->sendsInFlight > 0) {
+        return;
+    }
+    evbuffer_drain(c->sending, c->sent);
+    if (c->closing) {
+        release(c);
+        return;
+    }
+    if (c->sendFailed) {
+        qCDebug(pxmNet) << "send on io_uring failed";
+        c->broken = true;
+        evbuffer_drain(c->sending, evbuffer_get_length(c->sending));
+        finish(c);
+        return;
+    }
+    // Whatever is left, or came in meanwhile
+    send(c);
+}
+
+void RingPrivate::finish(Connection* c)
+{
+    if (c->finished) {
+        return;
+    }
+    c->finished = true;
+    if (c->incoming) {
+        evbuffer_add_buffer(bufferevent_get_output(c->ringEnd), c->incoming);
+    }
+    // Hands over what is buffered and raises BEV_EVENT_EOF on appEnd
+    bufferevent_flush(c->ringEnd, EV_WRITE, BEV_FINISHED);
+}
+
+void RingPrivate::close(Connection* c)
+{
+    if (c->closing) {
+        return;
+    }
+    c->closing = true;
+    // Ends the recv, the peer sees EOF
+    shutdown(c->fd, SHUT_RDWR);
+    io_uring_sqe* s = sqe();
+    if (s) {
+        io_uring_prep_cancel_fd(s, c->fd, IORING_ASYNC_CANCEL_ALL);
+        io_uring_sqe_set_data64(s, tag(c, CANCEL));
+        c->pending++;
+    }
+    release(c);
+}
+
+void RingPrivate::release(Connection* c)
+{
+    if (!c->closing || c->pending > 0) {
+        return;
+    }
+    connections.remove(c);
+    starved.remove(c);
+    if (byApp.value(c->appEnd) == c) {
+        byApp.remove(c->appEnd);
+    }
+    free(c);
+}
+
+void RingPrivate::free(Connection* c)
+{
+    if (c->deliver) {
+        event_free(c->deliver);
+        evbuffer_free(c->incoming);
+    }
+    bufferevent_free(c->ringEnd);
+    evbuffer_free(c->sending);
+    evutil_closesocket(c->fd);
+    PXMMetrics::ringConnections.sub();
+    delete c;
+}
+
+void RingPrivate::feed()
+{
+    // A buffer may have come back between the recv failing and now
+    QSet<Connection*> waiting;
+    waiting.swap(starved);
+    for (Connection* c : waiting) {
+        c->starved = false;
+        armRecv(c);
+    }
+}
+
+void RingPrivate::sweep()
+{
+    // There is no callback for a bufferevent being freed, but its pair
+    // partner lets go of it.  What was written before that still goes out,
+    // like it would from the kernel's buffer on a plain socket
+    QVector<Connection*> gone;
+    for (Connection* c : connections) {
+        if (c->closing) {
+            continue;
+        }
+        if (c->lingering < 0) {
+            if (bufferevent_pair_get_partner(c->ringEnd)) {
+                continue;
+            }
+            c->lingering = LINGER_MSECS / SWEEP_MSECS;
+            send(c);
+        } else {
+            c->lingering--;
+        }
+        bool unsent = c->sendsInFlight > 0 || evbuffer_get_length(c->sending) > 0 ||
+                      evbuffer_get_length(bufferevent_get_input(c->ringEnd)) > 0;
+        if (!unsent || c->broken || c->lingering == 0) {
+            gone.append(c);
+        }
+    }
+    for (Connection* c : gone) {
+        close(c);
+    }
+    // In case a buffer came back before the recv that found none finished
+    feed();
+}
+
+bool RingPrivate::probeRecv()
+{
+    // Kernels before 6.0 take the opcode but fail a multishot recv, so one
+    // is tried on a socket pair
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        return false;
+    }
+    bool multishot  = false;
+    io_uring_sqe* s = io_uring_get_sqe(&ring);
+    if (s && ::send(pair[1], "x", 1, MSG_NOSIGNAL) == 1) {
+        io_uring_prep_recv_multishot(s, pair[0], nullptr, 0, 0);
+        s->flags |= IOSQE_BUFFER_SELECT;
+        s->buf_group = BUFFER_GROUP;
+        io_uring_sqe_set_data64(s, tag(nullptr, PROBE));
+        io_uring_submit(&ring);
+        // Until the recv has ended, shutting the socket down ends it
+        for (;;) {
+            io_uring_cqe* cqe = nullptr;
+            __kernel_timespec wait = {1, 0};
+            if (io_uring_wait_cqe_timeout(&ring, &cqe, &wait) < 0) {
+                break;
+            }
+            bool more = cqe->flags & IORING_CQE_F_MORE;
+            if (cqe->res == 1 && more) {
+                multishot = true;
+            }
+            if (cqe->flags & IORING_CQE_F_BUFFER) {
+                buffers->put(static_cast<int>(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            io_uring_cqe_seen(&ring, cqe);
+            if (!more) {
+                break;
+            }
+            shutdown(pair[0], SHUT_RDWR);
+        }
+    }
+    evutil_closesocket(pair[0]);
+    evutil_closesocket(pair[1]);
+    return multishot;
+}
+
+void RingPrivate::completions(evutil_socket_t fd, short, void* arg)
+{
+    eventfd_t count;
+    eventfd_read(fd, &count);
+    static_cast<RingPrivate*>(arg)->reap();
+}
+
+void RingPrivate::submitCB(evutil_socket_t, short, void* arg)
+{
+    static_cast<RingPrivate*>(arg)->submit();
+}
+
+void RingPrivate::sweepCB(evutil_socket_t, short, void* arg)
+{
+    static_cast<RingPrivate*>(arg)->sweep();
+}
+
+void RingPrivate::wakeCB(evutil_socket_t, short, void* arg)
+{
+    static_cast<RingPrivate*>(arg)->feed();
+}
+
+void RingPrivate::deliverCB(evutil_socket_t, short, void* arg)
+{
+    Connection* c = static_cast<Connection*>(arg);
+    evbuffer_add_buffer(bufferevent_get_output(c->ringEnd), c->incoming);
+    c->ring->send(c);
+}
+
+void RingPrivate::outgoing(bufferevent*, void* arg)
+{
+    Connection* c = static_cast<Connection*>(arg);
+    if (c->deliver) {
+        event_active(c->deliver, EV_TIMEOUT, 0);
+    } else {
+        c->ring->send(c);
+    }
+}
+
+void RingPrivate::drained(bufferevent*, void* arg)
+{
+    Connection* c = static_cast<Connection*>(arg);
+    if (c->paused) {
+        c->paused = false;
+        c->ring->armRecv(c);
+    }
+}
+
+Ring::Ring(event_base* base) : d_ptr(new RingPrivate)
+{
+    d_ptr->base = base;
+}
+
+Ring::~Ring()
+{
+    // Stops the kernel using any of the memory below, buffers still lent
+    // out stay until they are drained
+    if (d_ptr->buffers) {
+        QMutexLocker locker(&d_ptr->buffers->lock);
+        if (d_ptr->buffers->ring) {
+            io_uring_free_buf_ring(&d_ptr->ring, d_ptr->buffers->ring, RECV_BUFFERS, BUFFER_GROUP);
+        }
+        d_ptr->buffers->ring = nullptr;
+        d_ptr->buffers->wake = nullptr;
+    }
+    if (d_ptr->ringUp) {
+        io_uring_queue_exit(&d_ptr->ring);
+    }
+    for (Connection* c : d_ptr->connections) {
+        d_ptr->free(c);
+    }
+    qDeleteAll(d_ptr->listeners);
+    if (d_ptr->eventCompletions) {
+        event_free(d_ptr->eventCompletions);
+    }
+    if (d_ptr->eventSubmit) {
+        event_free(d_ptr->eventSubmit);
+    }
+    if (d_ptr->eventSweep) {
+        event_free(d_ptr->eventSweep);
+    }
+    if (d_ptr->eventWake) {
+        event_free(d_ptr->eventWake);
+    }
+    if (d_ptr->eventFd >= 0) {
+        ::close(d_ptr->eventFd);
+    }
+    if (d_ptr->buffers) {
+        d_ptr->buffers->unref();
+    }
+}
+
+bool Ring::start()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int result = io_uring_queue_init_params(QUEUE_ENTRIES, &d_ptr->ring, &params);
+    if (result < 0) {
+        qInfo().noquote() << "io_uring is not available:" << QString::fromUtf8(strerror(-result));
+        return false;
+    }
+    d_ptr->ringUp = true;
+
+    io_uring_probe* probe = io_uring_get_probe_ring(&d_ptr->ring);
+    bool supported        = probe && io_uring_opcode_supported(probe, IORING_OP_ACCEPT) &&
+                     io_uring_opcode_supported(probe, IORING_OP_RECV) &&
+                     io_uring_opcode_supported(probe, IORING_OP_SEND) &&
+                     io_uring_opcode_supported(probe, IORING_OP_ASYNC_CANCEL);
+    if (probe) {
+        io_uring_free_probe(probe);
+    }
+    if (!supported) {
+        qInfo() << "io_uring lacks accept, recv, send or cancel";
+        return false;
+    }
+
+    RecvBuffers* buffers = new RecvBuffers;
+    buffers->memory = new unsigned char[static_cast<size_t>(RECV_BUFFERS) * RECV_BUFFER_BYTES];
+    buffers->ring   = io_uring_setup_buf_ring(&d_ptr->ring, RECV_BUFFERS, BUFFER_GROUP, 0, &result);
+    d_ptr->buffers  = buffers;
+    if (!buffers->ring) {
+        qInfo().noquote() << "io_uring buffer ring:" << QString::fromUtf8(strerror(-result));
+        return false;
+    }
+    for (int i = 0; i < RECV_BUFFERS; i++) {
+        io_uring_buf_ring_add(buffers->ring, &buffers->memory[static_cast<size_t>(i) * RECV_BUFFER_BYTES],
+                              RECV_BUFFER_BYTES, static_cast<unsigned short>(i), io_uring_buf_ring_mask(RECV_BUFFERS),
+                              i);
+    }
+    io_uring_buf_ring_advance(buffers->ring, RECV_BUFFERS);
+    if (!d_ptr->probeRecv()) {
+        qInfo() << "io_uring lacks multishot recv, it needs Linux 6.0";
+        return false;
+    }
+
+    // Completions wake the libevent loop through an eventfd
+    d_ptr->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (d_ptr->eventFd < 0 || io_uring_register_eventfd(&d_ptr->ring, d_ptr->eventFd) < 0) {
+        qInfo().noquote() << "io_uring eventfd:" << QString::fromUtf8(strerror(errno));
+        return false;
+    }
+    d_ptr->eventCompletions =
+        event_new(d_ptr->base, d_ptr->eventFd, EV_READ | EV_PERSIST, RingPrivate::completions, d_ptr.data());
+    d_ptr->eventSubmit = event_new(d_ptr->base, -1, 0, RingPrivate::submitCB, d_ptr.data());
+    d_ptr->eventSweep  = event_new(d_ptr->base, -1, EV_PERSIST, RingPrivate::sweepCB, d_ptr.data());
+    d_ptr->eventWake   = event_new(d_ptr->base, -1, 0, RingPrivate::wakeCB, d_ptr.data());
+    buffers->wake      = d_ptr->eventWake;
+    timeval sweepInterval = {0, SWEEP_MSECS * 1000};
+    if (!d_ptr->eventCompletions || !d_ptr->eventSubmit || !d_ptr->eventSweep || !d_ptr->eventWake ||
+        event_add(d_ptr->eventCompletions, nullptr) < 0 || event_add(d_ptr->eventSweep, &sweepInterval) < 0) {
+        qWarning() << "Could not watch the io_uring eventfd";
+        return false;
+    }
+    qInfo() << "io_uring transport ready," << RECV_BUFFERS << "receive buffers of" << RECV_BUFFER_BYTES << "bytes";
+    return true;
+}
+
+bool Ring::listen(evutil_socket_t fd, bool local, AcceptCallback callback, void* arg)
+{
+    Listener* l = new Listener{d_ptr.data(), fd, local, callback, arg};
+    d_ptr->listeners.append(l);
+    return d_ptr->armAccept(l);
+}
+
+bufferevent* Ring::adopt(evutil_socket_t fd)
+{
+    Connection* c = d_ptr->connect(fd);
+    return c ? c->appEnd : nullptr;
+}
+
+bool Ring::setPriority(bufferevent* bev, int priority)
+{
+    Connection* c = d_ptr->byApp.value(bev);
+    if (!c || c->closing) {
+        return false;
+    }
+    if (!c->deliver) {
+        c->deliver  = event_new(d_ptr->base, -1, 0, RingPrivate::deliverCB, c);
+        c->incoming = evbuffer_new();
+    }
+    return event_priority_set(c->deliver, priority) == 0;
+}
+
+evutil_socket_t Ring::socketOf(const bufferevent* bev) const
+{
+    Connection* c = d_ptr->byApp.value(bev);
+    // The address may have been reused since that connection's end was freed
+    if (!c || c->closing || bufferevent_pair_get_partner(c->ringEnd) != bev) {
+        return -1;
+    }
+    return c->appFd;
+}
+
+int Ring::connections() const
+{
+    return d_ptr->connections.size();
+}
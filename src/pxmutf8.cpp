@@ -0,0 +1,137 @@
+#include "pxmutf8.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PXM_UTF8_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+int lowestBit(quint64 value)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(value);
+#else
+    int bit = 0;
+    while (!(value & 1)) {
+        value >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+// Length of the well formed sequence starting at buf, 0 if it is not
+size_t sequenceLength(const unsigned char* buf, size_t len)
+{
+    unsigned char lead = buf[0];
+    size_t need;
+    // Bounds on the second byte, the rest are always 80..BF
+    unsigned char low  = 0x80;
+    unsigned char high = 0xBF;
+    if (lead < 0x80) {
+        return 1;
+    } else if (lead < 0xC2) {
+        // Continuation bytes, and C0 and C1 which only start overlongs
+        return 0;
+    } else if (lead < 0xE0) {
+        need = 2;
+    } else if (lead < 0xF0) {
+        need = 3;
+        if (lead == 0xE0) {
+            low = 0xA0;
+        } else if (lead == 0xED) {
+            // D800..DFFF are surrogates
+            high = 0x9F;
+        }
+    } else if (lead < 0xF5) {
+        need = 4;
+        if (lead == 0xF0) {
+            low = 0x90;
+        } else if (lead == 0xF4) {
+            high = 0x8F;
+        }
+    } else {
+        return 0;
+    }
+    if (len < need || buf[1] < low || buf[1] > high) {
+        return 0;
+    }
+    for (size_t i = 2; i < need; i++) {
+        if ((buf[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return need;
+}
+}
+
+size_t PXMUtf8::asciiPrefix(const unsigned char* buf, size_t len)
+{
+    size_t i = 0;
+#ifdef PXM_UTF8_SSE2
+    for (; i + 16 <= len; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&buf[i])));
+        if (mask) {
+            return i + static_cast<size_t>(lowestBit(static_cast<quint64>(mask)));
+        }
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        quint64 word;
+        memcpy(&word, &buf[i], sizeof(word));
+        word &= Q_UINT64_C(0x8080808080808080);
+        if (word) {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+            return i + static_cast<size_t>(lowestBit(word) / 8);
+#else
+            break;
+#endif
+        }
+    }
+    while (i < len && buf[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+bool PXMUtf8::isValid(const unsigned char* buf, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+        i += asciiPrefix(&buf[i], len - i);
+        // Text with few ASCII bytes, CJK say, stays in here
+        while (i < len && buf[i] >= 0x80) {
+            size_t step = sequenceLength(&buf[i], len - i);
+            if (step == 0) {
+                return false;
+            }
+            i += step;
+        }
+    }
+    return true;
+}
+
+QString PXMUtf8::decode(const unsigned char* buf, size_t len, bool* ok)
+{
+    size_t ascii = asciiPrefix(buf, len);
+    if (ascii == len) {
+        if (ok) {
+            *ok = true;
+        }
+        return QString::fromLatin1(reinterpret_cast<const char*>(buf), static_cast<int>(len));
+    }
+    if (!isValid(&buf[ascii], len - ascii)) {
+        if (ok) {
+            *ok = false;
+        }
+        return QString();
+    }
+    if (ok) {
+        *ok = true;
+    }
+    return QString::fromUtf8(reinterpret_cast<const char*>(buf), static_cast<int>(len));
+}
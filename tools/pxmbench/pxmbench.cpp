@@ -0,0 +1,725 @@
+/*!
+ * pxmbench: load generator and throughput benchmark.
+ *
+ * Runs one real PXMPeerWorker (the node under test, with its server and
+ * client threads) and N virtual peers in the same process.  The virtual
+ * peers share one libevent thread but each has its own uuid and its own
+ * loopback TCP connection to the node, and they speak the same framing
+ * and auth handshake as PXMClient and PXMServer.  Once every peer is
+ * authenticated they send a weighted mix of MSG_TEXT, MSG_GLOBAL and
+ * MSG_SYNC_REQUEST at a fixed total rate, optionally while the node
+ * broadcasts MSG_GLOBAL to all of them.
+ *
+ * Reported:
+ *   delivered messages per second and how that compares to the offered rate
+ *   CPU time per delivered message, for the whole process, so it includes
+ *   the load generator
+ *   resident set size
+ *   read/write and io_uring_enter calls per delivered message, for the node
+ *   apart from the load generator, run once with --backend libevent and
+ *   once with --backend io_uring to compare the two (Linux only)
+ *   latency percentiles: virtual peer send -> node worker, sync request ->
+ *   sync reply, node broadcast -> virtual peer, and the node's own stages
+ *   from PXMLatency
+ */
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRegularExpression>
+#include <QSharedPointer>
+#include <QStringBuilder>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+#include <random>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/thread.h>
+
+#ifdef __unix__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#error "pxmbench needs a unix like system"
+#endif
+
+#include "netcompression.h"
+#include "pxmconsts.h"
+#include "pxmlatency.h"
+#include "pxmlogbackend.h"
+#include "pxmmetrics.h"
+#include "pxmpeerworker.h"
+#include "pxmserver.h"
+
+Q_DECLARE_METATYPE(QSharedPointer<QString>)
+
+using PXMLatency::Histogram;
+
+namespace
+{
+const char BENCH_VERSION[]   = "1.4.0";
+const char TEXT_PREFIX[]     = "pxmbench#";
+const int SEND_TIMES_BITS    = 20;
+const int SEND_TIMES_SIZE    = 1 << SEND_TIMES_BITS;
+const timeval PACING_TIMEOUT = {0, 1000};
+
+struct Options {
+    int peers         = 50;
+    int rate          = 10000;
+    int duration      = 10;
+    int textWeight    = 80;
+    int globalWeight  = 15;
+    int syncWeight    = 5;
+    int broadcastRate = 0;
+    unsigned seed     = 1;
+    unsigned short udpPort;
+    QString multicast;
+    QString history;
+    bool ioUring = false;
+};
+
+class LoadGenerator;
+
+struct VirtualPeer {
+    LoadGenerator* generator;
+    int index;
+    QUuid uuid;
+    unsigned char packedUUID[NetCompression::PACKED_UUID_LENGTH];
+    bufferevent* bev;
+    bool gotNodeAuth;
+    qint64 syncSentMicros;
+};
+
+class LoadGenerator : public QThread
+{
+    const Options options;
+    unsigned short nodePort;
+    QUuid nodeUUID;
+    event_base* base;
+    event* pacing;
+    QVector<VirtualPeer> peers;
+    std::mt19937 rng;
+    QElapsedTimer trafficClock;
+    quint64 scheduled;
+    quint64 seq;
+    int nextPeer;
+
+    static void readCB(bufferevent* bev, void* arg);
+    static void eventCB(bufferevent* bev, short events, void* arg);
+    static void pacingCB(evutil_socket_t, short, void* arg);
+    void send(VirtualPeer& peer, uint32_t type, const QByteArray& payload);
+    void handleFrame(VirtualPeer& peer, const unsigned char* frame, size_t len);
+    void sendOne();
+
+   public:
+    LoadGenerator(const Options& options, unsigned short nodePort);
+    ~LoadGenerator();
+
+    QVector<QUuid> uuids() const;
+    void stop() { event_base_loopexit(base, nullptr); }
+
+    std::atomic<bool> trafficOn;
+    std::atomic<int> connected;
+    std::atomic<int> disconnected;
+    std::atomic<quint64> sentText;
+    std::atomic<quint64> sentGlobal;
+    std::atomic<quint64> sentSync;
+    std::atomic<quint64> syncReplies;
+    std::atomic<quint64> broadcastsReceived;
+    // Kernel thread id of the loop, so its syscalls can be told apart
+    std::atomic<long> threadId;
+    Histogram syncLatency;
+    Histogram broadcastLatency;
+    // Monotonic send time of text and global messages by sequence number
+    std::unique_ptr<std::atomic<qint64>[]> sendTimes;
+
+   protected:
+    void run() Q_DECL_OVERRIDE;
+};
+
+LoadGenerator::LoadGenerator(const Options& options, unsigned short nodePort)
+    : QThread(),
+      options(options),
+      nodePort(nodePort),
+      base(event_base_new()),
+      pacing(nullptr),
+      rng(options.seed),
+      scheduled(0),
+      seq(0),
+      nextPeer(0),
+      trafficOn(false),
+      connected(0),
+      disconnected(0),
+      sentText(0),
+      sentGlobal(0),
+      sentSync(0),
+      syncReplies(0),
+      broadcastsReceived(0),
+      threadId(0),
+      sendTimes(new std::atomic<qint64>[SEND_TIMES_SIZE])
+{
+    setObjectName("LoadGenerator");
+    for (int i = 0; i < SEND_TIMES_SIZE; i++) {
+        sendTimes[i].store(0, std::memory_order_relaxed);
+    }
+    peers.resize(options.peers);
+    for (int i = 0; i < options.peers; i++) {
+        VirtualPeer& peer   = peers[i];
+        peer.generator      = this;
+        peer.index          = i;
+        peer.uuid           = QUuid::createUuid();
+        peer.bev            = nullptr;
+        peer.gotNodeAuth    = false;
+        peer.syncSentMicros = 0;
+        NetCompression::packUUID(peer.packedUUID, peer.uuid);
+    }
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    event_base_free(base);
+}
+
+QVector<QUuid> LoadGenerator::uuids() const
+{
+    QVector<QUuid> result;
+    result.reserve(peers.size());
+    for (const VirtualPeer& peer : peers) {
+        result.append(peer.uuid);
+    }
+    return result;
+}
+
+void LoadGenerator::run()
+{
+#ifdef SYS_gettid
+    threadId.store(syscall(SYS_gettid));
+#endif
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(nodePort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (VirtualPeer& peer : peers) {
+        peer.bev = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
+        bufferevent_setcb(peer.bev, LoadGenerator::readCB, NULL, LoadGenerator::eventCB, &peer);
+        bufferevent_enable(peer.bev, EV_READ | EV_WRITE);
+        if (bufferevent_socket_connect(peer.bev, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            qWarning() << "Virtual peer" << peer.index << "could not connect";
+        }
+    }
+
+    pacing = event_new(base, -1, EV_PERSIST, LoadGenerator::pacingCB, this);
+    event_add(pacing, &PACING_TIMEOUT);
+
+    event_base_dispatch(base);
+
+    event_free(pacing);
+    for (VirtualPeer& peer : peers) {
+        bufferevent_free(peer.bev);
+        peer.bev = nullptr;
+    }
+}
+
+void LoadGenerator::send(VirtualPeer& peer, uint32_t type, const QByteArray& payload)
+{
+    uint16_t lenNBO  = htons(static_cast<uint16_t>(NetCompression::PACKED_UUID_LENGTH + sizeof(type) + payload.size()));
+    uint32_t typeNBO = htonl(type);
+    evbuffer* output = bufferevent_get_output(peer.bev);
+    evbuffer_add(output, &lenNBO, sizeof(lenNBO));
+    evbuffer_add(output, peer.packedUUID, NetCompression::PACKED_UUID_LENGTH);
+    evbuffer_add(output, &typeNBO, sizeof(typeNBO));
+    evbuffer_add(output, payload.constData(), payload.size());
+}
+
+void LoadGenerator::readCB(bufferevent* bev, void* arg)
+{
+    VirtualPeer* peer = static_cast<VirtualPeer*>(arg);
+    evbuffer* input   = bufferevent_get_input(bev);
+    for (;;) {
+        size_t available = evbuffer_get_length(input);
+        if (available < PXMServer::PACKET_HEADER_LEN) {
+            return;
+        }
+        uint16_t lenNBO;
+        evbuffer_copyout(input, &lenNBO, sizeof(lenNBO));
+        size_t len = ntohs(lenNBO);
+        if (available < PXMServer::PACKET_HEADER_LEN + len) {
+            return;
+        }
+        evbuffer_drain(input, PXMServer::PACKET_HEADER_LEN);
+        peer->generator->handleFrame(*peer, evbuffer_pullup(input, len), len);
+        evbuffer_drain(input, len);
+    }
+}
+
+void LoadGenerator::handleFrame(VirtualPeer& peer, const unsigned char* frame, size_t len)
+{
+    using namespace PXMConsts;
+    if (len < NetCompression::PACKED_UUID_LENGTH + sizeof(uint32_t)) {
+        return;
+    }
+    if (nodeUUID.isNull()) {
+        NetCompression::unpackUUID(frame, nodeUUID);
+    }
+    uint32_t typeNBO;
+    memcpy(&typeNBO, &frame[NetCompression::PACKED_UUID_LENGTH], sizeof(typeNBO));
+    const unsigned char* body = &frame[NetCompression::PACKED_UUID_LENGTH + sizeof(typeNBO)];
+    size_t bodyLen            = len - NetCompression::PACKED_UUID_LENGTH - sizeof(typeNBO);
+
+    switch (ntohl(typeNBO)) {
+        case MSG_AUTH:
+            peer.gotNodeAuth = true;
+            break;
+        case MSG_SYNC_REQUEST:
+            // Nothing to offer, an empty list completes the node's sync
+            send(peer, MSG_SYNC, QByteArray());
+            break;
+        case MSG_SYNC:
+            if (peer.syncSentMicros) {
+                syncLatency.record(PXMLatency::monotonicMicros() - peer.syncSentMicros);
+                peer.syncSentMicros = 0;
+                syncReplies.fetch_add(1, std::memory_order_relaxed);
+            }
+            break;
+        case MSG_GLOBAL_STAMPED:
+            if (bodyLen >= PXMLatency::STAMP_LENGTH) {
+                broadcastLatency.record(PXMLatency::wallMicros() - PXMLatency::readStamp(body));
+            }
+            broadcastsReceived.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case MSG_GLOBAL:
+            broadcastsReceived.fetch_add(1, std::memory_order_relaxed);
+            break;
+        default:
+            break;
+    }
+}
+
+void LoadGenerator::eventCB(bufferevent* bev, short events, void* arg)
+{
+    VirtualPeer* peer = static_cast<VirtualPeer*>(arg);
+    if (events & BEV_EVENT_CONNECTED) {
+        peer->generator->connected.fetch_add(1, std::memory_order_relaxed);
+        // Auth packet format "Hostname:::12345:::001.001.001", the port is
+        // never connected to
+        QByteArray auth = "pxmbench-" + QByteArray::number(peer->index) + PXMConsts::AUTH_SEPERATOR +
+                          QByteArray::number(1 + peer->index % 60000) + PXMConsts::AUTH_SEPERATOR + BENCH_VERSION;
+        peer->generator->send(*peer, PXMConsts::MSG_AUTH, auth);
+        // So the node stamps what it sends back
+        QByteArray capabilities(sizeof(uint32_t), Qt::Uninitialized);
+        NetCompression::writeUint32(reinterpret_cast<unsigned char*>(capabilities.data()),
+                                    PXMConsts::CAPABILITY_STAMPS);
+        peer->generator->send(*peer, PXMConsts::MSG_CAPABILITIES, capabilities);
+    } else if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+        qWarning() << "Virtual peer" << peer->index << "lost its connection";
+        peer->generator->disconnected.fetch_add(1, std::memory_order_relaxed);
+        bufferevent_disable(bev, EV_READ | EV_WRITE);
+    }
+}
+
+void LoadGenerator::pacingCB(evutil_socket_t, short, void* arg)
+{
+    LoadGenerator* generator = static_cast<LoadGenerator*>(arg);
+    if (!generator->trafficOn.load(std::memory_order_relaxed)) {
+        generator->trafficClock.invalidate();
+        return;
+    }
+    if (!generator->trafficClock.isValid()) {
+        generator->trafficClock.start();
+        generator->scheduled = 0;
+    }
+    // Open loop, whatever is due by now goes out even if the node lags
+    quint64 due = static_cast<quint64>(generator->trafficClock.nsecsElapsed() / 1000) *
+                  static_cast<quint64>(generator->options.rate) / 1000000;
+    while (generator->scheduled < due) {
+        generator->sendOne();
+        generator->scheduled++;
+    }
+}
+
+void LoadGenerator::sendOne()
+{
+    using namespace PXMConsts;
+    VirtualPeer& peer = peers[nextPeer];
+    nextPeer          = (nextPeer + 1) % peers.size();
+    if (!peer.gotNodeAuth) {
+        return;
+    }
+
+    int total = options.textWeight + options.globalWeight + options.syncWeight;
+    int pick  = static_cast<int>(rng() % static_cast<unsigned>(total));
+    if (pick >= options.textWeight + options.globalWeight && !peer.syncSentMicros) {
+        peer.syncSentMicros = PXMLatency::monotonicMicros();
+        send(peer, MSG_SYNC_REQUEST, QByteArray());
+        sentSync.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    bool global     = pick >= options.textWeight && pick < options.textWeight + options.globalWeight;
+    quint64 current = seq++;
+    sendTimes[current & (SEND_TIMES_SIZE - 1)].store(PXMLatency::monotonicMicros(), std::memory_order_relaxed);
+    QByteArray text = "<p>" + QByteArray(TEXT_PREFIX) + QByteArray::number(current) + "</p>";
+    if (global) {
+        send(peer, MSG_GLOBAL_STAMPED, PXMLatency::stamp(text));
+        sentGlobal.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        send(peer, MSG_TEXT_STAMPED, PXMLatency::stamp(text));
+        sentText.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+struct Usage {
+    qint64 cpuMicros;
+    qint64 rssBytes;
+    qint64 peakRssBytes;
+    // read() and write() like calls, -1 where /proc has no io files
+    qint64 syscalls;
+    qint64 generatorSyscalls;
+    quint64 ringSubmits;
+};
+
+// syscr and syscw of a /proc io file.  Neither counts epoll_wait or the
+// like, so this is the data path only
+qint64 ioSyscalls(const QString& path)
+{
+    QFile io(path);
+    if (!io.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    qint64 calls = 0;
+    for (const QByteArray& line : io.readAll().split('\n')) {
+        if (line.startsWith("syscr:") || line.startsWith("syscw:")) {
+            calls += line.mid(6).trimmed().toLongLong();
+        }
+    }
+    return calls;
+}
+
+Usage currentUsage(long generatorThread)
+{
+    Usage usage = {0, 0, 0, -1, -1, PXMMetrics::ringSubmits.get()};
+    usage.syscalls = ioSyscalls(QStringLiteral("/proc/self/io"));
+    if (generatorThread > 0) {
+        usage.generatorSyscalls = ioSyscalls(QStringLiteral("/proc/self/task/") % QString::number(generatorThread) %
+                                              QStringLiteral("/io"));
+    }
+    rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        usage.cpuMicros = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * Q_INT64_C(1000000) + ru.ru_utime.tv_usec +
+                          ru.ru_stime.tv_usec;
+        // kilobytes on Linux
+        usage.peakRssBytes = static_cast<qint64>(ru.ru_maxrss) * 1024;
+    }
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if (statm.open(QIODevice::ReadOnly)) {
+        QList<QByteArray> fields = statm.readAll().split(' ');
+        if (fields.size() > 1) {
+            usage.rssBytes = fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+        }
+    }
+    if (!usage.rssBytes) {
+        usage.rssBytes = usage.peakRssBytes;
+    }
+    return usage;
+}
+
+class Bench : public QObject
+{
+    const Options options;
+    QThread* nodeThread;
+    PXMPeerWorker* node;
+    QScopedPointer<LoadGenerator> generator;
+    QSet<QUuid> pending;
+    QRegularExpression seqPattern;
+    QElapsedTimer clock;
+    Usage startUsage;
+    quint64 delivered;
+    Histogram deliveryLatency;
+    QTimer broadcastTimer;
+    QUuid globalUUID;
+
+    void nodeListening(unsigned short tcpPort, unsigned short);
+    void peerNameChanged(QUuid uuid, QString);
+    void messageAdded(QSharedPointer<QString> msg, QUuid, bool, qint64);
+    void startTraffic();
+    void finish();
+    void broadcast();
+
+   public:
+    Bench(const Options& options);
+    ~Bench();
+    int exitCode = 0;
+};
+
+Bench::Bench(const Options& options)
+    : QObject(),
+      options(options),
+      seqPattern(QString::fromLatin1(TEXT_PREFIX) + QStringLiteral("(\\d+)")),
+      delivered(0),
+      globalUUID(QUuid::createUuid())
+{
+    nodeThread = new QThread(this);
+    nodeThread->setObjectName("WorkerThread");
+    node = new PXMPeerWorker(nullptr, QStringLiteral("pxmbench-node"), QUuid::createUuid(), options.multicast, 0,
+                             options.udpPort, globalUUID, options.history);
+    node->setLatencyStamps(true);
+    node->setIoUring(options.ioUring);
+    node->moveToThread(nodeThread);
+    QObject::connect(nodeThread, &QThread::started, node, &PXMPeerWorker::currentThreadInit);
+    QObject::connect(nodeThread, &QThread::finished, node, &PXMPeerWorker::deleteLater);
+    QObject::connect(node, &PXMPeerWorker::listening, this, &Bench::nodeListening);
+    QObject::connect(node, &PXMPeerWorker::peerNameChanged, this, &Bench::peerNameChanged);
+    QObject::connect(node, &PXMPeerWorker::messageAdded, this, &Bench::messageAdded);
+    QObject::connect(node, &PXMPeerWorker::warning, this,
+                     [](QString title, QString text) { qWarning().noquote() << title + ":" << text; });
+    QObject::connect(&broadcastTimer, &QTimer::timeout, this, &Bench::broadcast);
+    nodeThread->start();
+
+    QTimer::singleShot(30000, this, [this]() {
+        if (!clock.isValid()) {
+            qCritical().noquote() << pending.size() << "virtual peers never authenticated, giving up";
+            exitCode = 1;
+            finish();
+        }
+    });
+}
+
+Bench::~Bench()
+{
+    if (generator) {
+        generator->stop();
+        generator->wait(5000);
+    }
+    nodeThread->quit();
+    nodeThread->wait(5000);
+}
+
+void Bench::nodeListening(unsigned short tcpPort, unsigned short)
+{
+    if (generator) {
+        return;
+    }
+    qInfo().noquote() << "Node listening on port" << tcpPort << "starting" << options.peers << "virtual peers";
+    generator.reset(new LoadGenerator(options, tcpPort));
+    for (const QUuid& uuid : generator->uuids()) {
+        pending.insert(uuid);
+    }
+    generator->start();
+}
+
+void Bench::peerNameChanged(QUuid uuid, QString)
+{
+    // Emitted once the node has authenticated a peer
+    if (pending.remove(uuid) && pending.isEmpty()) {
+        startTraffic();
+    }
+}
+
+void Bench::startTraffic()
+{
+    qInfo().noquote() << "All virtual peers authenticated, running for" << options.duration << "seconds";
+    startUsage = currentUsage(generator->threadId.load());
+    clock.start();
+    generator->trafficOn.store(true);
+    if (options.broadcastRate > 0) {
+        broadcastTimer.start(qMax(1, 1000 / options.broadcastRate));
+    }
+    QTimer::singleShot(options.duration * 1000, this, &Bench::finish);
+}
+
+void Bench::broadcast()
+{
+    QMetaObject::invokeMethod(node, "sendMsgAccessor", Qt::QueuedConnection,
+                              Q_ARG(QByteArray, QByteArray("<p>pxmbench broadcast</p>")),
+                              Q_ARG(PXMConsts::MESSAGE_TYPE, PXMConsts::MSG_GLOBAL), Q_ARG(QUuid, QUuid()));
+}
+
+void Bench::messageAdded(QSharedPointer<QString> msg, QUuid, bool, qint64)
+{
+    if (!clock.isValid()) {
+        return;
+    }
+    QRegularExpressionMatch match = seqPattern.match(*msg);
+    if (!match.hasMatch()) {
+        return;
+    }
+    quint64 current = match.captured(1).toULongLong();
+    qint64 sent     = generator->sendTimes[current & (SEND_TIMES_SIZE - 1)].load(std::memory_order_relaxed);
+    if (sent) {
+        deliveryLatency.record(PXMLatency::monotonicMicros() - sent);
+    }
+    delivered++;
+}
+
+QString latencyLine(const char* name, const Histogram& histogram)
+{
+    return QString::fromLatin1(name).leftJustified(24) % QStringLiteral(" n=") % QString::number(histogram.count()) %
+           QStringLiteral(" p50=") % QString::number(histogram.percentile(0.5)) % QStringLiteral("us p99=") %
+           QString::number(histogram.percentile(0.99)) % QStringLiteral("us p999=") %
+           QString::number(histogram.percentile(0.999)) % QStringLiteral("us max=") %
+           QString::number(histogram.maxValue()) % QStringLiteral("us\n");
+}
+
+void Bench::finish()
+{
+    broadcastTimer.stop();
+    if (generator) {
+        generator->trafficOn.store(false);
+    }
+    if (!clock.isValid()) {
+        QCoreApplication::exit(exitCode);
+        return;
+    }
+
+    double seconds = static_cast<double>(clock.nsecsElapsed()) / 1e9;
+    Usage end      = currentUsage(generator->threadId.load());
+    quint64 sent   = generator->sentText.load() + generator->sentGlobal.load();
+    qint64 cpu     = end.cpuMicros - startUsage.cpuMicros;
+
+    QString report;
+    QTextStream out(&report);
+    out << "---pxmbench---\n";
+    out << "peers:               " << options.peers << " (" << generator->disconnected.load() << " lost)\n";
+    out << "duration:            " << QString::number(seconds, 'f', 2) << "s\n";
+    out << "offered rate:        " << options.rate << " msg/s (text " << options.textWeight << ", global "
+        << options.globalWeight << ", sync " << options.syncWeight << ")\n";
+    out << "sent:                " << generator->sentText.load() << " text, " << generator->sentGlobal.load()
+        << " global, " << generator->sentSync.load() << " sync requests\n";
+    out << "delivered:           " << delivered << " (" << QString::number(delivered / seconds, 'f', 0)
+        << " msg/s, " << QString::number(sent ? 100.0 * delivered / sent : 0.0, 'f', 1) << "% of sent)\n";
+    out << "sync replies:        " << generator->syncReplies.load() << " ("
+        << QString::number(generator->syncReplies.load() / seconds, 'f', 0) << " /s)\n";
+    out << "broadcasts received: " << generator->broadcastsReceived.load() << "\n";
+    out << "cpu:                 " << QString::number(cpu / 1e6, 'f', 2) << "s, "
+        << QString::number(delivered ? static_cast<double>(cpu) / delivered : 0.0, 'f', 1)
+        << "us per delivered message (whole process)\n";
+    out << "rss:                 " << end.rssBytes / 1024 << " KiB (peak " << end.peakRssBytes / 1024 << " KiB)\n";
+    qint64 ringConnections = PXMMetrics::ringConnections.get();
+    if (ringConnections > 0) {
+        out << "backend:             io_uring for TCP (" << ringConnections << " connections on the ring)\n";
+    } else {
+        out << "backend:             libevent" << (options.ioUring ? " (io_uring not available)" : "") << "\n";
+    }
+    if (startUsage.syscalls >= 0 && startUsage.generatorSyscalls >= 0 && end.generatorSyscalls >= 0) {
+        qint64 generatorCalls = end.generatorSyscalls - startUsage.generatorSyscalls;
+        qint64 readWrite      = end.syscalls - startUsage.syscalls - generatorCalls;
+        quint64 enters        = end.ringSubmits - startUsage.ringSubmits;
+        qint64 calls          = readWrite + static_cast<qint64>(enters);
+        double perMessage     = delivered ? static_cast<double>(calls) / delivered : 0.0;
+        out << "syscalls:            " << QString::number(perMessage, 'f', 2) << " per delivered message by the node ("
+            << readWrite << " read/write, " << enters << " io_uring_enter), " << generatorCalls
+            << " read/write by the load generator\n";
+    } else {
+        out << "syscalls:            not counted, no /proc io files\n";
+    }
+    out << "---latency---\n";
+    out << latencyLine("send_to_worker", deliveryLatency);
+    out << latencyLine("sync_round_trip", generator->syncLatency);
+    out << latencyLine("broadcast_to_peer", generator->broadcastLatency);
+    for (int i = 0; i < PXMLatency::STAGE_COUNT; i++) {
+        PXMLatency::Stage stage = static_cast<PXMLatency::Stage>(i);
+        const Histogram& histogram = PXMLatency::Recorder::instance()->overallHistogram(stage);
+        if (histogram.count()) {
+            out << latencyLine(PXMLatency::stageName(stage), histogram);
+        }
+    }
+    out.flush();
+
+    QTextStream(stdout) << report;
+    QCoreApplication::exit(exitCode);
+}
+}
+
+void debugMessageOutput(QtMsgType type, const QMessageLogContext& context, const QString& msg)
+{
+    PXMLog::Backend::instance()->log(type, context, msg);
+}
+
+int main(int argc, char** argv)
+{
+    qInstallMessageHandler(debugMessageOutput);
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("pxmbench");
+    QCoreApplication::setApplicationVersion("1.4.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Load generator and throughput benchmark for the PXMessenger core");
+    parser.addHelpOption();
+    QCommandLineOption peersOption("peers", "Number of virtual peers.", "n", "50");
+    QCommandLineOption rateOption("rate", "Messages per second from all virtual peers together.", "n", "10000");
+    QCommandLineOption durationOption("duration", "Seconds to run once every peer is connected.", "s", "10");
+    QCommandLineOption mixOption("mix", "Weights of text, global and sync request messages.", "t,g,s", "80,15,5");
+    QCommandLineOption broadcastOption("broadcast", "Global messages per second sent by the node.", "n", "0");
+    QCommandLineOption seedOption("seed", "Seed for the message mix.", "n", "1");
+    QCommandLineOption udpOption("udp-port", "UDP port for discovery, keep it away from real nodes.", "port",
+                                 "53299");
+    QCommandLineOption multicastOption("multicast", "Multicast group for discovery.", "address", "239.192.13.99");
+    QCommandLineOption historyOption("history", "Keep the node's history in this directory.", "dir");
+    QCommandLineOption verboseOption("verbose", "Log the node's info messages.");
+    QCommandLineOption backendOption("backend", "TCP on libevent or io_uring, the latter needs CONFIG+=pxm_uring.",
+                                     "libevent|io_uring", "libevent");
+    parser.addOptions({peersOption, rateOption, durationOption, mixOption, broadcastOption, seedOption, udpOption,
+                       multicastOption, historyOption, verboseOption, backendOption});
+    parser.process(app);
+
+    Options options;
+    options.peers         = qMax(1, parser.value(peersOption).toInt());
+    options.rate          = qMax(1, parser.value(rateOption).toInt());
+    options.duration      = qMax(1, parser.value(durationOption).toInt());
+    options.broadcastRate = parser.value(broadcastOption).toInt();
+    options.seed          = parser.value(seedOption).toUInt();
+    options.udpPort       = static_cast<unsigned short>(parser.value(udpOption).toUInt());
+    options.multicast     = parser.value(multicastOption);
+    options.history       = parser.value(historyOption);
+    options.ioUring       = parser.value(backendOption) == QLatin1String("io_uring");
+    if (!options.ioUring && parser.value(backendOption) != QLatin1String("libevent")) {
+        qCritical() << "--backend is libevent or io_uring";
+        return 2;
+    }
+    QStringList mix       = parser.value(mixOption).split(',');
+    if (mix.size() != 3) {
+        qCritical() << "--mix needs three weights";
+        return 2;
+    }
+    options.textWeight   = qMax(0, mix[0].toInt());
+    options.globalWeight = qMax(0, mix[1].toInt());
+    options.syncWeight   = qMax(0, mix[2].toInt());
+    if (options.textWeight + options.globalWeight + options.syncWeight == 0) {
+        qCritical() << "--mix weights add up to zero";
+        return 2;
+    }
+
+    PXMLog::Backend::instance()->setVerbosityLevel(parser.isSet(verboseOption) ? 1 : 0);
+    PXMLog::Backend::instance()->startWriter();
+
+    evthread_use_pthreads();
+    qRegisterMetaType<struct sockaddr_in>();
+    qRegisterMetaType<size_t>("size_t");
+    qRegisterMetaType<bufferevent*>();
+    qRegisterMetaType<PXMConsts::MESSAGE_TYPE>();
+    qRegisterMetaType<QSharedPointer<Peers::BevWrapper>>();
+    qRegisterMetaType<QSharedPointer<QString>>();
+    qRegisterMetaType<PXMHistory::Cursor>();
+
+    int result;
+    {
+        Bench bench(options);
+        result = app.exec();
+    }
+    PXMLog::Backend::instance()->stop();
+    return result;
+}
@@ -0,0 +1,24 @@
+# Load generator and throughput benchmark, runs a real node against
+# virtual peers in one process
+TEMPLATE = app
+TARGET = pxmbench
+CONFIG += console \
+          RELEASE \
+          DEBUG
+CONFIG -= app_bundle
+
+QT = core
+
+include($$PWD/../../core/pxmcore.pri)
+
+QMAKE_CXXFLAGS += -Wall \
+                -std=c++14
+
+SOURCES += \
+    $$PWD/pxmbench.cpp
+
+DESTDIR = $$PWD/../..
+unix {
+OBJECTS_DIR = $$PWD/../../build-unix/pxmbench/obj
+MOC_DIR = $$PWD/../../build-unix/pxmbench/moc
+}
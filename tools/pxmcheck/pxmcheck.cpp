@@ -0,0 +1,365 @@
+/*!
+ * pxmcheck: randomized checks of core containers, history and search.
+ *
+ * Each case runs a long seeded sequence of operations against the
+ * container and against a QHash that does the same thing the slow way,
+ * and compares every answer.  A failure prints the seed and step so it
+ * can be replayed.
+ */
+#include <QHash>
+#include <QSet>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <random>
+
+#include "pxmcache.h"
+#include "pxmclock.h"
+#include "pxmhistory.h"
+#include "pxmsearch.h"
+#include "timedvector.h"
+
+class PXMCheck : public QObject
+{
+    Q_OBJECT
+   private slots:
+    void monotonicMsecs();
+    void timedVectorMatchesReference_data();
+    void timedVectorMatchesReference();
+    void cacheMatchesReference_data();
+    void cacheMatchesReference();
+    void historyMatchesReference_data();
+    void historyMatchesReference();
+    void searchNewestFirst_data();
+    void searchNewestFirst();
+};
+
+void PXMCheck::monotonicMsecs()
+{
+    qint64 first = PXMClock::monotonicMsecs();
+    QTest::qSleep(20);
+    qint64 second = PXMClock::monotonicMsecs();
+    QVERIFY(first >= 0);
+    QVERIFY2(second - first >= 15, qPrintable(QString::number(second - first)));
+    QCOMPARE(TimedVector<int>::now() >= second, true);
+    QCOMPARE(PXMCache::MonotonicClock::now() >= second, true);
+}
+
+void PXMCheck::timedVectorMatchesReference_data()
+{
+    QTest::addColumn<quint32>("seed");
+    QTest::addColumn<int>("keys");
+    QTest::addColumn<int>("life");
+
+    // Few keys keep the table churning, many make it grow and rehash
+    QTest::newRow("few keys, short life") << 1u << 8 << 3;
+    QTest::newRow("some keys") << 2u << 64 << 20;
+    QTest::newRow("many keys") << 3u << 4096 << 50;
+    QTest::newRow("many keys, long life") << 4u << 1024 << 1000;
+}
+
+void PXMCheck::timedVectorMatchesReference()
+{
+    QFETCH(quint32, seed);
+    QFETCH(int, keys);
+    QFETCH(int, life);
+
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pickKey(0, keys - 1);
+    std::uniform_int_distribution<int> pickOp(0, 99);
+    std::uniform_int_distribution<int> pickStep(0, 3);
+
+    TimedVector<int> vector(static_cast<unsigned int>(life), MSECONDS);
+    // key -> expiry, an entry only counts while now is before its expiry
+    QHash<int, qint64> reference;
+    auto live = [&](int key, qint64 now) { return reference.contains(key) && reference.value(key) > now; };
+
+    qint64 now = 0;
+    for (int step = 0; step < 200000; step++) {
+        const QByteArray where = "seed " + QByteArray::number(seed) + " step " + QByteArray::number(step);
+        int op                 = pickOp(rng);
+        int key                = pickKey(rng);
+        if (op < 20) {
+            now += pickStep(rng);
+        } else if (op < 55) {
+            vector.append(key, now);
+            reference.insert(key, now + life);
+        } else if (op < 85) {
+            QVERIFY2(vector.contains(key, now) == live(key, now), where.constData());
+        } else if (op < 95) {
+            int expected = live(key, now) ? 0 : -1;
+            reference.remove(key);
+            QVERIFY2(vector.remove(key, now) == expected, where.constData());
+        } else {
+            int expected = 0;
+            for (QHash<int, qint64>::const_iterator itr = reference.cbegin(); itr != reference.cend(); ++itr) {
+                expected += itr.value() > now;
+            }
+            QVERIFY2(vector.length(now) == expected, where.constData());
+        }
+    }
+
+    // Everything goes once its life is over
+    now += life;
+    QCOMPARE(vector.length(now), 0);
+}
+
+void PXMCheck::cacheMatchesReference_data()
+{
+    QTest::addColumn<quint32>("seed");
+    QTest::addColumn<int>("capacity");
+    QTest::addColumn<int>("ttl");
+    QTest::addColumn<int>("eviction");
+
+    QTest::newRow("lru, no expiry") << 5u << 16 << 0 << int(PXMCache::LEAST_RECENTLY_USED);
+    QTest::newRow("lru, expiry") << 6u << 64 << 30 << int(PXMCache::LEAST_RECENTLY_USED);
+    QTest::newRow("oldest, no expiry") << 7u << 16 << 0 << int(PXMCache::OLDEST_INSERTED);
+    QTest::newRow("oldest, expiry") << 8u << 64 << 30 << int(PXMCache::OLDEST_INSERTED);
+    QTest::newRow("single entry") << 9u << 1 << 5 << int(PXMCache::LEAST_RECENTLY_USED);
+}
+
+void PXMCheck::cacheMatchesReference()
+{
+    QFETCH(quint32, seed);
+    QFETCH(int, capacity);
+    QFETCH(int, ttl);
+    QFETCH(int, eviction);
+
+    struct RefEntry {
+        int value;
+        qint64 expiry;
+        quint64 used;
+        quint64 inserted;
+    };
+    typedef PXMCache::ManualClock Clock;
+
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pickKey(0, capacity * 3);
+    std::uniform_int_distribution<int> pickOp(0, 99);
+    std::uniform_int_distribution<int> pickStep(0, 3);
+
+    Clock::set(0);
+    PXMCache::Cache<int, int, Clock> cache(capacity, ttl, static_cast<PXMCache::Eviction>(eviction));
+    QHash<int, RefEntry> reference;
+    quint64 sequence = 0;
+    auto expire      = [&]() {
+        QHash<int, RefEntry>::iterator itr = reference.begin();
+        while (itr != reference.end()) {
+            if (ttl > 0 && itr.value().expiry <= Clock::now()) {
+                itr = reference.erase(itr);
+            } else {
+                ++itr;
+            }
+        }
+    };
+
+    for (int step = 0; step < 200000; step++) {
+        const QByteArray where = "seed " + QByteArray::number(seed) + " step " + QByteArray::number(step);
+        int op                 = pickOp(rng);
+        int key                = pickKey(rng);
+        if (op < 15) {
+            Clock::advance(pickStep(rng));
+        } else if (op < 50) {
+            expire();
+            if (!reference.contains(key) && reference.size() == capacity) {
+                QHash<int, RefEntry>::iterator victim = reference.begin();
+                for (QHash<int, RefEntry>::iterator itr = reference.begin(); itr != reference.end(); ++itr) {
+                    bool older = eviction == PXMCache::LEAST_RECENTLY_USED ? itr.value().used < victim.value().used
+                                                                            : itr.value().inserted < victim.value().inserted;
+                    if (older) {
+                        victim = itr;
+                    }
+                }
+                reference.erase(victim);
+            }
+            sequence++;
+            RefEntry entry = {step, Clock::now() + ttl, sequence, sequence};
+            reference.insert(key, entry);
+            cache.insert(key, step);
+        } else if (op < 85) {
+            expire();
+            int* found = cache.find(key);
+            QVERIFY2((found != nullptr) == reference.contains(key), where.constData());
+            if (found) {
+                QVERIFY2(*found == reference.value(key).value, where.constData());
+                reference[key].used = ++sequence;
+            }
+        } else if (op < 95) {
+            expire();
+            QVERIFY2(cache.remove(key) == (reference.remove(key) > 0), where.constData());
+        } else {
+            expire();
+            QVERIFY2(cache.size() == reference.size(), where.constData());
+        }
+    }
+}
+
+void PXMCheck::historyMatchesReference_data()
+{
+    QTest::addColumn<quint32>("seed");
+    QTest::addColumn<int>("steps");
+    QTest::addColumn<int>("maxLength");
+
+    QTest::newRow("short messages") << 13u << 5000 << 200;
+    // Long enough to fill segments so appends move on to new ones
+    QTest::newRow("long messages") << 14u << 600 << 96 * 1024;
+}
+
+void PXMCheck::historyMatchesReference()
+{
+    QFETCH(quint32, seed);
+    QFETCH(int, steps);
+    QFETCH(int, maxLength);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pickConversation(0, 2);
+    std::uniform_int_distribution<int> pickLength(0, maxLength);
+    std::uniform_int_distribution<int> pickOp(0, 99);
+    std::uniform_int_distribution<int> pickCount(1, 20);
+    std::uniform_int_distribution<int> pickRecord(0, steps);
+
+    // conversation -> every record appended, oldest first
+    QHash<QString, QVector<PXMHistory::Record>> reference;
+    auto same = [](const PXMHistory::Record& a, const PXMHistory::Record& b) {
+        return a.msecs == b.msecs && a.text == b.text && a.position.segment == b.position.segment &&
+               a.position.offset == b.position.offset;
+    };
+
+    {
+        PXMHistory::Store store(dir.path());
+        for (int step = 0; step < steps; step++) {
+            const QByteArray where = "seed " + QByteArray::number(seed) + " step " + QByteArray::number(step);
+            const QString name     = QStringLiteral("conversation") + QString::number(pickConversation(rng));
+            int op                 = pickOp(rng);
+            QVector<PXMHistory::Record>& records = reference[name];
+            if (op < 70) {
+                PXMHistory::Record record;
+                record.msecs    = step;
+                record.text     = QString::number(step) + QString(pickLength(rng), QChar('a' + step % 26)) + QChar(0xe9);
+                record.position = store.append(name, record.text, record.msecs);
+                records.append(record);
+            } else if (op < 85) {
+                const int count                          = pickCount(rng);
+                const QVector<PXMHistory::Record> newest = store.readBefore(name, PXMHistory::Cursor(), count);
+                QVERIFY2(newest.size() == qMin(count, records.size()), where.constData());
+                for (int i = 0; i < newest.size(); i++) {
+                    QVERIFY2(same(newest.at(i), records.at(records.size() - newest.size() + i)), where.constData());
+                }
+            } else if (op < 95) {
+                if (!records.isEmpty()) {
+                    const PXMHistory::Record& expected = records.at(pickRecord(rng) % records.size());
+                    QVERIFY2(same(store.readAt(name, expected.position), expected), where.constData());
+                }
+            } else {
+                store.flush();
+            }
+        }
+    }
+
+    // Everything is on disk once the store is gone, page through it again
+    PXMHistory::Store reopened(dir.path());
+    for (QHash<QString, QVector<PXMHistory::Record>>::const_iterator itr = reference.cbegin();
+         itr != reference.cend(); ++itr) {
+        QVector<PXMHistory::Record> all;
+        PXMHistory::Cursor cursor;
+        for (;;) {
+            QVector<PXMHistory::Record> page = reopened.readBefore(itr.key(), cursor, 50);
+            if (page.isEmpty()) {
+                break;
+            }
+            cursor = page.first().position;
+            all    = page + all;
+        }
+        QCOMPARE(all.size(), itr.value().size());
+        for (int i = 0; i < all.size(); i++) {
+            QVERIFY2(same(all.at(i), itr.value().at(i)), qPrintable(itr.key() + QStringLiteral(" record ") +
+                                                                    QString::number(i)));
+        }
+
+        int scanned = 0;
+        PXMHistory::Store::scan(dir.path(), itr.key(), PXMHistory::Cursor(), [&scanned](const PXMHistory::Record&) {
+            scanned++;
+            return true;
+        });
+        QCOMPARE(scanned, itr.value().size());
+    }
+}
+
+void PXMCheck::searchNewestFirst_data()
+{
+    QTest::addColumn<quint32>("seed");
+    QTest::addColumn<int>("limit");
+
+    QTest::newRow("limit 50") << 10u << 50;
+    QTest::newRow("limit 5") << 11u << 5;
+    QTest::newRow("limit 0") << 12u << 0;
+}
+
+void PXMCheck::searchNewestFirst()
+{
+    QFETCH(quint32, seed);
+    QFETCH(int, limit);
+
+    struct RefDoc {
+        QString conversation;
+        qint64 msecs;
+        PXMHistory::Cursor position;
+        QSet<QString> words;
+    };
+
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pickWord(0, 39);
+    std::uniform_int_distribution<int> pickLength(1, 6);
+    // Few distinct times so ties are common
+    std::uniform_int_distribution<int> pickTime(0, 500);
+
+    // Conversation after conversation like the backfill, so doc ids do not
+    // follow time
+    PXMSearch::Index index;
+    QVector<RefDoc> reference;
+    for (int c = 0; c < 5; c++) {
+        const QString conversation = QStringLiteral("conversation") + QString::number(c);
+        for (int d = 0; d < 1000; d++) {
+            RefDoc doc = {conversation, pickTime(rng),
+                          PXMHistory::Cursor(static_cast<quint32>(c), static_cast<quint32>(d + 1)), QSet<QString>()};
+            QStringList words;
+            for (int w = pickLength(rng); w > 0; w--) {
+                words.append(QStringLiteral("w") + QString::number(pickWord(rng)));
+            }
+            doc.words = words.toSet();
+            index.add(conversation, doc.msecs, doc.position, words.join(QLatin1Char(' ')));
+            reference.append(doc);
+        }
+    }
+
+    for (int q = 0; q < 40; q++) {
+        const QString word = QStringLiteral("w") + QString::number(q);
+        QVector<int> expected;
+        for (int i = 0; i < reference.size(); i++) {
+            if (reference.at(i).words.contains(word)) {
+                expected.append(i);
+            }
+        }
+        // Newest first, the later indexed first among equal times
+        std::sort(expected.begin(), expected.end(), [&](int a, int b) {
+            return reference.at(a).msecs != reference.at(b).msecs ? reference.at(a).msecs > reference.at(b).msecs
+                                                                  : a > b;
+        });
+        expected.resize(qMin(expected.size(), limit));
+
+        const QVector<PXMSearch::Hit> hits = index.search(word, limit);
+        QCOMPARE(hits.size(), expected.size());
+        for (int i = 0; i < hits.size(); i++) {
+            const RefDoc& doc = reference.at(expected.at(i));
+            QCOMPARE(hits.at(i).msecs, doc.msecs);
+            QCOMPARE(hits.at(i).conversation, doc.conversation);
+            QCOMPARE(hits.at(i).position.offset, doc.position.offset);
+        }
+    }
+}
+
+QTEST_APPLESS_MAIN(PXMCheck)
+
+#include "pxmcheck.moc"
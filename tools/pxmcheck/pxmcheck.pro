@@ -0,0 +1,28 @@
+# Randomized checks of core containers against plain reference maps, run
+# with make check
+TEMPLATE = app
+TARGET = pxmcheck
+CONFIG += console \
+          testcase \
+          DEBUG
+CONFIG -= app_bundle
+
+QT = core testlib
+
+include($$PWD/../../core/pxmcore.pri)
+
+QMAKE_CXXFLAGS += -Wall \
+                -std=c++14
+
+SOURCES += \
+    $$PWD/pxmcheck.cpp
+
+DESTDIR = $$PWD/../..
+win32 {
+OBJECTS_DIR = $$PWD/../../build-win32/pxmcheck/obj
+MOC_DIR = $$PWD/../../build-win32/pxmcheck/moc
+}
+unix {
+OBJECTS_DIR = $$PWD/../../build-unix/pxmcheck/obj
+MOC_DIR = $$PWD/../../build-unix/pxmcheck/moc
+}
@@ -0,0 +1,498 @@
+/*!
+ * pxmmicro: microbenchmarks for core data structures and codecs.
+ *
+ * Every case runs its loop for at least the requested time, reports
+ * nanoseconds per operation and prints a checksum so the compiler cannot
+ * drop the work.  Run with case names to pick some, without to run all.
+ */
+#include <QByteArray>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTextStream>
+#include <QTimer>
+#include <QUuid>
+#include <QVector>
+
+#include <cmath>
+#include <random>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+#include "netcompression.h"
+#include "pxmcache.h"
+#include "pxmsearch.h"
+#include "pxmutf8.h"
+#include "timedvector.h"
+
+namespace
+{
+struct Measurement {
+    quint64 ops;
+    quint64 checksum;
+    qint64 nsecs;
+};
+
+typedef Measurement (*CaseFunction)(qint64 minNsecs);
+
+struct Case {
+    const char* name;
+    const char* description;
+    CaseFunction run;
+};
+
+// Calls body(iteration) in batches until minNsecs have passed
+template <class Body>
+Measurement timeLoop(qint64 minNsecs, quint64 opsPerCall, Body body, int batchSize = 1024)
+{
+    Measurement m = {0, 0, 0};
+    QElapsedTimer timer;
+    timer.start();
+    quint64 i = 0;
+    do {
+        for (int batch = 0; batch < batchSize; batch++, i++) {
+            m.checksum += body(i);
+        }
+        m.ops += static_cast<quint64>(batchSize) * opsPerCall;
+    } while (timer.nsecsElapsed() < minNsecs);
+    m.nsecs = timer.nsecsElapsed();
+    return m;
+}
+
+QVector<QUuid> makeUUIDs(int count)
+{
+    QVector<QUuid> uuids;
+    uuids.reserve(count);
+    for (int i = 0; i < count; i++) {
+        uuids.append(QUuid::createUuid());
+    }
+    return uuids;
+}
+
+// Sync requests: one append and one lookup per peer, peers expire in 2s
+Measurement timedVectorSync(qint64 minNsecs)
+{
+    const QVector<QUuid> uuids = makeUUIDs(4096);
+    TimedVector<QUuid> syncable(2000, MSECONDS);
+    return timeLoop(minNsecs, 2, [&](quint64 i) -> quint64 {
+        // A millisecond every 64 operations so expiry keeps up
+        qint64 now = static_cast<qint64>(i >> 6);
+        syncable.append(uuids.at(i & 4095), now);
+        return syncable.contains(uuids.at((i * 7) & 4095), now) ? 1 : 0;
+    });
+}
+
+// Lookups that miss against a full set, the common case for stray sync packets
+Measurement timedVectorMiss(qint64 minNsecs)
+{
+    const QVector<QUuid> present = makeUUIDs(1024);
+    const QVector<QUuid> absent  = makeUUIDs(1024);
+    TimedVector<QUuid> syncable(3600, SECONDS);
+    for (const QUuid& uuid : present) {
+        syncable.append(uuid, 0);
+    }
+    return timeLoop(minNsecs, 1,
+                    [&](quint64 i) -> quint64 { return syncable.contains(absent.at(i & 1023), 1) ? 1 : 0; });
+}
+
+// Append then remove, what a sync round does to each peer
+Measurement timedVectorChurn(qint64 minNsecs)
+{
+    const QVector<QUuid> uuids = makeUUIDs(1024);
+    TimedVector<QUuid> syncable(2000, MSECONDS);
+    return timeLoop(minNsecs, 2, [&](quint64 i) -> quint64 {
+        qint64 now = static_cast<qint64>(i >> 4);
+        syncable.append(uuids.at(i & 1023), now);
+        return static_cast<quint64>(syncable.remove(uuids.at((i + 512) & 1023), now) + 1);
+    });
+}
+
+// Lookups that hit, as attemptConnection does for a peer still backing off
+Measurement cacheLruHit(qint64 minNsecs)
+{
+    const QVector<QUuid> uuids = makeUUIDs(1024);
+    PXMCache::Cache<QUuid, bool> cache(1024, 0);
+    for (const QUuid& uuid : uuids) {
+        cache.insert(uuid, true);
+    }
+    return timeLoop(minNsecs, 1, [&](quint64 i) -> quint64 { return cache.contains(uuids.at((i * 7) & 1023)) ? 1 : 0; });
+}
+
+// Failed connects coming and going, 4096 peers through 256 entries with a 10s ttl
+Measurement cacheTtlChurn(qint64 minNsecs)
+{
+    typedef PXMCache::ManualClock Clock;
+    const QVector<QUuid> uuids = makeUUIDs(4096);
+    PXMCache::Cache<QUuid, bool, Clock> cache(256, 10000);
+    Clock::set(0);
+    return timeLoop(minNsecs, 2, [&](quint64 i) -> quint64 {
+        Clock::set(static_cast<qint64>(i >> 2));
+        cache.insert(uuids.at(i & 4095), true);
+        return cache.contains(uuids.at((i * 7) & 4095)) ? 1 : 0;
+    });
+}
+
+// The hand rolled alternative: a timestamp per key, pruned by a full scan every so often
+Measurement qhashTimestamp(qint64 minNsecs)
+{
+    const QVector<QUuid> uuids = makeUUIDs(4096);
+    QHash<QUuid, qint64> failed;
+    return timeLoop(minNsecs, 2, [&](quint64 i) -> quint64 {
+        qint64 now = static_cast<qint64>(i >> 2);
+        if ((i & 1023) == 0) {
+            for (auto it = failed.begin(); it != failed.end();) {
+                it = it.value() <= now ? failed.erase(it) : it + 1;
+            }
+        }
+        failed.insert(uuids.at(i & 4095), now + 10000);
+        auto it = failed.constFind(uuids.at((i * 7) & 4095));
+        return it != failed.constEnd() && it.value() > now ? 1 : 0;
+    });
+}
+
+// The other hand rolled alternative: a single shot QTimer per key
+Measurement qhashQTimer(qint64 minNsecs)
+{
+    const QVector<QUuid> uuids = makeUUIDs(4096);
+    QHash<QUuid, QTimer*> failed;
+    Measurement m = timeLoop(minNsecs, 2, [&](quint64 i) -> quint64 {
+        QTimer* timer = new QTimer;
+        timer->setSingleShot(true);
+        timer->start(10000);
+        QTimer*& slot = failed[uuids.at(i & 4095)];
+        delete slot;
+        slot = timer;
+        return failed.contains(uuids.at((i * 7) & 4095)) ? 1 : 0;
+    });
+    qDeleteAll(failed);
+    return m;
+}
+
+// The QByteArray round trip NetCompression used to make for every uuid
+size_t legacyPackUUID(unsigned char* buf, const QUuid& uuid)
+{
+    memcpy(buf, uuid.toRfc4122().constData(), NetCompression::PACKED_UUID_LENGTH);
+    return NetCompression::PACKED_UUID_LENGTH;
+}
+size_t legacyUnpackUUID(const unsigned char* src, QUuid& uuid)
+{
+    uuid = QUuid::fromRfc4122(
+        QByteArray::fromRawData(reinterpret_cast<const char*>(src), NetCompression::PACKED_UUID_LENGTH));
+    return NetCompression::PACKED_UUID_LENGTH;
+}
+
+QVector<NetCompression::PeerRecord> makePeerRecords(int count)
+{
+    QVector<NetCompression::PeerRecord> records(count);
+    for (int i = 0; i < count; i++) {
+        memset(&records[i].addr, 0, sizeof(sockaddr_in));
+        records[i].addr.sin_family      = AF_INET;
+        records[i].addr.sin_addr.s_addr = htonl(0x0A000000 + static_cast<uint32_t>(i));
+        records[i].addr.sin_port        = htons(static_cast<uint16_t>(53200 + i));
+        records[i].uuid                 = QUuid::createUuid();
+    }
+    return records;
+}
+
+// A whole MSG_SYNC payload per call, records per op
+const int SYNC_RECORDS = 256;
+
+Measurement syncPackLegacy(qint64 minNsecs)
+{
+    const QVector<NetCompression::PeerRecord> records = makePeerRecords(SYNC_RECORDS);
+    QVector<unsigned char> buf(SYNC_RECORDS * NetCompression::PACKED_PEER_RECORD_LENGTH);
+    return timeLoop(minNsecs, SYNC_RECORDS, [&](quint64 i) -> quint64 {
+        size_t index = 0;
+        for (const NetCompression::PeerRecord& record : records) {
+            index += NetCompression::packSockaddr_in(&buf[static_cast<int>(index)], record.addr);
+            index += legacyPackUUID(&buf[static_cast<int>(index)], record.uuid);
+        }
+        return buf.at(static_cast<int>(i % buf.size()));
+    });
+}
+
+Measurement syncPack(qint64 minNsecs)
+{
+    const QVector<NetCompression::PeerRecord> records = makePeerRecords(SYNC_RECORDS);
+    QVector<unsigned char> buf(SYNC_RECORDS * NetCompression::PACKED_PEER_RECORD_LENGTH);
+    return timeLoop(minNsecs, SYNC_RECORDS, [&](quint64 i) -> quint64 {
+        NetCompression::packPeerRecords(buf.data(), records.constData(), SYNC_RECORDS);
+        return buf.at(static_cast<int>(i % buf.size()));
+    });
+}
+
+Measurement syncUnpackLegacy(qint64 minNsecs)
+{
+    const QVector<NetCompression::PeerRecord> records = makePeerRecords(SYNC_RECORDS);
+    QVector<unsigned char> buf(SYNC_RECORDS * NetCompression::PACKED_PEER_RECORD_LENGTH);
+    NetCompression::packPeerRecords(buf.data(), records.constData(), SYNC_RECORDS);
+    QVector<NetCompression::PeerRecord> out(SYNC_RECORDS);
+    return timeLoop(minNsecs, SYNC_RECORDS, [&](quint64 i) -> quint64 {
+        size_t index = 0;
+        for (NetCompression::PeerRecord& record : out) {
+            index += NetCompression::unpackSockaddr_in(&buf[static_cast<int>(index)], record.addr);
+            record.addr.sin_family = AF_INET;
+            index += legacyUnpackUUID(&buf[static_cast<int>(index)], record.uuid);
+        }
+        return out.at(static_cast<int>(i % SYNC_RECORDS)).uuid.data1;
+    });
+}
+
+Measurement syncUnpack(qint64 minNsecs)
+{
+    const QVector<NetCompression::PeerRecord> records = makePeerRecords(SYNC_RECORDS);
+    QVector<unsigned char> buf(SYNC_RECORDS * NetCompression::PACKED_PEER_RECORD_LENGTH);
+    NetCompression::packPeerRecords(buf.data(), records.constData(), SYNC_RECORDS);
+    QVector<NetCompression::PeerRecord> out(SYNC_RECORDS);
+    return timeLoop(minNsecs, SYNC_RECORDS, [&](quint64 i) -> quint64 {
+        NetCompression::unpackPeerRecords(buf.constData(), static_cast<size_t>(buf.size()), out.data(), SYNC_RECORDS);
+        return out.at(static_cast<int>(i % SYNC_RECORDS)).uuid.data1;
+    });
+}
+
+// A large pasted message, 64KiB, one op per KiB
+const int PASTE_BYTES = 64 * 1024;
+
+QByteArray makePaste(bool ascii)
+{
+    // Latin with accents, a euro sign and an emoji every line when not ascii
+    const QByteArray line = ascii ? QByteArray("The quick brown fox jumps over the lazy dog, 0123456789.\n")
+                                  : QByteArray("Caf\xc3\xa9 na\xc3\xafve \xe2\x82\xac" "12 r\xc3\xa9sum\xc3\xa9 "
+                                               "\xf0\x9f\x98\x80 over the lazy dog.\n");
+    QByteArray paste;
+    while (paste.size() < PASTE_BYTES) {
+        paste.append(line);
+    }
+    // Cut on a line boundary so the text stays well formed
+    paste.truncate(paste.lastIndexOf('\n', PASTE_BYTES - 1) + 1);
+    return paste;
+}
+
+QByteArray makeCjkPaste()
+{
+    // U+4E00 onwards, three bytes each
+    QByteArray paste;
+    for (int i = 0; paste.size() + 3 <= PASTE_BYTES; i++) {
+        int c = 0x4E00 + (i % 0x5000);
+        paste.append(static_cast<char>(0xE0 | (c >> 12)));
+        paste.append(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+        paste.append(static_cast<char>(0x80 | (c & 0x3F)));
+    }
+    return paste;
+}
+
+Measurement fromUtf8Loop(qint64 minNsecs, const QByteArray& paste)
+{
+    return timeLoop(minNsecs, static_cast<quint64>(paste.size() / 1024), [&](quint64) -> quint64 {
+        return static_cast<quint64>(QString::fromUtf8(paste.constData(), paste.size()).size());
+    });
+}
+
+Measurement decodeLoop(qint64 minNsecs, const QByteArray& paste)
+{
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(paste.constData());
+    return timeLoop(minNsecs, static_cast<quint64>(paste.size() / 1024), [&](quint64) -> quint64 {
+        return static_cast<quint64>(PXMUtf8::decode(data, static_cast<size_t>(paste.size())).size());
+    });
+}
+
+Measurement validateLoop(qint64 minNsecs, const QByteArray& paste)
+{
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(paste.constData());
+    return timeLoop(minNsecs, static_cast<quint64>(paste.size() / 1024), [&](quint64) -> quint64 {
+        return PXMUtf8::isValid(data, static_cast<size_t>(paste.size())) ? 1 : 0;
+    });
+}
+
+Measurement utf8AsciiFromUtf8(qint64 minNsecs)
+{
+    return fromUtf8Loop(minNsecs, makePaste(true));
+}
+Measurement utf8AsciiDecode(qint64 minNsecs)
+{
+    return decodeLoop(minNsecs, makePaste(true));
+}
+Measurement utf8MixedFromUtf8(qint64 minNsecs)
+{
+    return fromUtf8Loop(minNsecs, makePaste(false));
+}
+Measurement utf8MixedDecode(qint64 minNsecs)
+{
+    return decodeLoop(minNsecs, makePaste(false));
+}
+Measurement utf8MixedValidate(qint64 minNsecs)
+{
+    return validateLoop(minNsecs, makePaste(false));
+}
+Measurement utf8CjkValidate(qint64 minNsecs)
+{
+    return validateLoop(minNsecs, makeCjkPaste());
+}
+
+// Word i of the synthetic vocabulary, letters only so it is one term
+QString searchWord(int i)
+{
+    QString word;
+    do {
+        word.prepend(QChar('a' + i % 26));
+        i /= 26;
+    } while (i > 0);
+    return word;
+}
+
+/*
+ * A million messages from 20 conversations, indexed one conversation after
+ * the other like the backfill does, so doc ids do not follow time.  Words
+ * come from a 50000 word vocabulary with a Zipf like spread, "release
+ * notes" is in one message in a hundred and each of its words alone in one
+ * more.  Built once and shared by the search cases.
+ */
+const PXMSearch::Index& searchIndex()
+{
+    static const PXMSearch::Index* index = [] {
+        const int documents     = 1000000;
+        const int conversations = 20;
+        const int vocabulary    = 50000;
+        const qint64 span       = Q_INT64_C(3) * 365 * 24 * 3600 * 1000;
+        std::mt19937 rng(30);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        std::uniform_int_distribution<int> length(6, 14);
+        std::uniform_int_distribution<int> extra(0, 99);
+        QVector<QString> words;
+        for (int i = 0; i < vocabulary; i++) {
+            words.append(searchWord(i));
+        }
+
+        PXMSearch::Index* built = new PXMSearch::Index;
+        QElapsedTimer timer;
+        timer.start();
+        for (int c = 0; c < conversations; c++) {
+            const QString conversation = QUuid::createUuid().toString();
+            const int perConversation  = documents / conversations;
+            for (int d = 0; d < perConversation; d++) {
+                QString text;
+                for (int w = length(rng); w > 0; w--) {
+                    int index = static_cast<int>(std::pow(static_cast<double>(vocabulary), unit(rng))) - 1;
+                    text += words.at(qBound(0, index, vocabulary - 1)) + QLatin1Char(' ');
+                }
+                int roll = extra(rng);
+                if (roll == 0) {
+                    text += QStringLiteral("release notes");
+                } else if (roll == 1) {
+                    text += QStringLiteral("notes");
+                } else if (roll == 2) {
+                    text += QStringLiteral("release");
+                }
+                qint64 msecs = span * d / perConversation + c;
+                built->add(conversation, msecs,
+                           PXMHistory::Cursor(static_cast<quint32>(c), static_cast<quint32>(d + 1)), text);
+            }
+        }
+        QTextStream(stderr) << "search index: " << built->documentCount() << " messages, " << built->termCount()
+                            << " terms, built in " << timer.elapsed() << " ms\n";
+        return built;
+    }();
+    return *index;
+}
+
+// Top 50 newest of many hits for a query, checksum covers the order
+Measurement searchLoop(qint64 minNsecs, const QString& query)
+{
+    const PXMSearch::Index& index = searchIndex();
+    return timeLoop(minNsecs, 1,
+                    [&](quint64) -> quint64 {
+                        QVector<PXMSearch::Hit> hits = index.search(query);
+                        quint64 sum                  = static_cast<quint64>(hits.size());
+                        for (const PXMSearch::Hit& hit : hits) {
+                            sum = sum * 31 + static_cast<quint64>(hit.msecs);
+                        }
+                        return sum;
+                    },
+                    1);
+}
+
+// Word 50 of the vocabulary is in about 2% of the messages
+Measurement searchTerm(qint64 minNsecs)
+{
+    return searchLoop(minNsecs, searchWord(50));
+}
+Measurement searchPrefix(qint64 minNsecs)
+{
+    return searchLoop(minNsecs, searchWord(1000).left(2) + QLatin1Char('*'));
+}
+Measurement searchPhrase(qint64 minNsecs)
+{
+    return searchLoop(minNsecs, QStringLiteral("\"release notes\""));
+}
+
+const Case CASES[] = {
+    {"timedvector-sync", "TimedVector append and contains, 4096 uuids", timedVectorSync},
+    {"timedvector-miss", "TimedVector contains misses, 1024 live uuids", timedVectorMiss},
+    {"timedvector-churn", "TimedVector append and remove, 1024 uuids", timedVectorChurn},
+    {"cache-lru-hit", "PXMCache hits, 1024 live uuids", cacheLruHit},
+    {"cache-ttl-churn", "PXMCache insert and lookup, 4096 uuids through 256 entries", cacheTtlChurn},
+    {"qhash-timestamp", "QHash of expiry times with periodic prune, 4096 uuids", qhashTimestamp},
+    {"qhash-qtimer", "QHash of single shot QTimers, 4096 uuids", qhashQTimer},
+    {"sync-pack-legacy", "MSG_SYNC records packed through QUuid::toRfc4122", syncPackLegacy},
+    {"sync-pack", "MSG_SYNC records packed with packPeerRecords", syncPack},
+    {"sync-unpack-legacy", "MSG_SYNC records unpacked through QUuid::fromRfc4122", syncUnpackLegacy},
+    {"sync-unpack", "MSG_SYNC records unpacked with unpackPeerRecords", syncUnpack},
+    {"utf8-ascii-fromutf8", "64KiB ASCII paste, QString::fromUtf8, per KiB", utf8AsciiFromUtf8},
+    {"utf8-ascii-decode", "64KiB ASCII paste, PXMUtf8::decode, per KiB", utf8AsciiDecode},
+    {"utf8-mixed-fromutf8", "64KiB accented paste, QString::fromUtf8, per KiB", utf8MixedFromUtf8},
+    {"utf8-mixed-decode", "64KiB accented paste, PXMUtf8::decode, per KiB", utf8MixedDecode},
+    {"utf8-mixed-validate", "64KiB accented paste, PXMUtf8::isValid only, per KiB", utf8MixedValidate},
+    {"utf8-cjk-validate", "64KiB CJK paste, PXMUtf8::isValid only, per KiB", utf8CjkValidate},
+    {"search-term", "Index::search for one term, 1M messages", searchTerm},
+    {"search-prefix", "Index::search for a two letter prefix, 1M messages", searchPrefix},
+    {"search-phrase", "Index::search for a two word phrase, 1M messages", searchPhrase},
+};
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("pxmmicro");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Microbenchmarks for the PXMessenger core");
+    parser.addHelpOption();
+    QCommandLineOption timeOption("time", "Minimum milliseconds per case.", "ms", "500");
+    QCommandLineOption listOption("list", "List the cases and exit.");
+    parser.addOptions({timeOption, listOption});
+    parser.addPositionalArgument("cases", "Cases to run, all when none are given.", "[case...]");
+    parser.process(app);
+
+    QTextStream out(stdout);
+    if (parser.isSet(listOption)) {
+        for (const Case& c : CASES) {
+            out << QString::fromLatin1(c.name).leftJustified(24) << c.description << "\n";
+        }
+        return 0;
+    }
+
+    const QStringList wanted = parser.positionalArguments();
+    const qint64 minNsecs    = parser.value(timeOption).toLongLong() * 1000000;
+    int ran                  = 0;
+    for (const Case& c : CASES) {
+        if (!wanted.isEmpty() && !wanted.contains(QLatin1String(c.name))) {
+            continue;
+        }
+        Measurement m = c.run(minNsecs);
+        out << QString::fromLatin1(c.name).leftJustified(24)
+            << QString::number(static_cast<double>(m.nsecs) / m.ops, 'f', 2).rightJustified(10) << " ns/op "
+            << QString::number(m.ops).rightJustified(12) << " ops  checksum " << m.checksum << "\n";
+        out.flush();
+        ran++;
+    }
+    if (ran == 0) {
+        qCritical("No such case, see --list");
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+# Microbenchmarks for core data structures and codecs
+TEMPLATE = app
+TARGET = pxmmicro
+CONFIG += console \
+          RELEASE
+CONFIG -= app_bundle
+
+QT = core
+
+include($$PWD/../../core/pxmcore.pri)
+
+QMAKE_CXXFLAGS += -Wall \
+                -std=c++14
+
+SOURCES += \
+    $$PWD/pxmmicro.cpp
+
+DESTDIR = $$PWD/../..
+win32 {
+OBJECTS_DIR = $$PWD/../../build-win32/pxmmicro/obj
+MOC_DIR = $$PWD/../../build-win32/pxmmicro/moc
+}
+unix {
+OBJECTS_DIR = $$PWD/../../build-unix/pxmmicro/obj
+MOC_DIR = $$PWD/../../build-unix/pxmmicro/moc
+}
@@ -0,0 +1,663 @@
+/*!
+ * pxmsim: discovery and sync convergence simulator.
+ *
+ * A single threaded discrete event simulation of N nodes joining a LAN.
+ * Time is simulated, so runs are deterministic for a given seed and
+ * hundreds of nodes take seconds rather than the hours the timers would
+ * need in real life.
+ *
+ * Every node runs PXMMembership::Membership, the code PXMPeerWorker uses
+ * to decide who to connect to, which connection to keep and whom to sync
+ * with, on ManualClock.  What the worker's server thread does around it
+ * is played here: the /discover sent when the server starts and the
+ * /name: replies (twice, unicast) from udpRecieve, the connect timeout,
+ * tcpAuth taking the first frame as the auth packet, and sync requests and
+ * packets handed to the worker.
+ *
+ * The transport is fake: UDP datagrams are dropped with the given loss
+ * rate, TCP segments are never dropped but a loss costs a retransmission
+ * timeout, SYNs back off from one second like Linux does.  One way
+ * latency is the base plus uniform jitter.
+ *
+ * For each N the report has the time until every node is authenticated
+ * with every other (from the first start and from the last one), whether
+ * that still holds after the settle period, and packets, bytes,
+ * connection attempts and dropped connections per node.  Bytes are
+ * application payload: UDP datagrams and whole TCP frames.
+ */
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QLoggingCategory>
+#include <QTextStream>
+#include <QVector>
+
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "netcompression.h"
+#include "pxmconsts.h"
+#include "pxmmembership.h"
+#include "pxmserver.h"
+
+using namespace PXMConsts;
+
+namespace
+{
+// sendUDP() sends the terminator too
+const quint64 DISCOVER_BYTES = sizeof("/discover");
+const quint64 NAME_BYTES =
+    sizeof(uint16_t) + NetCompression::PACKED_UUID_LENGTH + ct_strlen("/name:") + sizeof(PXMServer::NAME_FLAGS);
+const quint64 FRAME_OVERHEAD =
+    PXMServer::PACKET_HEADER_LEN + NetCompression::PACKED_UUID_LENGTH + sizeof(MESSAGE_TYPE);
+const quint64 SYNC_ENTRY_BYTES = NetCompression::PACKED_SOCKADDR_IN_LENGTH + NetCompression::PACKED_UUID_LENGTH;
+// "user@computer:::port:::1.4.0", the hostname is typically about 20
+const quint64 AUTH_BYTES = 20 + 2 * ct_strlen(AUTH_SEPERATOR) + 5 + ct_strlen("1.4.0");
+// MSG_CAPABILITIES follows every auth packet
+const quint64 CAPABILITIES_BYTES = sizeof(uint32_t);
+
+const qint64 MSEC = 1000;
+const qint64 SEC  = 1000 * MSEC;
+// CONNECT_TO_ADDR in the server
+const qint64 CONNECT_TIMEOUT = 5 * SEC;
+const qint64 SYN_RTO         = 1 * SEC;
+const qint64 MIN_RTO         = 200 * MSEC;
+const int TIMERS             = PXMMembership::NEXT_SYNC_TIMER + 1;
+
+struct Options {
+    QVector<int> sizes;
+    double loss;
+    qint64 latency;
+    qint64 jitter;
+    qint64 spread;
+    qint64 settle;
+    qint64 maxTime;
+    quint64 seed;
+};
+
+struct Result {
+    int nodes;
+    qint64 lastStart;
+    qint64 meshTime;
+    bool held;
+    double coverage;
+    quint64 udpPackets;
+    quint64 tcpFrames;
+    quint64 bytes;
+    quint64 maxNodeBytes;
+    quint64 connects;
+    quint64 connectFailures;
+    quint64 drops;
+    quint64 syncRounds;
+    quint64 events;
+    qint64 wallMsecs;
+};
+
+enum EventKind { NODE_START, TIMER, UDP_DISCOVER, UDP_NAME, TCP_ACCEPT, CONNECT_RESULT, TCP_FRAME, TCP_EOF };
+
+struct Event {
+    qint64 time;
+    quint64 seq;
+    EventKind kind;
+    int node;
+    // Peer node, endpoint or timer depending on kind
+    int arg;
+    // Message type, endpoint or timer generation depending on kind
+    int extra;
+    // Index into the sync packet pool or success flag, -1 for none
+    int payload;
+};
+
+struct EventLater {
+    bool operator()(const Event& a, const Event& b) const
+    {
+        return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+    }
+};
+
+// One side of a TCP connection, the other side is id ^ 1
+struct Endpoint {
+    int node;
+    qint64 lastArrival;
+    // Socket not closed yet
+    bool open;
+    // Bufferevent freed or disabled, nothing more is read
+    bool freed;
+    // Read callbacks set up, for outgoing connections only once the worker
+    // has seen the connect result
+    bool enabled;
+    bool gotAuth;
+};
+
+// A node listens where it is, so its address is its number
+struct SimRecord {
+    int peer;
+    int address;
+};
+
+class Simulator;
+
+// What the worker and its server thread do for Membership, on the fake
+// network.  Links and sockets are both endpoints
+struct SimTransport {
+    typedef int Peer;
+    typedef int Address;
+    typedef int Link;
+    typedef int Socket;
+    typedef SimRecord Record;
+
+    Simulator* sim;
+    int node;
+
+    static int noLink() { return -1; }
+    static SimRecord record(int peer, int address) { return SimRecord{peer, address}; }
+    static const int& recordPeer(const SimRecord& record) { return record.peer; }
+    static const int& recordAddress(const SimRecord& record) { return record.address; }
+    bool shareable(int) { return true; }
+    unsigned int random();
+    void sendDiscover();
+    void connect(const SimRecord* targets, size_t count);
+    void enable(int ep);
+    void sendAuth(int ep, const int*);
+    void sendSyncRequest(const int&, int ep);
+    void sendSync(const int&, int ep, const QVector<SimRecord>& records);
+    void freeLink(int ep);
+    void closeSocket(int ep);
+    void startTimer(PXMMembership::Timer timer, int msecs);
+    void stopTimer(PXMMembership::Timer timer);
+    void changed(const int& peer, const PXMMembership::PeerState<SimTransport>& state);
+    void authenticated(const int&) {}
+    void disconnected(const int&) {}
+    void syncStarted();
+};
+
+typedef PXMMembership::Membership<SimTransport, PXMCache::ManualClock> SimMembership;
+
+struct Node {
+    SimMembership membership;
+    // Who the membership has authenticated, to count pairs
+    std::vector<quint64> authedBits;
+    bool running = false;
+    int timerGeneration[TIMERS];
+    quint64 udpPackets = 0;
+    quint64 tcpFrames  = 0;
+    quint64 bytes      = 0;
+    quint64 connects   = 0;
+    Node(Simulator* sim, int node, int words)
+        : membership(SimTransport{sim, node}, node), authedBits(static_cast<size_t>(words), 0), timerGeneration()
+    {
+    }
+};
+
+class Simulator
+{
+    friend struct SimTransport;
+
+    const Options& options;
+    const int n;
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> unit;
+    std::priority_queue<Event, std::vector<Event>, EventLater> queue;
+    quint64 seq = 0;
+    qint64 now  = 0;
+    std::vector<Node> nodes;
+    std::vector<Endpoint> endpoints;
+    QHash<int, QVector<Event>> pendingFrames;
+    std::vector<QVector<SimRecord>> packets;
+    QVector<int> freePackets;
+    quint64 authedPairs     = 0;
+    quint64 connectFailures = 0;
+    quint64 drops           = 0;
+    quint64 syncRounds      = 0;
+
+    void schedule(qint64 at, EventKind kind, int node, int arg = -1, int extra = -1, int payload = -1);
+    bool lost() { return options.loss > 0 && unit(rng) < options.loss; }
+    qint64 oneWay() { return options.latency + static_cast<qint64>(unit(rng) * options.jitter); }
+
+    // Fake transport
+    void multicastDiscover(int from);
+    void sendName(int from, int to);
+    void openConnection(int from, int to);
+    bool sendFrame(int ep, MESSAGE_TYPE type, quint64 bodyBytes, int payload = -1);
+    void deliverOrdered(int ep, Event event);
+    void closeSocket(int ep);
+    void enable(int ep);
+    int takePacket(const QVector<SimRecord>& records);
+    void releasePacket(int index);
+
+    // PXMServer
+    void frameReceived(int ep, MESSAGE_TYPE type, int payload);
+
+    void handle(const Event& event);
+
+   public:
+    Simulator(const Options& options, int n);
+    Result run();
+};
+
+unsigned int SimTransport::random()
+{
+    return static_cast<unsigned int>(sim->rng());
+}
+
+void SimTransport::sendDiscover()
+{
+    sim->multicastDiscover(node);
+}
+
+void SimTransport::connect(const SimRecord* targets, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        sim->openConnection(node, targets[i].peer);
+    }
+}
+
+void SimTransport::enable(int ep)
+{
+    sim->enable(ep);
+}
+
+void SimTransport::sendAuth(int ep, const int*)
+{
+    sim->sendFrame(ep, MSG_AUTH, AUTH_BYTES);
+    sim->sendFrame(ep, MSG_CAPABILITIES, CAPABILITIES_BYTES);
+}
+
+void SimTransport::sendSyncRequest(const int&, int ep)
+{
+    sim->sendFrame(ep, MSG_SYNC_REQUEST, 0);
+}
+
+void SimTransport::sendSync(const int&, int ep, const QVector<SimRecord>& records)
+{
+    sim->sendFrame(ep, MSG_SYNC, static_cast<quint64>(records.size()) * SYNC_ENTRY_BYTES, sim->takePacket(records));
+}
+
+void SimTransport::freeLink(int ep)
+{
+    // Nothing more is read, the other side does not hear about it
+    sim->endpoints[ep].freed = true;
+}
+
+void SimTransport::closeSocket(int ep)
+{
+    sim->closeSocket(ep);
+}
+
+void SimTransport::startTimer(PXMMembership::Timer timer, int msecs)
+{
+    int generation = ++sim->nodes[node].timerGeneration[timer];
+    sim->schedule(sim->now + msecs * MSEC, TIMER, node, timer, generation);
+}
+
+void SimTransport::stopTimer(PXMMembership::Timer timer)
+{
+    ++sim->nodes[node].timerGeneration[timer];
+}
+
+void SimTransport::changed(const int& peer, const PXMMembership::PeerState<SimTransport>& state)
+{
+    std::vector<quint64>& bits = sim->nodes[node].authedBits;
+    quint64 bit                = Q_UINT64_C(1) << (peer & 63);
+    bool was                   = bits[peer >> 6] & bit;
+    if (was == state.authed) {
+        return;
+    }
+    if (state.authed) {
+        bits[peer >> 6] |= bit;
+        sim->authedPairs++;
+    } else {
+        bits[peer >> 6] &= ~bit;
+        sim->authedPairs--;
+        sim->drops++;
+    }
+}
+
+void SimTransport::syncStarted()
+{
+    sim->syncRounds++;
+}
+
+Simulator::Simulator(const Options& options, int n)
+    : options(options), n(n), rng(options.seed * 1000003 + n), unit(0.0, 1.0)
+{
+    nodes.reserve(static_cast<size_t>(n));
+    for (int i = 0; i < n; i++) {
+        nodes.emplace_back(this, i, (n + 63) / 64);
+    }
+}
+
+void Simulator::schedule(qint64 at, EventKind kind, int node, int arg, int extra, int payload)
+{
+    queue.push(Event{at, seq++, kind, node, arg, extra, payload});
+}
+
+int Simulator::takePacket(const QVector<SimRecord>& records)
+{
+    if (!freePackets.isEmpty()) {
+        int index      = freePackets.takeLast();
+        packets[index] = records;
+        return index;
+    }
+    packets.push_back(records);
+    return static_cast<int>(packets.size()) - 1;
+}
+
+void Simulator::releasePacket(int index)
+{
+    if (index >= 0) {
+        packets[index] = QVector<SimRecord>();
+        freePackets.append(index);
+    }
+}
+
+void Simulator::multicastDiscover(int from)
+{
+    nodes[from].udpPackets++;
+    nodes[from].bytes += DISCOVER_BYTES;
+    // Multicast loop is on, the sender hears itself too
+    for (int i = 0; i < n; i++) {
+        if (nodes[i].running && !lost()) {
+            schedule(now + oneWay(), UDP_DISCOVER, i, from);
+        }
+    }
+}
+
+void Simulator::sendName(int from, int to)
+{
+    nodes[from].udpPackets++;
+    nodes[from].bytes += NAME_BYTES;
+    if (!lost()) {
+        schedule(now + oneWay(), UDP_NAME, to, from);
+    }
+}
+
+void Simulator::openConnection(int from, int to)
+{
+    int ep = static_cast<int>(endpoints.size());
+    endpoints.push_back(Endpoint{from, 0, true, false, false, false});
+    endpoints.push_back(Endpoint{to, 0, false, false, false, false});
+    nodes[from].connects++;
+
+    // SYN and SYN-ACK both have to make it, retries back off 1s, 2s, 4s
+    qint64 sendAt = now;
+    qint64 rto    = SYN_RTO;
+    for (;;) {
+        qint64 synAck = sendAt + oneWay() + oneWay();
+        if (synAck - now > CONNECT_TIMEOUT) {
+            break;
+        }
+        if (!lost() && !lost()) {
+            schedule(synAck, CONNECT_RESULT, from, to, ep, 1);
+            schedule(synAck + oneWay(), TCP_ACCEPT, to, ep + 1);
+            return;
+        }
+        sendAt += rto;
+        rto *= 2;
+    }
+    schedule(now + CONNECT_TIMEOUT, CONNECT_RESULT, from, to, ep, 0);
+}
+
+bool Simulator::sendFrame(int ep, MESSAGE_TYPE type, quint64 bodyBytes, int payload)
+{
+    if (ep < 0 || !endpoints[ep].open || endpoints[ep].freed) {
+        releasePacket(payload);
+        return false;
+    }
+    Node& node = nodes[endpoints[ep].node];
+    node.tcpFrames++;
+    node.bytes += FRAME_OVERHEAD + bodyBytes;
+    deliverOrdered(ep ^ 1, Event{0, 0, TCP_FRAME, endpoints[ep ^ 1].node, ep ^ 1, static_cast<int>(type), payload});
+    return true;
+}
+
+void Simulator::deliverOrdered(int ep, Event event)
+{
+    qint64 at = now + oneWay();
+    while (lost()) {
+        at += qMax(MIN_RTO, 2 * options.latency);
+    }
+    at                        = qMax(at, endpoints[ep].lastArrival);
+    endpoints[ep].lastArrival = at;
+    schedule(at, event.kind, event.node, event.arg, event.extra, event.payload);
+}
+
+void Simulator::closeSocket(int ep)
+{
+    if (ep < 0) {
+        return;
+    }
+    Endpoint& endpoint = endpoints[ep];
+    endpoint.freed     = true;
+    if (endpoint.open) {
+        endpoint.open = false;
+        deliverOrdered(ep ^ 1, Event{0, 0, TCP_EOF, endpoints[ep ^ 1].node, ep ^ 1, -1, -1});
+    }
+}
+
+void Simulator::enable(int ep)
+{
+    endpoints[ep].enabled = true;
+    // Read on the next loop iteration, the server thread enables it after
+    // the worker asked
+    QVector<Event> pending = pendingFrames.take(ep);
+    for (const Event& event : pending) {
+        schedule(now, TCP_FRAME, event.node, ep, event.extra, event.payload);
+    }
+}
+
+void Simulator::frameReceived(int ep, MESSAGE_TYPE type, int payload)
+{
+    Endpoint& endpoint = endpoints[ep];
+    if (endpoint.freed) {
+        releasePacket(payload);
+        return;
+    }
+    if (!endpoint.enabled) {
+        // Sits in the socket until the bufferevent is enabled
+        pendingFrames[ep].append(Event{now, 0, TCP_FRAME, endpoint.node, ep, static_cast<int>(type), payload});
+        return;
+    }
+    SimMembership& membership = nodes[endpoint.node].membership;
+    int peer                  = endpoints[ep ^ 1].node;
+    if (!endpoint.gotAuth) {
+        // tcpAuth, the first frame has to be MSG_AUTH
+        if (type == MSG_AUTH) {
+            endpoint.gotAuth = true;
+            membership.authenticated(peer, peer, ep, ep);
+        } else {
+            endpoint.freed = true;
+            membership.closed(ep, ep);
+        }
+        releasePacket(payload);
+        return;
+    }
+    switch (type) {
+        case MSG_SYNC_REQUEST:
+            membership.syncRequested(peer, ep);
+            break;
+        case MSG_SYNC: {
+            QVector<SimRecord>& records = packets[payload];
+            membership.syncReceived(peer, records.data(), static_cast<size_t>(records.size()));
+            break;
+        }
+        default:
+            break;
+    }
+    releasePacket(payload);
+}
+
+void Simulator::handle(const Event& event)
+{
+    SimMembership& membership = nodes[event.node].membership;
+    switch (event.kind) {
+        case NODE_START:
+            nodes[event.node].running = true;
+            // The server sends one as soon as it is listening
+            multicastDiscover(event.node);
+            membership.start();
+            break;
+        case TIMER:
+            if (nodes[event.node].timerGeneration[event.arg] == event.extra) {
+                membership.timerFired(static_cast<PXMMembership::Timer>(event.arg));
+            }
+            break;
+        case UDP_DISCOVER:
+            // Replied to twice to ensure one of them gets there
+            sendName(event.node, event.arg);
+            sendName(event.node, event.arg);
+            break;
+        case UDP_NAME:
+            membership.found(event.arg, event.arg);
+            break;
+        case TCP_ACCEPT:
+            endpoints[event.arg].open = true;
+            membership.accepted(event.arg);
+            enable(event.arg);
+            break;
+        case CONNECT_RESULT:
+            if (!event.payload) {
+                // Never connected, there is nobody to tell about the close
+                connectFailures++;
+                endpoints[event.extra].open = false;
+            }
+            membership.connectResult(event.arg, event.extra, event.extra, event.payload != 0);
+            break;
+        case TCP_FRAME:
+            frameReceived(event.arg, static_cast<MESSAGE_TYPE>(event.extra), event.payload);
+            break;
+        case TCP_EOF:
+            if (!endpoints[event.arg].freed) {
+                endpoints[event.arg].freed = true;
+                membership.closed(event.arg, event.arg);
+            }
+            break;
+    }
+}
+
+Result Simulator::run()
+{
+    QElapsedTimer wall;
+    wall.start();
+
+    Result result = Result();
+    result.nodes  = n;
+    for (int i = 0; i < n; i++) {
+        qint64 start     = static_cast<qint64>(unit(rng) * options.spread);
+        result.lastStart = qMax(result.lastStart, start);
+        schedule(start, NODE_START, i);
+    }
+
+    const quint64 fullMesh = static_cast<quint64>(n) * static_cast<quint64>(n - 1);
+    result.meshTime        = -1;
+    qint64 stopAt          = options.maxTime;
+    while (!queue.empty() && queue.top().time <= stopAt) {
+        Event event = queue.top();
+        queue.pop();
+        now = event.time;
+        PXMCache::ManualClock::set(now / MSEC);
+        handle(event);
+        result.events++;
+        if (result.meshTime < 0 && authedPairs == fullMesh) {
+            result.meshTime = now;
+            stopAt          = qMin(options.maxTime, now + options.settle);
+        }
+    }
+
+    result.held     = authedPairs == fullMesh;
+    result.coverage = fullMesh ? static_cast<double>(authedPairs) / fullMesh : 1.0;
+    for (const Node& node : nodes) {
+        result.udpPackets += node.udpPackets;
+        result.tcpFrames += node.tcpFrames;
+        result.bytes += node.bytes;
+        result.maxNodeBytes = qMax(result.maxNodeBytes, node.bytes);
+        result.connects += node.connects;
+    }
+    result.connectFailures = connectFailures;
+    result.drops           = drops;
+    result.syncRounds      = syncRounds;
+    result.wallMsecs       = wall.elapsed();
+    return result;
+}
+
+QString seconds(qint64 micros)
+{
+    return micros < 0 ? QStringLiteral("never") : QString::number(static_cast<double>(micros) / SEC, 'f', 2);
+}
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("pxmsim");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Discovery and sync convergence simulator for PXMessenger");
+    parser.addHelpOption();
+    QCommandLineOption nodesOption("nodes", "Comma separated network sizes to simulate.", "n,n,...",
+                                   "10,50,100,500,1000");
+    QCommandLineOption lossOption("loss", "Packet loss rate, 0 to 1.", "rate", "0.01");
+    QCommandLineOption latencyOption("latency", "Base one way latency in milliseconds.", "ms", "0.5");
+    QCommandLineOption jitterOption("jitter", "Uniform extra one way latency in milliseconds.", "ms", "0.5");
+    QCommandLineOption spreadOption("spread", "Nodes start uniformly within this many seconds.", "s", "60");
+    QCommandLineOption settleOption("settle", "Seconds to keep running once the mesh is complete.", "s", "60");
+    QCommandLineOption maxTimeOption("max-time", "Give up after this many simulated seconds.", "s", "3600");
+    QCommandLineOption seedOption("seed", "Random seed.", "n", "1");
+    parser.addOptions({nodesOption, lossOption, latencyOption, jitterOption, spreadOption, settleOption,
+                       maxTimeOption, seedOption});
+    parser.process(app);
+    // Membership logs every connect and sync, far too much for thousands
+    // of simulated nodes
+    QLoggingCategory::setFilterRules(QStringLiteral("pxm.net=false"));
+
+    Options options;
+    for (const QString& size : parser.value(nodesOption).split(',', QString::SkipEmptyParts)) {
+        int nodes = size.toInt();
+        if (nodes < 2) {
+            qCritical().noquote() << "Bad network size" << size;
+            return 2;
+        }
+        options.sizes.append(nodes);
+    }
+    options.loss    = qBound(0.0, parser.value(lossOption).toDouble(), 0.99);
+    options.latency = static_cast<qint64>(parser.value(latencyOption).toDouble() * MSEC);
+    options.jitter  = static_cast<qint64>(parser.value(jitterOption).toDouble() * MSEC);
+    options.spread  = static_cast<qint64>(parser.value(spreadOption).toDouble() * SEC);
+    options.settle  = static_cast<qint64>(parser.value(settleOption).toDouble() * SEC);
+    options.maxTime = static_cast<qint64>(parser.value(maxTimeOption).toDouble() * SEC);
+    options.seed    = parser.value(seedOption).toULongLong();
+
+    QTextStream out(stdout);
+    out << "loss " << options.loss << ", latency " << parser.value(latencyOption) << "+" << parser.value(jitterOption)
+        << "ms, starts spread over " << parser.value(spreadOption) << "s, seed " << options.seed << "\n";
+    out.setFieldAlignment(QTextStream::AlignRight);
+    out << qSetFieldWidth(7) << "nodes" << qSetFieldWidth(10) << "mesh_s"
+        << "after_last" << qSetFieldWidth(6) << "held" << qSetFieldWidth(9) << "cover%" << qSetFieldWidth(10)
+        << "udp/node" << "tcp/node" << qSetFieldWidth(12) << "bytes/node"
+        << "max_bytes" << qSetFieldWidth(10) << "conn/node"
+        << "fail/node"
+        << "drop/node"
+        << "syncs" << qSetFieldWidth(11) << "events" << qSetFieldWidth(8) << "wall_ms" << qSetFieldWidth(0)
+        << "\n";
+    out.flush();
+
+    for (int size : options.sizes) {
+        Simulator simulator(options, size);
+        Result r          = simulator.run();
+        const double per  = static_cast<double>(r.nodes);
+        qint64 afterLast  = r.meshTime < 0 ? -1 : qMax(Q_INT64_C(0), r.meshTime - r.lastStart);
+        out << qSetFieldWidth(7) << r.nodes << qSetFieldWidth(10) << seconds(r.meshTime) << seconds(afterLast)
+            << qSetFieldWidth(6) << (r.held ? "yes" : "no") << qSetFieldWidth(9)
+            << QString::number(100.0 * r.coverage, 'f', 2) << qSetFieldWidth(10)
+            << QString::number(r.udpPackets / per, 'f', 1) << QString::number(r.tcpFrames / per, 'f', 1)
+            << qSetFieldWidth(12) << QString::number(r.bytes / per, 'f', 0) << r.maxNodeBytes << qSetFieldWidth(10)
+            << QString::number(r.connects / per, 'f', 2) << QString::number(r.connectFailures / per, 'f', 3)
+            << QString::number(r.drops / per, 'f', 3) << r.syncRounds << qSetFieldWidth(11) << r.events
+            << qSetFieldWidth(8) << r.wallMsecs << qSetFieldWidth(0) << "\n";
+        out.flush();
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+# Discovery and sync convergence simulator, runs the core membership code
+# on simulated time against a fake transport
+TEMPLATE = app
+TARGET = pxmsim
+CONFIG += console \
+          RELEASE \
+          DEBUG
+CONFIG -= app_bundle
+
+QT = core
+
+include($$PWD/../../core/pxmcore.pri)
+
+QMAKE_CXXFLAGS += -Wall \
+                -std=c++14
+
+SOURCES += \
+    $$PWD/pxmsim.cpp
+
+DESTDIR = $$PWD/../..
+win32 {
+OBJECTS_DIR = $$PWD/../../build-win32/pxmsim/obj
+MOC_DIR = $$PWD/../../build-win32/pxmsim/moc
+}
+unix {
+OBJECTS_DIR = $$PWD/../../build-unix/pxmsim/obj
+MOC_DIR = $$PWD/../../build-unix/pxmsim/moc
+}